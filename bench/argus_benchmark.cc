@@ -0,0 +1,556 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include <lib/arguscache.h>
+#include <lib/argusdigest.h>
+#include <lib/argusfake.h>
+#include <lib/argusmatch.h>
+#include <lib/argusnotify.h>
+#include <lib/argusskeleton.h>
+#include <lib/argustree.h>
+#include <lib/argusuring.h>
+#include <lib/argusutil.h>
+}
+
+namespace {
+// Path components fan out 16 ways at every level so that the top-level
+// subtree used by the rename/remove benchmarks holds ~1/16 of the cache.
+const int kFanout = 16;
+const char *kRootPath = "/proc/1/root/argusbench";
+
+/**
+ * Synthetic `arguswatch` populated with `count` cache entries, each `depth`
+ * path components below `kRootPath`. Watch descriptors are assigned
+ * sequentially starting at 1, matching what `inotify_add_watch` hands out for
+ * a freshly created `inotify` instance.
+ */
+class SyntheticWatch {
+public:
+    SyntheticWatch(const int count, const int depth, const std::string &root = kRootPath) {
+        memset(&watch_, 0, sizeof(watch_));
+        watch_.slot = 0;
+        watch_.fd = EOF;
+        watch_.processevtfd = EOF;
+        watch_.pathc = count;
+        watch_.wd = static_cast<int *>(calloc(count, sizeof(int)));
+        watch_.paths = static_cast<char **>(calloc(count, sizeof(char *)));
+        for (int i = 0; i < count; ++i) {
+            watch_.wd[i] = i + 1;
+            watch_.paths[i] = strdup(pathForIndex(root, i, depth).c_str());
+        }
+    }
+
+    ~SyntheticWatch() {
+        for (unsigned int i = 0; i < watch_.pathc; ++i) {
+            free(watch_.paths[i]);
+        }
+        free(watch_.paths);
+        free(watch_.wd);
+    }
+
+    SyntheticWatch(const SyntheticWatch &) = delete;
+    SyntheticWatch &operator=(const SyntheticWatch &) = delete;
+
+    struct arguswatch *get() { return &watch_; }
+
+    /**
+     * Builds the path stored at cache position `index`: `depth - 1` directory
+     * components taken from the base-16 digits of `index`, followed by a leaf
+     * component that makes the path unique.
+     *
+     * @param root
+     * @param index
+     * @param depth
+     * @return
+     */
+    static std::string pathForIndex(const std::string &root, const int index, const int depth) {
+        std::string path(root);
+        int n = index;
+        for (int level = 0; level < depth - 1; ++level) {
+            path += "/d" + std::to_string(n % kFanout);
+            n /= kFanout;
+        }
+        path += "/n" + std::to_string(index);
+        return path;
+    }
+
+private:
+    struct arguswatch watch_;
+};
+
+/**
+ * Building a half-million entry cache dominates the run time, so share one
+ * instance per (count, depth) between all benchmarks and iterations. Any
+ * benchmark that mutates the cache must restore it before returning.
+ *
+ * @param count
+ * @param depth
+ * @return
+ */
+SyntheticWatch &sharedWatch(const int count, const int depth) {
+    static std::map<std::pair<int, int>, std::unique_ptr<SyntheticWatch>> watches;
+    auto &watch = watches[std::make_pair(count, depth)];
+    if (watch == nullptr) {
+        watch.reset(new SyntheticWatch(count, depth));
+    }
+    return *watch;
+}
+
+/**
+ * Starts a watcher of `path` with `opts`, like argusd does. Watchers take over
+ * and free their configuration, so it is copied onto the heap.
+ *
+ * @param pid
+ * @param sid
+ * @param path
+ * @param mask
+ * @param flags
+ * @param opts
+ * @param logfn
+ */
+void startWatcher(const int pid, const int sid, const char *path, const uint32_t mask, const uint32_t flags,
+    const struct arguswatch_opts *opts, arguswatch_logfn logfn) {
+    const char **paths = static_cast<const char **>(calloc(1, sizeof(char *)));
+    paths[0] = strdup(path);
+    start_inotify_watcher(strdup("bench"), strdup("node"), strdup("pod"), pid, sid, 1, paths, 0, nullptr, 0, nullptr,
+        0, mask, flags, 0, opts, strdup(""), strdup(""), logfn);
+}
+
+/**
+ * Watch counts and path depths we care about: the lower end matches a typical
+ * application container, the upper end a recursive watch over a package
+ * cache or a `node_modules` tree.
+ *
+ * @param bench
+ */
+void CacheArgs(benchmark::internal::Benchmark *bench) {
+    for (int count : {1000, 10000, 100000, 500000}) {
+        for (int depth : {2, 8, 16}) {
+            bench->Args({count, depth});
+        }
+    }
+}
+
+/**
+ * `check_cache_consistency` has to `lstat` real paths, so keep the counts to
+ * what can reasonably be created on a scratch filesystem.
+ *
+ * @param bench
+ */
+void ConsistencyArgs(benchmark::internal::Benchmark *bench) {
+    for (int count : {1000, 4000, 16000}) {
+        for (int depth : {2, 8}) {
+            bench->Args({count, depth});
+        }
+    }
+}
+
+void BM_FindWatch(benchmark::State &state) {
+    auto *watch = sharedWatch(state.range(0), state.range(1)).get();
+    int i = 0;
+    for (auto _ : state) {
+        // Stride through the cache so hits land anywhere in the array.
+        int wd = (i++ * 7919) % watch->pathc + 1;
+        benchmark::DoNotOptimize(find_watch(watch, wd));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindWatch)->Apply(CacheArgs);
+
+void BM_WdToPathName(benchmark::State &state) {
+    auto *watch = sharedWatch(state.range(0), state.range(1)).get();
+    int i = 0;
+    for (auto _ : state) {
+        int wd = (i++ * 7919) % watch->pathc + 1;
+        benchmark::DoNotOptimize(wd_to_path_name(watch, wd));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WdToPathName)->Apply(CacheArgs);
+
+void BM_PathNameToCacheSlot(benchmark::State &state) {
+    auto *watch = sharedWatch(state.range(0), state.range(1)).get();
+    std::vector<std::string> lookups;
+    for (int i = 0; i < 64; ++i) {
+        lookups.push_back(SyntheticWatch::pathForIndex(kRootPath, (i * 7919) % watch->pathc,
+            static_cast<int>(state.range(1))));
+    }
+    int i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(path_name_to_cache_slot(watch, lookups[i++ % lookups.size()].c_str()));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PathNameToCacheSlot)->Apply(CacheArgs);
+
+void BM_RewriteCachedPaths(benchmark::State &state) {
+    auto *watch = sharedWatch(state.range(0), state.range(1)).get();
+    // Rename the first top-level subtree and immediately rename it back, so
+    // the shared cache is left untouched; each iteration is two renames.
+    for (auto _ : state) {
+        rewrite_cached_paths(&watch, kRootPath, "d0", kRootPath, "r0");
+        rewrite_cached_paths(&watch, kRootPath, "r0", kRootPath, "d0");
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_RewriteCachedPaths)->Apply(CacheArgs);
+
+void BM_RemoveSubtree(benchmark::State &state) {
+    auto *watch = sharedWatch(state.range(0), state.range(1)).get();
+    // Removing a subtree that is actually cached calls `inotify_rm_watch` for
+    // every match, which needs a live `inotify` instance; measure the
+    // prefix scan every `IN_MOVED_FROM`/`IN_MOVE_SELF` pays instead.
+    std::string path = std::string(kRootPath) + "/absent";
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(remove_subtree(&watch, path.c_str()));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RemoveSubtree)->Apply(CacheArgs);
+
+void BM_CheckCacheConsistency(benchmark::State &state) {
+    const int count = state.range(0), depth = state.range(1);
+    char tmpl[] = "/tmp/argusbench.XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        state.SkipWithError("mkdtemp failed");
+        return;
+    }
+    const std::string root(tmpl);
+    SyntheticWatch synthetic(count, depth, root);
+    auto *watch = synthetic.get();
+    for (unsigned int i = 0; i < watch->pathc; ++i) {
+        // Create every component along the way; `EEXIST` is expected for
+        // shared parents.
+        for (char *p = watch->paths[i] + root.size() + 1; *p; ++p) {
+            if (*p == '/') {
+                *p = '\0';
+                mkdir(watch->paths[i], 0700);
+                *p = '/';
+            }
+        }
+        mkdir(watch->paths[i], 0700);
+    }
+
+    for (auto _ : state) {
+        check_cache_consistency(&watch);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+
+    std::string cmd = "rm -rf " + root;
+    if (system(cmd.c_str()) != 0) {
+        state.SkipWithError("failed to clean up scratch tree");
+    }
+}
+BENCHMARK(BM_CheckCacheConsistency)->Apply(ConsistencyArgs)->Unit(benchmark::kMicrosecond);
+
+/**
+ * `lstat` `range(0)` directories the way `check_cache_consistency` does, in
+ * `io_uring` batches if `range(1)` is set or one syscall each otherwise.
+ * Reports the syscalls made per path.
+ */
+void BM_BatchLstat(benchmark::State &state) {
+    const int count = state.range(0);
+    char tmpl[] = "/tmp/argusbench.XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        state.SkipWithError("mkdtemp failed");
+        return;
+    }
+    const std::string root(tmpl);
+    std::vector<std::string> dirs;
+    std::vector<const char *> paths;
+    for (int i = 0; i < count; ++i) {
+        dirs.push_back(root + "/" + std::to_string(i));
+        mkdir(dirs.back().c_str(), 0700);
+    }
+    for (const auto &dir : dirs) {
+        paths.push_back(dir.c_str());
+    }
+    std::vector<struct stat> sbs(count);
+    std::vector<int> errs(count);
+
+    set_uring_enabled(state.range(1));
+    long long calls = 0;
+    for (auto _ : state) {
+        calls += batch_lstat(count, paths.data(), sbs.data(), errs.data());
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    state.counters["syscalls/path"] = static_cast<double>(calls) / (state.iterations() * count);
+    if (state.range(1) && !uring_enabled()) {
+        state.SetLabel("io_uring unavailable");
+    }
+    set_uring_enabled(true);
+
+    std::string cmd = "rm -rf " + root;
+    if (system(cmd.c_str()) != 0) {
+        state.SkipWithError("failed to clean up scratch tree");
+    }
+}
+BENCHMARK(BM_BatchLstat)->Args({1000, 0})->Args({1000, 1})->Args({16000, 0})->Args({16000, 1})->Unit(benchmark::kMicrosecond);
+
+void BM_FindCachedSlot(benchmark::State &state) {
+    const int count = state.range(0);
+    // Populate the watch cache with one watch per (pid, sid).
+    std::vector<struct arguswatch> watches(count);
+    for (int i = 0; i < count; ++i) {
+        watches[i].pid = i + 1;
+        watches[i].sid = 0;
+        struct arguswatch *watch = &watches[i];
+        add_watch_to_cache(&watch);
+    }
+
+    int i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(find_cached_slot((i++ * 7919) % count + 1, 0));
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    for (auto &watch : watches) {
+        mark_cache_slot_empty(watch.slot);
+    }
+}
+BENCHMARK(BM_FindCachedSlot)->Arg(1000)->Arg(10000)->Arg(100000)->Arg(500000);
+
+/**
+ * Register, look up and retire watches from several threads at once, each
+ * with its own pids. Throughput should scale with threads as long as they
+ * mostly land in different cache shards.
+ */
+void BM_CacheRegisterRetire(benchmark::State &state) {
+    struct arguswatch watch = {};
+    struct arguswatch *pwatch = &watch;
+    int i = 0;
+    for (auto _ : state) {
+        watch.pid = state.thread_index() + (i++ % 64) * state.threads() + 1;
+        add_watch_to_cache(&pwatch);
+        benchmark::DoNotOptimize(find_cached_slot(watch.pid, 0));
+        mark_cache_slot_empty(watch.slot);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CacheRegisterRetire)->ThreadRange(1, 16)->UseRealTime();
+
+/**
+ * Match ignore patterns against paths of a synthetic tree, with `range(0)`
+ * patterns compiled into one matcher. Time per path should not grow with the
+ * number of patterns once the DFA has warmed up.
+ */
+void BM_MatchPath(benchmark::State &state) {
+    const int count = state.range(0);
+    std::vector<std::string> patterns;
+    std::vector<const char *> cpatterns;
+    for (int i = 0; i < count; ++i) {
+        switch (i % 4) {
+        case 0: patterns.push_back("*.cache" + std::to_string(i)); break;
+        case 1: patterns.push_back("dir" + std::to_string(i) + "/**"); break;
+        case 2: patterns.push_back("/var/log/*/archive" + std::to_string(i)); break;
+        case 3: patterns.push_back("build" + std::to_string(i)); break;
+        }
+    }
+    for (const auto &pattern : patterns) {
+        cpatterns.push_back(pattern.c_str());
+    }
+    struct argusmatch *matcher = compile_match_patterns(count, cpatterns.data());
+
+    std::vector<std::string> paths;
+    for (int i = 0; i < 1024; ++i) {
+        paths.push_back("/var/lib/app/d" + std::to_string(i % 31) + "/e" + std::to_string(i % 7) +
+            "/f" + std::to_string(i));
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(match_path(matcher, paths[i++ % paths.size()].c_str()));
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    free_match_patterns(matcher);
+}
+BENCHMARK(BM_MatchPath)->Arg(1)->Arg(8)->Arg(64)->Arg(256);
+
+/**
+ * Hash a buffer of `range(0)` bytes the way written files are hashed for
+ * content verification.
+ */
+void BM_DigestBuffer(benchmark::State &state) {
+    std::vector<unsigned char> buf(state.range(0));
+    for (size_t i = 0; i < buf.size(); ++i) {
+        buf[i] = static_cast<unsigned char>(i * 2654435761u >> 24);
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(digest_buffer(buf.data(), buf.size(), 0));
+    }
+    state.SetBytesProcessed(state.iterations() * buf.size());
+}
+BENCHMARK(BM_DigestBuffer)->Arg(64)->Arg(4 << 10)->Arg(64 << 10)->Arg(1 << 20);
+
+std::atomic<long> fakeLogged(0);
+
+void CountFakeEvent(struct arguswatch_event *) {
+    fakeLogged.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Run a watcher on the `fake` backend and inject batches of `range(0)`
+ * IN_MODIFY events on its root, timing how long it takes to log all of them.
+ * Measures the event path from the backend read to the log callback with the
+ * kernel taken out of it.
+ */
+void BM_ProcessFakeEvents(benchmark::State &state) {
+    static int sid = 0;
+    const int batch = state.range(0);
+    char tmpl[] = "/tmp/argusbench.XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        state.SkipWithError("mkdtemp failed");
+        return;
+    }
+    struct arguswatch_status status = {};
+    struct arguswatch_opts opts = {};
+    opts.backend = AW_BACKEND_FAKE;
+    opts.status = &status;
+    const int pid = getpid(), subject = sid++;
+    std::thread watcher([&] {
+        startWatcher(pid, subject, tmpl, IN_MODIFY, 0, &opts, CountFakeEvent);
+    });
+    while (__atomic_load_n(&status.state, __ATOMIC_ACQUIRE) < AW_STATE_ARMED) {
+        std::this_thread::yield();
+    }
+    struct arguswatch *watch = cached_watch(find_cached_slot(pid, subject));
+
+    // Every event is for a file in the root, which is the first watch.
+    const size_t evtlen = IN_EVENT_LEN + 16;
+    std::vector<char> buf(batch * evtlen);
+    for (int i = 0; i < batch; ++i) {
+        struct inotify_event *event = reinterpret_cast<struct inotify_event *>(&buf[i * evtlen]);
+        event->wd = 1;
+        event->mask = IN_MODIFY;
+        event->len = 16;
+        snprintf(event->name, 16, "f%d", i % 64);
+    }
+
+    if (status.state != AW_STATE_ARMED || watch == nullptr) {
+        state.SkipWithError("watcher failed to start");
+    } else {
+        for (auto _ : state) {
+            const long target = fakeLogged.load(std::memory_order_relaxed) + batch;
+            inject_fake_events(watch, buf.data(), buf.size());
+            while (fakeLogged.load(std::memory_order_relaxed) < target) {
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * batch);
+    }
+
+    send_watcher_kill_signal(pid);
+    watcher.join();
+    rmdir(tmpl);
+}
+BENCHMARK(BM_ProcessFakeEvents)->Arg(64)->Arg(1024)->Arg(16384)->UseRealTime();
+
+void DropEvent(struct arguswatch_event *) {}
+
+/**
+ * Start recursive watchers for a tree of `range(0)` directories (with a few
+ * files in each), timing how long each takes to be armed. With `range(1)` set, every watcher after the first reuses the
+ * skeleton the first one left instead of reading the tree again, the way
+ * containers of the same image do.
+ */
+void BM_WatchTree(benchmark::State &state) {
+    static int sid = 0;
+    const int count = state.range(0);
+    char tmpl[] = "/tmp/argusbench.XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        state.SkipWithError("mkdtemp failed");
+        return;
+    }
+    const std::string root(tmpl);
+    for (int i = 0; i < count; ++i) {
+        std::string dir = root + "/d" + std::to_string(i % kFanout);
+        mkdir(dir.c_str(), 0700);
+        dir += "/d" + std::to_string(i);
+        mkdir(dir.c_str(), 0700);
+        for (int j = 0; j < 4; ++j) {
+            close(creat((dir + "/f" + std::to_string(j)).c_str(), 0600));
+        }
+    }
+    // Directories changed this recently aren't trusted from a skeleton.
+    sleep(SKELETON_RACY_WINDOW + 1);
+    set_skeleton_cache_size(state.range(1) ? SKELETON_CACHE_SIZE : 0);
+
+    const int pid = getpid();
+    auto watchTree = [&](const bool timed) -> unsigned int {
+        struct arguswatch_status status = {};
+        struct arguswatch_opts opts = {};
+        opts.status = &status;
+        const int subject = sid++;
+        std::thread watcher([&] {
+            startWatcher(pid, subject, tmpl, IN_CREATE, AW_RECURSIVE, &opts, DropEvent);
+        });
+        while (__atomic_load_n(&status.state, __ATOMIC_ACQUIRE) < AW_STATE_ARMED) {
+            std::this_thread::yield();
+        }
+        if (timed) {
+            state.PauseTiming();
+        }
+        send_watcher_kill_signal(pid);
+        watcher.join();
+        if (timed) {
+            state.ResumeTiming();
+        }
+        return status.traversed;
+    };
+    // The first watcher of the tree always reads it.
+    unsigned int pathc = watchTree(false);
+    for (auto _ : state) {
+        pathc = watchTree(true);
+    }
+    state.SetItemsProcessed(state.iterations() * pathc);
+    set_skeleton_cache_size(SKELETON_CACHE_SIZE);
+
+    std::string cmd = "rm -rf " + root;
+    if (system(cmd.c_str()) != 0) {
+        state.SkipWithError("failed to clean up scratch tree");
+    }
+}
+BENCHMARK(BM_WatchTree)->Args({1000, 0})->Args({1000, 1})->Args({16000, 0})->Args({16000, 1})
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+} // namespace
+
+BENCHMARK_MAIN();
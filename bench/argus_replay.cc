@@ -0,0 +1,114 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <lib/argusnotify.h>
+#include <lib/argusrecord.h>
+#include <lib/argusutil.h>
+}
+
+namespace {
+uint64_t kEventCount = 0;
+bool kVerbose = false;
+
+void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--paced] [--verbose] <recording.awr>...\n", prog);
+    fprintf(stderr, "  --paced    replay with the original timing between `read` buffers\n");
+    fprintf(stderr, "  --verbose  print every event handed to the log function\n");
+}
+} // namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * Log function handed to the replayed watcher; counts events instead of
+ * formatting them so the replay measures the processing pipeline itself.
+ *
+ * @param awevent
+ */
+void countReplayEvent(struct arguswatch_event *awevent) {
+    ++kEventCount;
+    if (kVerbose) {
+        printf("0x%08x %s '%s/%s'\n", awevent->event_mask, awevent->is_dir ? "directory" : "file",
+            awevent->path_name, awevent->file_name);
+    }
+}
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+/**
+ * Replays raw `inotify` event streams recorded by argusd (`-recorddir`)
+ * through the argusnotify processing pipeline and reports throughput.
+ */
+int main(int argc, char **argv) {
+    bool paced = false;
+    std::vector<std::string> recordings;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--paced") == 0) {
+            paced = true;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            kVerbose = true;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            recordings.push_back(argv[i]);
+        }
+    }
+    if (recordings.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int status = 0;
+    for (const auto &recording : recordings) {
+        struct argusrecord_stats stats = {};
+        kEventCount = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        if (replay_inotify_watcher(recording.c_str(), paced, countReplayEvent, &stats) != EXIT_SUCCESS) {
+            fprintf(stderr, "%s: unable to replay recording\n", recording.c_str());
+            status = 1;
+            continue;
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%s: %" PRIu64 " events, %" PRIu64 " buffers (%" PRIu64 " bytes), %" PRIu64 " cache tables in %.3fs",
+            recording.c_str(), kEventCount, stats.buffers, stats.bytes, stats.tables, secs);
+        if (secs > 0) {
+            printf(" (%.0f events/s, %.2f MB/s)", kEventCount / secs, stats.bytes / secs / (1024 * 1024));
+        }
+        printf("\n");
+    }
+    return status;
+}
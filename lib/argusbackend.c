@@ -0,0 +1,192 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "argusbackend.h"
+#include "argusbudget.h"
+#include "argusfake.h"
+#include "argusfanotify.h"
+#include "arguspoll.h"
+#include "argusutil.h"
+
+// A watch on each directory of the tree.
+const struct argusbackend inotify_backend = {
+    .name = "inotify",
+    .init = init_inotify_backend,
+    .add_watch = add_inotify_watch,
+    .remove_watch = remove_inotify_watch,
+    .read_batch = read_inotify_batch,
+    .close = close_inotify_backend
+};
+
+/**
+ * Returns the backend with the id `backend` (one of AW_BACKEND_*), or the
+ * `inotify` backend if there is no such backend.
+ *
+ * @param backend
+ * @return
+ */
+const struct argusbackend *find_backend(const int backend) {
+    switch (backend) {
+    case AW_BACKEND_FANOTIFY:
+        return &fanotify_backend;
+    case AW_BACKEND_FAKE:
+        return &fake_backend;
+    case AW_BACKEND_POLL:
+        return &poll_backend;
+    default:
+        return &inotify_backend;
+    }
+}
+
+/**
+ * Returns the backend `watch` is read from. Watches that were never started
+ * (e.g. replayed ones) count as `inotify` watches.
+ *
+ * @param watch
+ * @return
+ */
+const struct argusbackend *watch_backend(const struct arguswatch *const watch) {
+    return watch->source != NULL ? watch->source : &inotify_backend;
+}
+
+/**
+ * Watch the directory `path` of `watch` with `mask`, or change its mask.
+ * Returns the watch descriptor, or -1 on error.
+ *
+ * @param watch
+ * @param path
+ * @param mask
+ * @return
+ */
+int add_backend_watch(const struct arguswatch *const watch, const char *const path, const uint32_t mask) {
+    const struct argusbackend *const source = watch_backend(watch);
+    if (source->add_watch == NULL) {
+        errno = ENOTSUP;
+        return EOF;
+    }
+    return (*source->add_watch)(watch, path, mask);
+}
+
+/**
+ * Stop watching `wd` of `watch`. Returns 0, or -1 on error.
+ *
+ * @param watch
+ * @param wd
+ * @return
+ */
+int remove_backend_watch(const struct arguswatch *const watch, const int wd) {
+    const struct argusbackend *const source = watch_backend(watch);
+    if (source->remove_watch == NULL) {
+        errno = ENOTSUP;
+        return EOF;
+    }
+    return (*source->remove_watch)(watch, wd);
+}
+
+/**
+ * Create the `inotify` instance of `watch`, counted against the node-wide
+ * budget. Fails with `EMFILE` once `max_user_instances` are in use.
+ *
+ * @param watch
+ * @return
+ */
+static int init_inotify_backend(struct arguswatch *const watch) {
+    int fd;
+    if (!admit_instance()) {
+        errno = EMFILE;
+#if DEBUG
+        perror("admit_instance");
+#endif
+        return EOF;
+    }
+    if ((fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) == EOF) {
+#if DEBUG
+        perror("inotify_init1");
+#endif
+        release_instance();
+        return EOF;
+    }
+    return fd;
+}
+
+/**
+ * `inotify_add_watch` on the instance of `watch`.
+ *
+ * @param watch
+ * @param path
+ * @param mask
+ * @return
+ */
+static int add_inotify_watch(const struct arguswatch *const watch, const char *const path, const uint32_t mask) {
+    return inotify_add_watch(watch->fd, path, mask);
+}
+
+/**
+ * `inotify_rm_watch` on the instance of `watch`.
+ *
+ * @param watch
+ * @param wd
+ * @return
+ */
+static int remove_inotify_watch(const struct arguswatch *const watch, const int wd) {
+    return inotify_rm_watch(watch->fd, wd);
+}
+
+/**
+ * `read` the events queued on the instance of `watch`.
+ *
+ * @param watch
+ * @param buf
+ * @param len
+ * @return
+ */
+static ssize_t read_inotify_batch(const struct arguswatch *const watch, void *const buf, const size_t len) {
+    return read(watch->fd, buf, len);
+}
+
+/**
+ * Close the `inotify` instance of `watch`.
+ *
+ * @param watch
+ */
+static void close_inotify_backend(struct arguswatch *const watch) {
+    if (watch->fd == EOF) {
+        return;
+    }
+    if (close(watch->fd) == EOF) {
+#if DEBUG
+        perror("close");
+#endif
+    } else {
+        release_instance();
+    }
+    watch->fd = EOF;
+}
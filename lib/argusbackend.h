@@ -0,0 +1,76 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_BACKEND__
+#define __ARGUS_BACKEND__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+#include "argusutil.h"
+
+// Called with each event of a backend that reports events by path rather
+// than by watch descriptor, as an `inotify` event on the directory `path`.
+typedef void (*argusbackend_eventfn)(struct arguswatch *watch, const struct inotify_event *event,
+    const char *path, void *arg);
+
+// Source of the events of a watch. A backend either watches each directory
+// of the tree (`add_watch`), and reports events by watch descriptor
+// (`read_batch`), or watches the tree as a whole, and reports events by path
+// (`read_events`).
+struct argusbackend {
+    const char *name;
+    // Set up the backend for `watch`. Returns the fd to poll for events, or
+    // -1 on error.
+    int (*init)(struct arguswatch *watch);
+    // Watch the directory `path` with `mask`, or change the mask it is
+    // watched with. Returns the watch descriptor, or -1 on error. NULL if the
+    // backend has no per-directory watches.
+    int (*add_watch)(const struct arguswatch *watch, const char *path, uint32_t mask);
+    // Stop watching `wd`. Returns 0, or -1 on error.
+    int (*remove_watch)(const struct arguswatch *watch, int wd);
+    // Read the available events into `buf` as `inotify_event` records.
+    // Returns the number of bytes read, or -1 on error (EAGAIN if none).
+    ssize_t (*read_batch)(const struct arguswatch *watch, void *buf, size_t len);
+    // Read the available events, passing each one to `fn`.
+    void (*read_events)(struct arguswatch *watch, argusbackend_eventfn fn, void *arg);
+    // Release everything `init` set up, including the fd.
+    void (*close)(struct arguswatch *watch);
+};
+
+extern const struct argusbackend inotify_backend;
+
+const struct argusbackend *find_backend(int backend);
+const struct argusbackend *watch_backend(const struct arguswatch *watch);
+int add_backend_watch(const struct arguswatch *watch, const char *path, uint32_t mask);
+int remove_backend_watch(const struct arguswatch *watch, int wd);
+static int init_inotify_backend(struct arguswatch *watch);
+static int add_inotify_watch(const struct arguswatch *watch, const char *path, uint32_t mask);
+static int remove_inotify_watch(const struct arguswatch *watch, int wd);
+static ssize_t read_inotify_batch(const struct arguswatch *watch, void *buf, size_t len);
+static void close_inotify_backend(struct arguswatch *watch);
+
+#endif
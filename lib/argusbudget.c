@@ -0,0 +1,229 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "argusbudget.h"
+#include "arguscache.h"
+#include "argusrecord.h"
+#include "argusutil.h"
+
+static pthread_once_t budgetonce_ = PTHREAD_ONCE_INIT;
+static double fraction_ = 0.9;
+static unsigned long quota_ = 0;
+static int policy_ = AW_DEGRADE_DEPTH;
+static unsigned long maxwatches_, maxinstances_;
+static unsigned long usedwatches_, usedinstances_;
+
+/**
+ * Reads a single unsigned integer from a procfs file, or returns `fallback`
+ * if it can't be read.
+ *
+ * @param path
+ * @param fallback
+ * @return
+ */
+static unsigned long read_proc_limit(const char *path, const unsigned long fallback) {
+    unsigned long value;
+    FILE *fp;
+    if ((fp = fopen(path, "re")) == NULL) {
+#if DEBUG
+        perror("fopen");
+#endif
+        return fallback;
+    }
+    if (fscanf(fp, "%lu", &value) != 1) {
+        value = fallback;
+    }
+    fclose(fp);
+    return value;
+}
+
+/**
+ * Reads the kernel limits the first time the budget is needed. The limits are
+ * per-user, and are shared with anything else running as the same user on the
+ * node, so only `fraction_` of `max_user_watches` is handed out to watchers.
+ */
+static void init_budget() {
+    // Kernel defaults, in case procfs isn't available.
+    maxwatches_ = read_proc_limit(INOTIFY_MAX_USER_WATCHES, 8192) * fraction_;
+    maxinstances_ = read_proc_limit(INOTIFY_MAX_USER_INSTANCES, 128);
+#if DEBUG
+    printf("inotify budget: %lu watches, %lu instances\n", maxwatches_, maxinstances_);
+    fflush(stdout);
+#endif
+}
+
+/**
+ * Configure the node-wide watch budget as a `fraction` of `max_user_watches`,
+ * the maximum number of watches a single watcher may hold (`quota`, 0 for no
+ * limit) and how watchers that don't fit are degraded. Must be called before
+ * any watchers are started.
+ *
+ * @param fraction
+ * @param quota
+ * @param policy
+ */
+void configure_budget(const double fraction, const unsigned long quota, const int policy) {
+    if (fraction > 0 && fraction <= 1) {
+        fraction_ = fraction;
+    }
+    quota_ = quota;
+    policy_ = policy;
+}
+
+/**
+ * Check whether `watch` may add one more watch without going over its quota
+ * or the node-wide budget, and reserve it if so. Reservations are taken out
+ * of the node-wide budget straight away, so concurrent traversals can't hand
+ * out the same watches twice; the ones left unused are given back by the next
+ * `update_watch_usage`.
+ *
+ * @param watch
+ * @return
+ */
+bool admit_watch(struct arguswatch *const watch) {
+    pthread_once(&budgetonce_, init_budget);
+
+    if (quota_ &&
+        watch->pathc + 1 > quota_) {
+        return false;
+    }
+    // Watches removed since the last `update_watch_usage` are still
+    // reserved, as are replayed caches, which don't hold any kernel watches.
+    if (watch->pathc < watch->budgeted ||
+        is_replaying(watch)) {
+        return true;
+    }
+    if (__atomic_add_fetch(&usedwatches_, 1, __ATOMIC_RELAXED) > maxwatches_) {
+        __atomic_sub_fetch(&usedwatches_, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    ++watch->budgeted;
+    return true;
+}
+
+/**
+ * Bring the node-wide usage in line with the number of watches currently held
+ * by `watch`. Called whenever its cache grows or shrinks.
+ *
+ * @param watch
+ */
+void update_watch_usage(struct arguswatch *const watch) {
+    long delta = (long)watch->pathc - (long)watch->budgeted;
+    // Replayed caches don't hold any kernel watches.
+    if (is_replaying(watch)) {
+        return;
+    }
+    if (delta) {
+        __atomic_add_fetch(&usedwatches_, delta, __ATOMIC_RELAXED);
+        watch->budgeted = watch->pathc;
+    }
+}
+
+/**
+ * Check whether another `inotify` instance fits in `max_user_instances`, and
+ * count it if so. Returns false if the instance shouldn't be created.
+ *
+ * @return
+ */
+bool admit_instance() {
+    pthread_once(&budgetonce_, init_budget);
+
+    if (__atomic_add_fetch(&usedinstances_, 1, __ATOMIC_RELAXED) > maxinstances_) {
+        __atomic_sub_fetch(&usedinstances_, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Count an `inotify` instance that exists already, such as one handed over
+ * by another process, whether or not it fits.
+ */
+void acquire_instance() {
+    __atomic_add_fetch(&usedinstances_, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Stop counting an `inotify` instance counted by `admit_instance` or
+ * `acquire_instance` once it is closed.
+ */
+void release_instance() {
+    __atomic_sub_fetch(&usedinstances_, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the depth to retry a recursive traversal with after it ran over
+ * budget, given the deepest level the failed traversal reached. Returns 0 if
+ * the watch can't be degraded any further.
+ *
+ * @param watch
+ * @param deepest
+ * @return
+ */
+int degrade_depth(const struct arguswatch *const watch, const int deepest) {
+    int depth = watch->depth_cap ? watch->depth_cap : deepest + 1;
+    if (watch->max_depth &&
+        watch->max_depth < depth) {
+        depth = watch->max_depth;
+    }
+    if (depth <= 1) {
+        return 0;
+    }
+    return policy_ == AW_DEGRADE_TOPLEVEL ? 1 : depth / 2;
+}
+
+/**
+ * Counts a watch in `arg`, a `struct argusbudget_usage`, if its depth was
+ * capped.
+ *
+ * @param watch
+ * @param arg
+ */
+static void count_degraded(struct arguswatch *watch, void *arg) {
+    if (watch->depth_cap) {
+        ++((struct argusbudget_usage *)arg)->degraded;
+    }
+}
+
+/**
+ * Fill `usage` with the current node-wide budget usage.
+ *
+ * @param usage
+ */
+void get_budget_usage(struct argusbudget_usage *const usage) {
+    pthread_once(&budgetonce_, init_budget);
+
+    usage->watches = __atomic_load_n(&usedwatches_, __ATOMIC_RELAXED);
+    usage->maxwatches = maxwatches_;
+    usage->instances = __atomic_load_n(&usedinstances_, __ATOMIC_RELAXED);
+    usage->maxinstances = maxinstances_;
+    usage->quota = quota_;
+    usage->degraded = 0;
+    for_each_cached_watch(count_degraded, usage);
+}
@@ -0,0 +1,54 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_BUDGET__
+#define __ARGUS_BUDGET__
+
+#include <stdbool.h>
+
+#include "argusutil.h"
+
+#define AW_DEGRADE_DEPTH    0 // Halve the recursion depth until the tree fits.
+#define AW_DEGRADE_TOPLEVEL 1 // Only watch the root paths themselves.
+
+#define INOTIFY_MAX_USER_WATCHES   "/proc/sys/fs/inotify/max_user_watches"
+#define INOTIFY_MAX_USER_INSTANCES "/proc/sys/fs/inotify/max_user_instances"
+
+struct argusbudget_usage {
+    unsigned long watches, maxwatches;     // Watches held by all watchers, node-wide watch budget.
+    unsigned long instances, maxinstances; // `inotify` instances held, `max_user_instances`.
+    unsigned long quota;                   // Per-watcher watch quota (0 if unlimited).
+    unsigned int degraded;                 // Watchers currently running with a capped depth.
+};
+
+void configure_budget(double fraction, unsigned long quota, int policy);
+bool admit_watch(struct arguswatch *watch);
+void update_watch_usage(struct arguswatch *watch);
+bool admit_instance();
+void acquire_instance();
+void release_instance();
+int degrade_depth(const struct arguswatch *watch, int deepest);
+void get_budget_usage(struct argusbudget_usage *usage);
+
+#endif
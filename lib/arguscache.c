@@ -25,17 +25,118 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/inotify.h>
 #include <sys/stat.h>
 
+#include "argusbudget.h"
 #include "arguscache.h"
+#include "argusuring.h"
 #include "argusutil.h"
 
-struct arguswatch **wlcache = NULL;
-int wlcachec = 0;
+// Shards of the cache, by pid. Each shard has its own lock, and its slots
+// live in fixed-size chunks that are never moved, so a slot can be read while
+// other shards, or other chunks of the same shard, grow.
+static struct arguscache_shard shards_[CACHE_SHARDS];
+static pthread_once_t cacheonce_ = PTHREAD_ONCE_INIT;
+
+/**
+ * Initialize the locks of the cache shards.
+ */
+static void init_cache() {
+    int i;
+    for (i = 0; i < CACHE_SHARDS; ++i) {
+        pthread_mutex_init(&shards_[i].mux, NULL);
+    }
+}
+
+/**
+ * Return the shard holding the watches of `pid`.
+ *
+ * @param pid
+ * @return
+ */
+static struct arguscache_shard *pid_shard(const int pid) {
+    pthread_once(&cacheonce_, init_cache);
+    return &shards_[(unsigned int)pid % CACHE_SHARDS];
+}
+
+/**
+ * Return the bucket of the pid index of a shard holding `pid`.
+ *
+ * @param shard
+ * @param pid
+ * @return
+ */
+static struct arguscache_pidentry **pid_bucket(struct arguscache_shard *shard, const int pid) {
+    return &shard->pidindex[((unsigned int)pid / CACHE_SHARDS) % PID_BUCKETS];
+}
+
+/**
+ * Return the address of `slot`, or NULL if it was never allocated. The
+ * address stays valid for the life of the process.
+ *
+ * @param slot
+ * @return
+ */
+static struct arguswatch **slot_address(const int slot) {
+    struct arguswatch **chunk;
+    int index;
+    if (slot < 0) {
+        return NULL;
+    }
+    index = slot / CACHE_SHARDS;
+    if (index / ALLOC_INC >= CACHE_CHUNKS ||
+        (chunk = __atomic_load_n(&shards_[slot % CACHE_SHARDS].chunks[index / ALLOC_INC],
+            __ATOMIC_ACQUIRE)) == NULL) {
+        return NULL;
+    }
+    return &chunk[index % ALLOC_INC];
+}
+
+/**
+ * Add `slot` to the slots of `pid`. Callers hold the lock of `shard`.
+ *
+ * @param shard
+ * @param pid
+ * @param slot
+ */
+static void index_pid_slot(struct arguscache_shard *shard, const int pid, const int slot) {
+    struct arguscache_pidentry *entry, **bucket = pid_bucket(shard, pid);
+    if ((entry = malloc(sizeof(struct arguscache_pidentry))) == NULL) {
+#if DEBUG
+        perror("malloc");
+#endif
+        return;
+    }
+    entry->pid = pid;
+    entry->slot = slot;
+    entry->next = *bucket;
+    *bucket = entry;
+}
+
+/**
+ * Remove `slot` from the slots of `pid`. Callers hold the lock of `shard`.
+ *
+ * @param shard
+ * @param pid
+ * @param slot
+ */
+static void unindex_pid_slot(struct arguscache_shard *shard, const int pid, const int slot) {
+    struct arguscache_pidentry **entry, *next;
+    for (entry = pid_bucket(shard, pid); *entry != NULL; entry = &(*entry)->next) {
+        if ((*entry)->pid == pid &&
+            (*entry)->slot == slot) {
+            next = (*entry)->next;
+            free(*entry);
+            *entry = next;
+            return;
+        }
+    }
+}
 
 /**
  * Deallocate the watch cache.
@@ -56,48 +157,148 @@ void clear_watch(struct arguswatch **watch) {
     (*watch)->pathc = 0;
     (*watch)->fd = EOF;
     (*watch)->processevtfd = EOF;
+    update_watch_usage(*watch);
 }
 
 /**
- * Find the position in the `wlcache` given a `pid` and `sid`.
+ * Find the cache slot of the watch of `pid` and `sid`, or -1.
  *
  * @param pid
  * @param sid
  * @return
  */
 int find_cached_slot(const int pid, const int sid) {
-    int i;
-    for (i = 0; i < wlcachec; ++i) {
-        // In the case we're still initializing the cache, we want to make sure
-        // we don't access unmapped memory.
-        if (wlcache[i] == NULL) {
-            continue;
+    struct arguscache_shard *shard = pid_shard(pid);
+    struct arguscache_pidentry *entry;
+    int slot = -1;
+    pthread_mutex_lock(&shard->mux);
+    for (entry = *pid_bucket(shard, pid); entry != NULL; entry = entry->next) {
+        if (entry->pid == pid &&
+            (*slot_address(entry->slot))->sid == sid) {
+            slot = entry->slot;
+            break;
         }
-        if (wlcache[i]->pid == pid &&
-            wlcache[i]->sid == sid) {
-            return i;
+    }
+    pthread_mutex_unlock(&shard->mux);
+    return slot;
+}
+
+/**
+ * Return the watch in cache slot `slot`, or NULL if the slot is unused. The
+ * watch is only safe to use without the cache locked if it can't be retired
+ * meanwhile, i.e. it isn't running; see `with_cached_watch`.
+ *
+ * @param slot
+ * @return
+ */
+struct arguswatch *cached_watch(const int slot) {
+    struct arguswatch **address = slot_address(slot);
+    return address != NULL ? __atomic_load_n(address, __ATOMIC_ACQUIRE) : NULL;
+}
+
+/**
+ * Call `fn` with the cached watch of `pid` and `sid`, with its shard locked
+ * so the watch can't be retired meanwhile. Returns -1 if there is no such
+ * watch.
+ *
+ * @param pid
+ * @param sid
+ * @param fn
+ * @param arg
+ * @return
+ */
+int with_cached_watch(const int pid, const int sid, arguscache_watchfn fn, void *arg) {
+    struct arguscache_shard *shard = pid_shard(pid);
+    struct arguscache_pidentry *entry;
+    struct arguswatch *watch;
+    int rc = -1;
+    pthread_mutex_lock(&shard->mux);
+    for (entry = *pid_bucket(shard, pid); entry != NULL; entry = entry->next) {
+        watch = *slot_address(entry->slot);
+        if (entry->pid == pid &&
+            watch->sid == sid) {
+            (*fn)(watch, arg);
+            rc = 0;
+            break;
         }
     }
-    return -1;
+    pthread_mutex_unlock(&shard->mux);
+    return rc;
+}
+
+/**
+ * Call `fn` with every cached watch of `pid`. `fn` is called with the shard
+ * of `pid` locked, so it must not add or remove watches.
+ *
+ * @param pid
+ * @param fn
+ * @param arg
+ */
+void for_each_pid_watch(const int pid, arguscache_watchfn fn, void *arg) {
+    struct arguscache_shard *shard = pid_shard(pid);
+    struct arguscache_pidentry *entry;
+    pthread_mutex_lock(&shard->mux);
+    for (entry = *pid_bucket(shard, pid); entry != NULL; entry = entry->next) {
+        if (entry->pid == pid) {
+            (*fn)(*slot_address(entry->slot), arg);
+        }
+    }
+    pthread_mutex_unlock(&shard->mux);
+}
+
+/**
+ * Call `fn` with every cached watch, one shard locked at a time.
+ *
+ * @param fn
+ * @param arg
+ */
+void for_each_cached_watch(arguscache_watchfn fn, void *arg) {
+    struct arguscache_pidentry *entry;
+    unsigned int i, bucket;
+    pthread_once(&cacheonce_, init_cache);
+    for (i = 0; i < CACHE_SHARDS; ++i) {
+        pthread_mutex_lock(&shards_[i].mux);
+        for (bucket = 0; bucket < PID_BUCKETS; ++bucket) {
+            for (entry = shards_[i].pidindex[bucket]; entry != NULL; entry = entry->next) {
+                (*fn)(*slot_address(entry->slot), arg);
+            }
+        }
+        pthread_mutex_unlock(&shards_[i].mux);
+    }
 }
 
 /**
  * Check that all path names in the cache are valid and refer to directories.
+ * The paths are stat'ed up front in batches (see `batch_lstat`), rather than
+ * one syscall each.
  *
  * @param watch
  */
 void check_cache_consistency(struct arguswatch **watch) {
-    struct stat sb;
-    int i;
+    const unsigned int pathc = (*watch)->pathc;
+    struct stat *sbs;
+    unsigned int j;
+    int *errs, i;
+
+    if ((sbs = malloc((pathc ? pathc : 1) * sizeof(struct stat))) == NULL ||
+        (errs = malloc((pathc ? pathc : 1) * sizeof(int))) == NULL) {
+#if DEBUG
+        perror("malloc");
+#endif
+        free(sbs);
+        return;
+    }
+    batch_lstat(pathc, (const char *const *)(*watch)->paths, sbs, errs);
 
-    for (i = 0; i < (*watch)->pathc;) {
+    // `i` is where the path stat'ed as `j` is now, after the removals.
+    for (i = 0, j = 0; j < pathc; ++j) {
         if (*(*watch)->paths[i] == '\0') {
             goto out_increaseloop;
         }
-        if (lstat((*watch)->paths[i], &sb) == EOF) {
+        if (errs[j]) {
 #if DEBUG
             printf("%s: stat: [slot = %d; wd = %d] %s: %s\n", __func__,
-                i, (*watch)->wd[i], (*watch)->paths[i], strerror(errno));
+                i, (*watch)->wd[i], (*watch)->paths[i], strerror(errs[j]));
             fflush(stdout);
 #endif
             remove_item_from_cache(watch, i);
@@ -105,7 +306,7 @@ void check_cache_consistency(struct arguswatch **watch) {
         }
 
         if (((*watch)->flags & AW_ONLYDIR) &&
-            !S_ISDIR(sb.st_mode)) {
+            !S_ISDIR(sbs[j].st_mode)) {
 #if DEBUG
             fprintf(stderr, "%s: %s is not a directory\n", __func__,
                 (*watch)->paths[i]);
@@ -117,18 +318,21 @@ void check_cache_consistency(struct arguswatch **watch) {
 out_increaseloop:
         ++i;
     }
+    free(sbs);
+    free(errs);
+    update_watch_usage(*watch);
 }
 
 /**
  * When checking cache consistency, remove an item at `index` in a given
  * arguswatch object. This just moves the `wd` and `paths` position in the watch
  * object, doesn't deallocate any memory or remove the item itself from the
- * `wlcache`.
+ * cache.
  *
  * @param watch
  * @param index
  */
-static void remove_item_from_cache(struct arguswatch **watch, const int index) {
+void remove_item_from_cache(struct arguswatch **watch, const int index) {
     int i;
     for (i = index; i < (*watch)->pathc - 1; ++i) {
         (*watch)->wd[i] = (*watch)->wd[i + 1];
@@ -184,63 +388,95 @@ int find_watch_checked(const struct arguswatch *const watch, const int wd) {
 }
 
 /**
- * Mark a cache entry as unused.
+ * Mark a cache entry as unused. Once this returns, the watch that was in it
+ * is no longer reachable from the cache and can be freed.
  *
  * @param slot
  */
 void mark_cache_slot_empty(const int slot) {
-    struct arguswatch *watch;
-    if ((watch = calloc(1, sizeof(struct arguswatch))) == NULL) {
+    struct arguscache_shard *shard;
+    struct arguswatch **address;
+    int *freeslots;
+
+    if ((address = slot_address(slot)) == NULL) {
+        return;
+    }
+    shard = &shards_[slot % CACHE_SHARDS];
+    pthread_mutex_lock(&shard->mux);
+    if (*address == NULL) {
+        pthread_mutex_unlock(&shard->mux);
+        return;
+    }
+    unindex_pid_slot(shard, (*address)->pid, slot);
+    __atomic_store_n(address, NULL, __ATOMIC_RELEASE);
+    if (shard->freec == shard->freecap) {
+        if ((freeslots = realloc(shard->freeslots, (shard->freecap + ALLOC_INC) * sizeof(int))) == NULL) {
 #if DEBUG
-        perror("calloc");
+            perror("realloc");
 #endif
-        return;
+            // The slot is leaked, but stays unused.
+            pthread_mutex_unlock(&shard->mux);
+            return;
+        }
+        shard->freeslots = freeslots;
+        shard->freecap += ALLOC_INC;
     }
-    // Placeholder to pick open slot.
-    watch->slot = -1;
-    wlcache[slot] = watch;
+    shard->freeslots[shard->freec++] = slot;
+    pthread_mutex_unlock(&shard->mux);
 }
 
 /**
- * Find a free slot in the cache.
+ * Find a free slot in `shard`, allocating a new chunk if there is none.
+ * Callers hold the lock of `shard`.
  *
+ * @param shard
  * @return
  */
-static int find_empty_cache_slot() {
-    int i, len;
-    for (i = 0; i < wlcachec; ++i) {
-        if (wlcache[i]->slot == -1) {
-            return i;
-        }
-    }
-
-    // No free slot found; resize cache.
-    len = wlcachec + ALLOC_INC;
+static int find_empty_cache_slot(struct arguscache_shard *shard) {
+    struct arguswatch **chunk;
+    int index;
 
-    if ((wlcache = realloc(wlcache, len * sizeof(struct arguswatch *))) == NULL) {
+    if (shard->freec > 0) {
+        return shard->freeslots[--shard->freec];
+    }
+    if (shard->slotc / ALLOC_INC >= CACHE_CHUNKS) {
 #if DEBUG
-        perror("realloc");
+        fprintf(stderr, "%s: watch cache shard is full\n", __func__);
 #endif
         return -1;
     }
-
-    for (i = len - ALLOC_INC; i < len; ++i, ++wlcachec) {
-        mark_cache_slot_empty(i);
+    if (shard->slotc % ALLOC_INC == 0) {
+        if ((chunk = calloc(ALLOC_INC, sizeof(struct arguswatch *))) == NULL) {
+#if DEBUG
+            perror("calloc");
+#endif
+            return -1;
+        }
+        __atomic_store_n(&shard->chunks[shard->slotc / ALLOC_INC], chunk, __ATOMIC_RELEASE);
     }
-    // Return first slot in newly allocated space.
-    return wlcachec - ALLOC_INC;
+    index = shard->slotc++;
+    return index * CACHE_SHARDS + (int)(shard - shards_);
 }
 
 /**
- * Add an item to the cache.
+ * Add an item to the cache. Only the shard of its pid is locked, so watches
+ * of different processes are added in parallel.
  *
  * @param watch
  */
 void add_watch_to_cache(struct arguswatch **watch) {
-    int slot = find_empty_cache_slot();
+    struct arguscache_shard *shard = pid_shard((*watch)->pid);
+    int slot;
+    pthread_mutex_lock(&shard->mux);
+    if ((slot = find_empty_cache_slot(shard)) == -1) {
+        pthread_mutex_unlock(&shard->mux);
+        return;
+    }
     (*watch)->slot = slot;
-    // Point this `wlcache` slot to `watch`.
-    wlcache[slot] = *watch;
+    // Point this cache slot to `watch`.
+    __atomic_store_n(slot_address(slot), *watch, __ATOMIC_RELEASE);
+    index_pid_slot(shard, (*watch)->pid, slot);
+    pthread_mutex_unlock(&shard->mux);
 }
 
 /**
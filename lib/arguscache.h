@@ -25,6 +25,7 @@
 #ifndef __ARGUS_CACHE__
 #define __ARGUS_CACHE__
 
+#include <pthread.h>
 #include <stdbool.h>
 
 #include "argusutil.h"
@@ -33,15 +34,50 @@
 #define ALLOC_INC 32
 #endif
 
+#ifndef PID_BUCKETS
+#define PID_BUCKETS 4096
+#endif
+
+// Entry of the pid -> cache slot index.
+struct arguscache_pidentry {
+    int pid;
+    int slot;
+    struct arguscache_pidentry *next;  // Next entry in the same bucket.
+};
+
+#ifndef CACHE_SHARDS
+#define CACHE_SHARDS 16
+#endif
+
+#ifndef CACHE_CHUNKS
+#define CACHE_CHUNKS 4096
+#endif
+
+// Shard of the watch cache, holding the watches of the pids that hash to it.
+// Slot `n` is in shard `n % CACHE_SHARDS`, at index `n / CACHE_SHARDS`.
+struct arguscache_shard {
+    pthread_mutex_t mux;                                // Guards everything below.
+    struct arguswatch **chunks[CACHE_CHUNKS];           // Slots, `ALLOC_INC` per chunk, never moved.
+    int slotc;                                          // Slots allocated.
+    int *freeslots;                                     // Slots given back by `mark_cache_slot_empty`.
+    int freec, freecap;
+    struct arguscache_pidentry *pidindex[PID_BUCKETS];  // pid -> slots.
+};
+
+typedef void (*arguscache_watchfn)(struct arguswatch *watch, void *arg);
+
 void clear_watch(struct arguswatch **watch);
 int find_cached_slot(int pid, int sid);
 void check_cache_consistency(struct arguswatch **watch);
-static void remove_item_from_cache(struct arguswatch **watch, int index);
+void remove_item_from_cache(struct arguswatch **watch, int index);
 int find_watch(const struct arguswatch *watch, int wd);
 int find_watch_checked(const struct arguswatch *watch, int wd);
 void mark_cache_slot_empty(int slot);
-static int find_empty_cache_slot();
 void add_watch_to_cache(struct arguswatch **watch);
+struct arguswatch *cached_watch(int slot);
+int with_cached_watch(int pid, int sid, arguscache_watchfn fn, void *arg);
+void for_each_pid_watch(int pid, arguscache_watchfn fn, void *arg);
+void for_each_cached_watch(arguscache_watchfn fn, void *arg);
 int path_name_to_cache_slot(const struct arguswatch *watch, const char *path);
 const char *wd_to_path_name(const struct arguswatch *watch, int wd);
 
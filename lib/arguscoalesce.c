@@ -0,0 +1,276 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arguscoalesce.h"
+#include "arguslimit.h"
+#include "argusutil.h"
+
+/**
+ * Returns the bucket for events on file `name` in the directory watched by
+ * `wd`. The mask is left out so all events on a file can be flushed together.
+ *
+ * @param wd
+ * @param name
+ * @return
+ */
+static unsigned int coalesce_bucket(const int wd, const char *name) {
+    uint32_t hash = 2166136261u ^ (uint32_t)wd;
+    hash *= 16777619u;
+    while (*name) {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash % COALESCE_BUCKETS;
+}
+
+/**
+ * Hand a folded event to the log function and deallocate it.
+ *
+ * @param watch
+ * @param entry
+ * @param logfn
+ */
+static void emit_entry(struct arguswatch *const watch, struct arguscoalesce_entry *const entry,
+    arguswatch_logfn logfn) {
+
+    struct arguswatch_event awevent = {
+        .watch = watch,
+        .path_name = entry->path_name,
+        .file_name = entry->file_name,
+        .event_mask = entry->event_mask,
+        .is_dir = entry->is_dir,
+        .count = entry->count,
+        .first = entry->first,
+        .last = entry->last
+    };
+    emit_event(watch, &awevent, logfn);
+
+    free(entry->path_name);
+    free(entry->file_name);
+    free(entry);
+    --watch->coalesce->size;
+}
+
+/**
+ * Create a coalescing table that folds identical events within `window`
+ * milliseconds of the first one. Returns NULL if `window` is 0, which turns
+ * coalescing off.
+ *
+ * @param window
+ * @return
+ */
+struct arguscoalesce *create_coalesce_table(const int window) {
+    struct arguscoalesce *table;
+    if (window <= 0) {
+        return NULL;
+    }
+    if ((table = calloc(1, sizeof(struct arguscoalesce))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return NULL;
+    }
+    table->window = window;
+    return table;
+}
+
+/**
+ * Log `awevent`, or fold it into an identical pending event (same `wd`, file
+ * name and mask) if coalescing is enabled for `watch`. Events that end a
+ * burst on a file first flush whatever was folded for that file, so they
+ * are logged in order.
+ *
+ * @param watch
+ * @param awevent
+ * @param wd
+ * @param logfn
+ */
+void coalesce_event(struct arguswatch *const watch, struct arguswatch_event *const awevent, const int wd,
+    arguswatch_logfn logfn) {
+
+    struct arguscoalesce *const table = watch->coalesce;
+    struct arguscoalesce_entry *entry;
+    struct timespec now;
+    unsigned int bucket;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (table == NULL ||
+        !(awevent->event_mask & AW_COALESCE_MASK)) {
+        if (table != NULL &&
+            (awevent->event_mask & AW_COALESCE_FLUSH_MASK)) {
+            flush_coalesced_events(watch, wd, awevent->file_name, logfn);
+        }
+        awevent->count = 1;
+        awevent->first = now;
+        awevent->last = now;
+        emit_event(watch, awevent, logfn);
+        return;
+    }
+
+    bucket = coalesce_bucket(wd, awevent->file_name);
+    for (entry = table->buckets[bucket]; entry != NULL; entry = entry->next) {
+        // Compare paths too: a rebuilt cache may reuse `wd` for a different
+        // directory.
+        if (entry->wd == wd &&
+            entry->event_mask == awevent->event_mask &&
+            strcmp(entry->file_name, awevent->file_name) == 0 &&
+            strcmp(entry->path_name, awevent->path_name) == 0) {
+            ++entry->count;
+            entry->last = now;
+            return;
+        }
+    }
+
+    if ((entry = calloc(1, sizeof(struct arguscoalesce_entry))) == NULL ||
+        (entry->path_name = strdup(awevent->path_name)) == NULL ||
+        (entry->file_name = strdup(awevent->file_name)) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        if (entry != NULL) {
+            free(entry->path_name);
+            free(entry);
+        }
+        // Better to log it unfolded than not at all.
+        awevent->count = 1;
+        awevent->first = now;
+        awevent->last = now;
+        emit_event(watch, awevent, logfn);
+        return;
+    }
+    entry->wd = wd;
+    entry->event_mask = awevent->event_mask;
+    entry->is_dir = awevent->is_dir;
+    entry->count = 1;
+    entry->first = now;
+    entry->last = now;
+    entry->deadline = monotonic_ms() + table->window;
+    entry->next = table->buckets[bucket];
+    table->buckets[bucket] = entry;
+    ++table->size;
+}
+
+/**
+ * Log and remove the pending events on file `name` in the directory watched
+ * by `wd`, or all pending events if `name` is NULL.
+ *
+ * @param watch
+ * @param wd
+ * @param name
+ * @param logfn
+ */
+void flush_coalesced_events(struct arguswatch *const watch, const int wd, const char *const name,
+    arguswatch_logfn logfn) {
+
+    struct arguscoalesce *const table = watch->coalesce;
+    struct arguscoalesce_entry **prev, *entry;
+    unsigned int bucket, last;
+
+    if (table == NULL ||
+        !table->size) {
+        return;
+    }
+
+    bucket = name == NULL ? 0 : coalesce_bucket(wd, name);
+    last = name == NULL ? COALESCE_BUCKETS - 1 : bucket;
+    for (; bucket <= last; ++bucket) {
+        prev = &table->buckets[bucket];
+        while ((entry = *prev) != NULL) {
+            if (name == NULL ||
+                (entry->wd == wd && strcmp(entry->file_name, name) == 0)) {
+                *prev = entry->next;
+                emit_entry(watch, entry, logfn);
+            } else {
+                prev = &entry->next;
+            }
+        }
+    }
+}
+
+/**
+ * Log and remove the pending events whose window has passed. Returns the
+ * number of milliseconds until the next one is due, or -1 if there are none
+ * left, to be used as the `epoll` timeout.
+ *
+ * @param watch
+ * @param logfn
+ * @return
+ */
+int flush_expired_events(struct arguswatch *const watch, arguswatch_logfn logfn) {
+    struct arguscoalesce *const table = watch->coalesce;
+    struct arguscoalesce_entry **prev, *entry;
+    long long now, next = -1;
+    unsigned int bucket;
+
+    if (table == NULL ||
+        !table->size) {
+        return -1;
+    }
+
+    now = monotonic_ms();
+    for (bucket = 0; bucket < COALESCE_BUCKETS && table->size; ++bucket) {
+        prev = &table->buckets[bucket];
+        while ((entry = *prev) != NULL) {
+            if (entry->deadline <= now) {
+                *prev = entry->next;
+                emit_entry(watch, entry, logfn);
+            } else {
+                if (next == -1 ||
+                    entry->deadline - now < next) {
+                    next = entry->deadline - now;
+                }
+                prev = &entry->next;
+            }
+        }
+    }
+    return (int)next;
+}
+
+/**
+ * Deallocate a coalescing table, dropping any pending events.
+ *
+ * @param table
+ */
+void free_coalesce_table(struct arguscoalesce *const table) {
+    struct arguscoalesce_entry *entry, *next;
+    unsigned int bucket;
+
+    if (table == NULL) {
+        return;
+    }
+    for (bucket = 0; bucket < COALESCE_BUCKETS; ++bucket) {
+        for (entry = table->buckets[bucket]; entry != NULL; entry = next) {
+            next = entry->next;
+            free(entry->path_name);
+            free(entry->file_name);
+            free(entry);
+        }
+    }
+    free(table);
+}
@@ -0,0 +1,67 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_COALESCE__
+#define __ARGUS_COALESCE__
+
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#include "argusutil.h"
+
+#ifndef COALESCE_BUCKETS
+#define COALESCE_BUCKETS 256
+#endif
+
+// Events that come in bursts and are folded together; anything else is
+// logged straight away.
+#define AW_COALESCE_MASK (IN_ACCESS | IN_ATTRIB | IN_MODIFY | IN_OPEN | IN_CLOSE_NOWRITE)
+// Events that end a burst on a file, flushing what was folded for it first.
+#define AW_COALESCE_FLUSH_MASK (IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM)
+
+struct arguscoalesce_entry {
+    int wd;                            // Watch descriptor of the directory.
+    uint32_t event_mask;               // `inotify` event mask.
+    char *path_name, *file_name;       // Copies of the event paths.
+    bool is_dir;                       // Whether the event was on a directory.
+    unsigned int count;                // Number of events folded together.
+    struct timespec first, last;       // Wall clock time of the first and last event.
+    long long deadline;                // Monotonic time (ms) the entry is flushed at.
+    struct arguscoalesce_entry *next;  // Next entry in the same bucket.
+};
+
+struct arguscoalesce {
+    struct arguscoalesce_entry *buckets[COALESCE_BUCKETS];
+    unsigned int size;                 // Entries waiting to be flushed.
+    int window;                        // Coalescing window (ms).
+};
+
+struct arguscoalesce *create_coalesce_table(int window);
+void coalesce_event(struct arguswatch *watch, struct arguswatch_event *awevent, int wd, arguswatch_logfn logfn);
+void flush_coalesced_events(struct arguswatch *watch, int wd, const char *name, arguswatch_logfn logfn);
+int flush_expired_events(struct arguswatch *watch, arguswatch_logfn logfn);
+void free_coalesce_table(struct arguscoalesce *table);
+
+#endif
@@ -0,0 +1,689 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arguscache.h"
+#include "arguscoalesce.h"
+#include "argusdigest.h"
+#include "argusrecord.h"
+#include "argusutil.h"
+
+// XXH64 primes.
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+// Size of the reads a file is hashed in; a multiple of the 32-byte stripe.
+#define DIGEST_READ_SIZE (64 * 1024)
+// A file modified this close to when it was hashed may have changed again
+// within the same timestamp, so its cached hash isn't trusted (ns).
+#define DIGEST_RACY_NS 1000000000LL
+
+// Shared pool of workers hashing files for all watches.
+static pthread_mutex_t poolmux_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolcond_ = PTHREAD_COND_INITIALIZER;
+static struct argusdigest_job *queue_ = NULL, **queuetail_ = &queue_;
+static int maxworkers_ = DIGEST_WORKERS, workers_ = 0;
+
+// Running XXH64 state.
+struct xxh64_state {
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char mem[32];
+    size_t memsize;
+    uint64_t seed;
+};
+
+static inline uint64_t xxh_rotl(const uint64_t x, const int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t xxh_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, const uint64_t input) {
+    acc += input * XXH_P2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, const uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+/**
+ * Start an XXH64 hash with `seed`.
+ *
+ * @param state
+ * @param seed
+ */
+static void xxh64_reset(struct xxh64_state *const state, const uint64_t seed) {
+    memset(state, 0, sizeof(struct xxh64_state));
+    state->seed = seed;
+    state->v[0] = seed + XXH_P1 + XXH_P2;
+    state->v[1] = seed + XXH_P2;
+    state->v[2] = seed;
+    state->v[3] = seed - XXH_P1;
+}
+
+/**
+ * Add `len` bytes at `data` to an XXH64 hash. Whole 32-byte stripes go
+ * through four independent lanes, which the compiler can keep in registers
+ * and vectorize.
+ *
+ * @param state
+ * @param data
+ * @param len
+ */
+static void xxh64_update(struct xxh64_state *const state, const void *const data, size_t len) {
+    const unsigned char *p = data, *const end = p + len;
+    uint64_t v0, v1, v2, v3;
+
+    state->total += len;
+    if (state->memsize + len < 32) {
+        memcpy(state->mem + state->memsize, p, len);
+        state->memsize += len;
+        return;
+    }
+    if (state->memsize) {
+        memcpy(state->mem + state->memsize, p, 32 - state->memsize);
+        p += 32 - state->memsize;
+        state->v[0] = xxh_round(state->v[0], xxh_read64(state->mem));
+        state->v[1] = xxh_round(state->v[1], xxh_read64(state->mem + 8));
+        state->v[2] = xxh_round(state->v[2], xxh_read64(state->mem + 16));
+        state->v[3] = xxh_round(state->v[3], xxh_read64(state->mem + 24));
+        state->memsize = 0;
+    }
+    v0 = state->v[0];
+    v1 = state->v[1];
+    v2 = state->v[2];
+    v3 = state->v[3];
+    while (p + 32 <= end) {
+        v0 = xxh_round(v0, xxh_read64(p));
+        v1 = xxh_round(v1, xxh_read64(p + 8));
+        v2 = xxh_round(v2, xxh_read64(p + 16));
+        v3 = xxh_round(v3, xxh_read64(p + 24));
+        p += 32;
+    }
+    state->v[0] = v0;
+    state->v[1] = v1;
+    state->v[2] = v2;
+    state->v[3] = v3;
+    if (p < end) {
+        memcpy(state->mem, p, end - p);
+        state->memsize = end - p;
+    }
+}
+
+/**
+ * Return the XXH64 hash of everything added so far.
+ *
+ * @param state
+ * @return
+ */
+static uint64_t xxh64_digest(const struct xxh64_state *const state) {
+    const unsigned char *p = state->mem, *const end = p + state->memsize;
+    uint64_t h;
+
+    if (state->total >= 32) {
+        h = xxh_rotl(state->v[0], 1) + xxh_rotl(state->v[1], 7) +
+            xxh_rotl(state->v[2], 12) + xxh_rotl(state->v[3], 18);
+        h = xxh_merge(h, state->v[0]);
+        h = xxh_merge(h, state->v[1]);
+        h = xxh_merge(h, state->v[2]);
+        h = xxh_merge(h, state->v[3]);
+    } else {
+        h = state->seed + XXH_P5;
+    }
+    h += state->total;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)xxh_read32(p) * XXH_P1;
+        h = xxh_rotl(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (*p) * XXH_P5;
+        h = xxh_rotl(h, 11) * XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * Return the XXH64 hash of `len` bytes at `data`.
+ *
+ * @param data
+ * @param len
+ * @param seed
+ * @return
+ */
+uint64_t digest_buffer(const void *const data, const size_t len, const uint64_t seed) {
+    struct xxh64_state state;
+    xxh64_reset(&state, seed);
+    xxh64_update(&state, data, len);
+    return xxh64_digest(&state);
+}
+
+/**
+ * Set the number of threads hashing files for all watches. Only workers not
+ * started yet are affected.
+ *
+ * @param workers
+ */
+void set_digest_workers(const int workers) {
+    pthread_mutex_lock(&poolmux_);
+    maxworkers_ = workers > 0 ? workers : 1;
+    pthread_mutex_unlock(&poolmux_);
+}
+
+/**
+ * Whether the cached hash of a path can be trusted without hashing it again:
+ * it's still the same file, which was modified before it was hashed, and
+ * hasn't been since.
+ *
+ * @param entry
+ * @param sb
+ * @return
+ */
+static bool digest_is_fresh(const struct argusdigest_entry *const entry, const struct stat *const sb) {
+    long long mtime, hashed;
+    if (entry->dev != sb->st_dev ||
+        entry->ino != sb->st_ino ||
+        entry->mtime.tv_sec != sb->st_mtim.tv_sec ||
+        entry->mtime.tv_nsec != sb->st_mtim.tv_nsec ||
+        entry->size != sb->st_size) {
+        return false;
+    }
+    mtime = (long long)entry->mtime.tv_sec * 1000000000LL + entry->mtime.tv_nsec;
+    hashed = (long long)entry->hashed.tv_sec * 1000000000LL + entry->hashed.tv_nsec;
+    return hashed - mtime >= DIGEST_RACY_NS;
+}
+
+/**
+ * Hash the open file `fd` from its current offset. Returns false if it
+ * couldn't be read.
+ *
+ * @param fd
+ * @param hash
+ * @return
+ */
+bool digest_file(const int fd, uint64_t *const hash) {
+    struct xxh64_state state;
+    unsigned char *buf;
+    ssize_t len;
+
+    if ((buf = malloc(DIGEST_READ_SIZE)) == NULL) {
+#if DEBUG
+        perror("malloc");
+#endif
+        return false;
+    }
+    xxh64_reset(&state, 0);
+    while ((len = read(fd, buf, DIGEST_READ_SIZE)) != 0) {
+        if (len == EOF) {
+            if (errno == EINTR) {
+                continue;
+            }
+#if DEBUG
+            perror("read");
+#endif
+            free(buf);
+            return false;
+        }
+        xxh64_update(&state, buf, len);
+    }
+    free(buf);
+    *hash = xxh64_digest(&state);
+    return true;
+}
+
+/**
+ * Decide whether the content of the file of `job` changed since its path was
+ * last hashed, and remember its hash. Hashes are kept by path rather than by
+ * inode, so that a file replaced by renaming another one over it is compared
+ * with what was there before. Files that can't be hashed (e.g. deleted
+ * meanwhile) count as changed.
+ *
+ * @param job
+ */
+static void run_digest_job(struct argusdigest_job *const job) {
+    struct argusdigest *const table = job->table;
+    struct argusdigest_entry **entry, *last;
+    char fullpath[PATH_MAX + NAME_MAX + 1];
+    struct timespec hashed;
+    struct stat sb;
+    unsigned int bucket;
+    uint64_t key, hash;
+    bool closing;
+    int fd;
+
+    job->changed = true;
+    pthread_mutex_lock(&table->mux);
+    closing = table->closing;
+    pthread_mutex_unlock(&table->mux);
+    if (closing) {
+        return;
+    }
+
+    if (*job->file_name) {
+        FORMAT_PATH(fullpath, job->path_name, job->file_name);
+    } else {
+        snprintf(fullpath, sizeof(fullpath), "%s", job->path_name);
+    }
+    key = digest_buffer(fullpath, strlen(fullpath), 0);
+    bucket = key % DIGEST_BUCKETS;
+    if ((fd = open(fullpath, O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NOCTTY | O_NONBLOCK)) == EOF) {
+        return;
+    }
+    if (fstat(fd, &sb) == EOF ||
+        !S_ISREG(sb.st_mode)) {
+        close(fd);
+        return;
+    }
+
+    pthread_mutex_lock(&table->mux);
+    for (entry = &table->buckets[bucket]; *entry != NULL; entry = &(*entry)->next) {
+        if ((*entry)->key == key) {
+            break;
+        }
+    }
+    if (*entry != NULL &&
+        digest_is_fresh(*entry, &sb)) {
+        // Closed without being written to since it was last hashed.
+        job->changed = false;
+        pthread_mutex_unlock(&table->mux);
+        close(fd);
+        return;
+    }
+    pthread_mutex_unlock(&table->mux);
+
+    clock_gettime(CLOCK_REALTIME, &hashed);
+    if (!digest_file(fd, &hash)) {
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    pthread_mutex_lock(&table->mux);
+    for (entry = &table->buckets[bucket]; *entry != NULL; entry = &(*entry)->next) {
+        if ((*entry)->key == key) {
+            break;
+        }
+    }
+    if (*entry == NULL) {
+        if (table->size >= DIGEST_MAX_ENTRIES &&
+            table->buckets[bucket] != NULL) {
+            // Make room by forgetting the oldest file in the same bucket.
+            for (entry = &table->buckets[bucket]; (*entry)->next != NULL; entry = &(*entry)->next);
+            last = *entry;
+            *entry = NULL;
+            free(last);
+            --table->size;
+        }
+        if ((last = calloc(1, sizeof(struct argusdigest_entry))) == NULL) {
+#if DEBUG
+            perror("calloc");
+#endif
+            pthread_mutex_unlock(&table->mux);
+            return;
+        }
+        last->key = key;
+        last->next = table->buckets[bucket];
+        table->buckets[bucket] = last;
+        ++table->size;
+        entry = &table->buckets[bucket];
+    } else {
+        job->changed = (*entry)->hash != hash;
+    }
+    (*entry)->dev = sb.st_dev;
+    (*entry)->ino = sb.st_ino;
+    (*entry)->mtime = sb.st_mtim;
+    (*entry)->size = sb.st_size;
+    (*entry)->hashed = hashed;
+    (*entry)->hash = hash;
+    pthread_mutex_unlock(&table->mux);
+}
+
+/**
+ * Worker thread of the pool: hashes queued jobs and hands them back to the
+ * watch they came from.
+ *
+ * @param arg
+ * @return
+ */
+static void *digest_worker(void *arg) {
+    struct argusdigest_job *job;
+    struct argusdigest *table;
+    uint64_t value = 1;
+
+    for (;;) {
+        pthread_mutex_lock(&poolmux_);
+        while (queue_ == NULL) {
+            pthread_cond_wait(&poolcond_, &poolmux_);
+        }
+        job = queue_;
+        if ((queue_ = job->next) == NULL) {
+            queuetail_ = &queue_;
+        }
+        pthread_mutex_unlock(&poolmux_);
+
+        run_digest_job(job);
+
+        table = job->table;
+        pthread_mutex_lock(&table->mux);
+        job->done = true;
+        // Signalled before letting go of the table, which may be freed as
+        // soon as nothing is pending.
+        if (write(table->fd, &value, sizeof(value)) == EOF) {
+#if DEBUG
+            perror("write");
+#endif
+        }
+        if (--table->pending == 0) {
+            pthread_cond_broadcast(&table->idle);
+        }
+        pthread_mutex_unlock(&table->mux);
+    }
+    return NULL;
+}
+
+/**
+ * Create a table of content hashes for a watch, or NULL if `enabled` is not
+ * set, which turns content verification off.
+ *
+ * @param enabled
+ * @return
+ */
+struct argusdigest *create_digest_table(const bool enabled) {
+    struct argusdigest *table;
+    if (!enabled) {
+        return NULL;
+    }
+    if ((table = calloc(1, sizeof(struct argusdigest))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return NULL;
+    }
+    if ((table->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == EOF) {
+#if DEBUG
+        perror("eventfd");
+#endif
+        free(table);
+        return NULL;
+    }
+    pthread_mutex_init(&table->mux, NULL);
+    pthread_cond_init(&table->idle, NULL);
+    table->jobstail = &table->jobs;
+    return table;
+}
+
+/**
+ * Queue `awevent` to be logged once the content of its file is known to have
+ * changed, if content verification is on for `watch` and the event ends a
+ * write. Any other event on a file with a write still queued is queued
+ * behind it, so that e.g. its deletion isn't logged first. Returns false if
+ * the event should be logged straight away instead.
+ *
+ * @param watch
+ * @param awevent
+ * @param wd
+ * @return
+ */
+bool digest_event(struct arguswatch *const watch, const struct arguswatch_event *const awevent, const int wd) {
+    struct argusdigest *const table = watch->digest;
+    struct argusdigest_job *job;
+    pthread_t thread;
+    bool digest;
+
+    if (table == NULL ||
+        is_replaying(watch)) {
+        return false;
+    }
+    digest = !awevent->is_dir && (awevent->event_mask & AW_DIGEST_MASK);
+    if (!digest) {
+        // Only this thread adds or removes jobs, so the answer holds.
+        pthread_mutex_lock(&table->mux);
+        for (job = table->jobs; job != NULL; job = job->later) {
+            if (job->wd == wd &&
+                strcmp(job->file_name, awevent->file_name) == 0 &&
+                strcmp(job->path_name, awevent->path_name) == 0) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&table->mux);
+        if (job == NULL) {
+            return false;
+        }
+    }
+
+    if ((job = calloc(1, sizeof(struct argusdigest_job))) == NULL ||
+        (job->path_name = strdup(awevent->path_name)) == NULL ||
+        (job->file_name = strdup(awevent->file_name)) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        if (job != NULL) {
+            free(job->path_name);
+            free(job);
+        }
+        return false;
+    }
+    job->table = table;
+    job->wd = wd;
+    job->event_mask = awevent->event_mask;
+    job->is_dir = awevent->is_dir;
+    job->done = !digest;
+    job->changed = true;
+
+    pthread_mutex_lock(&table->mux);
+    *table->jobstail = job;
+    table->jobstail = &job->later;
+    if (digest) {
+        ++table->pending;
+    }
+    pthread_mutex_unlock(&table->mux);
+    if (!digest) {
+        return true;
+    }
+
+    pthread_mutex_lock(&poolmux_);
+    *queuetail_ = job;
+    queuetail_ = &job->next;
+    if (workers_ < maxworkers_) {
+        if (pthread_create(&thread, NULL, digest_worker, NULL) == 0) {
+            pthread_detach(thread);
+            ++workers_;
+        } else if (workers_ == 0) {
+#if DEBUG
+            perror("pthread_create");
+#endif
+        }
+    }
+    pthread_cond_signal(&poolcond_);
+    pthread_mutex_unlock(&poolmux_);
+    return true;
+}
+
+/**
+ * Log the queued events up to the first one whose file is still being
+ * hashed, in the order they came in, skipping writes that didn't change the
+ * content of their file.
+ *
+ * @param watch
+ * @param logfn
+ */
+void emit_digested_events(struct arguswatch *const watch, arguswatch_logfn logfn) {
+    struct argusdigest *const table = watch->digest;
+    struct argusdigest_job *job, *next, **tail;
+    uint64_t value;
+    int savederr = errno;
+
+    if (table == NULL) {
+        return;
+    }
+    // Nothing may have been signalled yet when draining.
+    if (read(table->fd, &value, sizeof(value)) == EOF &&
+        errno != EAGAIN) {
+#if DEBUG
+        perror("read");
+#endif
+    }
+    errno = savederr;
+    pthread_mutex_lock(&table->mux);
+    job = table->jobs;
+    for (tail = &job; *tail != NULL && (*tail)->done; tail = &(*tail)->later);
+    table->jobs = *tail;
+    *tail = NULL;
+    if (table->jobs == NULL) {
+        table->jobstail = &table->jobs;
+    }
+    pthread_mutex_unlock(&table->mux);
+
+    for (; job != NULL; job = next) {
+        next = job->later;
+        if (job->changed) {
+            struct arguswatch_event awevent = {
+                .watch = watch,
+                .event_mask = job->event_mask,
+                .path_name = job->path_name,
+                .file_name = job->file_name,
+                .is_dir = job->is_dir
+            };
+            coalesce_event(watch, &awevent, job->wd, logfn);
+        } else {
+            __atomic_add_fetch(&watch->unchanged_writes, 1, __ATOMIC_RELAXED);
+        }
+        free(job->path_name);
+        free(job->file_name);
+        free(job);
+    }
+}
+
+/**
+ * Wait for the jobs of `watch` still being hashed and log them. Jobs that
+ * haven't started are logged without being hashed.
+ *
+ * @param watch
+ * @param logfn
+ */
+void drain_digest_table(struct arguswatch *const watch, arguswatch_logfn logfn) {
+    struct argusdigest *const table = watch->digest;
+    if (table == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&table->mux);
+    table->closing = true;
+    while (table->pending > 0) {
+        pthread_cond_wait(&table->idle, &table->mux);
+    }
+    table->closing = false;
+    pthread_mutex_unlock(&table->mux);
+    emit_digested_events(watch, logfn);
+}
+
+/**
+ * Deallocate a table of content hashes. Its jobs have to be drained first.
+ *
+ * @param table
+ */
+void free_digest_table(struct argusdigest *const table) {
+    struct argusdigest_entry *entry, *next;
+    unsigned int bucket;
+
+    if (table == NULL) {
+        return;
+    }
+    for (bucket = 0; bucket < DIGEST_BUCKETS; ++bucket) {
+        for (entry = table->buckets[bucket]; entry != NULL; entry = next) {
+            next = entry->next;
+            free(entry);
+        }
+    }
+    if (close(table->fd) == EOF) {
+#if DEBUG
+        perror("close");
+#endif
+    }
+    pthread_cond_destroy(&table->idle);
+    pthread_mutex_destroy(&table->mux);
+    free(table);
+}
+
+/**
+ * Adds the writes a watch didn't log because they left the content of a file
+ * unchanged to `arg`.
+ *
+ * @param watch
+ * @param arg
+ */
+static void sum_unchanged_writes(struct arguswatch *watch, void *arg) {
+    *(unsigned long *)arg += __atomic_load_n(&watch->unchanged_writes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sum the writes not logged by the watches of `pid` because they left the
+ * content of a file unchanged.
+ *
+ * @param pid
+ * @param unchanged
+ */
+void get_digest_stats(const int pid, unsigned long *const unchanged) {
+    *unchanged = 0;
+    for_each_pid_watch(pid, sum_unchanged_writes, unchanged);
+}
@@ -0,0 +1,98 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_DIGEST__
+#define __ARGUS_DIGEST__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "argusutil.h"
+
+#ifndef DIGEST_BUCKETS
+#define DIGEST_BUCKETS 1024
+#endif
+
+#ifndef DIGEST_MAX_ENTRIES
+#define DIGEST_MAX_ENTRIES 16384
+#endif
+
+#ifndef DIGEST_WORKERS
+#define DIGEST_WORKERS 4
+#endif
+
+// Events that end a write to a file, and are only logged if its content
+// changed.
+#define AW_DIGEST_MASK (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct argusdigest_entry {
+    uint64_t key;                      // Hash of the path of the file.
+    dev_t dev;                         // Device and inode of the file.
+    ino_t ino;
+    struct timespec mtime;             // Modification time and size when hashed.
+    off_t size;
+    struct timespec hashed;            // Wall clock time it was hashed at.
+    uint64_t hash;                     // Hash of the content.
+    struct argusdigest_entry *next;    // Next entry in the same bucket.
+};
+
+struct argusdigest_job {
+    struct argusdigest *table;         // Table of the watch the event is for.
+    int wd;                            // Watch descriptor of the directory.
+    uint32_t event_mask;               // `inotify` event mask.
+    char *path_name, *file_name;       // Copies of the event paths.
+    bool is_dir;
+    bool done;                         // Whether it can be logged.
+    bool changed;                      // Whether the content changed, once hashed.
+    struct argusdigest_job *next;      // Next job in the pool queue.
+    struct argusdigest_job *later;     // Next job of the same watch, in event order.
+};
+
+struct argusdigest {
+    pthread_mutex_t mux;               // Guards everything below.
+    pthread_cond_t idle;               // Signalled when `pending` drops to 0.
+    struct argusdigest_entry *buckets[DIGEST_BUCKETS];
+    unsigned int size;                 // Cached hashes.
+    unsigned int pending;              // Jobs queued or being hashed.
+    bool closing;                      // Remaining jobs are logged without hashing.
+    struct argusdigest_job *jobs;      // Jobs not logged yet, in event order.
+    struct argusdigest_job **jobstail;
+    int fd;                            // `eventfd` signalled when jobs are done.
+};
+
+void set_digest_workers(int workers);
+uint64_t digest_buffer(const void *data, size_t len, uint64_t seed);
+bool digest_file(int fd, uint64_t *hash);
+struct argusdigest *create_digest_table(bool enabled);
+bool digest_event(struct arguswatch *watch, const struct arguswatch_event *awevent, int wd);
+void emit_digested_events(struct arguswatch *watch, arguswatch_logfn logfn);
+void drain_digest_table(struct arguswatch *watch, arguswatch_logfn logfn);
+void free_digest_table(struct argusdigest *table);
+void get_digest_stats(int pid, unsigned long *unchanged);
+
+#endif
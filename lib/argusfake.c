@@ -0,0 +1,278 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "argusbackend.h"
+#include "argusfake.h"
+#include "argusutil.h"
+
+// Events are injected by the caller instead of coming from the kernel, which
+// takes the kernel out of benchmarks of the rest of the event path.
+const struct argusbackend fake_backend = {
+    .name = "fake",
+    .init = init_fake_backend,
+    .add_watch = add_fake_watch,
+    .remove_watch = remove_fake_watch,
+    .read_batch = read_fake_batch,
+    .close = close_fake_backend
+};
+
+/**
+ * Queue the `inotify_event` records in `buf` on a running `fake` watch, to be
+ * read the same way `inotify` events are. Watch descriptors are handed out
+ * sequentially from 1, in the order the tree was walked. Returns 0, or -1 on
+ * error.
+ *
+ * @param watch
+ * @param buf
+ * @param len
+ * @return
+ */
+int inject_fake_events(struct arguswatch *const watch, const void *const buf, const size_t len) {
+    struct argusfake *const fake = watch->fake;
+    const struct inotify_event *event;
+    const uint64_t value = 1;
+    size_t off, size;
+    char *newbuf;
+
+    if (fake == NULL) {
+        errno = EINVAL;
+        return EOF;
+    }
+
+    pthread_mutex_lock(&fake->mux);
+    // Move what is left to the front before growing the buffer.
+    if (fake->head > 0) {
+        memmove(fake->buf, fake->buf + fake->head, fake->tail - fake->head);
+        fake->tail -= fake->head;
+        fake->head = 0;
+    }
+    if (fake->tail + len > fake->size) {
+        for (size = fake->size ? fake->size : IN_BUFFER_SIZE; size < fake->tail + len; size *= 2);
+        if ((newbuf = realloc(fake->buf, size)) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            pthread_mutex_unlock(&fake->mux);
+            return EOF;
+        }
+        fake->buf = newbuf;
+        fake->size = size;
+    }
+    memcpy(fake->buf + fake->tail, buf, len);
+    fake->tail += len;
+    for (off = 0; off < len; off += IN_EVENT_LEN + event->len) {
+        event = (const struct inotify_event *)((const char *)buf + off);
+        ++fake->injected;
+    }
+    pthread_mutex_unlock(&fake->mux);
+
+    if (write(watch->fd, &value, sizeof(uint64_t)) == EOF) {
+#if DEBUG
+        perror("write");
+#endif
+        return EOF;
+    }
+    return 0;
+}
+
+/**
+ * Set up an empty queue for `watch`, polled through an `eventfd`.
+ *
+ * @param watch
+ * @return
+ */
+static int init_fake_backend(struct arguswatch *const watch) {
+    struct argusfake *fake;
+    int fd;
+
+    if ((fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == EOF) {
+#if DEBUG
+        perror("eventfd");
+#endif
+        return EOF;
+    }
+    if ((fake = calloc(1, sizeof(struct argusfake))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        close(fd);
+        return EOF;
+    }
+    pthread_mutex_init(&fake->mux, NULL);
+    watch->fake = fake;
+    return fd;
+}
+
+/**
+ * Hand out a watch descriptor for `path`: the one it already has, like
+ * `inotify_add_watch` does, or the next one.
+ *
+ * @param watch
+ * @param path
+ * @param mask
+ * @return
+ */
+static int add_fake_watch(const struct arguswatch *const watch, const char *const path, const uint32_t mask) {
+    struct argusfake *const fake = watch->fake;
+    char **paths;
+    int i;
+
+    (void)mask;
+    pthread_mutex_lock(&fake->mux);
+    for (i = fake->pathc - 1; i >= 0; --i) {
+        if (fake->paths[i] != NULL &&
+            strcmp(fake->paths[i], path) == 0) {
+            pthread_mutex_unlock(&fake->mux);
+            return i + 1;
+        }
+    }
+    if ((paths = realloc(fake->paths, (fake->pathc + 1) * sizeof(char *))) == NULL ||
+        (paths[fake->pathc] = strdup(path)) == NULL) {
+#if DEBUG
+        perror("realloc");
+#endif
+        if (paths != NULL) {
+            fake->paths = paths;
+        }
+        pthread_mutex_unlock(&fake->mux);
+        errno = ENOMEM;
+        return EOF;
+    }
+    fake->paths = paths;
+    i = ++fake->pathc;
+    pthread_mutex_unlock(&fake->mux);
+    return i;
+}
+
+/**
+ * Forget the path of `wd`. Its descriptor is not handed out again.
+ *
+ * @param watch
+ * @param wd
+ * @return
+ */
+static int remove_fake_watch(const struct arguswatch *const watch, const int wd) {
+    struct argusfake *const fake = watch->fake;
+
+    pthread_mutex_lock(&fake->mux);
+    if (wd < 1 ||
+        wd > fake->pathc ||
+        fake->paths[wd - 1] == NULL) {
+        pthread_mutex_unlock(&fake->mux);
+        errno = EINVAL;
+        return EOF;
+    }
+    free(fake->paths[wd - 1]);
+    fake->paths[wd - 1] = NULL;
+    pthread_mutex_unlock(&fake->mux);
+    return 0;
+}
+
+/**
+ * Copy as many whole queued events as fit into `buf`. Like `read` on an
+ * `inotify` fd, fails with EAGAIN if there are none, and EINVAL if `buf` is
+ * too small for the next one.
+ *
+ * @param watch
+ * @param buf
+ * @param len
+ * @return
+ */
+static ssize_t read_fake_batch(const struct arguswatch *const watch, void *const buf, const size_t len) {
+    struct argusfake *const fake = watch->fake;
+    const struct inotify_event *event;
+    size_t off, evtlen;
+    uint64_t value;
+
+    pthread_mutex_lock(&fake->mux);
+    if (fake->head == fake->tail) {
+        // Nothing left; stop polling as readable until more is injected.
+        if (read(watch->fd, &value, sizeof(uint64_t)) == EOF &&
+            errno != EAGAIN) {
+#if DEBUG
+            perror("read");
+#endif
+        }
+        fake->head = fake->tail = 0;
+        pthread_mutex_unlock(&fake->mux);
+        errno = EAGAIN;
+        return EOF;
+    }
+    for (off = fake->head; off < fake->tail; off += evtlen) {
+        event = (const struct inotify_event *)(fake->buf + off);
+        evtlen = IN_EVENT_LEN + event->len;
+        if (off - fake->head + evtlen > len) {
+            break;
+        }
+    }
+    if (off == fake->head) {
+        pthread_mutex_unlock(&fake->mux);
+        errno = EINVAL;
+        return EOF;
+    }
+    memcpy(buf, fake->buf + fake->head, off - fake->head);
+    evtlen = off - fake->head;
+    fake->head = off;
+    pthread_mutex_unlock(&fake->mux);
+    return (ssize_t)evtlen;
+}
+
+/**
+ * Close the `eventfd` of `watch`, and drop the events still queued.
+ *
+ * @param watch
+ */
+static void close_fake_backend(struct arguswatch *const watch) {
+    struct argusfake *const fake = watch->fake;
+    int i;
+
+    if (watch->fd != EOF &&
+        close(watch->fd) == EOF) {
+#if DEBUG
+        perror("close");
+#endif
+    }
+    watch->fd = EOF;
+    if (fake == NULL) {
+        return;
+    }
+    for (i = 0; i < fake->pathc; ++i) {
+        free(fake->paths[i]);
+    }
+    free(fake->paths);
+    free(fake->buf);
+    pthread_mutex_destroy(&fake->mux);
+    free(fake);
+    watch->fake = NULL;
+}
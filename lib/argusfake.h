@@ -0,0 +1,55 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_FAKE__
+#define __ARGUS_FAKE__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "argusbackend.h"
+#include "argusutil.h"
+
+// Events injected into a watch, waiting to be read as if they came from
+// `inotify`.
+struct argusfake {
+    pthread_mutex_t mux;              // Guards everything below.
+    char *buf;                        // Queued `inotify_event` records.
+    size_t head, tail, size;          // Read and write offsets into `buf`, and its size.
+    char **paths;                     // Watched paths, by watch descriptor - 1.
+    int pathc;
+    unsigned long injected;           // Events injected so far.
+};
+
+extern const struct argusbackend fake_backend;
+
+int inject_fake_events(struct arguswatch *watch, const void *buf, size_t len);
+static int init_fake_backend(struct arguswatch *watch);
+static int add_fake_watch(const struct arguswatch *watch, const char *path, uint32_t mask);
+static int remove_fake_watch(const struct arguswatch *watch, int wd);
+static ssize_t read_fake_batch(const struct arguswatch *watch, void *buf, size_t len);
+static void close_fake_backend(struct arguswatch *watch);
+
+#endif
@@ -0,0 +1,449 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "argusbackend.h"
+#include "argusfanotify.h"
+#include "argusmatch.h"
+#include "argustree.h"
+#include "argusutil.h"
+
+// Order events merged into one are logged in.
+static const uint32_t event_order[] = {
+    IN_CREATE, IN_MOVED_TO, IN_OPEN, IN_ACCESS, IN_MODIFY, IN_ATTRIB, IN_CLOSE_WRITE, IN_CLOSE_NOWRITE,
+    IN_MOVED_FROM, IN_DELETE, IN_DELETE_SELF, IN_MOVE_SELF
+};
+
+// A mark on each filesystem the tree is on; there are no directory watches.
+const struct argusbackend fanotify_backend = {
+    .name = "fanotify",
+    .init = init_fanotify_watch,
+    .read_events = read_fanotify_events,
+    .close = close_fanotify_backend
+};
+
+/**
+ * Open descriptors of the root paths of `watch` to resolve the file handles
+ * in events with, and note how paths under them show up when resolved.
+ * Returns NULL if none of the roots could be opened.
+ *
+ * @param watch
+ * @return
+ */
+struct argusfanotify *open_fanotify_roots(const struct arguswatch *const watch) {
+    struct argusfanotify *fanotify;
+    struct argusfanotify_root *root;
+    char fdpath[32], resolved[PATH_MAX];
+    struct statfs sfs;
+    struct stat sb;
+    unsigned int i;
+    ssize_t len;
+
+    if ((fanotify = calloc(1, sizeof(struct argusfanotify))) == NULL ||
+        (fanotify->roots = calloc(watch->rootpathc ? watch->rootpathc : 1,
+            sizeof(struct argusfanotify_root))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        free(fanotify);
+        return NULL;
+    }
+    for (i = 0; i < watch->rootpathc; ++i) {
+        if (watch->rootpaths[i] == NULL) {
+            continue;
+        }
+        root = &fanotify->roots[fanotify->rootc];
+        root->path = watch->rootpaths[i];
+        // `open_by_handle_at` doesn't take `O_PATH` descriptors everywhere,
+        // so those are only used for roots that are files.
+        if ((root->fd = open(root->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW)) == EOF &&
+            (root->fd = open(root->path, O_PATH | O_CLOEXEC | O_NOFOLLOW)) == EOF) {
+#if DEBUG
+            fprintf(stderr, "open: %s: %s\n", root->path, strerror(errno));
+#endif
+            continue;
+        }
+        snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", root->fd);
+        if (fstatfs(root->fd, &sfs) == EOF ||
+            fstat(root->fd, &sb) == EOF ||
+            (len = readlink(fdpath, resolved, sizeof(resolved) - 1)) == EOF ||
+            (root->resolved = strndup(resolved, len)) == NULL) {
+#if DEBUG
+            fprintf(stderr, "%s: %s: %s\n", __func__, root->path, strerror(errno));
+#endif
+            close(root->fd);
+            continue;
+        }
+        root->fsid = sfs.f_fsid;
+        // The root directory of a filesystem resolves to "/", which every
+        // path under it starts with.
+        root->resolvedlen = strcmp(root->resolved, "/") == 0 ? 0 : len;
+        root->isdir = S_ISDIR(sb.st_mode);
+        ++fanotify->rootc;
+    }
+    if (fanotify->rootc == 0) {
+        free_fanotify_roots(fanotify);
+        return NULL;
+    }
+    return fanotify;
+}
+
+/**
+ * Create a `fanotify` group for `watch`, reporting events by directory file
+ * handle and name, and mark the whole filesystem of each of its root paths.
+ * Nothing is watched per directory, so there is no tree to walk or to keep in
+ * the cache; events are filtered down to the watched paths as they are read.
+ * Returns the `fanotify` fd, or -1 if the kernel (< 5.9), the filesystem or
+ * the privileges of the process don't allow it.
+ *
+ * @param watch
+ * @return
+ */
+int init_fanotify_watch(struct arguswatch *const watch) {
+#ifdef FAN_REPORT_DFID_NAME
+    const uint64_t mask = (watch->event_mask & AW_FANOTIFY_MASK) | FAN_ONDIR;
+    struct argusfanotify *fanotify;
+    unsigned int i, marked = 0;
+    int fd;
+
+    if ((fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK,
+        O_RDONLY | O_LARGEFILE)) == EOF) {
+#if DEBUG
+        perror("fanotify_init");
+#endif
+        return EOF;
+    }
+    if ((fanotify = open_fanotify_roots(watch)) == NULL) {
+        close(fd);
+        return EOF;
+    }
+    for (i = 0; i < fanotify->rootc; ++i) {
+        if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, fanotify->roots[i].path) == EOF) {
+#if DEBUG
+            fprintf(stderr, "fanotify_mark: %s: %s\n", fanotify->roots[i].path, strerror(errno));
+#endif
+            continue;
+        }
+        ++marked;
+    }
+    if (marked < fanotify->rootc) {
+        free_fanotify_roots(fanotify);
+        close(fd);
+        return EOF;
+    }
+    free_fanotify_roots(watch->fanotify);
+    watch->fanotify = fanotify;
+    return fd;
+#else
+    errno = ENOSYS;
+    return EOF;
+#endif
+}
+
+/**
+ * Returns whether `fd` is a `fanotify` group, e.g. one handed over by
+ * another process, rather than an `inotify` instance.
+ *
+ * @param fd
+ * @return
+ */
+bool is_fanotify_fd(const int fd) {
+    char fdpath[32], target[64];
+    ssize_t len;
+    snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", fd);
+    if ((len = readlink(fdpath, target, sizeof(target) - 1)) == EOF) {
+        return false;
+    }
+    target[len] = '\0';
+    return strcmp(target, "anon_inode:[fanotify]") == 0;
+}
+
+/**
+ * Resolve the directory `handle` on filesystem `fsid` of an event into
+ * `path`, as a path under one of the roots of `watch`, and return that root.
+ * For an event on a file watched as a root path, `path` is the directory
+ * of the root. Returns NULL if the directory is gone, or isn't under any
+ * root.
+ *
+ * @param watch
+ * @param fsid
+ * @param handle
+ * @param name
+ * @param path
+ * @param size
+ * @return
+ */
+static const struct argusfanotify_root *resolve_fanotify_dir(const struct arguswatch *const watch,
+    const fsid_t *const fsid, struct file_handle *const handle, const char *const name, char *const path,
+    const size_t size) {
+
+    struct argusfanotify *const fanotify = watch->fanotify;
+    const struct argusfanotify_root *root;
+    char fdpath[32], resolved[PATH_MAX];
+    const char *base;
+    unsigned int i;
+    ssize_t len = EOF;
+    int fd = EOF;
+
+    for (i = 0; i < fanotify->rootc; ++i) {
+        root = &fanotify->roots[i];
+        if (memcmp(&root->fsid, fsid, sizeof(fsid_t)) != 0) {
+            continue;
+        }
+        // Resolve each handle once, through the first root on its
+        // filesystem; every root shows paths the same way.
+        if (fd == EOF) {
+            if ((fd = open_by_handle_at(root->fd, handle, O_PATH | O_CLOEXEC)) == EOF) {
+                ++fanotify->unresolved;
+                return NULL;
+            }
+            snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", fd);
+            len = readlink(fdpath, resolved, sizeof(resolved) - 1);
+            close(fd);
+            if (len == EOF) {
+                ++fanotify->unresolved;
+                return NULL;
+            }
+            resolved[len] = '\0';
+        }
+
+        if (!root->isdir) {
+            // Only events on the file itself.
+            base = strrchr(root->path, '/');
+            if (base != NULL &&
+                strncmp(resolved, root->resolved, len) == 0 &&
+                root->resolved[len] == '/' &&
+                strcmp(root->resolved + len + 1, name) == 0) {
+                snprintf(path, size, "%.*s", (int)(base - root->path), root->path);
+                return root;
+            }
+            continue;
+        }
+        if (strncmp(resolved, root->resolved, root->resolvedlen) == 0 &&
+            (resolved[root->resolvedlen] == '/' || resolved[root->resolvedlen] == '\0') &&
+            (size_t)snprintf(path, size, "%s%s", root->path,
+                resolved + root->resolvedlen + (root->resolvedlen == 0 && len == 1)) < size) {
+            return root;
+        }
+    }
+    ++fanotify->outside;
+    return NULL;
+}
+
+/**
+ * Check the directory `path` under `root` against the depth and ignore
+ * patterns of `watch`, the way a traversal would have when deciding whether
+ * to watch it. `path` is modified while checking, but restored.
+ *
+ * @param watch
+ * @param root
+ * @param path
+ * @return
+ */
+static bool in_fanotify_subtree(const struct arguswatch *const watch, const struct argusfanotify_root *const root,
+    char *const path) {
+
+    const size_t rootlen = strlen(root->path);
+    int depth = 0, maxdepth = watch->max_depth;
+    bool ignored = false;
+    char *p;
+
+    if (!root->isdir) {
+        return true;
+    }
+    for (p = path + rootlen; *p; ++p) {
+        depth += *p == '/';
+    }
+    if (!(watch->flags & AW_RECURSIVE)) {
+        maxdepth = 1;
+    }
+    if (maxdepth &&
+        depth + 1 > maxdepth) {
+        return false;
+    }
+    if (watch->ignore == NULL) {
+        return true;
+    }
+    // An ignored directory leaves out its whole subtree.
+    for (p = path + rootlen; !ignored; ++p) {
+        if (*p == '/' || *p == '\0') {
+            const char c = *p;
+            *p = '\0';
+            ignored = match_path(watch->ignore, container_path(watch, path));
+            *p = c;
+            if (c == '\0') {
+                break;
+            }
+        }
+    }
+    return !ignored;
+}
+
+/**
+ * Read the available `fanotify` events of `watch`, and pass those under its
+ * paths on to `fn` as `inotify` events. Events caused by this process (e.g.
+ * hashing files) are left out.
+ *
+ * @param watch
+ * @param fn
+ * @param arg
+ */
+void read_fanotify_events(struct arguswatch *const watch, argusbackend_eventfn fn, void *arg) {
+#ifdef FAN_REPORT_DFID_NAME
+    char buf[FAN_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    char evtbuf[sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *const event = (struct inotify_event *)evtbuf;
+    char path[PATH_MAX], infobuf[sizeof(struct fanotify_event_info_fid) + MAX_HANDLE_SZ + NAME_MAX + 1]
+        __attribute__((aligned(__alignof__(struct fanotify_event_info_fid))));
+    const struct fanotify_event_info_fid *const info = (const struct fanotify_event_info_fid *)infobuf;
+    struct fanotify_event_metadata meta;
+    const struct argusfanotify_root *root;
+    struct file_handle *handle;
+    const char *name, *p;
+    const pid_t self = getpid();
+    size_t infolen;
+    unsigned int i;
+    ssize_t len;
+
+    if ((len = read(watch->fd, buf, sizeof(buf))) == EOF) {
+        if (errno != EAGAIN) {
+#if DEBUG
+            perror("read");
+#endif
+        }
+        return;
+    }
+
+    // Events are packed back to back without padding, so each one is copied
+    // out before it is looked at.
+    for (p = buf; buf + len - p >= (ssize_t)sizeof(meta); p += meta.event_len) {
+        memcpy(&meta, p, sizeof(meta));
+        if (meta.event_len < sizeof(meta) ||
+            meta.event_len > buf + len - p) {
+            return;
+        }
+        if (meta.vers != FANOTIFY_METADATA_VERSION) {
+#if DEBUG
+            fprintf(stderr, "fanotify: unexpected metadata version %d\n", meta.vers);
+#endif
+            return;
+        }
+        if (meta.mask & FAN_Q_OVERFLOW) {
+            // Events were lost, but there is no cache to rebuild.
+#if DEBUG
+            printf("fanotify: queue overflow\n");
+            fflush(stdout);
+#endif
+            continue;
+        }
+        infolen = meta.event_len - meta.metadata_len;
+        if (meta.pid == self ||
+            infolen < sizeof(struct fanotify_event_info_fid) + sizeof(struct file_handle) ||
+            infolen >= sizeof(infobuf)) {
+            continue;
+        }
+        memcpy(infobuf, p + meta.metadata_len, infolen);
+        infobuf[infolen] = '\0';
+        handle = (struct file_handle *)info->handle;
+        if ((info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME &&
+             info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID) ||
+            sizeof(struct fanotify_event_info_fid) + sizeof(struct file_handle) + handle->handle_bytes > infolen) {
+            continue;
+        }
+        name = info->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME ?
+            (const char *)handle->f_handle + handle->handle_bytes : "";
+        // Events on a directory itself name it ".".
+        if (strcmp(name, ".") == 0) {
+            name = "";
+        }
+
+        if ((root = resolve_fanotify_dir(watch, (const fsid_t *)&info->fsid, handle, name, path,
+            sizeof(path))) == NULL ||
+            !in_fanotify_subtree(watch, root, path)) {
+            continue;
+        }
+
+        // The kernel merges events on the same file that are still queued,
+        // so they are split back up in the order they would have happened
+        // in. The bits are the same as `inotify`'s, FAN_ONDIR included.
+        event->wd = 0;
+        event->cookie = 0;
+        event->len = *name ? strlen(name) + 1 : 0;
+        memcpy(event->name, name, event->len);
+        for (i = 0; i < sizeof(event_order) / sizeof(event_order[0]); ++i) {
+            if (meta.mask & event_order[i]) {
+                event->mask = event_order[i] | (meta.mask & IN_ISDIR);
+                (*fn)(watch, event, path, arg);
+            }
+        }
+    }
+#endif
+}
+
+/**
+ * Close and deallocate the root descriptors of a `fanotify` watch.
+ *
+ * @param fanotify
+ */
+void free_fanotify_roots(struct argusfanotify *const fanotify) {
+    unsigned int i;
+    if (fanotify == NULL) {
+        return;
+    }
+    for (i = 0; i < fanotify->rootc; ++i) {
+        close(fanotify->roots[i].fd);
+        free(fanotify->roots[i].resolved);
+    }
+    free(fanotify->roots);
+    free(fanotify);
+}
+
+/**
+ * Close the `fanotify` group of `watch`, along with its root descriptors.
+ *
+ * @param watch
+ */
+static void close_fanotify_backend(struct arguswatch *const watch) {
+    if (watch->fd != EOF &&
+        close(watch->fd) == EOF) {
+#if DEBUG
+        perror("close");
+#endif
+    }
+    watch->fd = EOF;
+    free_fanotify_roots(watch->fanotify);
+    watch->fanotify = NULL;
+}
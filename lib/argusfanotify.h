@@ -0,0 +1,79 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_FANOTIFY__
+#define __ARGUS_FANOTIFY__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/inotify.h>
+#include <sys/statfs.h>
+
+#include "argusbackend.h"
+#include "argusutil.h"
+
+struct file_handle;
+
+// Events `fanotify` reports the same way `inotify` does (and with the same
+// bits); the rest of a watch's mask has no `fanotify` equivalent.
+#define AW_FANOTIFY_MASK (IN_ACCESS | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CLOSE_NOWRITE | IN_OPEN | \
+    IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+#ifndef FAN_BUFFER_SIZE
+#define FAN_BUFFER_SIZE 65536
+#endif
+
+// Root path of a watch, and how to resolve the directories events under it
+// name.
+struct argusfanotify_root {
+    const char *path;                 // Root path of the watch.
+    int fd;                           // Descriptor of the root, to resolve file handles with.
+    fsid_t fsid;                      // Filesystem the root is on.
+    char *resolved;                   // The root, as the kernel shows paths resolved through `fd`.
+    size_t resolvedlen;
+    bool isdir;                       // Directory, rather than a single file.
+};
+
+// Filesystem marks of a watch.
+struct argusfanotify {
+    struct argusfanotify_root *roots;
+    unsigned int rootc;
+    unsigned long outside;            // Events on the filesystem, but outside of the watched paths.
+    unsigned long unresolved;         // Events whose directory was gone by the time they were read.
+};
+
+extern const struct argusbackend fanotify_backend;
+
+int init_fanotify_watch(struct arguswatch *watch);
+struct argusfanotify *open_fanotify_roots(const struct arguswatch *watch);
+bool is_fanotify_fd(int fd);
+static const struct argusfanotify_root *resolve_fanotify_dir(const struct arguswatch *watch,
+    const fsid_t *fsid, struct file_handle *handle, const char *name, char *path, size_t size);
+static bool in_fanotify_subtree(const struct arguswatch *watch, const struct argusfanotify_root *root,
+    char *path);
+void read_fanotify_events(struct arguswatch *watch, argusbackend_eventfn fn, void *arg);
+void free_fanotify_roots(struct argusfanotify *fanotify);
+static void close_fanotify_backend(struct arguswatch *watch);
+
+#endif
@@ -0,0 +1,346 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "argusbackend.h"
+#include "argusbudget.h"
+#include "arguscache.h"
+#include "argusfanotify.h"
+#include "argushandoff.h"
+#include "argusutil.h"
+
+/**
+ * Writes all `len` bytes of `buf` to `sock`, retrying short writes and
+ * interrupted calls. Returns false on error.
+ *
+ * @param sock
+ * @param buf
+ * @param len
+ * @return
+ */
+static bool write_all(const int sock, const void *buf, size_t len) {
+    const char *p = buf;
+    ssize_t n;
+    while (len > 0) {
+        if ((n = write(sock, p, len)) == EOF) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * Reads exactly `len` bytes from `sock` into `buf`. Returns false on error,
+ * or if the other end closes the socket first.
+ *
+ * @param sock
+ * @param buf
+ * @param len
+ * @return
+ */
+static bool read_all(const int sock, void *buf, size_t len) {
+    char *p = buf;
+    ssize_t n;
+    while (len > 0) {
+        if ((n = read(sock, p, len)) == EOF) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            errno = EPIPE;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * Return the cache slot of the watch `pid`/`sid` if it was detached (see
+ * `detach_inotify_watchers`) with its `inotify` instance still open, or -1.
+ *
+ * @param pid
+ * @param sid
+ * @return
+ */
+int find_detached_watch(const int pid, const int sid) {
+    int slot = find_cached_slot(pid, sid);
+    struct arguswatch *watch = cached_watch(slot);
+    if (watch == NULL ||
+        watch->fd == EOF ||
+        watch->processevtfd != EOF) {
+        return -1;
+    }
+    return slot;
+}
+
+/**
+ * Hand the `inotify` instance of the detached watch `pid`/`sid` (see
+ * `detach_inotify_watchers`) over to another process on the Unix socket
+ * `sock`. The fd is passed with `SCM_RIGHTS`, so the kernel queue, and the
+ * events waiting in it, carry on in the other process. The wd -> path cache
+ * is sent along with it, so the tree doesn't have to be walked again. Once
+ * sent, this process lets go of the instance. Returns 0, or -1 on error.
+ *
+ * @param sock
+ * @param pid
+ * @param sid
+ * @return
+ */
+int send_watch_handoff(const int sock, const int pid, const int sid) {
+    struct arguswatch *watch;
+    struct argushandoff_header header;
+    struct msghdr msg = {0};
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    int slot, i;
+    uint32_t len;
+
+    if ((slot = find_detached_watch(pid, sid)) == -1) {
+        errno = ENOENT;
+        return EOF;
+    }
+    watch = cached_watch(slot);
+
+    header = (struct argushandoff_header){
+        .magic = AWH_MAGIC,
+        .pid = pid,
+        .sid = sid,
+        .depth_cap = watch->depth_cap,
+        .backend = watch->backend,
+        // The index of a polled tree lives in memory, and is rebuilt by the
+        // other process.
+        .pathc = watch->backend == AW_BACKEND_POLL ? 0 : watch->pathc
+    };
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &watch->fd, sizeof(int));
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(header)) {
+#if DEBUG
+        perror("sendmsg");
+#endif
+        return EOF;
+    }
+    for (i = 0; i < header.pathc; ++i) {
+        len = strlen(watch->paths[i]);
+        if (!write_all(sock, &watch->wd[i], sizeof(int32_t)) ||
+            !write_all(sock, &len, sizeof(len)) ||
+            !write_all(sock, watch->paths[i], len)) {
+#if DEBUG
+            perror("write");
+#endif
+            return EOF;
+        }
+    }
+
+    // The other process holds the instance now.
+    (*watch_backend(watch)->close)(watch);
+    clear_watch(&watch);
+    return 0;
+}
+
+/**
+ * Take the `inotify` instance of the detached watch `pid`/`sid` back into
+ * `handoff` within this process, e.g. after handing it over failed, so a
+ * watcher restarted with it carries on where the detached one stopped.
+ * Polled watches keep nothing worth carrying on with, and are indexed again.
+ * Returns 0, or -1 if there is no such watch.
+ *
+ * @param pid
+ * @param sid
+ * @param handoff
+ * @return
+ */
+int take_watch_handoff(const int pid, const int sid, struct arguswatch_handoff *const handoff) {
+    struct arguswatch *watch;
+    int slot;
+
+    if ((slot = find_detached_watch(pid, sid)) == -1) {
+        errno = ENOENT;
+        return EOF;
+    }
+    watch = cached_watch(slot);
+
+    memset(handoff, 0, sizeof(struct arguswatch_handoff));
+    handoff->pid = pid;
+    handoff->sid = sid;
+    handoff->backend = watch->backend;
+    handoff->fd = EOF;
+    if (watch->backend == AW_BACKEND_POLL) {
+        (*watch_backend(watch)->close)(watch);
+        clear_watch(&watch);
+        return 0;
+    }
+    handoff->fd = watch->fd;
+    handoff->depth_cap = watch->depth_cap;
+    handoff->pathc = watch->pathc;
+    handoff->wd = watch->wd;
+    handoff->paths = watch->paths;
+
+    // The watcher adopting the instance owns these now, and counts it again.
+    if (watch->fanotify != NULL) {
+        free_fanotify_roots(watch->fanotify);
+        watch->fanotify = NULL;
+    } else {
+        release_instance();
+    }
+    watch->fd = EOF;
+    watch->wd = NULL;
+    watch->paths = NULL;
+    watch->pathc = 0;
+    update_watch_usage(watch);
+    return 0;
+}
+
+/**
+ * Receive an `inotify` instance handed over by `send_watch_handoff` into
+ * `handoff`. Returns 0, 1 once the other process has nothing more to send,
+ * or -1 on error.
+ *
+ * @param sock
+ * @param handoff
+ * @return
+ */
+int recv_watch_handoff(const int sock, struct arguswatch_handoff *const handoff) {
+    struct argushandoff_header header;
+    struct msghdr msg = {0};
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int))];
+    ssize_t n;
+    uint32_t i, len;
+
+    memset(handoff, 0, sizeof(struct arguswatch_handoff));
+    handoff->fd = EOF;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) <= 0) {
+        return n == 0 ? 1 : EOF;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&handoff->fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    // The fd arrives with the first byte; the rest of the header may not.
+    if (!read_all(sock, (char *)&header + n, sizeof(header) - n) ||
+        header.magic != AWH_MAGIC ||
+        handoff->fd == EOF) {
+        errno = EPROTO;
+        goto err;
+    }
+    handoff->pid = header.pid;
+    handoff->sid = header.sid;
+    handoff->depth_cap = header.depth_cap;
+    handoff->backend = header.backend;
+
+    if ((handoff->wd = calloc(header.pathc ? header.pathc : 1, sizeof(int))) == NULL ||
+        (handoff->paths = calloc(header.pathc ? header.pathc : 1, sizeof(char *))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        goto err;
+    }
+    for (i = 0; i < header.pathc; ++i) {
+        if (!read_all(sock, &handoff->wd[i], sizeof(int32_t)) ||
+            !read_all(sock, &len, sizeof(len)) ||
+            len > PATH_MAX ||
+            (handoff->paths[i] = calloc(len + 1, sizeof(char))) == NULL) {
+#if DEBUG
+            perror("read");
+#endif
+            goto err;
+        }
+        // Count the path as soon as it's allocated, so it's freed along with
+        // the rest if the read fails.
+        ++handoff->pathc;
+        if (!read_all(sock, handoff->paths[i], len)) {
+#if DEBUG
+            perror("read");
+#endif
+            goto err;
+        }
+    }
+    return 0;
+
+err:
+    free_watch_handoff(handoff);
+    return EOF;
+}
+
+/**
+ * Release whatever of `handoff` wasn't taken over by a watcher.
+ *
+ * @param handoff
+ */
+void free_watch_handoff(struct arguswatch_handoff *const handoff) {
+    unsigned int i;
+    if (handoff->fd != EOF &&
+        close(handoff->fd) == EOF) {
+#if DEBUG
+        perror("close");
+#endif
+    }
+    handoff->fd = EOF;
+    for (i = 0; i < handoff->pathc; ++i) {
+        free(handoff->paths[i]);
+    }
+    free(handoff->paths);
+    free(handoff->wd);
+    handoff->paths = NULL;
+    handoff->wd = NULL;
+    handoff->pathc = 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_HANDOFF__
+#define __ARGUS_HANDOFF__
+
+#include <stdint.h>
+
+#include "argusutil.h"
+
+#define AWH_MAGIC 0x32485741 // "AWH2"
+
+// Header of a watch handed over to another process. The `inotify` fd is
+// attached to it as ancillary data, and it is followed by `pathc` entries of
+// a 32-bit wd and a 32-bit length followed by the path. Polled watches have
+// no kernel state to carry on with, so they are sent without any entries.
+struct argushandoff_header {
+    uint32_t magic;
+    int32_t pid, sid;
+    int32_t depth_cap;
+    int32_t backend;
+    uint32_t pathc;
+};
+
+int find_detached_watch(int pid, int sid);
+int send_watch_handoff(int sock, int pid, int sid);
+int take_watch_handoff(int pid, int sid, struct arguswatch_handoff *handoff);
+int recv_watch_handoff(int sock, struct arguswatch_handoff *handoff);
+void free_watch_handoff(struct arguswatch_handoff *handoff);
+
+#endif
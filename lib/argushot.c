@@ -0,0 +1,426 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#include "argushot.h"
+#include "argusbackend.h"
+#include "arguscache.h"
+#include "argusrecord.h"
+#include "argustree.h"
+#include "argusutil.h"
+
+// Guards the published `hot_paths` of every watch. The trackers themselves
+// are only ever touched by their watcher thread.
+static pthread_mutex_t publishmux_ = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Publish the paths of the directories `watch` currently has downgraded, as
+ * seen from inside the container, for `list_downgraded_paths` to read from
+ * other threads. Called by the watcher thread whenever the set changes.
+ *
+ * @param watch
+ */
+static void publish_hot_paths(struct arguswatch *const watch) {
+    struct argushot_entry *entry;
+    char **paths = NULL, **old;
+    unsigned int pathc = 0, oldc, bucket, i;
+
+    if (watch->hot != NULL &&
+        watch->hot->downgraded &&
+        (paths = calloc(watch->hot->downgraded, sizeof(char *))) != NULL) {
+        for (bucket = 0; bucket < HOT_BUCKETS; ++bucket) {
+            for (entry = watch->hot->buckets[bucket]; entry != NULL; entry = entry->next) {
+                if (entry->until &&
+                    entry->path != NULL &&
+                    pathc < watch->hot->downgraded &&
+                    (paths[pathc] = strdup(container_path(watch, entry->path))) != NULL) {
+                    ++pathc;
+                }
+            }
+        }
+    }
+
+    pthread_mutex_lock(&publishmux_);
+    old = watch->hot_paths;
+    oldc = watch->hot_pathc;
+    watch->hot_paths = paths;
+    watch->hot_pathc = pathc;
+    pthread_mutex_unlock(&publishmux_);
+
+    for (i = 0; i < oldc; ++i) {
+        free(old[i]);
+    }
+    free(old);
+}
+
+/**
+ * Re-issue `inotify_add_watch` for `path` with `mask`. Without IN_MASK_ADD
+ * this replaces the mask of the existing watch, keeping its descriptor.
+ *
+ * @param watch
+ * @param path
+ * @param mask
+ * @return
+ */
+static bool rewatch(const struct arguswatch *const watch, const char *const path, const uint32_t mask) {
+    if (is_replaying(watch)) {
+        return true;
+    }
+    if (add_backend_watch(watch, path, mask) == EOF) {
+#if DEBUG
+        fprintf(stderr, "inotify_add_watch: %s: %s\n", path, strerror(errno));
+#endif
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Create a tracker that downgrades directories seeing more than `threshold`
+ * AW_HOT_MASK events per second for `cooldown` milliseconds. Returns NULL if
+ * `threshold` is 0, or the watch doesn't ask for any of those events.
+ *
+ * @param threshold
+ * @param cooldown
+ * @return
+ */
+struct argushot *create_hot_tracker(const unsigned int threshold, const int cooldown) {
+    struct argushot *hot;
+    if (threshold == 0) {
+        return NULL;
+    }
+    if ((hot = calloc(1, sizeof(struct argushot))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return NULL;
+    }
+    hot->threshold = threshold;
+    hot->cooldown = cooldown > 0 ? cooldown : 1;
+    return hot;
+}
+
+/**
+ * Apply a new `threshold` and `cooldown` to the tracker of `watch`, creating
+ * it if the watch had none. Directories already downgraded stay downgraded.
+ * If `threshold` is 0, the tracker is dropped and the full mask is put back
+ * on those directories.
+ *
+ * @param watch
+ * @param threshold
+ * @param cooldown
+ */
+void configure_hot_tracker(struct arguswatch *const watch, const unsigned int threshold, const int cooldown) {
+    struct argushot_entry *entry;
+    unsigned int bucket;
+    const char *path;
+
+    if (watch->hot == NULL) {
+        watch->hot = create_hot_tracker(threshold, cooldown);
+        return;
+    }
+    if (threshold) {
+        watch->hot->threshold = threshold;
+        watch->hot->cooldown = cooldown > 0 ? cooldown : 1;
+        return;
+    }
+    for (bucket = 0; bucket < HOT_BUCKETS && watch->hot->downgraded; ++bucket) {
+        for (entry = watch->hot->buckets[bucket]; entry != NULL; entry = entry->next) {
+            if (entry->until &&
+                *(path = wd_to_path_name(watch, entry->wd))) {
+                rewatch(watch, path, watch_mask_for_path(watch, path));
+            }
+        }
+    }
+    drop_hot_tracker(watch);
+}
+
+/**
+ * Returns whether the directory watched by `wd` is currently downgraded.
+ *
+ * @param watch
+ * @param wd
+ * @return
+ */
+bool is_hot_watch(const struct arguswatch *const watch, const int wd) {
+    const struct argushot_entry *entry;
+    if (watch->hot == NULL ||
+        !watch->hot->downgraded) {
+        return false;
+    }
+    for (entry = watch->hot->buckets[(unsigned int)wd % HOT_BUCKETS]; entry != NULL; entry = entry->next) {
+        if (entry->wd == wd) {
+            return entry->until != 0;
+        }
+    }
+    return false;
+}
+
+/**
+ * Count an event towards the rate of its watch descriptor, and downgrade the
+ * directory to a mask without AW_HOT_MASK bits once the rate goes over the
+ * threshold.
+ *
+ * @param watch
+ * @param event
+ */
+void track_hot_event(struct arguswatch *const watch, const struct inotify_event *const event) {
+    struct argushot *const hot = watch->hot;
+    struct argushot_entry *entry;
+    const char *path;
+    unsigned int bucket;
+    long long now;
+
+    if (hot == NULL ||
+        !(event->mask & AW_HOT_MASK)) {
+        return;
+    }
+
+    bucket = (unsigned int)event->wd % HOT_BUCKETS;
+    for (entry = hot->buckets[bucket]; entry != NULL; entry = entry->next) {
+        if (entry->wd == event->wd) {
+            break;
+        }
+    }
+    if (entry == NULL) {
+        if ((entry = calloc(1, sizeof(struct argushot_entry))) == NULL) {
+#if DEBUG
+            perror("calloc");
+#endif
+            return;
+        }
+        entry->wd = event->wd;
+        entry->next = hot->buckets[bucket];
+        hot->buckets[bucket] = entry;
+    }
+
+    now = monotonic_ms();
+    if (now - entry->window >= 1000) {
+        entry->window = now;
+        entry->count = 0;
+    }
+    // A downgraded directory can go over the threshold again if a
+    // traversal put the full mask back; downgrade it again.
+    if (++entry->count <= hot->threshold) {
+        return;
+    }
+    if (!*(path = wd_to_path_name(watch, event->wd)) ||
+        !rewatch(watch, path, watch_mask_for_path(watch, path) & ~AW_HOT_MASK)) {
+        return;
+    }
+#if DEBUG
+    printf("downgraded hot directory: %s (wd = %d)\n", path, event->wd);
+    fflush(stdout);
+#endif
+    if (!entry->until) {
+        ++hot->downgraded;
+    }
+    free(entry->path);
+    entry->path = strdup(path);
+    entry->until = now + hot->cooldown;
+    entry->count = 0;
+    publish_hot_paths(watch);
+}
+
+/**
+ * Put the full mask back on directories whose cool-down has passed. Returns
+ * the number of milliseconds until the next one is due, or -1 if none are
+ * downgraded, to be used as the `epoll` timeout.
+ *
+ * @param watch
+ * @return
+ */
+int restore_cooled_watches(struct arguswatch *const watch) {
+    struct argushot *const hot = watch->hot;
+    struct argushot_entry *entry;
+    long long now, next = -1;
+    unsigned int bucket, restored = 0;
+    const char *path;
+
+    if (hot == NULL ||
+        !hot->downgraded) {
+        return -1;
+    }
+
+    now = monotonic_ms();
+    for (bucket = 0; bucket < HOT_BUCKETS; ++bucket) {
+        for (entry = hot->buckets[bucket]; entry != NULL; entry = entry->next) {
+            if (!entry->until) {
+                continue;
+            }
+            if (entry->until > now) {
+                if (next == -1 ||
+                    entry->until - now < next) {
+                    next = entry->until - now;
+                }
+                continue;
+            }
+            if (*(path = wd_to_path_name(watch, entry->wd))) {
+                rewatch(watch, path, watch_mask_for_path(watch, path));
+            }
+#if DEBUG
+            printf("restored directory: %s (wd = %d)\n", entry->path, entry->wd);
+            fflush(stdout);
+#endif
+            entry->until = 0;
+            entry->count = 0;
+            free(entry->path);
+            entry->path = NULL;
+            --hot->downgraded;
+            ++restored;
+        }
+    }
+    if (restored) {
+        publish_hot_paths(watch);
+    }
+    return (int)next;
+}
+
+/**
+ * Forget about a watch descriptor that was removed (IN_IGNORED).
+ *
+ * @param watch
+ * @param wd
+ */
+void forget_hot_watch(struct arguswatch *const watch, const int wd) {
+    struct argushot *const hot = watch->hot;
+    struct argushot_entry **prev, *entry;
+    bool downgraded;
+
+    if (hot == NULL) {
+        return;
+    }
+    for (prev = &hot->buckets[(unsigned int)wd % HOT_BUCKETS]; (entry = *prev) != NULL; prev = &entry->next) {
+        if (entry->wd == wd) {
+            *prev = entry->next;
+            if ((downgraded = entry->until != 0)) {
+                --hot->downgraded;
+            }
+            free(entry->path);
+            free(entry);
+            if (downgraded) {
+                publish_hot_paths(watch);
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * Deallocate all entries of `hot`.
+ *
+ * @param hot
+ */
+static void clear_hot_entries(struct argushot *const hot) {
+    struct argushot_entry *entry, *next;
+    unsigned int bucket;
+
+    for (bucket = 0; bucket < HOT_BUCKETS; ++bucket) {
+        for (entry = hot->buckets[bucket]; entry != NULL; entry = next) {
+            next = entry->next;
+            free(entry->path);
+            free(entry);
+        }
+        hot->buckets[bucket] = NULL;
+    }
+    hot->downgraded = 0;
+}
+
+/**
+ * Forget about all watch descriptors, when the `inotify` instance is
+ * recreated with the full mask on every directory.
+ *
+ * @param watch
+ */
+void reset_hot_tracker(struct arguswatch *const watch) {
+    if (watch->hot != NULL) {
+        clear_hot_entries(watch->hot);
+        publish_hot_paths(watch);
+    }
+}
+
+/**
+ * Deallocate a hot directory tracker.
+ *
+ * @param hot
+ */
+void free_hot_tracker(struct argushot *const hot) {
+    if (hot == NULL) {
+        return;
+    }
+    clear_hot_entries(hot);
+    free(hot);
+}
+
+/**
+ * Deallocate the tracker of `watch`, and withdraw the paths it published.
+ *
+ * @param watch
+ */
+void drop_hot_tracker(struct arguswatch *const watch) {
+    free_hot_tracker(watch->hot);
+    watch->hot = NULL;
+    publish_hot_paths(watch);
+}
+
+/**
+ * Passes the downgraded directories a watch last published to the
+ * `argushot_pathfn` and argument in `arg`.
+ *
+ * @param watch
+ * @param arg
+ */
+static void list_watch_downgraded_paths(struct arguswatch *watch, void *arg) {
+    argushot_pathfn fn = *(argushot_pathfn *)((void **)arg)[0];
+    void *fnarg = ((void **)arg)[1];
+    unsigned int i;
+
+    pthread_mutex_lock(&publishmux_);
+    for (i = 0; i < watch->hot_pathc; ++i) {
+        (*fn)(watch->hot_paths[i], fnarg);
+    }
+    pthread_mutex_unlock(&publishmux_);
+}
+
+/**
+ * Call `fn` with the path of every directory currently downgraded by any
+ * watch of `pid`.
+ *
+ * @param pid
+ * @param fn
+ * @param arg
+ */
+void list_downgraded_paths(const int pid, argushot_pathfn fn, void *arg) {
+    void *args[2] = {&fn, arg};
+    for_each_pid_watch(pid, list_watch_downgraded_paths, args);
+}
@@ -0,0 +1,70 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_HOT__
+#define __ARGUS_HOT__
+
+#include <stdbool.h>
+#include <sys/inotify.h>
+
+#include "argusutil.h"
+
+#ifndef HOT_BUCKETS
+#define HOT_BUCKETS 64
+#endif
+
+// Events that make a directory hot, and are dropped from its mask while it
+// is downgraded. They carry no information needed to maintain the tree.
+#define AW_HOT_MASK (IN_ACCESS | IN_OPEN | IN_CLOSE_NOWRITE)
+
+struct argushot_entry {
+    int wd;                       // Watch descriptor.
+    unsigned int count;           // Hot events in the current one-second window.
+    long long window;             // Monotonic time (ms) the window started.
+    long long until;              // Monotonic time (ms) the full mask is restored (0 if not downgraded).
+    char *path;                   // Path of the downgraded directory.
+    struct argushot_entry *next;  // Next entry in the same bucket.
+};
+
+struct argushot {
+    struct argushot_entry *buckets[HOT_BUCKETS];
+    unsigned int threshold;       // Hot events per second before a directory is downgraded.
+    int cooldown;                 // Time (ms) a directory stays downgraded.
+    unsigned int downgraded;      // Directories currently downgraded.
+};
+
+typedef void (*argushot_pathfn)(const char *path, void *arg);
+
+struct argushot *create_hot_tracker(unsigned int threshold, int cooldown);
+void configure_hot_tracker(struct arguswatch *watch, unsigned int threshold, int cooldown);
+bool is_hot_watch(const struct arguswatch *watch, int wd);
+void track_hot_event(struct arguswatch *watch, const struct inotify_event *event);
+int restore_cooled_watches(struct arguswatch *watch);
+void forget_hot_watch(struct arguswatch *watch, int wd);
+void reset_hot_tracker(struct arguswatch *watch);
+void free_hot_tracker(struct argushot *hot);
+void drop_hot_tracker(struct arguswatch *watch);
+void list_downgraded_paths(int pid, argushot_pathfn fn, void *arg);
+
+#endif
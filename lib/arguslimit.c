@@ -0,0 +1,231 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#include "arguslimit.h"
+#include "argusutil.h"
+
+/**
+ * Create a token bucket allowing `rate` events per second on average, and
+ * bursts of up to `burst` events (`rate` if 0). Returns NULL if `rate` is 0,
+ * which turns rate limiting off. The caller holds the only reference.
+ *
+ * @param rate
+ * @param burst
+ * @return
+ */
+struct arguslimit *create_rate_limit(const double rate, const double burst) {
+    struct arguslimit *limit;
+    if (rate <= 0) {
+        return NULL;
+    }
+    if ((limit = calloc(1, sizeof(struct arguslimit))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return NULL;
+    }
+    limit->rate = rate;
+    limit->burst = burst > 0 ? burst : rate;
+    limit->tokens = limit->burst;
+    limit->last = monotonic_us();
+    limit->refs = 1;
+    pthread_mutex_init(&limit->mux, NULL);
+    return limit;
+}
+
+/**
+ * Returns whether `limit` is what `create_rate_limit` would make of `rate`
+ * and `burst`, so a watch being updated can keep it, and the tokens in it.
+ *
+ * @param limit
+ * @param rate
+ * @param burst
+ * @return
+ */
+bool same_rate_limit(const struct arguslimit *const limit, const double rate, const double burst) {
+    if (rate <= 0) {
+        return limit == NULL;
+    }
+    return limit != NULL &&
+        limit->rate == rate &&
+        limit->burst == (burst > 0 ? burst : rate);
+}
+
+/**
+ * Take another reference to `limit`, for sharing it with another watcher.
+ *
+ * @param limit
+ * @return
+ */
+struct arguslimit *acquire_rate_limit(struct arguslimit *const limit) {
+    if (limit != NULL) {
+        __atomic_add_fetch(&limit->refs, 1, __ATOMIC_RELAXED);
+    }
+    return limit;
+}
+
+/**
+ * Drop a reference to `limit`, deallocating it with the last one.
+ *
+ * @param limit
+ */
+void release_rate_limit(struct arguslimit *const limit) {
+    if (limit != NULL &&
+        __atomic_sub_fetch(&limit->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_destroy(&limit->mux);
+        free(limit);
+    }
+}
+
+/**
+ * Take a token out of `limit`, refilling it for the time passed since the
+ * last call first. Returns false if the bucket is empty.
+ *
+ * @param limit
+ * @return
+ */
+bool take_token(struct arguslimit *const limit) {
+    long long now;
+    bool ok;
+
+    if (limit == NULL) {
+        return true;
+    }
+    pthread_mutex_lock(&limit->mux);
+    now = monotonic_us();
+    limit->tokens += (now - limit->last) * limit->rate / 1000000;
+    if (limit->tokens > limit->burst) {
+        limit->tokens = limit->burst;
+    }
+    limit->last = now;
+    if ((ok = limit->tokens >= 1)) {
+        limit->tokens -= 1;
+    }
+    pthread_mutex_unlock(&limit->mux);
+    return ok;
+}
+
+/**
+ * Put a token taken by `take_token` back into `limit`, for an event that
+ * another limit refused after all.
+ *
+ * @param limit
+ */
+void return_token(struct arguslimit *const limit) {
+    if (limit == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&limit->mux);
+    limit->tokens += 1;
+    if (limit->tokens > limit->burst) {
+        limit->tokens = limit->burst;
+    }
+    pthread_mutex_unlock(&limit->mux);
+}
+
+/**
+ * Hand `awevent` to the log function if both the subject's and the watcher's
+ * rate limits allow it. Events over the limit are only counted by type, to be
+ * reported by `flush_rate_summary`. A subject doesn't spend its own tokens on
+ * events the watcher's limit refuses, so noisy subjects can't use up the
+ * budget of quiet ones.
+ *
+ * @param watch
+ * @param awevent
+ * @param logfn
+ */
+void emit_event(struct arguswatch *const watch, struct arguswatch_event *const awevent, arguswatch_logfn logfn) {
+    uint32_t type;
+    if (take_token(watch->limit)) {
+        if (take_token(watch->shared_limit)) {
+            (*logfn)(awevent);
+            return;
+        }
+        return_token(watch->limit);
+    }
+
+    type = awevent->event_mask & IN_ALL_EVENTS;
+    if (type) {
+        watch->suppressed[__builtin_ctz(type)] += awevent->count;
+    }
+    if (!watch->summary_due) {
+        watch->summary_due = monotonic_us() / 1000 + RATE_SUMMARY_INTERVAL;
+    }
+}
+
+/**
+ * Report the events suppressed by rate limiting, one summary event per event
+ * type, once `RATE_SUMMARY_INTERVAL` has passed since the first of them (or
+ * straight away if `force` is set). Returns the number of milliseconds until
+ * the next summary is due, or -1 if nothing is waiting to be reported, to be
+ * used as the `epoll` timeout.
+ *
+ * @param watch
+ * @param force
+ * @param logfn
+ * @return
+ */
+int flush_rate_summary(struct arguswatch *const watch, const bool force, arguswatch_logfn logfn) {
+    long long now;
+    struct timespec ts;
+    int i;
+
+    if (!watch->summary_due) {
+        return -1;
+    }
+    now = monotonic_us() / 1000;
+    if (!force &&
+        now < watch->summary_due) {
+        return (int)(watch->summary_due - now);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    for (i = 0; i < AW_EVENT_TYPES; ++i) {
+        if (!watch->suppressed[i]) {
+            continue;
+        }
+        struct arguswatch_event awevent = {
+            .watch = watch,
+            .path_name = "",
+            .file_name = "",
+            .event_mask = 1u << i,
+            .is_dir = false,
+            .count = watch->suppressed[i],
+            .first = ts,
+            .last = ts,
+            .suppressed = true
+        };
+        (*logfn)(&awevent);
+        watch->suppressed[i] = 0;
+    }
+    watch->summary_due = 0;
+    return -1;
+}
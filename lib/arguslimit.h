@@ -0,0 +1,54 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_LIMIT__
+#define __ARGUS_LIMIT__
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "argusutil.h"
+
+#ifndef RATE_SUMMARY_INTERVAL
+#define RATE_SUMMARY_INTERVAL 10000 // How often suppressed events are reported (ms).
+#endif
+
+struct arguslimit {
+    double rate, burst;     // Tokens added per second, bucket size.
+    double tokens;          // Tokens currently in the bucket.
+    long long last;         // Monotonic time (us) tokens were last added.
+    pthread_mutex_t mux;    // Buckets can be shared between watcher threads.
+    int refs;               // Watchers holding this bucket.
+};
+
+struct arguslimit *create_rate_limit(double rate, double burst);
+bool same_rate_limit(const struct arguslimit *limit, double rate, double burst);
+struct arguslimit *acquire_rate_limit(struct arguslimit *limit);
+void release_rate_limit(struct arguslimit *limit);
+bool take_token(struct arguslimit *limit);
+void return_token(struct arguslimit *limit);
+void emit_event(struct arguswatch *watch, struct arguswatch_event *awevent, arguswatch_logfn logfn);
+int flush_rate_summary(struct arguswatch *watch, bool force, arguswatch_logfn logfn);
+
+#endif
@@ -0,0 +1,621 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "argusdigest.h"
+#include "argusmanifest.h"
+#include "argusmatch.h"
+#include "argustree.h"
+#include "argusutil.h"
+
+// Latest manifest of each watch, by `name.pod.sid`, when they aren't kept on
+// disk; and the scan that is allowed to replace it.
+struct argusmanifest_slot {
+    char *key;
+    unsigned long seq;                // Latest scan started.
+    struct argusmanifest *manifest;   // NULL if there is none yet, or kept on disk.
+    struct argusmanifest_slot *next;
+};
+
+// Baseline scan of a watch, working on copies of what it needs so it can
+// outlive the watch.
+struct argusmanifest_scan {
+    char *key;
+    char *name, *node_name, *pod_name;
+    int pid, sid;
+    unsigned long seq;
+    char **dirs;                      // Host paths cached by the watch.
+    unsigned int dirc;
+    struct argusmatch *ignore;        // Copy of the ignore patterns (NULL if none).
+    size_t prefixlen;                 // Length of the `/proc/[pid]/root` (or upperdir) prefix.
+    char **files;                     // Host paths of the files to hash.
+    unsigned int filec, filesize;
+    struct argusmanifest_entry *entries; // Entry of each file (NULL path if it couldn't be read).
+    unsigned int next;                // Next file to hash.
+    unsigned long long bytes;         // Bytes hashed.
+};
+
+static char manifestdir_[PATH_MAX] = "";
+static int workers_ = MANIFEST_WORKERS;
+static argusmanifest_reportfn reportfn_ = NULL;
+static sem_t iosem_;                  // Files being hashed by all scans together.
+static pthread_once_t manifestonce_ = PTHREAD_ONCE_INIT;
+static pthread_mutex_t slotmux_ = PTHREAD_MUTEX_INITIALIZER;
+static struct argusmanifest_slot *slots_ = NULL;
+
+/**
+ * Initialize the limit on files hashed at once.
+ */
+static void init_manifests() {
+    sem_init(&iosem_, 0, workers_);
+}
+
+/**
+ * Set where manifests are kept (in memory if `dir` is empty), the number of
+ * files hashed at once by all baseline scans together, and the function
+ * scans are reported to. Has to be called before the first scan.
+ *
+ * @param dir
+ * @param workers
+ * @param fn
+ */
+void configure_manifests(const char *const dir, const int workers, argusmanifest_reportfn fn) {
+    snprintf(manifestdir_, sizeof(manifestdir_), "%s", dir ? dir : "");
+    workers_ = workers > 0 ? workers : 1;
+    reportfn_ = fn;
+}
+
+/**
+ * Return the slot of `key`, creating it if needed. Callers hold `slotmux_`.
+ *
+ * @param key
+ * @return
+ */
+static struct argusmanifest_slot *manifest_slot(const char *const key) {
+    struct argusmanifest_slot *slot;
+    for (slot = slots_; slot != NULL; slot = slot->next) {
+        if (strcmp(slot->key, key) == 0) {
+            return slot;
+        }
+    }
+    if ((slot = calloc(1, sizeof(struct argusmanifest_slot))) == NULL ||
+        (slot->key = strdup(key)) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        free(slot);
+        return NULL;
+    }
+    slot->next = slots_;
+    slots_ = slot;
+    return slot;
+}
+
+/**
+ * Deallocate a manifest.
+ *
+ * @param manifest
+ */
+void free_manifest(struct argusmanifest *const manifest) {
+    unsigned int i;
+    if (manifest == NULL) {
+        return;
+    }
+    for (i = 0; i < manifest->count; ++i) {
+        free(manifest->entries[i].path);
+    }
+    free(manifest->entries);
+    free(manifest);
+}
+
+/**
+ * Read a manifest written by `store_manifest`. Returns NULL if there is none,
+ * or it can't be read.
+ *
+ * @param path
+ * @return
+ */
+struct argusmanifest *load_manifest(const char *const path) {
+    struct argusmanifest *manifest;
+    struct argusmanifest_entry *entry;
+    uint32_t header[2], len;
+    unsigned int i;
+    FILE *fp;
+
+    if ((fp = fopen(path, "re")) == NULL) {
+        return NULL;
+    }
+    if (fread(header, sizeof(header), 1, fp) != 1 ||
+        header[0] != AWM_MAGIC ||
+        (manifest = calloc(1, sizeof(struct argusmanifest))) == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    if ((manifest->entries = calloc(header[1] ? header[1] : 1, sizeof(struct argusmanifest_entry))) == NULL) {
+        free(manifest);
+        fclose(fp);
+        return NULL;
+    }
+    for (i = 0; i < header[1]; ++i) {
+        entry = &manifest->entries[i];
+        if (fread(&len, sizeof(len), 1, fp) != 1 ||
+            len > PATH_MAX ||
+            (entry->path = calloc(1, len + 1)) == NULL) {
+            goto fail;
+        }
+        ++manifest->count;
+        if ((len && fread(entry->path, len, 1, fp) != 1) ||
+            fread(&entry->size, sizeof(entry->size), 1, fp) != 1 ||
+            fread(&entry->mtime, sizeof(entry->mtime), 1, fp) != 1 ||
+            fread(&entry->hash, sizeof(entry->hash), 1, fp) != 1) {
+            goto fail;
+        }
+    }
+    fclose(fp);
+    return manifest;
+
+fail:
+#if DEBUG
+    fprintf(stderr, "%s: truncated manifest\n", path);
+#endif
+    free_manifest(manifest);
+    fclose(fp);
+    return NULL;
+}
+
+/**
+ * Write `manifest` to `path`, replacing it atomically. Returns false on
+ * error.
+ *
+ * @param path
+ * @param manifest
+ * @return
+ */
+bool store_manifest(const char *const path, const struct argusmanifest *const manifest) {
+    char tmppath[PATH_MAX + 8];
+    uint32_t header[2] = {AWM_MAGIC, manifest->count}, len;
+    const struct argusmanifest_entry *entry;
+    unsigned int i;
+    bool ok;
+    FILE *fp;
+
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+    if ((fp = fopen(tmppath, "we")) == NULL) {
+#if DEBUG
+        perror("fopen");
+#endif
+        return false;
+    }
+    ok = fwrite(header, sizeof(header), 1, fp) == 1;
+    for (i = 0; i < manifest->count && ok; ++i) {
+        entry = &manifest->entries[i];
+        len = strlen(entry->path);
+        ok = fwrite(&len, sizeof(len), 1, fp) == 1 &&
+            (!len || fwrite(entry->path, len, 1, fp) == 1) &&
+            fwrite(&entry->size, sizeof(entry->size), 1, fp) == 1 &&
+            fwrite(&entry->mtime, sizeof(entry->mtime), 1, fp) == 1 &&
+            fwrite(&entry->hash, sizeof(entry->hash), 1, fp) == 1;
+    }
+    if (fclose(fp) == EOF) {
+        ok = false;
+    }
+    if (!ok ||
+        rename(tmppath, path) == EOF) {
+#if DEBUG
+        perror("rename");
+#endif
+        unlink(tmppath);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Deallocate a scan.
+ *
+ * @param scan
+ */
+static void free_scan(struct argusmanifest_scan *const scan) {
+    unsigned int i;
+    for (i = 0; i < scan->dirc; ++i) {
+        free(scan->dirs[i]);
+    }
+    for (i = 0; i < scan->filec; ++i) {
+        free(scan->files[i]);
+        if (scan->entries != NULL) {
+            free(scan->entries[i].path);
+        }
+    }
+    free(scan->dirs);
+    free(scan->files);
+    free(scan->entries);
+    free_match_patterns(scan->ignore);
+    free(scan->key);
+    free(scan->name);
+    free(scan->node_name);
+    free(scan->pod_name);
+    free(scan);
+}
+
+/**
+ * Add the host path `path` to the files to hash, unless it is ignored.
+ *
+ * @param scan
+ * @param path
+ */
+static void add_scan_file(struct argusmanifest_scan *const scan, const char *const path) {
+    char **files;
+    if (scan->ignore != NULL &&
+        match_path(scan->ignore, path + scan->prefixlen)) {
+        return;
+    }
+    if (scan->filec == scan->filesize) {
+        if ((files = realloc(scan->files, (scan->filesize + ALLOC_INC) * sizeof(char *))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            return;
+        }
+        scan->files = files;
+        scan->filesize += ALLOC_INC;
+    }
+    if ((scan->files[scan->filec] = strdup(path)) != NULL) {
+        ++scan->filec;
+    }
+}
+
+/**
+ * List the regular files directly in the paths cached by the watch. Cached
+ * subdirectories are listed themselves, so this covers the same tree as the
+ * watch, down to the same depth.
+ *
+ * @param scan
+ */
+static void list_scan_files(struct argusmanifest_scan *const scan) {
+    char fullpath[PATH_MAX + NAME_MAX + 1];
+    struct dirent *dent;
+    struct stat sb;
+    unsigned int i;
+    DIR *dir;
+
+    for (i = 0; i < scan->dirc; ++i) {
+        if (lstat(scan->dirs[i], &sb) == EOF) {
+            continue;
+        }
+        if (S_ISREG(sb.st_mode)) {
+            // A file watched as a root path.
+            add_scan_file(scan, scan->dirs[i]);
+            continue;
+        }
+        if (!S_ISDIR(sb.st_mode) ||
+            (dir = opendir(scan->dirs[i])) == NULL) {
+            continue;
+        }
+        while ((dent = readdir(dir)) != NULL) {
+            if (dent->d_type != DT_REG &&
+                dent->d_type != DT_UNKNOWN) {
+                continue;
+            }
+            FORMAT_PATH(fullpath, scan->dirs[i], dent->d_name);
+            if (dent->d_type == DT_UNKNOWN &&
+                (lstat(fullpath, &sb) == EOF || !S_ISREG(sb.st_mode))) {
+                continue;
+            }
+            add_scan_file(scan, fullpath);
+        }
+        closedir(dir);
+    }
+}
+
+/**
+ * Hash files of a scan until there are none left. Several of these run at
+ * once, and all of them together only hash as many files at a time as there
+ * are workers.
+ *
+ * @param arg
+ * @return
+ */
+static void *hash_scan_files(void *arg) {
+    struct argusmanifest_scan *const scan = arg;
+    struct argusmanifest_entry *entry;
+    unsigned int i;
+    struct stat sb;
+    uint64_t hash;
+    int fd;
+
+    while ((i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED)) < scan->filec) {
+        entry = &scan->entries[i];
+        while (sem_wait(&iosem_) == EOF &&
+            errno == EINTR);
+        if ((fd = open(scan->files[i], O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NOCTTY | O_NONBLOCK)) != EOF) {
+            if (fstat(fd, &sb) == 0 &&
+                S_ISREG(sb.st_mode) &&
+                digest_file(fd, &hash)) {
+                entry->path = strdup(scan->files[i] + scan->prefixlen);
+                entry->size = sb.st_size;
+                entry->mtime = (int64_t)sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+                entry->hash = hash;
+                __atomic_add_fetch(&scan->bytes, sb.st_size, __ATOMIC_RELAXED);
+            }
+            close(fd);
+        }
+        sem_post(&iosem_);
+    }
+    return NULL;
+}
+
+/**
+ * Order manifest entries by path.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const struct argusmanifest_entry *)a)->path, ((const struct argusmanifest_entry *)b)->path);
+}
+
+/**
+ * Fill the differences between `previous` and `current` into `report`.
+ * Returns false if they couldn't be allocated.
+ *
+ * @param previous
+ * @param current
+ * @param report
+ * @return
+ */
+static bool diff_manifests(const struct argusmanifest *const previous, const struct argusmanifest *const current,
+    struct argusmanifest_report *const report) {
+
+    unsigned int i = 0, j = 0;
+    int cmp;
+
+    if ((report->added = calloc(current->count + 1, sizeof(char *))) == NULL ||
+        (report->removed = calloc(previous->count + 1, sizeof(char *))) == NULL ||
+        (report->changed = calloc(current->count + 1, sizeof(char *))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return false;
+    }
+    while (i < previous->count ||
+        j < current->count) {
+        cmp = i == previous->count ? 1 :
+            j == current->count ? -1 :
+            strcmp(previous->entries[i].path, current->entries[j].path);
+        if (cmp < 0) {
+            report->removed[report->removedc++] = previous->entries[i++].path;
+        } else if (cmp > 0) {
+            report->added[report->addedc++] = current->entries[j++].path;
+        } else {
+            if (previous->entries[i].hash != current->entries[j].hash ||
+                previous->entries[i].size != current->entries[j].size) {
+                report->changed[report->changedc++] = current->entries[j].path;
+            }
+            ++i;
+            ++j;
+        }
+    }
+    return true;
+}
+
+/**
+ * Run a baseline scan: hash every file, compare the result with the previous
+ * manifest of the watch, report the differences and keep the new manifest.
+ * The result is dropped if the process exited meanwhile (the files would all
+ * look removed), or a newer scan of the same watch started.
+ *
+ * @param arg
+ * @return
+ */
+static void *run_scan(void *arg) {
+    struct argusmanifest_scan *const scan = arg;
+    struct argusmanifest *previous = NULL, *current;
+    struct argusmanifest_report report = {0};
+    struct argusmanifest_slot *slot;
+    char path[PATH_MAX * 2], root[32];
+    struct timespec start, end;
+    pthread_t threads[64];
+    unsigned int i, n, threadc = 0;
+    struct stat sb;
+    bool latest;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    list_scan_files(scan);
+    if ((scan->entries = calloc(scan->filec ? scan->filec : 1, sizeof(struct argusmanifest_entry))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        free_scan(scan);
+        return NULL;
+    }
+    n = workers_ < 64 ? workers_ : 64;
+    for (i = 0; i + 1 < n && i + 1 < scan->filec; ++i) {
+        if (pthread_create(&threads[threadc], NULL, hash_scan_files, scan) == 0) {
+            ++threadc;
+        }
+    }
+    hash_scan_files(scan);
+    for (i = 0; i < threadc; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    snprintf(root, sizeof(root), "/proc/%d/root", scan->pid);
+    if (scan->prefixlen &&
+        stat(root, &sb) == EOF) {
+        free_scan(scan);
+        return NULL;
+    }
+
+    // Move the files that were hashed into a manifest of their own.
+    if ((current = calloc(1, sizeof(struct argusmanifest))) == NULL ||
+        (current->entries = calloc(scan->filec ? scan->filec : 1, sizeof(struct argusmanifest_entry))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        free(current);
+        free_scan(scan);
+        return NULL;
+    }
+    for (i = 0; i < scan->filec; ++i) {
+        if (scan->entries[i].path != NULL) {
+            current->entries[current->count++] = scan->entries[i];
+            scan->entries[i].path = NULL;
+        }
+    }
+    qsort(current->entries, current->count, sizeof(struct argusmanifest_entry), compare_entries);
+
+    if (*manifestdir_) {
+        snprintf(path, sizeof(path), "%s/%s.awm", manifestdir_, scan->key);
+    }
+    pthread_mutex_lock(&slotmux_);
+    slot = manifest_slot(scan->key);
+    latest = slot != NULL && slot->seq == scan->seq;
+    if (latest) {
+        if (*manifestdir_) {
+            previous = load_manifest(path);
+            store_manifest(path, current);
+        } else {
+            previous = slot->manifest;
+            slot->manifest = current;
+        }
+    }
+    pthread_mutex_unlock(&slotmux_);
+    if (!latest) {
+        free_manifest(current);
+        free_scan(scan);
+        return NULL;
+    }
+
+    report = (struct argusmanifest_report){
+        .name = scan->name,
+        .node_name = scan->node_name,
+        .pod_name = scan->pod_name,
+        .pid = scan->pid,
+        .sid = scan->sid,
+        .files = current->count,
+        .bytes = scan->bytes,
+        .seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+        .first = previous == NULL
+    };
+    if ((previous == NULL || diff_manifests(previous, current, &report)) &&
+        reportfn_ != NULL) {
+        (*reportfn_)(&report);
+    }
+    free(report.added);
+    free(report.removed);
+    free(report.changed);
+    free_manifest(previous);
+    if (*manifestdir_) {
+        free_manifest(current);
+    }
+    free_scan(scan);
+    return NULL;
+}
+
+/**
+ * Start a baseline scan of the files under the paths of `watch`, in the
+ * background. The scan walks the directories the watch has cached, rather
+ * than traversing the tree again, so it is only as deep as the watch and
+ * leaves out the same paths.
+ *
+ * @param watch
+ */
+void scan_manifest(const struct arguswatch *const watch) {
+    struct argusmanifest_scan *scan;
+    struct argusmanifest_slot *slot;
+    char key[PATH_MAX], buf[32];
+    const char *root;
+    pthread_t thread;
+    unsigned int i;
+
+    pthread_once(&manifestonce_, init_manifests);
+    if ((scan = calloc(1, sizeof(struct argusmanifest_scan))) == NULL ||
+        (scan->dirs = calloc(watch->pathc ? watch->pathc : 1, sizeof(char *))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        free(scan);
+        return;
+    }
+    snprintf(key, sizeof(key), "%s.%s.%d", watch->name ? watch->name : "watch",
+        watch->pod_name ? watch->pod_name : "pod", watch->sid);
+    scan->key = strdup(key);
+    scan->name = strdup(watch->name ? watch->name : "");
+    scan->node_name = strdup(watch->node_name ? watch->node_name : "");
+    scan->pod_name = strdup(watch->pod_name ? watch->pod_name : "");
+    scan->pid = watch->pid;
+    scan->sid = watch->sid;
+    for (i = 0; i < watch->pathc; ++i) {
+        if (watch->paths[i] != NULL &&
+            *watch->paths[i] &&
+            (scan->dirs[scan->dirc] = strdup(watch->paths[i])) != NULL) {
+            ++scan->dirc;
+        }
+    }
+    scan->ignore = compile_match_patterns(watch->ignorec, (const char *const *)watch->ignores);
+    if (scan->dirc) {
+        root = container_root(watch, scan->dirs[0], buf, sizeof(buf));
+        if (strncmp(scan->dirs[0], root, strlen(root)) == 0) {
+            scan->prefixlen = strlen(root);
+        }
+    }
+    if (scan->key == NULL ||
+        scan->name == NULL ||
+        scan->node_name == NULL ||
+        scan->pod_name == NULL) {
+        free_scan(scan);
+        return;
+    }
+
+    pthread_mutex_lock(&slotmux_);
+    if ((slot = manifest_slot(scan->key)) != NULL) {
+        scan->seq = ++slot->seq;
+    }
+    pthread_mutex_unlock(&slotmux_);
+    if (slot == NULL ||
+        pthread_create(&thread, NULL, run_scan, scan) != 0) {
+#if DEBUG
+        perror("pthread_create");
+#endif
+        free_scan(scan);
+        return;
+    }
+    pthread_detach(thread);
+}
@@ -0,0 +1,73 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_MANIFEST__
+#define __ARGUS_MANIFEST__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "argusutil.h"
+
+#define AWM_MAGIC 0x314d5741 // "AWM1"
+
+#ifndef MANIFEST_WORKERS
+#define MANIFEST_WORKERS 2
+#endif
+
+struct argusmanifest_entry {
+    char *path;                       // Path in the container.
+    uint64_t size;                    // Size of the file.
+    int64_t mtime;                    // Modification time (ns).
+    uint64_t hash;                    // XXH64 of the content.
+};
+
+// Baseline of the files under the paths of a watch, sorted by path.
+struct argusmanifest {
+    unsigned int count;
+    struct argusmanifest_entry *entries;
+};
+
+// Outcome of a baseline scan, compared with the previous one.
+struct argusmanifest_report {
+    const char *name;                 // Name of ArgusWatcher.
+    const char *node_name, *pod_name; // Name of node, pod in which process is running.
+    int pid, sid;
+    unsigned int files;               // Files hashed.
+    unsigned long long bytes;         // Bytes hashed.
+    double seconds;                   // Wall clock time the scan took.
+    bool first;                       // There was no previous manifest to compare with.
+    unsigned int addedc, removedc, changedc;
+    const char **added, **removed, **changed; // Container paths of the differences.
+};
+
+typedef void (*argusmanifest_reportfn)(const struct argusmanifest_report *report);
+
+void configure_manifests(const char *dir, int workers, argusmanifest_reportfn fn);
+void scan_manifest(const struct arguswatch *watch);
+struct argusmanifest *load_manifest(const char *path);
+bool store_manifest(const char *path, const struct argusmanifest *manifest);
+void free_manifest(struct argusmanifest *manifest);
+
+#endif
@@ -0,0 +1,548 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argusmatch.h"
+#include "argusutil.h"
+
+#define AM_ACCEPT 0x01
+#define AM_DEAD   0x02
+
+#define SET_HAS(set, b) ((set)[(b) >> 3] & (1 << ((b) & 7)))
+#define SET_ADD(set, b) ((set)[(b) >> 3] |= (1 << ((b) & 7)))
+
+/**
+ * Append a new NFA state with no transitions, returning its index, or -1 if
+ * out of memory.
+ *
+ * @param matcher
+ * @return
+ */
+static int new_state(struct argusmatch *const matcher) {
+    struct argusmatch_state *nfa;
+    if (matcher->nfac == matcher->nfasize) {
+        matcher->nfasize += ALLOC_INC;
+        if ((nfa = realloc(matcher->nfa, matcher->nfasize * sizeof(struct argusmatch_state))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            return -1;
+        }
+        matcher->nfa = nfa;
+    }
+    memset(&matcher->nfa[matcher->nfac], 0, sizeof(struct argusmatch_state));
+    matcher->nfa[matcher->nfac].out = -1;
+    matcher->nfa[matcher->nfac].eps[0] = -1;
+    matcher->nfa[matcher->nfac].eps[1] = -1;
+    return matcher->nfac++;
+}
+
+/**
+ * Add an epsilon transition `from` -> `to`.
+ *
+ * @param matcher
+ * @param from
+ * @param to
+ */
+static void add_epsilon(struct argusmatch *const matcher, const int from, const int to) {
+    struct argusmatch_state *s = &matcher->nfa[from];
+    s->eps[s->eps[0] == -1 ? 0 : 1] = to;
+}
+
+/**
+ * Consume a single byte out of `set` from state `cur`, returning the new
+ * current state.
+ *
+ * @param matcher
+ * @param cur
+ * @param set
+ * @return
+ */
+static int match_one(struct argusmatch *const matcher, const int cur, const uint8_t set[32]) {
+    int next;
+    if ((next = new_state(matcher)) == -1) {
+        return -1;
+    }
+    memcpy(matcher->nfa[cur].set, set, 32);
+    matcher->nfa[cur].out = next;
+    return next;
+}
+
+/**
+ * Consume any number of bytes out of `set` from state `cur` (`*`), returning
+ * the new current state.
+ *
+ * @param matcher
+ * @param cur
+ * @param set
+ * @return
+ */
+static int match_many(struct argusmatch *const matcher, const int cur, const uint8_t set[32]) {
+    int next;
+    if ((next = new_state(matcher)) == -1) {
+        return -1;
+    }
+    memcpy(matcher->nfa[cur].set, set, 32);
+    matcher->nfa[cur].out = cur;
+    add_epsilon(matcher, cur, next);
+    return next;
+}
+
+/**
+ * Match zero or more whole directories, each followed by a separator
+ * (`**` followed by `/`), returning the new current state.
+ *
+ * @param matcher
+ * @param cur
+ * @param all
+ * @param slash
+ * @return
+ */
+static int match_dirs(struct argusmatch *const matcher, const int cur, const uint8_t all[32],
+    const uint8_t slash[32]) {
+    int any, next;
+    if ((next = new_state(matcher)) == -1 ||
+        (any = new_state(matcher)) == -1) {
+        return -1;
+    }
+    add_epsilon(matcher, cur, next);
+    add_epsilon(matcher, cur, any);
+    // `any` loops over everything, then must see a separator.
+    if ((any = match_many(matcher, any, all)) == -1) {
+        return -1;
+    }
+    memcpy(matcher->nfa[any].set, slash, 32);
+    matcher->nfa[any].out = next;
+    return next;
+}
+
+/**
+ * Parse a bracket expression (`[abc]`, `[a-z]`, `[!x]`) starting at `p` into
+ * `set`, returning a pointer past the closing bracket, or NULL if it isn't
+ * closed (in which case the `[` is taken literally).
+ *
+ * @param p
+ * @param set
+ * @return
+ */
+static const char *parse_bracket(const char *p, uint8_t set[32]) {
+    uint8_t cls[32] = {0};
+    bool negate = false;
+    int i, lo, hi;
+
+    ++p;
+    if (*p == '!' || *p == '^') {
+        negate = true;
+        ++p;
+    }
+    // A `]` straight after the opening bracket is part of the set.
+    if (*p == ']') {
+        SET_ADD(cls, ']');
+        ++p;
+    }
+    while (*p && *p != ']') {
+        lo = (unsigned char)*p++;
+        hi = lo;
+        if (*p == '-' && p[1] && p[1] != ']') {
+            hi = (unsigned char)p[1];
+            p += 2;
+        }
+        for (i = lo; i <= hi; ++i) {
+            SET_ADD(cls, i);
+        }
+    }
+    if (*p != ']') {
+        return NULL;
+    }
+    for (i = 0; i < 32; ++i) {
+        set[i] = negate ? ~cls[i] : cls[i];
+    }
+    // A separator is never matched by a bracket expression.
+    set['/' >> 3] &= ~(1 << ('/' & 7));
+    return p + 1;
+}
+
+/**
+ * Compile a single glob pattern into the NFA.
+ *
+ * - `*` matches anything but a separator, `?` a single character but a
+ *   separator, `[...]` a bracket expression;
+ * - `**` as a whole path component matches any number of directories; as the
+ *   last component it matches everything under a directory, and the
+ *   directory itself;
+ * - patterns starting with a separator are anchored at the root of the
+ *   container filesystem; all others can match at any directory (`*.cache`
+ *   matches the basename of any path).
+ *
+ * @param matcher
+ * @param pattern
+ * @return
+ */
+static int compile_glob(struct argusmatch *const matcher, const char *const pattern) {
+    uint8_t all[32], notslash[32], slash[32] = {0}, set[32];
+    const char *p = pattern, *end;
+    int start, cur;
+    size_t len = strlen(pattern);
+
+    memset(all, 0xff, sizeof(all));
+    memset(notslash, 0xff, sizeof(notslash));
+    notslash['/' >> 3] &= ~(1 << ('/' & 7));
+    SET_ADD(slash, '/');
+
+    // A trailing separator only says the pattern is meant for directories,
+    // which are all we traverse anyway.
+    while (len > 1 && pattern[len - 1] == '/') {
+        --len;
+    }
+    end = pattern + len;
+
+    if ((start = cur = new_state(matcher)) == -1) {
+        return -1;
+    }
+    if (*p != '/') {
+        if (strncmp(p, "**/", 3) == 0) {
+            p += 3;
+        }
+        // Unanchored patterns match after any directory.
+        if ((cur = match_dirs(matcher, cur, all, slash)) == -1) {
+            return -1;
+        }
+    }
+
+    while (p < end && cur != -1) {
+        if (*p == '/' && end - p == 3 && strncmp(p, "/**", 3) == 0) {
+            // Trailing `**` component: the directory itself, or anything
+            // under it.
+            int next = new_state(matcher), under;
+            if (next == -1 ||
+                (under = match_one(matcher, cur, slash)) == -1) {
+                return -1;
+            }
+            add_epsilon(matcher, cur, next);
+            if ((under = match_many(matcher, under, all)) == -1) {
+                return -1;
+            }
+            add_epsilon(matcher, under, next);
+            cur = next;
+            p = end;
+        } else if (*p == '*' && p[1] == '*') {
+            if ((p == pattern || p[-1] == '/') && p + 2 < end && p[2] == '/') {
+                // `**/` as a whole component.
+                cur = match_dirs(matcher, cur, all, slash);
+                p += 3;
+            } else {
+                cur = match_many(matcher, cur, all);
+                p += 2;
+            }
+        } else if (*p == '*') {
+            cur = match_many(matcher, cur, notslash);
+            ++p;
+        } else if (*p == '?') {
+            cur = match_one(matcher, cur, notslash);
+            ++p;
+        } else if (*p == '[' && parse_bracket(p, set) != NULL) {
+            cur = match_one(matcher, cur, set);
+            p = parse_bracket(p, set);
+        } else {
+            if (*p == '\\' && p + 1 < end) {
+                ++p;
+            }
+            memset(set, 0, sizeof(set));
+            SET_ADD(set, (unsigned char)*p);
+            cur = match_one(matcher, cur, set);
+            ++p;
+        }
+    }
+    if (cur == -1) {
+        return -1;
+    }
+    matcher->nfa[cur].accept = true;
+    return start;
+}
+
+/**
+ * Split the 256 byte values into classes that no NFA transition tells apart,
+ * so the DFA only needs one transition per class rather than per byte.
+ *
+ * @param matcher
+ */
+static void build_byte_classes(struct argusmatch *const matcher) {
+    int remap[512];
+    unsigned int i, b, classc;
+
+    memset(matcher->classmap, 0, sizeof(matcher->classmap));
+    matcher->classc = 1;
+    for (i = 0; i < matcher->nfac; ++i) {
+        if (matcher->nfa[i].out == -1) {
+            continue;
+        }
+        // Refine: bytes stay together only if they agree on this set too.
+        memset(remap, -1, sizeof(remap));
+        classc = 0;
+        for (b = 0; b < 256; ++b) {
+            int key = matcher->classmap[b] * 2 + (SET_HAS(matcher->nfa[i].set, b) ? 1 : 0);
+            if (remap[key] == -1) {
+                remap[key] = classc++;
+            }
+            matcher->classmap[b] = remap[key];
+        }
+        matcher->classc = classc;
+    }
+    for (b = 256; b-- > 0;) {
+        matcher->classrep[matcher->classmap[b]] = b;
+    }
+}
+
+/**
+ * Add NFA state `state` and everything reachable from it through epsilon
+ * transitions to `set`.
+ *
+ * @param matcher
+ * @param set
+ * @param state
+ */
+static void add_closure(struct argusmatch *const matcher, uint64_t *const set, const int state) {
+    int top = 0, s, i;
+    matcher->stack[top++] = state;
+    while (top) {
+        s = matcher->stack[--top];
+        if (set[s >> 6] & (1ULL << (s & 63))) {
+            continue;
+        }
+        set[s >> 6] |= 1ULL << (s & 63);
+        for (i = 0; i < 2; ++i) {
+            if (matcher->nfa[s].eps[i] != -1) {
+                matcher->stack[top++] = matcher->nfa[s].eps[i];
+            }
+        }
+    }
+}
+
+/**
+ * Returns the DFA state for the NFA state set in `scratch`, adding it to the
+ * cache if it isn't there yet. Returns -1 if the cache is full.
+ *
+ * @param matcher
+ * @return
+ */
+static int find_or_add_dfa_state(struct argusmatch *const matcher) {
+    const uint64_t *const set = matcher->scratch;
+    uint64_t hash = 14695981039346656037ULL;
+    unsigned int i, h, mask = AM_MAX_STATES * 2 - 1;
+    bool empty = true, accept = false;
+    int id;
+
+    for (i = 0; i < matcher->words; ++i) {
+        hash = (hash ^ set[i]) * 1099511628211ULL;
+    }
+    for (h = hash & mask; (id = matcher->table[h]) != -1; h = (h + 1) & mask) {
+        if (memcmp(&matcher->sets[id * matcher->words], set, matcher->words * sizeof(uint64_t)) == 0) {
+            return id;
+        }
+    }
+    if (matcher->dfac == AM_MAX_STATES) {
+        return -1;
+    }
+
+    id = matcher->dfac++;
+    matcher->table[h] = id;
+    memcpy(&matcher->sets[id * matcher->words], set, matcher->words * sizeof(uint64_t));
+    memset(&matcher->trans[id * matcher->classc], -1, matcher->classc * sizeof(int));
+    for (i = 0; i < matcher->nfac; ++i) {
+        if (set[i >> 6] & (1ULL << (i & 63))) {
+            empty = false;
+            accept |= matcher->nfa[i].accept;
+        }
+    }
+    matcher->flags[id] = (accept ? AM_ACCEPT : 0) | (empty ? AM_DEAD : 0);
+    return id;
+}
+
+/**
+ * Drop every cached DFA state and add the start state back as state 0.
+ *
+ * @param matcher
+ */
+static void reset_dfa(struct argusmatch *const matcher) {
+    unsigned int i;
+    matcher->dfac = 0;
+    memset(matcher->table, -1, AM_MAX_STATES * 2 * sizeof(int));
+    memset(matcher->scratch, 0, matcher->words * sizeof(uint64_t));
+    for (i = 0; i < matcher->startc; ++i) {
+        add_closure(matcher, matcher->scratch, matcher->starts[i]);
+    }
+    find_or_add_dfa_state(matcher);
+}
+
+/**
+ * Returns the DFA state reached from `id` on byte class `cls`, building it
+ * from the NFA the first time it is needed.
+ *
+ * @param matcher
+ * @param id
+ * @param cls
+ * @return
+ */
+static int next_dfa_state(struct argusmatch *const matcher, const int id, const unsigned int cls) {
+    const uint64_t *set = &matcher->sets[id * matcher->words];
+    const uint8_t b = matcher->classrep[cls];
+    unsigned int i;
+    int next;
+
+    if ((next = matcher->trans[id * matcher->classc + cls]) != -1) {
+        return next;
+    }
+
+    memset(matcher->scratch, 0, matcher->words * sizeof(uint64_t));
+    for (i = 0; i < matcher->nfac; ++i) {
+        if ((set[i >> 6] & (1ULL << (i & 63))) &&
+            matcher->nfa[i].out != -1 &&
+            SET_HAS(matcher->nfa[i].set, b)) {
+            add_closure(matcher, matcher->scratch, matcher->nfa[i].out);
+        }
+    }
+    if ((next = find_or_add_dfa_state(matcher)) == -1) {
+        // Cache is full; start over, keeping just the state we need now.
+        uint64_t *keep = matcher->scratch;
+        if ((matcher->scratch = malloc(matcher->words * sizeof(uint64_t))) == NULL) {
+#if DEBUG
+            perror("malloc");
+#endif
+            matcher->scratch = keep;
+            return 0;
+        }
+        reset_dfa(matcher);
+        free(matcher->scratch);
+        matcher->scratch = keep;
+        return find_or_add_dfa_state(matcher);
+    }
+    matcher->trans[id * matcher->classc + cls] = next;
+    return next;
+}
+
+/**
+ * Compile `patterns` into a single matcher. Patterns are combined into one
+ * NFA, which is turned into a DFA lazily as paths are matched, so matching
+ * takes time proportional to the length of the path no matter how many
+ * patterns there are. Returns NULL if there are no patterns.
+ *
+ * @param patternc
+ * @param patterns
+ * @return
+ */
+struct argusmatch *compile_match_patterns(const unsigned int patternc, const char *const patterns[]) {
+    struct argusmatch *matcher;
+    unsigned int i;
+
+    if (patternc == 0) {
+        return NULL;
+    }
+    if ((matcher = calloc(1, sizeof(struct argusmatch))) == NULL ||
+        (matcher->starts = calloc(patternc, sizeof(int))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        free(matcher);
+        return NULL;
+    }
+
+    for (i = 0; i < patternc; ++i) {
+        if (patterns[i] == NULL ||
+            patterns[i][0] == '\0') {
+            continue;
+        }
+        if ((matcher->starts[matcher->startc] = compile_glob(matcher, patterns[i])) == -1) {
+            free_match_patterns(matcher);
+            return NULL;
+        }
+        ++matcher->startc;
+    }
+    build_byte_classes(matcher);
+
+    matcher->words = (matcher->nfac + 63) / 64;
+    if ((matcher->sets = calloc(AM_MAX_STATES, matcher->words * sizeof(uint64_t))) == NULL ||
+        (matcher->trans = calloc(AM_MAX_STATES, matcher->classc * sizeof(int))) == NULL ||
+        (matcher->flags = calloc(AM_MAX_STATES, sizeof(uint8_t))) == NULL ||
+        (matcher->table = calloc(AM_MAX_STATES * 2, sizeof(int))) == NULL ||
+        (matcher->scratch = calloc(matcher->words, sizeof(uint64_t))) == NULL ||
+        (matcher->stack = calloc(matcher->nfac * 2 + 1, sizeof(int))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        free_match_patterns(matcher);
+        return NULL;
+    }
+    reset_dfa(matcher);
+    return matcher;
+}
+
+/**
+ * Check if `path` matches any of the patterns compiled into `matcher`.
+ *
+ * @param matcher
+ * @param path
+ * @return
+ */
+bool match_path(struct argusmatch *const matcher, const char *const path) {
+    const unsigned char *p;
+    int id = 0;
+
+    for (p = (const unsigned char *)path; *p; ++p) {
+        id = next_dfa_state(matcher, id, matcher->classmap[*p]);
+        if (matcher->flags[id] & AM_DEAD) {
+            ++matcher->misses;
+            return false;
+        }
+    }
+    if (matcher->flags[id] & AM_ACCEPT) {
+        ++matcher->hits;
+        return true;
+    }
+    ++matcher->misses;
+    return false;
+}
+
+/**
+ * Deallocate a matcher returned by `compile_match_patterns`.
+ *
+ * @param matcher
+ */
+void free_match_patterns(struct argusmatch *const matcher) {
+    if (matcher == NULL) {
+        return;
+    }
+    free(matcher->nfa);
+    free(matcher->starts);
+    free(matcher->sets);
+    free(matcher->trans);
+    free(matcher->flags);
+    free(matcher->table);
+    free(matcher->scratch);
+    free(matcher->stack);
+    free(matcher);
+}
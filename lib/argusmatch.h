@@ -0,0 +1,69 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_MATCH__
+#define __ARGUS_MATCH__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef ALLOC_INC
+#define ALLOC_INC 32
+#endif
+
+#ifndef AM_MAX_STATES
+#define AM_MAX_STATES 2048 // Cached DFA states before the cache is flushed.
+#endif
+
+struct argusmatch_state {
+    uint8_t set[32]; // Bytes consumed by `out` (bitset).
+    int out;         // State reached by consuming a byte in `set` (-1 if none).
+    int eps[2];      // States reached without consuming anything (-1 if none).
+    bool accept;     // Whether a pattern ends here.
+};
+
+struct argusmatch {
+    struct argusmatch_state *nfa;    // Combined NFA of all patterns.
+    int *starts;                     // Start state of each pattern.
+    unsigned int nfac, nfasize;      // NFA state count, allocated count.
+    unsigned int startc;             // Pattern count.
+    uint8_t classmap[256];           // Byte -> equivalence class.
+    uint8_t classrep[256];           // Equivalence class -> representative byte.
+    unsigned int classc;             // Equivalence class count.
+    unsigned int words;              // 64-bit words per NFA state set.
+    uint64_t *sets;                  // NFA state set of each DFA state.
+    int *trans;                      // DFA transitions, `classc` per state (-1 if not built yet).
+    uint8_t *flags;                  // AM_ACCEPT/AM_DEAD per DFA state.
+    int *table;                      // Open-addressed NFA state set -> DFA state.
+    unsigned int dfac;               // Cached DFA state count.
+    uint64_t *scratch;               // Set being built.
+    int *stack;                      // Epsilon closure stack.
+    unsigned long hits, misses;      // Matches, non-matches.
+};
+
+struct argusmatch *compile_match_patterns(unsigned int patternc, const char *const patterns[]);
+bool match_path(struct argusmatch *matcher, const char *path);
+void free_match_patterns(struct argusmatch *matcher);
+
+#endif
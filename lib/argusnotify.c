@@ -36,13 +36,42 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "argusnotify.h"
+#include "argusbackend.h"
+#include "argusbudget.h"
 #include "arguscache.h"
+#include "arguscoalesce.h"
+#include "argusdigest.h"
+#include "argusfanotify.h"
+#include "argushot.h"
+#include "arguslimit.h"
+#include "argusmanifest.h"
+#include "argusmatch.h"
+#include "argusoverlay.h"
+#include "argusrecord.h"
 #include "argustree.h"
 #include "argusutil.h"
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+/**
+ * Report the lifecycle state of `watch` to whoever started it.
+ *
+ * @param watch
+ * @param state
+ */
+static void set_watch_state(struct arguswatch *const watch, const int state) {
+    if (watch->status != NULL) {
+        __atomic_store_n(&watch->status->state, state, __ATOMIC_RELEASE);
+    }
+}
+
 /**
  * When the cache is in an unrecoverable state, we discard the current
  * `inotify` file descriptor `oldfd` and create a new one (returned as the
@@ -54,13 +83,17 @@
  * @return
  */
 static void reinitialize(struct arguswatch **watch) {
+    const struct argusbackend *source;
     int fd, processevtfd, slot;
     bool rebuild = (*watch)->slot > -1;
 
+    if (replay_watch_table(*watch)) {
+        // When replaying, the rebuilt cache is read back from the recording.
+        return;
+    }
+
     if (rebuild) {
-        if ((*watch)->fd != EOF) {
-            close((*watch)->fd);
-        }
+        (*watch_backend(*watch)->close)(*watch);
         if ((*watch)->processevtfd != EOF) {
             close((*watch)->processevtfd);
         }
@@ -73,25 +106,42 @@ static void reinitialize(struct arguswatch **watch) {
 #endif
     }
 
-    if ((fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) == EOF) {
-#if DEBUG
-        perror("inotify_init1");
-#endif
+    set_watch_state(*watch, AW_STATE_TRAVERSING);
+    source = find_backend((*watch)->backend);
+    if ((fd = (*source->init)(*watch)) == EOF &&
+        source != &inotify_backend) {
+        // Watching every directory is also the fallback for kernels and
+        // filesystems that can't report events by file handle.
+        source = &inotify_backend;
+        fd = (*source->init)(*watch);
+    }
+    if (fd == EOF) {
+        set_watch_state(*watch, AW_STATE_FAILED);
         return;
     }
 #if DEBUG
-    printf("  new fd = %d\n", fd);
+    printf("  new %s fd = %d\n", source->name, fd);
     fflush(stdout);
 #endif
+    (*watch)->source = source;
     (*watch)->fd = fd;
 
-    // Begin traversing tree, or non-recursive directories.
-    watch_subtree(watch);
+    // Backends that watch the tree as a whole have no tree to walk.
+    if (source->add_watch != NULL) {
+        // Every directory is watched with its full mask again.
+        reset_hot_tracker(*watch);
+
+        // Begin traversing tree, or non-recursive directories. A full rebuild
+        // gets another chance at the full depth if it was degraded before.
+        (*watch)->depth_cap = 0;
+        watch_subtree(watch);
+    }
 
     if ((processevtfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == EOF) {
 #if DEBUG
         perror("eventfd");
 #endif
+        set_watch_state(*watch, AW_STATE_FAILED);
         return;
     }
 #if DEBUG
@@ -121,6 +171,127 @@ static void reinitialize(struct arguswatch **watch) {
     // containers in a single pod that don't have a path on the filesystem that
     // we specified to watch.
     check_cache_consistency(watch);
+    record_watch_table(*watch);
+    set_watch_state(*watch, AW_STATE_ARMED);
+
+    // Compare the files with the previous baseline, to catch changes made
+    // while nothing was watching them.
+    if ((*watch)->baseline) {
+        scan_manifest(*watch);
+    }
+}
+
+/**
+ * Carry on with an `inotify` instance handed over by another process instead
+ * of creating one and walking the tree: the wd -> path cache comes with it,
+ * and events queued in the meantime are still waiting to be read.
+ *
+ * @param watch
+ * @param handoff
+ */
+static void adopt_handoff(struct arguswatch **watch, struct arguswatch_handoff *handoff) {
+    int processevtfd;
+
+    (*watch)->fd = handoff->fd;
+    (*watch)->wd = handoff->wd;
+    (*watch)->paths = handoff->paths;
+    (*watch)->pathc = handoff->pathc;
+    (*watch)->depth_cap = handoff->depth_cap;
+    // The watch owns these now.
+    handoff->fd = EOF;
+    handoff->wd = NULL;
+    handoff->paths = NULL;
+    handoff->pathc = 0;
+    if (is_fanotify_fd((*watch)->fd)) {
+        // The marks come along with the group.
+        (*watch)->source = &fanotify_backend;
+        (*watch)->fanotify = open_fanotify_roots(*watch);
+    } else {
+        (*watch)->source = &inotify_backend;
+        acquire_instance();
+    }
+    update_watch_usage(*watch);
+#if DEBUG
+    printf("adopted fd = %d with %d entries\n", (*watch)->fd, (*watch)->pathc);
+    fflush(stdout);
+#endif
+    if ((*watch)->status != NULL) {
+        __atomic_store_n(&(*watch)->status->traversed, (*watch)->pathc, __ATOMIC_RELAXED);
+    }
+
+    if ((processevtfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == EOF) {
+#if DEBUG
+        perror("eventfd");
+#endif
+        set_watch_state(*watch, AW_STATE_FAILED);
+        return;
+    }
+    (*watch)->processevtfd = processevtfd;
+
+    if (find_cached_slot((*watch)->pid, (*watch)->sid) == -1) {
+        add_watch_to_cache(watch);
+    }
+    record_watch_table(*watch);
+    set_watch_state(*watch, AW_STATE_ARMED);
+}
+
+/**
+ * Check an event against the include patterns and file type predicates of
+ * `watch` before it is handed to the log function. Cheap checks go first:
+ * the directory bit comes with the event, patterns only need the path, and
+ * the file is only `lstat`ed if the predicates tell non-directories apart.
+ * Files that can no longer be `lstat`ed (e.g. deleted) pass as any
+ * non-directory type.
+ *
+ * @param watch
+ * @param event
+ * @param path
+ * @return
+ */
+static bool should_log_event(struct arguswatch *const watch, const struct inotify_event *const event,
+    const char *const path) {
+
+    char fullpath[PATH_MAX + NAME_MAX + 1];
+    const uint32_t types = watch->file_types, nondir = types & AW_FTYPE_NONDIR;
+    struct stat sb;
+
+    if (watch->include == NULL &&
+        !types) {
+        return true;
+    }
+
+    if (types &&
+        ((event->mask & IN_ISDIR) ? !(types & AW_FTYPE_DIR) : !nondir)) {
+        goto miss;
+    }
+
+    if (event->len) {
+        FORMAT_PATH(fullpath, path, event->name);
+    } else {
+        snprintf(fullpath, sizeof(fullpath), "%s", path);
+    }
+    if (watch->include != NULL &&
+        !match_path(watch->include, container_path(watch, fullpath))) {
+        goto miss;
+    }
+
+    if (!(event->mask & IN_ISDIR) &&
+        nondir && nondir != AW_FTYPE_NONDIR &&
+        !is_replaying(watch) &&
+        lstat(fullpath, &sb) == 0) {
+        if (S_ISREG(sb.st_mode) ? !(types & AW_FTYPE_REG) :
+            S_ISLNK(sb.st_mode) ? !(types & AW_FTYPE_LNK) :
+            !(types & AW_FTYPE_OTHER)) {
+            goto miss;
+        }
+    }
+
+    __atomic_add_fetch(&watch->filter_hits, 1, __ATOMIC_RELAXED);
+    return true;
+
+miss:
+    __atomic_add_fetch(&watch->filter_misses, 1, __ATOMIC_RELAXED);
+    return false;
 }
 
 /**
@@ -141,22 +312,25 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
     const char *path = NULL;
     char fullpath[PATH_MAX + NAME_MAX + 1];
     int slot, wdslot;
+    uint32_t mask;
     size_t evtlen;
 
     if (event->wd != EOF) {
         slot = find_watch_checked(*watch, event->wd);
         if (slot == -1 ||
             // Only continue with the events we care about.
-            !(event->mask & (*watch)->event_mask)) {
+            !((mask = whiteout_event_mask(*watch, event, wd_to_path_name(*watch, event->wd))) &
+              (*watch)->event_mask)) {
             // Discard all remaining events in current `read` buffer.
             return IN_BUFFER_SIZE;
         }
 
         path = wd_to_path_name(*watch, event->wd);
+        track_hot_event(*watch, event);
 
         struct arguswatch_event awevent = {
             .watch = *watch,
-            .event_mask = event->mask,
+            .event_mask = mask,
             .path_name = path,                          // Name of the watched directory.
             .file_name = event->len ? event->name : "", // Name of the file.
             .is_dir = (bool)(event->mask & IN_ISDIR)
@@ -168,10 +342,18 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
         fflush(stdout);
 #endif
 
-        // Call ArgusdImpl log function passed into this watch.
-        (*logfn)(&awevent);
+        // Call ArgusdImpl log function passed into this watch, unless the
+        // event is filtered out or folded into a pending identical one.
+        // Writes are held back until their content is known to have changed
+        // if content is verified.
+        if (should_log_event(*watch, event, path) &&
+            !digest_event(*watch, &awevent, event->wd)) {
+            coalesce_event(*watch, &awevent, event->wd, logfn);
+        }
 
-        if (!(event->mask & IN_IGNORED)) {
+        if (event->mask & IN_IGNORED) {
+            forget_hot_watch(*watch, event->wd);
+        } else {
             // IN_Q_OVERFLOW has (event->wd == EOF). Skip IN_IGNORED, since it
             // will come after an event that has already removed the
             // corresponding cache entry. Cache consistency check. See the
@@ -227,14 +409,18 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
          *      a second cache for the grandchild would leave the cache in a
          *      confused state).
          */
-        if (path_name_to_cache_slot(*watch, fullpath) == -1) {
+        if (path_name_to_cache_slot(*watch, fullpath) == -1 &&
+            // Nothing to do for an ignored directory.
+            ((*watch)->ignore == NULL ||
+             !match_path((*watch)->ignore, container_path(*watch, fullpath)))) {
             wdslot = find_watch(*watch, event->wd);
             if (wdslot > -1 &&
                 // Only do this if watching recursively.
-                ((*watch)->flags & AW_RECURSIVE)) {
+                ((*watch)->flags & AW_RECURSIVE) &&
+                !replay_watch_table(*watch)) {
                 (*watch)->pathc = 0;
                 watch_subtree(watch);
-                wlcache[(*watch)->slot] = *watch;
+                record_watch_table(*watch);
             }
         }
     } else if (event->mask & IN_DELETE_SELF) {
@@ -247,7 +433,10 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
         if (find_root_path(*watch, path) != NULL) {
             remove_root_path(watch, path);
         }
-        check_cache_consistency(watch);
+        if (!replay_watch_table(*watch)) {
+            check_cache_consistency(watch);
+            record_watch_table(*watch);
+        }
         // ... no need to remove the watch, that happens automatically.
     } else if ((event->mask & (IN_MOVED_FROM | IN_ISDIR)) == (IN_MOVED_FROM | IN_ISDIR)) {
         /**
@@ -464,7 +653,12 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
         return;
     }
 
-    if ((len = read((*watch)->fd, (void *)&buf, IN_BUFFER_SIZE)) == EOF) {
+    if (is_replaying(*watch)) {
+        len = replay_event_buffer(*watch, AWR_BUFFER, (void *)&buf, IN_BUFFER_SIZE);
+    } else {
+        len = (*watch_backend(*watch)->read_batch)(*watch, (void *)&buf, IN_BUFFER_SIZE);
+    }
+    if (len == EOF) {
         if (errno != EAGAIN) {
 #if DEBUG
             perror("read");
@@ -481,6 +675,7 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
     printf("`read` got %zd bytes\n", len);
     fflush(stdout);
 #endif
+    record_event_buffer(*watch, AWR_BUFFER, buf, len);
 
     // Point to the first event in the buffer.
     event = buf;
@@ -518,14 +713,18 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
             // directory tree. This number may warrant tuning on different
             // hardware and in environments with different filesystem activity
             // levels.
-            ualarm(2000, 0);
-            readlen = read((*watch)->fd, buf + len, IN_BUFFER_SIZE);
-
-            // In case `ualarm` should change errno.
-            savederr = errno;
-            // Cancel alarm.
-            ualarm(0, 0);
-            errno = savederr;
+            if (is_replaying(*watch)) {
+                readlen = replay_event_buffer(*watch, AWR_BUFFER_CONT, buf + len, IN_BUFFER_SIZE);
+            } else {
+                ualarm(2000, 0);
+                readlen = (*watch_backend(*watch)->read_batch)(*watch, buf + len, IN_BUFFER_SIZE);
+
+                // In case `ualarm` should change errno.
+                savederr = errno;
+                // Cancel alarm.
+                ualarm(0, 0);
+                errno = savederr;
+            }
 
             if (readlen == EOF &&
                 errno != EINTR) {
@@ -541,6 +740,9 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
             }
 
             if (errno != -1) {
+                if (readlen > 0) {
+                    record_event_buffer(*watch, AWR_BUFFER_CONT, buf + len, readlen);
+                }
                 len += readlen;
 #if DEBUG
                 printf("secondary `read` got %zd bytes\n", readlen);
@@ -562,6 +764,345 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
     }
 }
 
+/**
+ * Log an event read from a backend that reports events by path (e.g.
+ * `fanotify`), the same way an `inotify` event would be. There are no
+ * directory watches to keep up to date, so that is all there is to it.
+ *
+ * @param watch
+ * @param event
+ * @param path
+ * @param arg
+ */
+static void process_path_event(struct arguswatch *watch, const struct inotify_event *event,
+    const char *path, void *arg) {
+
+    const arguswatch_logfn logfn = *(arguswatch_logfn *)arg;
+    const uint32_t mask = whiteout_event_mask(watch, event, path);
+
+    if (!(mask & watch->event_mask)) {
+        return;
+    }
+
+    struct arguswatch_event awevent = {
+        .watch = watch,
+        .event_mask = mask,
+        .path_name = path,
+        .file_name = event->len ? event->name : "",
+        .is_dir = (bool)(event->mask & IN_ISDIR)
+    };
+
+    // Events on every directory share the same `wd`; folding also compares
+    // the directory.
+    if (should_log_event(watch, event, path) &&
+        !digest_event(watch, &awevent, event->wd)) {
+        coalesce_event(watch, &awevent, event->wd, logfn);
+    }
+}
+
+/**
+ * Read all available events of a watch whose backend reports them by path.
+ *
+ * @param watch
+ * @param logfn
+ */
+static void process_path_events(struct arguswatch *watch, arguswatch_logfn logfn) {
+    (*watch_backend(watch)->read_events)(watch, process_path_event, &logfn);
+}
+
+/**
+ * Returns the shorter of two `epoll` timeouts, where -1 means no timeout.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static int min_timeout(const int a, const int b) {
+    if (a == -1) {
+        return b;
+    }
+    return (b != -1 && b < a) ? b : a;
+}
+
+/**
+ * Returns true if two lists of patterns are the same, in the same order.
+ *
+ * @param ac
+ * @param a
+ * @param bc
+ * @param b
+ * @return
+ */
+static bool same_patterns(const unsigned int ac, char **a, const unsigned int bc, const char **b) {
+    unsigned int i;
+    if (ac != bc) {
+        return false;
+    }
+    for (i = 0; i < ac; ++i) {
+        if (strcmp(a[i], b[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns true if `path` is one of `paths`.
+ *
+ * @param pathc
+ * @param paths
+ * @param path
+ * @return
+ */
+static bool has_root_path(const unsigned int pathc, const char **paths, const char *const path) {
+    unsigned int i;
+    for (i = 0; i < pathc; ++i) {
+        if (paths[i] != NULL &&
+            strcmp(paths[i], path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Returns true if either path is the other one, or a directory above it.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static bool root_paths_overlap(const char *const a, const char *const b) {
+    size_t alen = strlen(a), blen = strlen(b);
+    if (alen > blen) {
+        return strncmp(a, b, blen) == 0 && a[blen] == '/';
+    }
+    return strncmp(a, b, alen) == 0 && (b[alen] == '/' || b[alen] == '\0');
+}
+
+/**
+ * Apply a new configuration to a running watch, touching as little of the
+ * `inotify` instance as possible. Name, tags, log format, include filters and
+ * rate limiting are only used in userspace, so changing them doesn't touch
+ * the kernel at all; pending coalesced events, rate limit tokens and hot
+ * directories carry over unless their own settings changed. A changed event
+ * mask is set on the existing watch descriptors (`inotify_add_watch` on a
+ * watched path replaces its mask and returns the same wd; `IN_MASK_ADD` isn't
+ * used since masks can also narrow), and root paths that were added or
+ * removed only add or remove their own subtrees. Changes to the shape of the
+ * tree (recursion, depth, ignore patterns, or a removed root overlapping one
+ * that is kept) rebuild the cache as before.
+ *
+ * @param watch
+ * @param update
+ * @param logfn
+ */
+static void apply_watch_update(struct arguswatch **watch, struct arguswatch_update *update,
+    arguswatch_logfn logfn) {
+
+    char **oldroots = (*watch)->rootpaths;
+    int oldrootc = (*watch)->rootpathc;
+    uint32_t oldmask = (*watch)->event_mask;
+    bool remask, rebuild, baselined;
+    int i, j;
+
+#if DEBUG
+    printf("updating watch (pid = %d, sid = %d)\n", (*watch)->pid, (*watch)->sid);
+    fflush(stdout);
+#endif
+
+    // Log anything suppressed under the old configuration first.
+    flush_rate_summary(*watch, true, logfn);
+
+    // Userspace-only state. The watch owns its configuration, so whatever is
+    // replaced is freed.
+    free((char *)(*watch)->name);
+    (*watch)->name = update->name;
+    free((char *)(*watch)->tags);
+    (*watch)->tags = update->tags;
+    free((char *)(*watch)->log_format);
+    (*watch)->log_format = update->log_format;
+    free_match_patterns((*watch)->include);
+    (*watch)->include = compile_match_patterns(update->includec, update->includes);
+    free_strings((char **)update->includes, update->includec);
+    (*watch)->file_types = update->file_types;
+    // Open coalescing windows and the tokens left in the rate limit carry on
+    // unless their own settings changed.
+    if (update->opts.coalesce_window != ((*watch)->coalesce != NULL ? (*watch)->coalesce->window : 0)) {
+        flush_coalesced_events(*watch, EOF, NULL, logfn);
+        free_coalesce_table((*watch)->coalesce);
+        (*watch)->coalesce = create_coalesce_table(update->opts.coalesce_window);
+    }
+    if (update->opts.verify_content != ((*watch)->digest != NULL)) {
+        if ((*watch)->digest != NULL) {
+            drain_digest_table(*watch, logfn);
+            if (epoll_ctl((*watch)->efd, EPOLL_CTL_DEL, (*watch)->digest->fd, NULL) == EOF) {
+#if DEBUG
+                perror("epoll_ctl");
+#endif
+            }
+            free_digest_table((*watch)->digest);
+            (*watch)->digest = NULL;
+        } else {
+            (*watch)->digest = create_digest_table(true);
+            add_digest_epoll_ctl_fd(*watch);
+        }
+    }
+    if (!same_rate_limit((*watch)->limit, update->opts.rate_limit, update->opts.rate_burst)) {
+        release_rate_limit((*watch)->limit);
+        (*watch)->limit = create_rate_limit(update->opts.rate_limit, update->opts.rate_burst);
+    }
+    release_rate_limit((*watch)->shared_limit);
+    (*watch)->shared_limit = update->opts.shared_limit;
+    baselined = (*watch)->baseline;
+    (*watch)->baseline = update->opts.baseline;
+
+    remask = update->event_mask != oldmask;
+
+    rebuild = update->flags != (*watch)->flags ||
+        update->max_depth != (*watch)->max_depth ||
+        !same_patterns((*watch)->ignorec, (*watch)->ignores, update->ignorec, update->ignores) ||
+        update->opts.backend != (*watch)->backend ||
+        // Filesystem marks are cheap to set up again, unlike a tree.
+        (watch_backend(*watch)->add_watch == NULL &&
+         (remask || !same_patterns(oldrootc, oldroots, update->pathc, update->paths)));
+    (*watch)->backend = update->opts.backend;
+    // Picked up by the next tick of a polled watch.
+    (*watch)->poll_interval = update->opts.poll_interval;
+    (*watch)->poll_budget = update->opts.poll_budget;
+    for (i = 0; i < oldrootc && !rebuild; ++i) {
+        if (oldroots[i] == NULL ||
+            has_root_path(update->pathc, update->paths, oldroots[i])) {
+            continue;
+        }
+        // Removing this root would take the subtree of another one with it.
+        for (j = 0; j < (int)update->pathc; ++j) {
+            if (root_paths_overlap(oldroots[i], update->paths[j])) {
+                rebuild = true;
+            }
+        }
+    }
+
+    (*watch)->event_mask = update->event_mask;
+    // Directories that are hot stay downgraded.
+    configure_hot_tracker(*watch, (update->event_mask & AW_HOT_MASK) ? update->opts.hot_threshold : 0,
+        update->opts.hot_cooldown);
+    (*watch)->flags = update->flags;
+    (*watch)->max_depth = update->max_depth;
+    free((char *)(*watch)->upperdir);
+    (*watch)->upperdir = update->opts.upperdir;
+    free_match_patterns((*watch)->ignore);
+    (*watch)->ignore = compile_match_patterns(update->ignorec, update->ignores);
+    free_strings((*watch)->ignores, (*watch)->ignorec);
+    (*watch)->ignorec = update->ignorec;
+    (*watch)->ignores = (char **)update->ignores;
+
+    if (rebuild) {
+        (*watch)->rootpathc = update->pathc;
+        (*watch)->rootpaths = (char **)update->paths;
+        free_strings(oldroots, oldrootc);
+        free((*watch)->rootstat);
+        validate_root_paths(*watch);
+        reinitialize(watch);
+        return;
+    }
+
+    // Drop the subtrees of roots that are no longer watched.
+    for (i = 0; i < oldrootc; ++i) {
+        if (oldroots[i] != NULL &&
+            !has_root_path(update->pathc, update->paths, oldroots[i])) {
+            remove_subtree(watch, oldroots[i]);
+        }
+    }
+
+    (*watch)->rootpathc = update->pathc;
+    (*watch)->rootpaths = (char **)update->paths;
+    free((*watch)->rootstat);
+    validate_root_paths(*watch);
+
+    // Set the new mask on the watch descriptors we already have.
+    if (remask) {
+        for (i = 0; i < (*watch)->pathc; ++i) {
+            if (add_backend_watch(*watch, (*watch)->paths[i],
+                watch_mask_for_path(*watch, (*watch)->paths[i]) &
+                ~(is_hot_watch(*watch, (*watch)->wd[i]) ? AW_HOT_MASK : 0)) == EOF) {
+#if DEBUG
+                fprintf(stderr, "inotify_add_watch: %s: %s\n", (*watch)->paths[i], strerror(errno));
+#endif
+            }
+        }
+    }
+
+    // Walk only the roots that weren't watched before.
+    for (i = 0; i < (*watch)->rootpathc; ++i) {
+        if (!has_root_path(oldrootc, (const char **)oldroots, (*watch)->rootpaths[i])) {
+            watch_new_root(watch, (*watch)->rootpaths[i]);
+        }
+    }
+    free_strings(oldroots, oldrootc);
+
+    record_watch_table(*watch);
+    if ((*watch)->baseline &&
+        !baselined) {
+        scan_manifest(*watch);
+    }
+}
+
+/**
+ * Free `count` strings of `strings`, and `strings` itself.
+ *
+ * @param strings
+ * @param count
+ */
+static void free_strings(char **strings, const unsigned int count) {
+    unsigned int i;
+    if (strings == NULL) {
+        return;
+    }
+    for (i = 0; i < count; ++i) {
+        free(strings[i]);
+    }
+    free(strings);
+}
+
+/**
+ * Free the configuration `watch` took over from `start_inotify_watcher` or
+ * `update_inotify_watcher`.
+ *
+ * @param watch
+ */
+static void free_watch_config(struct arguswatch *const watch) {
+    free_strings(watch->rootpaths, watch->rootpathc);
+    watch->rootpaths = NULL;
+    watch->rootpathc = 0;
+    free_strings(watch->ignores, watch->ignorec);
+    watch->ignores = NULL;
+    watch->ignorec = 0;
+    free((char *)watch->tags);
+    watch->tags = NULL;
+    free((char *)watch->log_format);
+    watch->log_format = NULL;
+    free((char *)watch->upperdir);
+    watch->upperdir = NULL;
+}
+
+/**
+ * Free the configuration of an update that won't be applied, and give back
+ * its reference to the shared rate limit.
+ *
+ * @param update
+ */
+static void free_update_config(struct arguswatch_update *const update) {
+    free((char *)update->name);
+    free_strings((char **)update->paths, update->pathc);
+    free_strings((char **)update->ignores, update->ignorec);
+    free_strings((char **)update->includes, update->includec);
+    free((char *)update->tags);
+    free((char *)update->log_format);
+    free((char *)update->opts.upperdir);
+    release_rate_limit(update->opts.shared_limit);
+}
+
 /**
  * Starts the `inotify` watcher process. Acts as the `main` function if this
  * was a standlone program. It is called from the main implementation of this
@@ -570,6 +1111,9 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
  * recursive or not, and loops infinitely waiting for new `inotify` events
  * until it receives a kill signal.
  *
+ * The watcher takes over the strings and arrays passed in, as well as
+ * `opts->upperdir`, and frees them once it is done with them.
+ *
  * @param name
  * @param pid
  * @param sid
@@ -579,31 +1123,40 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
  * @param paths
  * @param ignorec
  * @param ignores
+ * @param includec
+ * @param includes
+ * @param filetypes
  * @param mask
  * @param flags
  * @param maxdepth
+ * @param opts
  * @param tags
  * @param logformat
  * @param logfn
  * @return
  */
 int start_inotify_watcher(const char *name, const char *nodename, const char *podname, const int pid, const int sid,
-    const unsigned int pathc, const char *paths[], const unsigned int ignorec, const char *ignores[], const uint32_t mask,
-    const uint32_t flags, const int maxdepth, const char *tags, const char *logformat, arguswatch_logfn logfn) {
+    const unsigned int pathc, const char *paths[], const unsigned int ignorec, const char *ignores[],
+    const unsigned int includec, const char *includes[], const uint32_t filetypes, const uint32_t mask,
+    const uint32_t flags, const int maxdepth, const struct arguswatch_opts *opts, const char *tags,
+    const char *logformat, arguswatch_logfn logfn) {
 
     struct arguswatch *watch;
     // To keep this function idempotent we need to handle both existing
     // arguswatch configuration updates as well as new ones.
     // `inotify_add_watch` will also handle updates properly if a wd exists for
     // the supplied path.
-    int slot = find_cached_slot(pid, sid);
-    if (slot > -1 &&
-        wlcache[slot] != NULL) {
-        watch = wlcache[slot];
-    } else {
+    if ((watch = cached_watch(find_cached_slot(pid, sid))) == NULL) {
         // Create new arguswatch placeholder struct with select watch
-        // parameters that cannot change; the rest to be filled later.
-        watch = &(struct arguswatch){
+        // parameters that cannot change; the rest to be filled later. This
+        // has to outlive this block since the cache keeps a pointer to it.
+        if ((watch = calloc(1, sizeof(struct arguswatch))) == NULL) {
+#if DEBUG
+            perror("calloc");
+#endif
+            return EXIT_FAILURE;
+        }
+        *watch = (struct arguswatch){
             .name = name,
             .node_name = nodename,
             .pod_name = podname,
@@ -611,8 +1164,20 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
             .pid = pid,
             .sid = sid,
             .slot = -1,
-            .fd = EOF
+            .fd = EOF,
+            .pidfd = EOF
         };
+    } else {
+        // Drop what the previous run of this watcher was configured with.
+        free((char *)watch->name);
+        free((char *)watch->node_name);
+        free((char *)watch->pod_name);
+        watch->name = name;
+        watch->node_name = nodename;
+        watch->pod_name = podname;
+        free_watch_config(watch);
+        free(watch->rootstat);
+        watch->rootstat = NULL;
     }
 
     // Assign or update the passed-in watch parameters that can possibly change
@@ -621,29 +1186,68 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
     watch->rootpaths = (char **)paths;
     watch->ignorec = ignorec;
     watch->ignores = (char **)ignores;
+    // Compile ignore patterns once, rather than comparing against each of
+    // them for every path traversed.
+    free_match_patterns(watch->ignore);
+    watch->ignore = compile_match_patterns(ignorec, ignores);
+    free_match_patterns(watch->include);
+    watch->include = compile_match_patterns(includec, includes);
+    free_strings((char **)includes, includec);
+    watch->file_types = filetypes;
+    watch->coalesce = create_coalesce_table(opts != NULL ? opts->coalesce_window : 0);
+    watch->digest = create_digest_table(opts != NULL && opts->verify_content);
+    watch->limit = opts != NULL ? create_rate_limit(opts->rate_limit, opts->rate_burst) : NULL;
+    // The caller took a reference to the shared limit for this watcher.
+    watch->shared_limit = opts != NULL ? opts->shared_limit : NULL;
+    watch->hot = (opts != NULL && (mask & AW_HOT_MASK)) ?
+        create_hot_tracker(opts->hot_threshold, opts->hot_cooldown) : NULL;
     watch->event_mask = mask;
     watch->flags = flags;
     watch->max_depth = maxdepth;
     watch->tags = tags;
     watch->log_format = logformat;
+    watch->status = opts != NULL ? opts->status : NULL;
+    watch->baseline = opts != NULL && opts->baseline;
+    watch->backend = opts != NULL ? opts->backend : AW_BACKEND_INOTIFY;
+    watch->poll_interval = opts != NULL ? opts->poll_interval : 0;
+    watch->poll_budget = opts != NULL ? opts->poll_budget : 0;
+    watch->upperdir = opts != NULL ? opts->upperdir : NULL;
 
     // Validate root paths with `stat` and for duplicates.
     validate_root_paths(watch);
 
+    // Record the raw event stream for offline replay, if enabled. Only
+    // `inotify` streams can be replayed.
+    if (watch->record == NULL &&
+        watch->backend == AW_BACKEND_INOTIFY) {
+        watch->record = open_record_writer(watch);
+    }
+
 #if DEBUG
     printf("  Listening for events (pid = %d, sid = %d)\n", pid, sid);
     fflush(stdout);
 #endif
 
-    // Create an `inotify` instance and populate it with entries for paths.
-    reinitialize(&watch);
+    // Create an `inotify` instance and populate it with entries for paths, or
+    // carry on with the one handed over by the previous daemon.
+    // A polled watch only hands over its timer, so it starts over with a
+    // fresh index.
+    if (opts != NULL &&
+        opts->handoff != NULL &&
+        opts->handoff->backend != AW_BACKEND_POLL &&
+        watch->backend != AW_BACKEND_POLL) {
+        adopt_handoff(&watch, opts->handoff);
+    } else {
+        reinitialize(&watch);
+    }
     assert(watch->fd != EOF);
     assert(watch->processevtfd != EOF);
 
     // @TODO: document this
 
     struct epoll_event *epollevts; // Buffer where events are returned.
-    int nfds, i;
+    int nfds, i, timeout;
+    bool exited = false, detached = false;
     if ((epollevts = calloc(EPOLL_MAX_EVENTS, sizeof(struct epoll_event))) == NULL) {
 #if DEBUG
         perror("calloc");
@@ -658,24 +1262,52 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
 #if DEBUG
         perror("epoll_create");
 #endif
+        set_watch_state(watch, AW_STATE_FAILED);
         goto out;
     }
     add_epoll_ctl_fds(&watch);
 
+    // Watch the process itself, so we tear down as soon as the container
+    // exits instead of waiting on a dead /proc/[pid]/root until the
+    // controller destroys this watcher. Kernels without `pidfd_open` (< 5.3)
+    // fall back to waiting for the controller.
+    if ((watch->pidfd = open_pidfd(pid)) != EOF) {
+        watch->epollevt[2].data.fd = watch->pidfd;
+        watch->epollevt[2].events = EPOLLIN;
+        if (epoll_ctl(watch->efd, EPOLL_CTL_ADD, watch->pidfd, &watch->epollevt[2]) == EOF) {
+#if DEBUG
+            perror("epoll_ctl");
+#endif
+        }
+    }
+    add_digest_epoll_ctl_fd(watch);
+
     // Wait for events.
     for (;;) {
-        if ((nfds = epoll_pwait(watch->efd, epollevts, EPOLL_MAX_EVENTS, -1, &sigmask)) == EOF) {
+        // Wake up in time to log folded events whose window has passed, to
+        // report events suppressed by rate limiting, and to restore the mask
+        // of hot directories.
+        timeout = min_timeout(flush_expired_events(watch, logfn), flush_rate_summary(watch, false, logfn));
+        timeout = min_timeout(timeout, restore_cooled_watches(watch));
+        if ((nfds = epoll_pwait(watch->efd, epollevts, EPOLL_MAX_EVENTS, timeout, &sigmask)) == EOF) {
             if (errno == EINTR) {
                 continue;
             }
 #if DEBUG
             perror("epoll_pwait");
 #endif
+            set_watch_state(watch, AW_STATE_FAILED);
             goto out;
         }
         pthread_sigmask(SIG_SETMASK, &origmask, NULL);
 
         for (i = 0; i < nfds; ++i) {
+            if (epollevts[i].data.fd == watch->pidfd) {
+                // The watched process exited.
+                exited = true;
+                goto out;
+            }
+
             if ((epollevts[i].events & EPOLLERR) ||
                 (epollevts[i].events & EPOLLHUP) ||
                 (!(epollevts[i].events & EPOLLIN))) {
@@ -688,17 +1320,37 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
                 continue;
             }
 
-            if (epollevts[i].data.fd == watch->fd) {
+            if (epollevts[i].data.fd == watch->fd &&
+                watch_backend(watch)->read_events != NULL) {
+                // Events by path (e.g. `fanotify`) are available.
+                process_path_events(watch, logfn);
+            } else if (epollevts[i].data.fd == watch->fd) {
                 // `inotify` events are available.
                 process_inotify_events(&watch, logfn);
+            } else if (watch->digest != NULL &&
+                epollevts[i].data.fd == watch->digest->fd) {
+                // Files written to have been hashed.
+                emit_digested_events(watch, logfn);
             } else if (epollevts[i].data.fd == watch->processevtfd) {
                 // Anonymous pipe events are available.
                 uint64_t value;
+                struct arguswatch_update *update;
                 ssize_t len = read(epollevts[i].data.fd, &value, sizeof(uint64_t));
                 if (len != EOF &&
                     (value & ARGUSNOTIFY_KILL)) {
                     goto out;
                 }
+                if (len != EOF &&
+                    (value & ARGUSNOTIFY_DETACH)) {
+                    detached = true;
+                    goto out;
+                }
+                if ((update = __atomic_exchange_n(&watch->update, NULL, __ATOMIC_ACQ_REL)) != NULL) {
+                    apply_watch_update(&watch, update, logfn);
+                    free(update);
+                    // A rebuild replaces the descriptors in this batch.
+                    break;
+                }
             }
         }
     }
@@ -720,18 +1372,34 @@ out:
 #endif
     }
 
-    // Close `inotify` file descriptor.
-    if (close(watch->fd) == EOF) {
+    // Close `inotify` file descriptor, unless it is handed over.
+    if (detached) {
+        // Hot directories get their full mask back, since the next process
+        // doesn't know about them.
+        if (watch->hot != NULL &&
+            watch->hot->downgraded > 0) {
+            for (i = 0; i < watch->pathc; ++i) {
+                add_backend_watch(watch, watch->paths[i], watch_mask_for_path(watch, watch->paths[i]));
+            }
+        }
+    } else {
+        (*watch_backend(watch)->close)(watch);
+    }
+    // Close `eventfd` file descriptor.
+    if (close(watch->processevtfd) == EOF) {
 #if DEBUG
         perror("close");
 #endif
     }
-    // Close `eventfd` file descriptor.
-    if (close(watch->processevtfd) == EOF) {
+    watch->processevtfd = EOF;
+    // Close `pidfd` file descriptor.
+    if (watch->pidfd != EOF &&
+        close(watch->pidfd) == EOF) {
 #if DEBUG
         perror("close");
 #endif
     }
+    watch->pidfd = EOF;
     // Close `epoll` file descriptor.
     if (close(watch->efd) == EOF) {
 #if DEBUG
@@ -741,12 +1409,131 @@ out:
     // Free epoll event memory.
     free(epollevts);
 
+    // Drop a configuration that arrived too late to be applied.
+    struct arguswatch_update *update;
+    if ((update = __atomic_exchange_n(&watch->update, NULL, __ATOMIC_ACQ_REL)) != NULL) {
+        free_update_config(update);
+        free(update);
+    }
+
+    // Log writes still being hashed, and anything still waiting to be folded.
+    drain_digest_table(watch, logfn);
+    free_digest_table(watch->digest);
+    watch->digest = NULL;
+    flush_coalesced_events(watch, EOF, NULL, logfn);
+    free_coalesce_table(watch->coalesce);
+    watch->coalesce = NULL;
+    flush_rate_summary(watch, true, logfn);
+    release_rate_limit(watch->limit);
+    release_rate_limit(watch->shared_limit);
+    watch->limit = NULL;
+    watch->shared_limit = NULL;
+    drop_hot_tracker(watch);
+
+    close_record(watch->record);
+    watch->record = NULL;
+
+    // The caller may release the status once the watcher has returned.
+    if (watch->status != NULL &&
+        __atomic_load_n(&watch->status->state, __ATOMIC_ACQUIRE) != AW_STATE_FAILED) {
+        set_watch_state(watch, AW_STATE_STOPPED);
+    }
+    watch->status = NULL;
+
+    if (detached) {
+        // The cache goes along with the `inotify` instance.
+        return ARGUSNOTIFY_DETACHED;
+    }
+
     // Free watch cache.
     clear_watch(&watch);
 
+    if (exited) {
+        // Nothing will ever restart a watcher for this process, so give up
+        // the cache slot and the watch itself.
+        if (watch->slot > -1) {
+            mark_cache_slot_empty(watch->slot);
+        }
+        free(watch->wd);
+        free(watch->paths);
+        free(watch->rootstat);
+        free_match_patterns(watch->ignore);
+        free_match_patterns(watch->include);
+        free_watch_config(watch);
+        free((char *)watch->name);
+        free((char *)watch->node_name);
+        free((char *)watch->pod_name);
+        free(watch);
+        return ARGUSNOTIFY_PROCESS_EXIT;
+    }
+
     return errno ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
+/**
+ * Replays a recording made by a watcher started with a record directory set
+ * (see `set_record_dir`). The recorded `read` buffers are fed through the same
+ * event processing as a live watcher, either as fast as possible or with the
+ * original inter-buffer timing when `paced` is set. Cache rebuilds and other
+ * filesystem-dependent updates are taken from the wd -> path tables in the
+ * recording instead of touching the local filesystem.
+ *
+ * @param path
+ * @param paced
+ * @param logfn
+ * @param stats
+ * @return
+ */
+int replay_inotify_watcher(const char *path, const bool paced, arguswatch_logfn logfn,
+    struct argusrecord_stats *stats) {
+
+    struct arguswatch *watch;
+    struct argusrecord *rec;
+    unsigned int i;
+
+    if ((watch = calloc(1, sizeof(struct arguswatch))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return EXIT_FAILURE;
+    }
+    watch->slot = -1;
+    watch->fd = EOF;
+    watch->processevtfd = EOF;
+    watch->efd = EOF;
+    watch->pidfd = EOF;
+    if ((rec = open_record_reader(path, watch, paced)) == NULL) {
+        free(watch);
+        return EXIT_FAILURE;
+    }
+
+    // Load the initial cache, then process buffers until the recording is
+    // exhausted.
+    replay_watch_table(watch);
+    add_watch_to_cache(&watch);
+    while (!rec->eof) {
+        process_inotify_events(&watch, logfn);
+    }
+    if (stats != NULL) {
+        *stats = rec->stats;
+    }
+
+    mark_cache_slot_empty(watch->slot);
+    close_record(rec);
+    clear_watch(&watch);
+    for (i = 0; i < watch->rootpathc; ++i) {
+        free(watch->rootpaths[i]);
+    }
+    free(watch->rootpaths);
+    free(watch->paths);
+    free(watch->wd);
+    free((char *)watch->name);
+    free((char *)watch->node_name);
+    free((char *)watch->pod_name);
+    free(watch);
+    return EXIT_SUCCESS;
+}
+
 /**
  * Add `inotify` and `eventfd` file descriptors to the `epoll` definition.
  *
@@ -772,6 +1559,55 @@ void add_epoll_ctl_fds(struct arguswatch **watch) {
     }
 }
 
+/**
+ * Add the `eventfd` signalled when written files have been hashed to the
+ * `epoll` set, if content is verified.
+ *
+ * @param watch
+ */
+static void add_digest_epoll_ctl_fd(struct arguswatch *watch) {
+    if (watch->digest == NULL) {
+        return;
+    }
+    watch->epollevt[3].data.fd = watch->digest->fd;
+    watch->epollevt[3].events = EPOLLIN;
+    if (epoll_ctl(watch->efd, EPOLL_CTL_ADD, watch->digest->fd, &watch->epollevt[3]) == EOF) {
+#if DEBUG
+        perror("epoll_ctl");
+#endif
+    }
+}
+
+/**
+ * Writes the command `*arg` to the `processevtfd` of a running watch.
+ *
+ * @param watch
+ * @param arg
+ */
+static void signal_watch(struct arguswatch *watch, void *arg) {
+    if (watch->processevtfd == EOF) {
+        return;
+    }
+    if (write(watch->processevtfd, arg, sizeof(uint64_t)) == EOF) {
+#if DEBUG
+        perror("write");
+#endif
+    }
+}
+
+/**
+ * Stops a running watch if its `sid` is `*arg` or above.
+ *
+ * @param watch
+ * @param arg
+ */
+static void trim_watch(struct arguswatch *watch, void *arg) {
+    uint64_t value = ARGUSNOTIFY_KILL;
+    if (watch->sid >= *(const int *)arg) {
+        signal_watch(watch, &value);
+    }
+}
+
 /**
  * Sends the custom kill signal to break out of the `epoll` loop that is
  * listening for active `inotify` watch events.
@@ -779,17 +1615,153 @@ void add_epoll_ctl_fds(struct arguswatch **watch) {
  * @param pid
  */
 void send_watcher_kill_signal(const int pid) {
-    int i;
-    for (i = 0; i < wlcachec; ++i) {
-        if (wlcache[i]->pid == pid) {
-            uint64_t value = ARGUSNOTIFY_KILL;
-            if (write(wlcache[i]->processevtfd, &value, sizeof(value)) == EOF) {
+    uint64_t value = ARGUSNOTIFY_KILL;
+    for_each_pid_watch(pid, signal_watch, &value);
+}
+
+/**
+ * Posts the update `*arg` to a running watch. On success the watch owns the
+ * update and `*arg` is set to NULL.
+ *
+ * @param watch
+ * @param arg
+ */
+static void post_watch_update(struct arguswatch *watch, void *arg) {
+    struct arguswatch_update **update = arg, *stale, *posted = *update;
+    uint64_t value = ARGUSNOTIFY_UPDATE;
+
+    if (watch->processevtfd == EOF) {
+        return;
+    }
+    // Only the latest configuration matters if the watcher hasn't picked up
+    // the previous one yet.
+    if ((stale = __atomic_exchange_n(&watch->update, posted, __ATOMIC_ACQ_REL)) != NULL) {
+        free_update_config(stale);
+        free(stale);
+    }
+    if (write(watch->processevtfd, &value, sizeof(value)) == EOF) {
 #if DEBUG
-                perror("write");
+        perror("write");
 #endif
-            }
+        // The watcher is on its way out; leave the configuration to the caller.
+        if (__atomic_compare_exchange_n(&watch->update, &posted, NULL, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return;
         }
     }
+    *update = NULL;
+}
+
+/**
+ * Hands a new configuration to the running watcher of `pid`/`sid`, which
+ * applies it in place between events (see `apply_watch_update`) instead of
+ * being stopped and started again. The strings and arrays passed in, along
+ * with `opts->upperdir` and the reference to `opts->shared_limit`, are taken
+ * over (and freed) even if the update fails. Returns `EXIT_FAILURE` if there
+ * is no running watcher for `pid`/`sid`, in which case one has to be started.
+ *
+ * @param name
+ * @param pid
+ * @param sid
+ * @param pathc
+ * @param paths
+ * @param ignorec
+ * @param ignores
+ * @param includec
+ * @param includes
+ * @param filetypes
+ * @param mask
+ * @param flags
+ * @param maxdepth
+ * @param opts
+ * @param tags
+ * @param logformat
+ * @return
+ */
+int update_inotify_watcher(const char *name, const int pid, const int sid, const unsigned int pathc,
+    const char *paths[], const unsigned int ignorec, const char *ignores[], const unsigned int includec,
+    const char *includes[], const uint32_t filetypes, const uint32_t mask, const uint32_t flags, const int maxdepth,
+    const struct arguswatch_opts *opts, const char *tags, const char *logformat) {
+
+    struct arguswatch_update config, *update;
+
+    config = (struct arguswatch_update){
+        .name = name,
+        .pathc = pathc,
+        .ignorec = ignorec,
+        .includec = includec,
+        .paths = paths,
+        .ignores = ignores,
+        .includes = includes,
+        .file_types = filetypes,
+        .event_mask = mask,
+        .flags = flags,
+        .max_depth = maxdepth,
+        .tags = tags,
+        .log_format = logformat
+    };
+    if (opts != NULL) {
+        config.opts = *opts;
+    }
+    if ((update = malloc(sizeof(struct arguswatch_update))) == NULL) {
+#if DEBUG
+        perror("malloc");
+#endif
+        free_update_config(&config);
+        return EXIT_FAILURE;
+    }
+    *update = config;
+
+    // The watch is locked in the cache while the update is posted, so it
+    // can't exit and be freed meanwhile.
+    if (with_cached_watch(pid, sid, post_watch_update, &update) == -1 ||
+        update != NULL) {
+        free_update_config(update);
+        free(update);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Stops the watchers of `pid` for subjects that are no longer configured,
+ * i.e. those with a `sid` of `subjectc` or above.
+ *
+ * @param pid
+ * @param subjectc
+ */
+void trim_watcher_subjects(const int pid, const int subjectc) {
+    for_each_pid_watch(pid, trim_watch, (void *)&subjectc);
+}
+
+/**
+ * Stops the watchers of `pid`, leaving their `inotify` instances open and
+ * their caches in place to be handed over to another process with
+ * `send_watch_handoff`.
+ *
+ * @param pid
+ */
+void detach_inotify_watchers(const int pid) {
+    uint64_t value = ARGUSNOTIFY_DETACH;
+    for_each_pid_watch(pid, signal_watch, &value);
+}
+
+/**
+ * Returns a `pidfd` for `pid` that becomes readable once the process exits,
+ * or -1 if it can't be opened (e.g. the kernel doesn't support `pidfd_open`).
+ *
+ * @param pid
+ * @return
+ */
+static int open_pidfd(const int pid) {
+    int pidfd;
+    if ((pidfd = syscall(SYS_pidfd_open, pid, 0)) == EOF) {
+#if DEBUG
+        perror("pidfd_open");
+#endif
+        return EOF;
+    }
+    return pidfd;
 }
 
 /**
@@ -801,3 +1773,30 @@ void alarm_handler(int sig) {
     // Just interrupt `read`.
     return;
 }
+
+/**
+ * Adds the include filter counters of a watch to `arg`, an array of hits and
+ * misses.
+ *
+ * @param watch
+ * @param arg
+ */
+static void sum_filter_stats(struct arguswatch *watch, void *arg) {
+    unsigned long *stats = arg;
+    stats[0] += __atomic_load_n(&watch->filter_hits, __ATOMIC_RELAXED);
+    stats[1] += __atomic_load_n(&watch->filter_misses, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sum the include filter counters of all watches of `pid`.
+ *
+ * @param pid
+ * @param hits
+ * @param misses
+ */
+void get_filter_stats(const int pid, unsigned long *const hits, unsigned long *const misses) {
+    unsigned long stats[2] = {0, 0};
+    for_each_pid_watch(pid, sum_filter_stats, stats);
+    *hits = stats[0];
+    *misses = stats[1];
+}
@@ -29,20 +29,61 @@
 #include <signal.h>
 #include <sys/inotify.h>
 
+#include "argusrecord.h"
 #include "argusutil.h"
 
 #define EPOLL_MAX_EVENTS 64
 #define ARGUSNOTIFY_KILL SIGKILL
+// Written to `processevtfd` when a new configuration is waiting to be applied.
+// The `eventfd` counter adds up values, so this has no bits in common with
+// `ARGUSNOTIFY_KILL`.
+#define ARGUSNOTIFY_UPDATE 16
+// Written to `processevtfd` to stop the watcher, leaving its `inotify`
+// instance and cache to be handed over to another process.
+#define ARGUSNOTIFY_DETACH 32
+// Returned by `start_inotify_watcher` when the watched process exited.
+#define ARGUSNOTIFY_PROCESS_EXIT 2
+// Returned by `start_inotify_watcher` when the watcher was detached.
+#define ARGUSNOTIFY_DETACHED 3
 
+static void set_watch_state(struct arguswatch *watch, int state);
 static void reinitialize(struct arguswatch **watch);
+static void adopt_handoff(struct arguswatch **watch, struct arguswatch_handoff *handoff);
 static size_t process_next_inotify_event(struct arguswatch **watch, const struct inotify_event *event, ssize_t len,
     bool first, arguswatch_logfn logfn);
+static bool should_log_event(struct arguswatch *watch, const struct inotify_event *event, const char *path);
 static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn logfn);
+static void process_path_event(struct arguswatch *watch, const struct inotify_event *event, const char *path,
+    void *arg);
+static void process_path_events(struct arguswatch *watch, arguswatch_logfn logfn);
+static bool same_patterns(unsigned int ac, char **a, unsigned int bc, const char **b);
+static bool has_root_path(unsigned int pathc, const char **paths, const char *path);
+static bool root_paths_overlap(const char *a, const char *b);
+static void apply_watch_update(struct arguswatch **watch, struct arguswatch_update *update, arguswatch_logfn logfn);
+static void free_strings(char **strings, unsigned int count);
+static void free_watch_config(struct arguswatch *watch);
+static void free_update_config(struct arguswatch_update *update);
+static int open_pidfd(int pid);
+static void add_digest_epoll_ctl_fd(struct arguswatch *watch);
+static void signal_watch(struct arguswatch *watch, void *arg);
+static void trim_watch(struct arguswatch *watch, void *arg);
+static void post_watch_update(struct arguswatch *watch, void *arg);
+static void sum_filter_stats(struct arguswatch *watch, void *arg);
 int start_inotify_watcher(const char *name, const char *nodename, const char *podname, int pid, int sid,
-    unsigned int pathc, const char *paths[], unsigned int ignorec, const char *ignores[], uint32_t mask, uint32_t flags,
-    int maxdepth, const char *tags, const char *logformat, arguswatch_logfn logfn);
+    unsigned int pathc, const char *paths[], unsigned int ignorec, const char *ignores[], unsigned int includec,
+    const char *includes[], uint32_t filetypes, uint32_t mask, uint32_t flags, int maxdepth,
+    const struct arguswatch_opts *opts, const char *tags, const char *logformat, arguswatch_logfn logfn);
+int replay_inotify_watcher(const char *path, bool paced, arguswatch_logfn logfn, struct argusrecord_stats *stats);
 void add_epoll_ctl_fds(struct arguswatch **watch);
 void send_watcher_kill_signal(int pid);
+int update_inotify_watcher(const char *name, int pid, int sid, unsigned int pathc, const char *paths[],
+    unsigned int ignorec, const char *ignores[], unsigned int includec, const char *includes[], uint32_t filetypes,
+    uint32_t mask, uint32_t flags, int maxdepth, const struct arguswatch_opts *opts, const char *tags,
+    const char *logformat);
+void trim_watcher_subjects(int pid, int subjectc);
+void detach_inotify_watchers(int pid);
+void get_filter_stats(int pid, unsigned long *hits, unsigned long *misses);
+static int min_timeout(int a, int b);
 void alarm_handler(int sig);
 
 #endif
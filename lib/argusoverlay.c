@@ -0,0 +1,203 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "argusoverlay.h"
+#include "argusutil.h"
+
+/**
+ * Returns the host path of the writable layer of the container `pid` runs
+ * in, i.e. the `upperdir` of the overlay mounted on its root, or NULL if its
+ * root isn't an overlay with one. Changes to the container's filesystem all
+ * land there, since the layers below are read-only. The caller frees the
+ * path.
+ *
+ * @param pid
+ * @return
+ */
+char *find_overlay_upperdir(const int pid) {
+    char found[PATH_MAX + sizeof(OVERLAY_HOST_ROOT)];
+    char *upperdir;
+
+    if ((upperdir = find_overlay_option(pid, "upperdir=")) == NULL) {
+        return NULL;
+    }
+    snprintf(found, sizeof(found), "%s%s", OVERLAY_HOST_ROOT, upperdir);
+    free(upperdir);
+    return strdup(found);
+}
+
+/**
+ * Returns the read-only layers of the image the container `pid` runs from,
+ * i.e. the `lowerdir` of the overlay mounted on its root, or NULL if its root
+ * isn't an overlay. Containers started from the same image have the same
+ * layers. The caller frees the string.
+ *
+ * @param pid
+ * @return
+ */
+char *find_overlay_lowerdir(const int pid) {
+    return find_overlay_option(pid, "lowerdir=");
+}
+
+/**
+ * Returns the value of `option` (e.g. "upperdir=") of the overlay mounted on
+ * the root of the container `pid` runs in, or NULL if there is none. The
+ * caller frees the value.
+ *
+ * @param pid
+ * @param option
+ * @return
+ */
+static char *find_overlay_option(const int pid, const char *const option) {
+    char mountinfo[32];
+    char *line = NULL, *value, *found = NULL;
+    size_t size = 0;
+    FILE *fp;
+
+    snprintf(mountinfo, sizeof(mountinfo), "/proc/%d/mountinfo", pid);
+    if ((fp = fopen(mountinfo, "re")) == NULL) {
+#if DEBUG
+        perror("fopen");
+#endif
+        return NULL;
+    }
+    // The last mount on "/" is the one the process sees.
+    while (getline(&line, &size, fp) != EOF) {
+        if ((value = parse_overlay_option(line, option)) != NULL) {
+            free(found);
+            found = strdup(value);
+        }
+    }
+    free(line);
+    fclose(fp);
+    return found;
+}
+
+/**
+ * Parse a line of `/proc/[pid]/mountinfo`, and return the value of `option`
+ * of the mount if it is an overlay mounted on "/", or NULL. See proc(5) for
+ * the format. `line` is modified, and the value points into it.
+ *
+ * @param line
+ * @param option
+ * @return
+ */
+static char *parse_overlay_option(char *line, const char *const option) {
+    char *field, *saveptr = NULL, *mountpoint = NULL, *fstype = NULL, *options = NULL;
+    const size_t len = strlen(option);
+    int i;
+
+    for (i = 0; (field = strtok_r(i ? NULL : line, " \n", &saveptr)) != NULL; ++i) {
+        if (i == 4) {
+            mountpoint = field;
+        } else if (i > 5 &&
+            strcmp(field, "-") == 0) {
+            // Optional fields end here; then come the type, source and
+            // superblock options.
+            fstype = strtok_r(NULL, " \n", &saveptr);
+            strtok_r(NULL, " \n", &saveptr);
+            options = strtok_r(NULL, " \n", &saveptr);
+            break;
+        }
+    }
+    if (mountpoint == NULL ||
+        fstype == NULL ||
+        options == NULL ||
+        strcmp(mountpoint, "/") != 0 ||
+        strcmp(fstype, "overlay") != 0) {
+        return NULL;
+    }
+    // Commas in paths are escaped, so options split cleanly on them.
+    for (field = strtok_r(options, ",", &saveptr); field != NULL; field = strtok_r(NULL, ",", &saveptr)) {
+        if (strncmp(field, option, len) == 0) {
+            unescape_mount_field(field + len);
+            return field[len] == '/' ? field + len : NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Decode the octal escapes (e.g. "\040" for a space) of a field of
+ * `/proc/[pid]/mountinfo` in place.
+ *
+ * @param field
+ */
+static void unescape_mount_field(char *field) {
+    char *out = field;
+    for (; *field; ++out) {
+        if (field[0] == '\\' &&
+            field[1] >= '0' && field[1] <= '3' &&
+            field[2] >= '0' && field[2] <= '7' &&
+            field[3] >= '0' && field[3] <= '7') {
+            *out = (char)((field[1] - '0') << 6 | (field[2] - '0') << 3 | (field[3] - '0'));
+            field += 4;
+        } else {
+            *out = *field++;
+        }
+    }
+    *out = '\0';
+}
+
+/**
+ * Returns the mask `event` in the directory `path` should be logged with. In
+ * the upperdir of an overlay, removing a file of a lower layer creates a
+ * whiteout (a 0/0 character device) of the same name, which is a deletion
+ * as far as the container is concerned.
+ *
+ * @param watch
+ * @param event
+ * @param path
+ * @return
+ */
+uint32_t whiteout_event_mask(const struct arguswatch *const watch, const struct inotify_event *const event,
+    const char *const path) {
+
+    char fullpath[PATH_MAX + NAME_MAX + 1];
+    struct stat sb;
+
+    if (watch->upperdir == NULL ||
+        !(event->mask & (IN_CREATE | IN_MOVED_TO)) ||
+        (event->mask & IN_ISDIR) ||
+        !event->len ||
+        path == NULL) {
+        return event->mask;
+    }
+    FORMAT_PATH(fullpath, path, event->name);
+    if (lstat(fullpath, &sb) == 0 &&
+        S_ISCHR(sb.st_mode) &&
+        sb.st_rdev == makedev(0, 0)) {
+        return (event->mask & ~(IN_CREATE | IN_MOVED_TO)) | IN_DELETE;
+    }
+    return event->mask;
+}
@@ -0,0 +1,48 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_OVERLAY__
+#define __ARGUS_OVERLAY__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+
+#include "argusutil.h"
+
+// Host root the upperdir named in a container's mount options is under, as
+// seen from the daemon.
+#ifndef OVERLAY_HOST_ROOT
+#define OVERLAY_HOST_ROOT "/proc/1/root"
+#endif
+
+char *find_overlay_upperdir(int pid);
+char *find_overlay_lowerdir(int pid);
+static char *find_overlay_option(int pid, const char *option);
+static char *parse_overlay_option(char *line, const char *option);
+static void unescape_mount_field(char *field);
+uint32_t whiteout_event_mask(const struct arguswatch *watch, const struct inotify_event *event, const char *path);
+
+#endif
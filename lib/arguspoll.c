@@ -0,0 +1,739 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "argusbackend.h"
+#include "arguspoll.h"
+#include "argusmatch.h"
+#include "argustree.h"
+#include "argusutil.h"
+
+// Changes found by rescanning the tree every so often, for filesystems that
+// don't generate `inotify` events for them (e.g. NFS, FUSE or the lower
+// layers of an overlay).
+const struct argusbackend poll_backend = {
+    .name = "poll",
+    .init = init_poll_backend,
+    .read_events = read_poll_events,
+    .close = close_poll_backend
+};
+
+/**
+ * Returns the CPU time used by the calling thread in nanoseconds.
+ *
+ * @return
+ */
+static long long thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Returns whether `a` and `b` are the same point in time.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static bool same_time(const struct timespec *const a, const struct timespec *const b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/**
+ * `qsort` comparator ordering directory entries by name.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const struct arguspoll_entry *)a)->name, ((const struct arguspoll_entry *)b)->name);
+}
+
+/**
+ * Index the paths of `watch` without reporting anything, and start a timer
+ * that wakes the watch up to rescan them. Returns the timer fd, or -1 on
+ * error.
+ *
+ * @param watch
+ * @return
+ */
+static int init_poll_backend(struct arguswatch *const watch) {
+    const int interval = watch->poll_interval > 0 ? watch->poll_interval : POLL_INTERVAL;
+    const int tick = interval < POLL_TICK ? interval : POLL_TICK;
+    struct itimerspec its = {
+        .it_interval = { tick / 1000, (long)(tick % 1000) * 1000000 },
+        .it_value = { tick / 1000, (long)(tick % 1000) * 1000000 }
+    };
+    struct arguspoll *poll;
+    struct arguspoll_dir *dir;
+    char parent[PATH_MAX];
+    struct stat sb;
+    unsigned int i;
+    const char *base;
+    int fd;
+
+    if ((poll = calloc(1, sizeof(struct arguspoll))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return EOF;
+    }
+    for (i = 0; i < watch->rootpathc; ++i) {
+        if (watch->rootpaths[i] == NULL ||
+            lstat(watch->rootpaths[i], &sb) == EOF) {
+            continue;
+        }
+        if (S_ISDIR(sb.st_mode)) {
+            dir = add_poll_dir(poll, watch->rootpaths[i], NULL, false);
+        } else if ((base = strrchr(watch->rootpaths[i], '/')) != NULL) {
+            // A file is looked for in the listing of its directory.
+            snprintf(parent, sizeof(parent), "%.*s", (int)(base - watch->rootpaths[i]),
+                watch->rootpaths[i]);
+            dir = add_poll_dir(poll, *parent ? parent : "/", base + 1, false);
+        } else {
+            continue;
+        }
+        if (dir != NULL) {
+            dir->root = true;
+        }
+    }
+    if (poll->dirc == 0) {
+        free(poll);
+        errno = ENOENT;
+        return EOF;
+    }
+
+    // The first pass only builds the index.
+    watch->poll = poll;
+    for (i = 0; i < poll->dirc; ++i) {
+        scan_poll_dir(watch, i, NULL, NULL);
+    }
+    poll->next_pass = monotonic_ms() + interval;
+    if (watch->status != NULL) {
+        __atomic_store_n(&watch->status->traversed, poll->dirc, __ATOMIC_RELAXED);
+    }
+
+    if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == EOF ||
+        timerfd_settime(fd, 0, &its, NULL) == EOF) {
+#if DEBUG
+        perror("timerfd");
+#endif
+        if (fd != EOF) {
+            close(fd);
+        }
+        watch->fd = EOF;
+        close_poll_backend(watch);
+        return EOF;
+    }
+    return fd;
+}
+
+/**
+ * Carry on with the current pass over the tree of `watch`, or start the next
+ * one if it is due, for as long as the CPU budget of a tick allows. Changes
+ * are passed on to `fn` as the `inotify` events they would have caused.
+ *
+ * @param watch
+ * @param fn
+ * @param arg
+ */
+static void read_poll_events(struct arguswatch *const watch, argusbackend_eventfn fn, void *arg) {
+    struct arguspoll *const poll = watch->poll;
+    const int interval = watch->poll_interval > 0 ? watch->poll_interval : POLL_INTERVAL;
+    const int budget = watch->poll_budget > 0 ? watch->poll_budget : POLL_BUDGET;
+    const int tick = interval < POLL_TICK ? interval : POLL_TICK;
+    // Share of a tick the scan may spend on CPU.
+    const long long allowed = (long long)tick * budget * 10000;
+    long long start;
+    unsigned int i, j;
+    uint64_t ticks;
+
+    if (read(watch->fd, &ticks, sizeof(uint64_t)) == EOF) {
+        if (errno != EAGAIN) {
+#if DEBUG
+            perror("read");
+#endif
+        }
+        return;
+    }
+    if (poll->cursor == 0) {
+        if (monotonic_ms() < poll->next_pass) {
+            return;
+        }
+        poll->pass_start = monotonic_ms();
+    }
+
+    start = thread_cpu_ns();
+    while (poll->cursor < poll->dirc) {
+        scan_poll_dir(watch, poll->cursor++, fn, arg);
+        if (thread_cpu_ns() - start >= allowed) {
+            break;
+        }
+    }
+    if (poll->cursor < poll->dirc) {
+        return;
+    }
+
+    // Drop the directories that went away during the pass.
+    for (i = 0, j = 0; i < poll->dirc; ++i) {
+        if (poll->dirs[i].gone) {
+            free(poll->dirs[i].path);
+            free_poll_entries(poll->dirs[i].entries, poll->dirs[i].entryc);
+            continue;
+        }
+        poll->dirs[j++] = poll->dirs[i];
+    }
+    poll->dirc = j;
+    poll->cursor = 0;
+    ++poll->passes;
+    poll->next_pass = poll->pass_start + interval;
+#if DEBUG
+    printf("poll pass %lu: %u directories, %lu listed, %lu skipped\n", poll->passes, poll->dirc,
+        poll->listed, poll->skipped);
+    fflush(stdout);
+#endif
+}
+
+/**
+ * Stop the timer of `watch`, and deallocate its index.
+ *
+ * @param watch
+ */
+static void close_poll_backend(struct arguswatch *const watch) {
+    struct arguspoll *const poll = watch->poll;
+    unsigned int i;
+
+    if (watch->fd != EOF &&
+        close(watch->fd) == EOF) {
+#if DEBUG
+        perror("close");
+#endif
+    }
+    watch->fd = EOF;
+    if (poll == NULL) {
+        return;
+    }
+    for (i = 0; i < poll->dirc; ++i) {
+        free(poll->dirs[i].path);
+        free_poll_entries(poll->dirs[i].entries, poll->dirs[i].entryc);
+    }
+    free(poll->dirs);
+    free(poll);
+    watch->poll = NULL;
+}
+
+/**
+ * Add the directory `path` to the index of `poll`, to be listed later in the
+ * pass. Pointers to other directories of the index are invalidated. Returns
+ * the new directory, or NULL on error.
+ *
+ * @param poll
+ * @param path
+ * @param only
+ * @param announce
+ * @return
+ */
+static struct arguspoll_dir *add_poll_dir(struct arguspoll *const poll, const char *const path,
+    const char *const only, const bool announce) {
+
+    struct arguspoll_dir *dirs, *dir;
+
+    if ((dirs = realloc(poll->dirs, (poll->dirc + 1) * sizeof(struct arguspoll_dir))) == NULL) {
+#if DEBUG
+        perror("realloc");
+#endif
+        return NULL;
+    }
+    poll->dirs = dirs;
+    dir = &poll->dirs[poll->dirc];
+    memset(dir, 0, sizeof(struct arguspoll_dir));
+    if ((dir->path = strdup(path)) == NULL) {
+#if DEBUG
+        perror("strdup");
+#endif
+        return NULL;
+    }
+    dir->only = only;
+    dir->announce = announce;
+    ++poll->dirc;
+    return dir;
+}
+
+/**
+ * Check the directory `path` against the depth and ignore patterns of
+ * `watch`, the way a traversal would have when deciding whether to watch it.
+ *
+ * @param watch
+ * @param path
+ * @return
+ */
+static bool in_poll_subtree(const struct arguswatch *const watch, const char *const path) {
+    int depth = 0, maxdepth = watch->max_depth;
+    size_t rootlen = 0, len;
+    unsigned int i;
+    const char *p;
+
+    // Depth is counted from the closest root the directory is under.
+    for (i = 0; i < watch->rootpathc; ++i) {
+        if (watch->rootpaths[i] != NULL &&
+            (len = strlen(watch->rootpaths[i])) > rootlen &&
+            strncmp(path, watch->rootpaths[i], len) == 0 &&
+            (path[len] == '/' || path[len] == '\0')) {
+            rootlen = len;
+        }
+    }
+    for (p = path + rootlen; *p; ++p) {
+        depth += *p == '/';
+    }
+    if (!(watch->flags & AW_RECURSIVE)) {
+        maxdepth = 1;
+    }
+    if (maxdepth &&
+        depth + 1 > maxdepth) {
+        return false;
+    }
+    return watch->ignore == NULL ||
+        !match_path(watch->ignore, container_path(watch, path));
+}
+
+/**
+ * Read the entries of `dir` into a new array, sorted by name. Returns false
+ * if the directory couldn't be read.
+ *
+ * @param dir
+ * @param entries
+ * @param entryc
+ * @return
+ */
+static bool list_poll_dir(const struct arguspoll_dir *const dir, struct arguspoll_entry **entries,
+    unsigned int *entryc) {
+
+    struct arguspoll_entry *list = NULL, *grown;
+    unsigned int count = 0, size = 0;
+    struct dirent *dp;
+    struct stat sb;
+    DIR *dirp;
+
+    if ((dirp = opendir(dir->path)) == NULL) {
+#if DEBUG
+        perror("opendir");
+#endif
+        return false;
+    }
+    while ((dp = readdir(dirp)) != NULL) {
+        if (strcmp(dp->d_name, ".") == 0 ||
+            strcmp(dp->d_name, "..") == 0 ||
+            (dir->only != NULL && strcmp(dp->d_name, dir->only) != 0) ||
+            fstatat(dirfd(dirp), dp->d_name, &sb, AT_SYMLINK_NOFOLLOW) == EOF) {
+            continue;
+        }
+        if (count == size) {
+            size = size ? size * 2 : 16;
+            if ((grown = realloc(list, size * sizeof(struct arguspoll_entry))) == NULL) {
+#if DEBUG
+                perror("realloc");
+#endif
+                free_poll_entries(list, count);
+                closedir(dirp);
+                return false;
+            }
+            list = grown;
+        }
+        if ((list[count].name = strdup(dp->d_name)) == NULL) {
+            continue;
+        }
+        list[count].ino = sb.st_ino;
+        list[count].mtime = sb.st_mtim;
+        list[count].ctime = sb.st_ctim;
+        list[count].size = sb.st_size;
+        list[count].mode = sb.st_mode;
+        ++count;
+    }
+    closedir(dirp);
+    if (count > 0) {
+        qsort(list, count, sizeof(struct arguspoll_entry), compare_entries);
+    }
+    *entries = list;
+    *entryc = count;
+    return true;
+}
+
+/**
+ * Report how an entry of the directory `path` changed between `before` and
+ * `after`, which are the same file.
+ *
+ * @param watch
+ * @param path
+ * @param before
+ * @param after
+ * @param fn
+ * @param arg
+ */
+static void compare_poll_entry(struct arguswatch *const watch, const char *const path,
+    const struct arguspoll_entry *const before, const struct arguspoll_entry *const after,
+    argusbackend_eventfn fn, void *arg) {
+
+    const uint32_t isdir = S_ISDIR(after->mode) ? IN_ISDIR : 0;
+
+    if (!isdir &&
+        (!same_time(&before->mtime, &after->mtime) || before->size != after->size)) {
+        // Only the end result of the writes since the last look is known.
+        emit_poll_event(watch, path, after->name, IN_MODIFY, 0, fn, arg);
+        emit_poll_event(watch, path, after->name, IN_CLOSE_WRITE, 0, fn, arg);
+    } else if (!same_time(&before->ctime, &after->ctime) &&
+        same_time(&before->mtime, &after->mtime)) {
+        // The content of a directory changing changes its ctime too.
+        emit_poll_event(watch, path, after->name, IN_ATTRIB | isdir, 0, fn, arg);
+    }
+}
+
+/**
+ * Look at the directory `i` of the index of `watch` again. Changes to its
+ * entries are passed on to `fn` as events, unless it is being indexed for
+ * the first time (or `fn` is NULL). New subdirectories are added to the
+ * index; removed ones are dropped from it.
+ *
+ * @param watch
+ * @param i
+ * @param fn
+ * @param arg
+ */
+static void scan_poll_dir(struct arguswatch *const watch, const unsigned int i, argusbackend_eventfn fn,
+    void *arg) {
+
+    struct arguspoll *const poll = watch->poll;
+    struct arguspoll_dir *dir = &poll->dirs[i];
+    struct arguspoll_entry *entries, *old;
+    unsigned int entryc, oldc, a, b, removedc = 0, addedc = 0;
+    unsigned int *removed = NULL, *added = NULL;
+    char child[PATH_MAX], other[PATH_MAX];
+    bool report;
+    struct stat sb;
+    uint32_t isdir;
+
+    if (dir->gone) {
+        return;
+    }
+    if (lstat(dir->path, &sb) == EOF ||
+        !S_ISDIR(sb.st_mode)) {
+        drop_poll_subtree(watch, dir->path, dir->listed ? fn : NULL, arg);
+        return;
+    }
+    if (dir->listed &&
+        same_time(&dir->mtime, &sb.st_mtim) &&
+        same_time(&dir->ctime, &sb.st_ctim)) {
+        // No entry was added, removed or renamed. Their content still has to
+        // be looked at, since that doesn't show up in the directory's times.
+        ++poll->skipped;
+        if (fn != NULL &&
+            (watch->event_mask & AW_POLL_CONTENT_MASK)) {
+            restat_poll_dir(watch, dir, fn, arg);
+        }
+        return;
+    }
+    if (!list_poll_dir(dir, &entries, &entryc)) {
+        return;
+    }
+    ++poll->listed;
+    report = fn != NULL && (dir->listed || dir->announce);
+    old = dir->entries;
+    oldc = dir->entryc;
+    dir->entries = entries;
+    dir->entryc = entryc;
+    dir->listed = true;
+    dir->announce = false;
+    dir->mtime = sb.st_mtim;
+    dir->ctime = sb.st_ctim;
+    if (sb.st_mtim.tv_sec >= time(NULL) - 1) {
+        // Changes within the same timestamp wouldn't show; list it next time
+        // too.
+        dir->mtime.tv_sec = dir->mtime.tv_nsec = 0;
+    }
+    if ((removed = calloc(oldc + 1, sizeof(unsigned int))) == NULL ||
+        (added = calloc(entryc + 1, sizeof(unsigned int))) == NULL) {
+        free(removed);
+        free_poll_entries(old, oldc);
+        return;
+    }
+
+    // Both lists are sorted by name. Entries only in the old one went away,
+    // those only in the new one are new.
+    for (a = 0, b = 0; a < oldc || b < entryc;) {
+        const int cmp = a == oldc ? 1 : b == entryc ? -1 : strcmp(old[a].name, entries[b].name);
+        if (cmp == 0 &&
+            old[a].ino == entries[b].ino &&
+            (old[a].mode & S_IFMT) == (entries[b].mode & S_IFMT)) {
+            if (report) {
+                compare_poll_entry(watch, dir->path, &old[a], &entries[b], fn, arg);
+            }
+            ++a;
+            ++b;
+            continue;
+        }
+        if (cmp <= 0) {
+            removed[removedc++] = a++;
+        }
+        if (cmp >= 0) {
+            added[addedc++] = b++;
+        }
+    }
+
+    // An entry that went away and one that is new with the same inode were
+    // renamed within the directory.
+    for (a = 0; a < removedc; ++a) {
+        isdir = S_ISDIR(old[removed[a]].mode) ? IN_ISDIR : 0;
+        snprintf(child, sizeof(child), "%s/%s", dir->path, old[removed[a]].name);
+        for (b = 0; b < addedc; ++b) {
+            if (added[b] != UINT_MAX &&
+                entries[added[b]].ino == old[removed[a]].ino &&
+                (entries[added[b]].mode & S_IFMT) == (old[removed[a]].mode & S_IFMT)) {
+                break;
+            }
+        }
+        if (b == addedc) {
+            if (isdir) {
+                drop_poll_subtree(watch, child, report ? fn : NULL, arg);
+            }
+            if (report) {
+                emit_poll_event(watch, dir->path, old[removed[a]].name, IN_DELETE | isdir, 0, fn, arg);
+            }
+            continue;
+        }
+        if (report) {
+            ++poll->cookie;
+            emit_poll_event(watch, dir->path, old[removed[a]].name, IN_MOVED_FROM | isdir, poll->cookie,
+                fn, arg);
+            emit_poll_event(watch, dir->path, entries[added[b]].name, IN_MOVED_TO | isdir, poll->cookie,
+                fn, arg);
+        }
+        if (isdir) {
+            snprintf(other, sizeof(other), "%s/%s", dir->path, entries[added[b]].name);
+            if (in_poll_subtree(watch, other)) {
+                move_poll_subtree(poll, child, other);
+            } else {
+                drop_poll_subtree(watch, child, NULL, arg);
+            }
+        }
+        added[b] = UINT_MAX;
+    }
+
+    // The rest of the new entries were created.
+    for (b = 0; b < addedc; ++b) {
+        if (added[b] == UINT_MAX) {
+            continue;
+        }
+        const struct arguspoll_entry *const entry = &entries[added[b]];
+        isdir = S_ISDIR(entry->mode) ? IN_ISDIR : 0;
+        if (report) {
+            emit_poll_event(watch, dir->path, entry->name, IN_CREATE | isdir, 0, fn, arg);
+            if (S_ISREG(entry->mode)) {
+                if (entry->size > 0) {
+                    emit_poll_event(watch, dir->path, entry->name, IN_MODIFY, 0, fn, arg);
+                }
+                emit_poll_event(watch, dir->path, entry->name, IN_CLOSE_WRITE, 0, fn, arg);
+            }
+        }
+        snprintf(child, sizeof(child), "%s/%s", dir->path, entry->name);
+        if (isdir &&
+            in_poll_subtree(watch, child)) {
+            // Listed later in this pass; what is in it is new too.
+            add_poll_dir(poll, child, NULL, report);
+            dir = &poll->dirs[i];
+        }
+    }
+    free(removed);
+    free(added);
+    free_poll_entries(old, oldc);
+}
+
+/**
+ * `stat` the entries of `dir`, which hasn't had any added or removed since
+ * it was last listed, and report those that changed.
+ *
+ * @param watch
+ * @param dir
+ * @param fn
+ * @param arg
+ */
+static void restat_poll_dir(struct arguswatch *const watch, struct arguspoll_dir *const dir,
+    argusbackend_eventfn fn, void *arg) {
+
+    struct arguspoll_entry current;
+    struct stat sb;
+    unsigned int i;
+    int dfd;
+
+    if ((dfd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == EOF) {
+        return;
+    }
+    for (i = 0; i < dir->entryc; ++i) {
+        if (fstatat(dfd, dir->entries[i].name, &sb, AT_SYMLINK_NOFOLLOW) == EOF ||
+            sb.st_ino != dir->entries[i].ino) {
+            // Caught halfway through a change; the directory's times will
+            // show it next time.
+            continue;
+        }
+        current = dir->entries[i];
+        current.mtime = sb.st_mtim;
+        current.ctime = sb.st_ctim;
+        current.size = sb.st_size;
+        current.mode = sb.st_mode;
+        compare_poll_entry(watch, dir->path, &dir->entries[i], &current, fn, arg);
+        dir->entries[i] = current;
+    }
+    close(dfd);
+}
+
+/**
+ * Drop the directory `path` and everything under it from the index of
+ * `watch`. If `fn` is set, the entries that were in them are reported as
+ * deleted. Root directories stay in the index, empty, in case they come back.
+ *
+ * @param watch
+ * @param path
+ * @param fn
+ * @param arg
+ */
+static void drop_poll_subtree(struct arguswatch *const watch, const char *const path, argusbackend_eventfn fn,
+    void *arg) {
+
+    struct arguspoll *const poll = watch->poll;
+    const size_t len = strlen(path);
+    struct arguspoll_dir *dir;
+    unsigned int i, j;
+
+    for (i = 0; i < poll->dirc; ++i) {
+        dir = &poll->dirs[i];
+        if (dir->gone ||
+            strncmp(dir->path, path, len) != 0 ||
+            (dir->path[len] != '/' && dir->path[len] != '\0')) {
+            continue;
+        }
+        if (fn != NULL) {
+            for (j = 0; j < dir->entryc; ++j) {
+                emit_poll_event(watch, dir->path, dir->entries[j].name,
+                    IN_DELETE | (S_ISDIR(dir->entries[j].mode) ? IN_ISDIR : 0), 0, fn, arg);
+            }
+            if (dir->only == NULL) {
+                emit_poll_event(watch, dir->path, "", IN_DELETE_SELF, 0, fn, arg);
+            }
+        }
+        free_poll_entries(dir->entries, dir->entryc);
+        dir->entries = NULL;
+        dir->entryc = 0;
+        if (dir->root) {
+            // Whatever shows up again is new.
+            dir->announce = true;
+            dir->listed = false;
+            continue;
+        }
+        dir->gone = true;
+    }
+}
+
+/**
+ * Rename the directory `from` and everything under it to `to` in the index
+ * of `poll`.
+ *
+ * @param poll
+ * @param from
+ * @param to
+ */
+static void move_poll_subtree(struct arguspoll *const poll, const char *const from, const char *const to) {
+    const size_t len = strlen(from);
+    char path[PATH_MAX], *moved;
+    unsigned int i;
+
+    for (i = 0; i < poll->dirc; ++i) {
+        if (poll->dirs[i].gone ||
+            strncmp(poll->dirs[i].path, from, len) != 0 ||
+            (poll->dirs[i].path[len] != '/' && poll->dirs[i].path[len] != '\0') ||
+            (size_t)snprintf(path, sizeof(path), "%s%s", to, poll->dirs[i].path + len) >= sizeof(path) ||
+            (moved = strdup(path)) == NULL) {
+            continue;
+        }
+        free(poll->dirs[i].path);
+        poll->dirs[i].path = moved;
+    }
+}
+
+/**
+ * Pass an `inotify` event `mask` on the entry `name` of the directory `path`
+ * on to `fn`.
+ *
+ * @param watch
+ * @param path
+ * @param name
+ * @param mask
+ * @param cookie
+ * @param fn
+ * @param arg
+ */
+static void emit_poll_event(struct arguswatch *const watch, const char *const path, const char *const name,
+    const uint32_t mask, const uint32_t cookie, argusbackend_eventfn fn, void *arg) {
+
+    char evtbuf[sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *const event = (struct inotify_event *)evtbuf;
+    const size_t len = strlen(name);
+
+    if (len > NAME_MAX) {
+        return;
+    }
+    event->wd = 0;
+    event->mask = mask;
+    event->cookie = cookie;
+    event->len = len ? len + 1 : 0;
+    memcpy(event->name, name, len + 1);
+    (*fn)(watch, event, path, arg);
+}
+
+/**
+ * Deallocate the entries of a directory.
+ *
+ * @param entries
+ * @param entryc
+ */
+static void free_poll_entries(struct arguspoll_entry *const entries, const unsigned int entryc) {
+    unsigned int i;
+    for (i = 0; i < entryc; ++i) {
+        free(entries[i].name);
+    }
+    free(entries);
+}
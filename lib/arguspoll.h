@@ -0,0 +1,107 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_POLL__
+#define __ARGUS_POLL__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "argusbackend.h"
+#include "argusutil.h"
+
+#ifndef POLL_INTERVAL
+#define POLL_INTERVAL 10000 // Time (ms) between the starts of two passes over the tree.
+#endif
+
+#ifndef POLL_BUDGET
+#define POLL_BUDGET 5       // Percentage of a CPU a scan may use.
+#endif
+
+#ifndef POLL_TICK
+#define POLL_TICK 100       // Time (ms) between two slices of a pass.
+#endif
+
+// Events that need the entries of unchanged directories to be `stat`ed
+// again; the rest only show up in the listing of a directory.
+#define AW_POLL_CONTENT_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE)
+
+// Entry of a scanned directory, as of the last time it was looked at.
+struct arguspoll_entry {
+    char *name;
+    ino_t ino;
+    struct timespec mtime, ctime;
+    off_t size;
+    mode_t mode;
+};
+
+// Directory under the paths of a watch, and its entries sorted by name.
+struct arguspoll_dir {
+    char *path;
+    const char *only;                 // The one entry watched, if a root is a file (NULL for all).
+    struct timespec mtime, ctime;     // Of the directory, when it was last listed.
+    struct arguspoll_entry *entries;
+    unsigned int entryc;
+    bool root;                        // Root of the watch; kept even while it doesn't exist.
+    bool listed;                      // Entries have been read at least once.
+    bool announce;                    // Report the entries as created when first listed.
+    bool gone;                        // Removed; dropped at the end of the pass.
+};
+
+// Index of the tree of a polled watch.
+struct arguspoll {
+    struct arguspoll_dir *dirs;
+    unsigned int dirc, cursor;        // Directories, and the next one to scan in this pass.
+    long long next_pass;              // Monotonic time (ms) the next pass starts at.
+    long long pass_start;             // Monotonic time (ms) the current pass started at.
+    uint32_t cookie;                  // Last cookie handed to a pair of rename events.
+    unsigned long passes;             // Passes completed.
+    unsigned long listed, skipped;    // Directories read again, and skipped as unchanged.
+};
+
+extern const struct argusbackend poll_backend;
+
+static int init_poll_backend(struct arguswatch *watch);
+static void read_poll_events(struct arguswatch *watch, argusbackend_eventfn fn, void *arg);
+static void close_poll_backend(struct arguswatch *watch);
+static struct arguspoll_dir *add_poll_dir(struct arguspoll *poll, const char *path, const char *only,
+    bool announce);
+static bool in_poll_subtree(const struct arguswatch *watch, const char *path);
+static bool list_poll_dir(const struct arguspoll_dir *dir, struct arguspoll_entry **entries,
+    unsigned int *entryc);
+static void scan_poll_dir(struct arguswatch *watch, unsigned int i, argusbackend_eventfn fn, void *arg);
+static void compare_poll_entry(struct arguswatch *watch, const char *path, const struct arguspoll_entry *before,
+    const struct arguspoll_entry *after, argusbackend_eventfn fn, void *arg);
+static void restat_poll_dir(struct arguswatch *watch, struct arguspoll_dir *dir, argusbackend_eventfn fn,
+    void *arg);
+static void drop_poll_subtree(struct arguswatch *watch, const char *path, argusbackend_eventfn fn, void *arg);
+static void move_poll_subtree(struct arguspoll *poll, const char *from, const char *to);
+static void emit_poll_event(struct arguswatch *watch, const char *path, const char *name, uint32_t mask,
+    uint32_t cookie, argusbackend_eventfn fn, void *arg);
+static void free_poll_entries(struct arguspoll_entry *entries, unsigned int entryc);
+
+#endif
@@ -0,0 +1,468 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argusrecord.h"
+#include "argusutil.h"
+
+static char recorddir_[PATH_MAX];
+
+/**
+ * Writes all `len` bytes of `buf` to `fp`. Returns false on error.
+ *
+ * @param fp
+ * @param buf
+ * @param len
+ * @return
+ */
+static bool write_bytes(FILE *fp, const void *buf, const size_t len) {
+    return fwrite(buf, 1, len, fp) == len;
+}
+
+/**
+ * Reads exactly `len` bytes from `fp` into `buf`. Returns false on error or
+ * at the end of the file.
+ *
+ * @param fp
+ * @param buf
+ * @param len
+ * @return
+ */
+static bool read_bytes(FILE *fp, void *buf, const size_t len) {
+    return fread(buf, 1, len, fp) == len;
+}
+
+/**
+ * Strings are stored as a 32-bit length followed by the bytes, without the
+ * terminating NUL.
+ */
+static bool write_string(FILE *fp, const char *str) {
+    uint32_t len = str ? strlen(str) : 0;
+    return write_bytes(fp, &len, sizeof(len)) &&
+        write_bytes(fp, str, len);
+}
+
+static char *read_string(FILE *fp) {
+    uint32_t len;
+    char *str;
+    if (!read_bytes(fp, &len, sizeof(len)) ||
+        len > PATH_MAX) {
+        return NULL;
+    }
+    if ((str = calloc(len + 1, sizeof(char))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return NULL;
+    }
+    if (!read_bytes(fp, str, len)) {
+        free(str);
+        return NULL;
+    }
+    return str;
+}
+
+/**
+ * Set the directory new watchers record their raw `inotify` event stream to.
+ * An empty string or NULL disables recording.
+ *
+ * @param dir
+ */
+void set_record_dir(const char *const dir) {
+    snprintf(recorddir_, sizeof(recorddir_), "%s", dir ? dir : "");
+}
+
+/**
+ * Open a recording file for `watch` in the configured record directory and
+ * write the header describing the watch. Returns NULL when recording is
+ * disabled or the file can't be created.
+ *
+ * @param watch
+ * @return
+ */
+struct argusrecord *open_record_writer(const struct arguswatch *const watch) {
+    char path[PATH_MAX];
+    struct argusrecord *rec;
+    uint32_t header[2] = {AWR_MAGIC, AWR_VERSION};
+    int32_t ids[2] = {watch->pid, watch->sid};
+    int32_t maxdepth = watch->max_depth;
+    uint32_t rootpathc = watch->rootpathc;
+    unsigned int i;
+
+    if (recorddir_[0] == '\0') {
+        return NULL;
+    }
+    if ((rec = calloc(1, sizeof(struct argusrecord))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return NULL;
+    }
+    if (snprintf(path, sizeof(path), "%s/%s.%d.%d.awr", recorddir_, watch->name ? watch->name : "watch",
+        watch->pid, watch->sid) >= (int)sizeof(path) ||
+        (rec->fp = fopen(path, "we")) == NULL) {
+#if DEBUG
+        fprintf(stderr, "fopen: %s: %s\n", path, strerror(errno));
+#endif
+        free(rec);
+        return NULL;
+    }
+
+    if (!write_bytes(rec->fp, header, sizeof(header)) ||
+        !write_bytes(rec->fp, ids, sizeof(ids)) ||
+        !write_bytes(rec->fp, &watch->event_mask, sizeof(watch->event_mask)) ||
+        !write_bytes(rec->fp, &watch->flags, sizeof(watch->flags)) ||
+        !write_bytes(rec->fp, &maxdepth, sizeof(maxdepth)) ||
+        !write_string(rec->fp, watch->name) ||
+        !write_string(rec->fp, watch->node_name) ||
+        !write_string(rec->fp, watch->pod_name) ||
+        !write_bytes(rec->fp, &rootpathc, sizeof(rootpathc))) {
+        goto err;
+    }
+    for (i = 0; i < watch->rootpathc; ++i) {
+        if (!write_string(rec->fp, watch->rootpaths[i])) {
+            goto err;
+        }
+    }
+    return rec;
+
+err:
+#if DEBUG
+    perror("fwrite");
+#endif
+    fclose(rec->fp);
+    free(rec);
+    return NULL;
+}
+
+/**
+ * Open a recording for replay and populate `watch` from its header. The
+ * wd -> path table is not loaded until the first `replay_watch_table`.
+ *
+ * @param path
+ * @param watch
+ * @param paced
+ * @return
+ */
+struct argusrecord *open_record_reader(const char *const path, struct arguswatch *const watch, const bool paced) {
+    struct argusrecord *rec;
+    uint32_t header[2], rootpathc;
+    int32_t ids[2], maxdepth;
+    unsigned int i;
+
+    if ((rec = calloc(1, sizeof(struct argusrecord))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return NULL;
+    }
+    rec->replay = true;
+    rec->paced = paced;
+    if ((rec->fp = fopen(path, "re")) == NULL) {
+#if DEBUG
+        fprintf(stderr, "fopen: %s: %s\n", path, strerror(errno));
+#endif
+        free(rec);
+        return NULL;
+    }
+
+    if (!read_bytes(rec->fp, header, sizeof(header)) ||
+        header[0] != AWR_MAGIC ||
+        header[1] != AWR_VERSION ||
+        !read_bytes(rec->fp, ids, sizeof(ids)) ||
+        !read_bytes(rec->fp, &watch->event_mask, sizeof(watch->event_mask)) ||
+        !read_bytes(rec->fp, &watch->flags, sizeof(watch->flags)) ||
+        !read_bytes(rec->fp, &maxdepth, sizeof(maxdepth)) ||
+        (watch->name = read_string(rec->fp)) == NULL ||
+        (watch->node_name = read_string(rec->fp)) == NULL ||
+        (watch->pod_name = read_string(rec->fp)) == NULL ||
+        !read_bytes(rec->fp, &rootpathc, sizeof(rootpathc)) ||
+        (watch->rootpaths = calloc(rootpathc, sizeof(char *))) == NULL) {
+        goto err;
+    }
+    for (i = 0; i < rootpathc; ++i) {
+        if ((watch->rootpaths[i] = read_string(rec->fp)) == NULL) {
+            goto err;
+        }
+    }
+    watch->pid = ids[0];
+    watch->sid = ids[1];
+    watch->max_depth = maxdepth;
+    watch->rootpathc = rootpathc;
+    watch->record = rec;
+    return rec;
+
+err:
+#if DEBUG
+    fprintf(stderr, "%s: not a valid recording\n", path);
+#endif
+    fclose(rec->fp);
+    free(rec);
+    return NULL;
+}
+
+/**
+ * Flush and close a recording.
+ *
+ * @param rec
+ */
+void close_record(struct argusrecord *rec) {
+    if (rec == NULL) {
+        return;
+    }
+    if (fclose(rec->fp) == EOF) {
+#if DEBUG
+        perror("fclose");
+#endif
+    }
+    free(rec);
+}
+
+/**
+ * Whether `watch` is being driven from a recording rather than a live
+ * `inotify` instance. Filesystem-dependent operations (traversal, `lstat`
+ * consistency checks, `inotify_rm_watch`) are skipped while replaying; their
+ * outcome is taken from the recorded wd -> path tables instead.
+ *
+ * @param watch
+ * @return
+ */
+bool is_replaying(const struct arguswatch *const watch) {
+    return watch->record != NULL &&
+        watch->record->replay;
+}
+
+/**
+ * Append a raw buffer returned by `read` on the `inotify` fd to the
+ * recording.
+ *
+ * @param watch
+ * @param type
+ * @param buf
+ * @param len
+ */
+void record_event_buffer(const struct arguswatch *const watch, const uint8_t type, const void *const buf,
+    const size_t len) {
+
+    struct argusrecord *rec = watch->record;
+    uint64_t ts = monotonic_ns();
+    uint32_t buflen = len;
+
+    if (rec == NULL || rec->replay) {
+        return;
+    }
+    if (!write_bytes(rec->fp, &type, sizeof(type)) ||
+        !write_bytes(rec->fp, &ts, sizeof(ts)) ||
+        !write_bytes(rec->fp, &buflen, sizeof(buflen)) ||
+        !write_bytes(rec->fp, buf, len)) {
+#if DEBUG
+        perror("fwrite");
+#endif
+        return;
+    }
+    ++rec->stats.buffers;
+    rec->stats.bytes += len;
+}
+
+/**
+ * Append a snapshot of the wd -> path table of `watch` to the recording. This
+ * is done whenever the table changes as a result of looking at the
+ * filesystem, rather than as a pure function of the events themselves.
+ *
+ * @param watch
+ */
+void record_watch_table(const struct arguswatch *const watch) {
+    struct argusrecord *rec = watch->record;
+    uint8_t type = AWR_TABLE;
+    uint64_t ts = monotonic_ns();
+    uint32_t pathc = watch->pathc;
+    unsigned int i;
+
+    if (rec == NULL || rec->replay) {
+        return;
+    }
+    if (!write_bytes(rec->fp, &type, sizeof(type)) ||
+        !write_bytes(rec->fp, &ts, sizeof(ts)) ||
+        !write_bytes(rec->fp, &pathc, sizeof(pathc))) {
+        goto err;
+    }
+    for (i = 0; i < watch->pathc; ++i) {
+        if (!write_bytes(rec->fp, &watch->wd[i], sizeof(int32_t)) ||
+            !write_string(rec->fp, watch->paths[i])) {
+            goto err;
+        }
+    }
+    // Tables are rare compared to buffers; flush so a crash still leaves a
+    // usable recording up to the last rebuild.
+    fflush(rec->fp);
+    ++rec->stats.tables;
+    return;
+
+err:
+#if DEBUG
+    perror("fwrite");
+#endif
+    return;
+}
+
+/**
+ * Read a table record (after its type byte) and replace the wd -> path cache
+ * of `watch` with it.
+ *
+ * @param watch
+ * @return
+ */
+static bool load_watch_table(struct arguswatch *const watch) {
+    struct argusrecord *rec = watch->record;
+    uint64_t ts;
+    uint32_t pathc, i;
+
+    if (!read_bytes(rec->fp, &ts, sizeof(ts)) ||
+        !read_bytes(rec->fp, &pathc, sizeof(pathc))) {
+        rec->eof = true;
+        return false;
+    }
+    for (i = 0; i < watch->pathc; ++i) {
+        free(watch->paths[i]);
+    }
+    watch->pathc = 0;
+    if ((watch->wd = realloc(watch->wd, (pathc ? pathc : 1) * sizeof(int))) == NULL ||
+        (watch->paths = realloc(watch->paths, (pathc ? pathc : 1) * sizeof(char *))) == NULL) {
+#if DEBUG
+        perror("realloc");
+#endif
+        rec->eof = true;
+        return false;
+    }
+    for (i = 0; i < pathc; ++i) {
+        if (!read_bytes(rec->fp, &watch->wd[i], sizeof(int32_t)) ||
+            (watch->paths[i] = read_string(rec->fp)) == NULL) {
+            rec->eof = true;
+            return false;
+        }
+        ++watch->pathc;
+    }
+    ++rec->stats.tables;
+    return true;
+}
+
+/**
+ * Stand-in for `read` on the `inotify` fd while replaying. Returns the next
+ * recorded buffer of `type`, 0 once the recording is exhausted, or -1 with
+ * `errno` set to EINTR when a follow-up read (AWR_BUFFER_CONT) was not
+ * satisfied in the original run either. Table snapshots encountered along the
+ * way are applied so the cache stays in step with the recording.
+ *
+ * @param watch
+ * @param type
+ * @param buf
+ * @param len
+ * @return
+ */
+ssize_t replay_event_buffer(struct arguswatch *const watch, const uint8_t type, void *const buf, const size_t len) {
+    struct argusrecord *rec = watch->record;
+    uint64_t ts, now, target;
+    uint32_t buflen;
+    int c;
+
+    for (;;) {
+        if ((c = fgetc(rec->fp)) == EOF) {
+            rec->eof = true;
+            return 0;
+        }
+        if (c == AWR_TABLE) {
+            if (!load_watch_table(watch)) {
+                return 0;
+            }
+            continue;
+        }
+        if (type == AWR_BUFFER_CONT &&
+            c != AWR_BUFFER_CONT) {
+            // The original follow-up `read` timed out.
+            ungetc(c, rec->fp);
+            errno = EINTR;
+            return EOF;
+        }
+        break;
+    }
+
+    if (!read_bytes(rec->fp, &ts, sizeof(ts)) ||
+        !read_bytes(rec->fp, &buflen, sizeof(buflen)) ||
+        buflen > len ||
+        !read_bytes(rec->fp, buf, buflen)) {
+#if DEBUG
+        fprintf(stderr, "truncated or corrupt recording\n");
+#endif
+        rec->eof = true;
+        return 0;
+    }
+
+    if (rec->paced) {
+        now = monotonic_ns();
+        if (rec->stats.buffers == 0) {
+            rec->firstts = ts;
+            rec->startts = now;
+        }
+        target = rec->startts + (ts - rec->firstts);
+        if (target > now) {
+            struct timespec delay = {
+                .tv_sec = (target - now) / 1000000000ULL,
+                .tv_nsec = (target - now) % 1000000000ULL
+            };
+            nanosleep(&delay, NULL);
+        }
+    }
+
+    ++rec->stats.buffers;
+    rec->stats.bytes += buflen;
+    return buflen;
+}
+
+/**
+ * Stand-in for a filesystem-dependent cache update while replaying: if the
+ * next record is a table snapshot, load it into `watch`. Returns false when
+ * not replaying, in which case the caller should perform the real update.
+ *
+ * @param watch
+ * @return
+ */
+bool replay_watch_table(struct arguswatch *const watch) {
+    int c;
+    if (!is_replaying(watch)) {
+        return false;
+    }
+    if ((c = fgetc(watch->record->fp)) == AWR_TABLE) {
+        load_watch_table(watch);
+    } else if (c != EOF) {
+        ungetc(c, watch->record->fp);
+    }
+    return true;
+}
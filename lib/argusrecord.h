@@ -0,0 +1,68 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_RECORD__
+#define __ARGUS_RECORD__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "argusutil.h"
+
+#define AWR_MAGIC   0x52575741 // "AWWR"
+#define AWR_VERSION 1
+
+#define AWR_BUFFER      1 // Raw buffer returned by a `read` of the `inotify` fd.
+#define AWR_BUFFER_CONT 2 // Raw buffer returned by the follow-up `read` for a hanging IN_MOVED_FROM.
+#define AWR_TABLE       3 // Snapshot of the wd -> path table.
+
+struct argusrecord_stats {
+    uint64_t buffers;  // Number of event buffers recorded/replayed.
+    uint64_t bytes;    // Total bytes of raw `inotify` events.
+    uint64_t tables;   // Number of wd -> path table snapshots.
+};
+
+struct argusrecord {
+    FILE *fp;                       // Recording file.
+    bool replay;                    // Opened for replay rather than recording.
+    bool paced;                     // Replay with original inter-buffer timing.
+    bool eof;                       // No more records left to replay.
+    uint64_t firstts;               // Timestamp of the first replayed buffer.
+    uint64_t startts;               // Wall time the replay started at.
+    struct argusrecord_stats stats;
+};
+
+void set_record_dir(const char *dir);
+struct argusrecord *open_record_writer(const struct arguswatch *watch);
+struct argusrecord *open_record_reader(const char *path, struct arguswatch *watch, bool paced);
+void close_record(struct argusrecord *rec);
+bool is_replaying(const struct arguswatch *watch);
+void record_event_buffer(const struct arguswatch *watch, uint8_t type, const void *buf, size_t len);
+void record_watch_table(const struct arguswatch *watch);
+ssize_t replay_event_buffer(struct arguswatch *watch, uint8_t type, void *buf, size_t len);
+bool replay_watch_table(struct arguswatch *watch);
+
+#endif
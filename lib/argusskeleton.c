@@ -0,0 +1,328 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "argusoverlay.h"
+#include "argusskeleton.h"
+#include "argustree.h"
+#include "argusutil.h"
+
+// Skeletons of the trees traversed so far, shared by every watcher. A
+// skeleton is never modified once it is in here, so it can be walked without
+// holding the lock.
+static pthread_mutex_t skeletonmux_ = PTHREAD_MUTEX_INITIALIZER;
+static struct argusskeleton **skeletons_;
+static unsigned int skeletonc_;
+static int skeletonsize_ = SKELETON_CACHE_SIZE;
+static unsigned long skeletonclock_;
+
+/**
+ * Set the number of skeletons kept at once, dropping the least recently used
+ * ones if there are more. 0 turns the cache off.
+ *
+ * @param size
+ */
+void set_skeleton_cache_size(const int size) {
+    pthread_mutex_lock(&skeletonmux_);
+    __atomic_store_n(&skeletonsize_, size > 0 ? size : 0, __ATOMIC_RELAXED);
+    while (skeletonc_ > (unsigned int)skeletonsize_) {
+        evict_skeleton();
+    }
+    pthread_mutex_unlock(&skeletonmux_);
+}
+
+/**
+ * Returns an empty skeleton keyed for a recursive traversal of the root
+ * `path` of `watch`, or NULL if the skeleton of `path` isn't worth sharing
+ * (e.g. it is in the writable layer of a container, or not a directory).
+ * Paths on the overlay of a container are keyed by its image layers, since
+ * the overlay itself is different for each container; other paths by the
+ * device and inode of the root. The caller releases the skeleton, or
+ * publishes it once it is filled in.
+ *
+ * @param watch
+ * @param path
+ * @return
+ */
+struct argusskeleton *new_skeleton(const struct arguswatch *const watch, const char *const path) {
+    char procroot[32];
+    struct argusskeleton *skeleton;
+    struct stat sb, rootsb;
+    size_t len = 0;
+    unsigned int i;
+
+    // The writable layer of a container is its own, so there is nothing to
+    // share there.
+    if (__atomic_load_n(&skeletonsize_, __ATOMIC_RELAXED) == 0 ||
+        container_root(watch, path, procroot, sizeof(procroot)) != procroot ||
+        lstat(path, &sb) == EOF ||
+        !S_ISDIR(sb.st_mode)) {
+        return NULL;
+    }
+    if ((skeleton = calloc(1, sizeof(struct argusskeleton))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return NULL;
+    }
+    if (stat(procroot, &rootsb) == 0 &&
+        rootsb.st_dev == sb.st_dev) {
+        skeleton->layer = find_overlay_lowerdir(watch->pid);
+    }
+    if (skeleton->layer == NULL) {
+        skeleton->dev = sb.st_dev;
+        skeleton->ino = sb.st_ino;
+    }
+    skeleton->root = strdup(container_path(watch, path));
+    skeleton->max_depth = watch->max_depth;
+    skeleton->refs = 1;
+    clock_gettime(CLOCK_REALTIME, &skeleton->taken);
+
+    for (i = 0; i < watch->ignorec; ++i) {
+        len += strlen(watch->ignores[i]) + 1;
+    }
+    if ((skeleton->ignores = malloc(len + 1)) != NULL) {
+        skeleton->ignores[0] = '\0';
+        for (i = 0, len = 0; i < watch->ignorec; ++i) {
+            len += sprintf(skeleton->ignores + len, "%s\n", watch->ignores[i]);
+        }
+    }
+    if (skeleton->root == NULL ||
+        skeleton->ignores == NULL) {
+#if DEBUG
+        perror("malloc");
+#endif
+        free_skeleton(skeleton);
+        return NULL;
+    }
+    return skeleton;
+}
+
+/**
+ * Returns whether `a` and `b` are skeletons of the same traversal.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static bool same_skeleton_key(const struct argusskeleton *const a, const struct argusskeleton *const b) {
+    if ((a->layer == NULL) != (b->layer == NULL) ||
+        (a->layer != NULL && strcmp(a->layer, b->layer) != 0)) {
+        return false;
+    }
+    return a->dev == b->dev &&
+        a->ino == b->ino &&
+        a->max_depth == b->max_depth &&
+        strcmp(a->root, b->root) == 0 &&
+        strcmp(a->ignores, b->ignores) == 0;
+}
+
+/**
+ * Returns the cached skeleton of the traversal `key` is for, or NULL if
+ * there is none. The caller releases it.
+ *
+ * @param key
+ * @return
+ */
+struct argusskeleton *find_skeleton(const struct argusskeleton *const key) {
+    struct argusskeleton *skeleton = NULL;
+    unsigned int i;
+
+    pthread_mutex_lock(&skeletonmux_);
+    for (i = 0; i < skeletonc_; ++i) {
+        if (same_skeleton_key(skeletons_[i], key)) {
+            skeleton = skeletons_[i];
+            ++skeleton->refs;
+            skeleton->used = ++skeletonclock_;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&skeletonmux_);
+    return skeleton;
+}
+
+/**
+ * Append the directory `path` (relative to the root), `level` deep, to a
+ * skeleton being filled in. Returns false if it couldn't be added.
+ *
+ * @param skeleton
+ * @param path
+ * @param level
+ * @param sb
+ * @return
+ */
+bool add_skeleton_dir(struct argusskeleton *const skeleton, const char *const path, const int level,
+    const struct stat *const sb) {
+
+    struct argusskeleton_dir *dirs, *dir;
+    unsigned int cap;
+
+    // Trees can have hundreds of thousands of directories, so grow
+    // geometrically.
+    if (skeleton->dirc == skeleton->dircap) {
+        cap = skeleton->dircap ? skeleton->dircap * 2 : ALLOC_INC;
+        if ((dirs = realloc(skeleton->dirs, cap * sizeof(struct argusskeleton_dir))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            return false;
+        }
+        skeleton->dirs = dirs;
+        skeleton->dircap = cap;
+    }
+    dir = &skeleton->dirs[skeleton->dirc];
+    if ((dir->path = strdup(path)) == NULL) {
+#if DEBUG
+        perror("strdup");
+#endif
+        return false;
+    }
+    dir->level = level;
+    dir->mtime = sb->st_mtim;
+    dir->ctime = sb->st_ctim;
+    // Timestamps are coarser than the changes they stamp: a directory changed
+    // just before it was read could change again without them moving.
+    dir->recent = sb->st_ctim.tv_sec > skeleton->taken.tv_sec - SKELETON_RACY_WINDOW ||
+        sb->st_mtim.tv_sec > skeleton->taken.tv_sec - SKELETON_RACY_WINDOW;
+    ++skeleton->dirc;
+    return true;
+}
+
+/**
+ * Returns whether the directory `sb` is the `stat` of still has the entries
+ * it had when `dir` was recorded, going by its timestamps.
+ *
+ * @param dir
+ * @param sb
+ * @return
+ */
+bool skeleton_dir_unchanged(const struct argusskeleton_dir *const dir, const struct stat *const sb) {
+    return !dir->recent &&
+        S_ISDIR(sb->st_mode) &&
+        dir->mtime.tv_sec == sb->st_mtim.tv_sec &&
+        dir->mtime.tv_nsec == sb->st_mtim.tv_nsec &&
+        dir->ctime.tv_sec == sb->st_ctim.tv_sec &&
+        dir->ctime.tv_nsec == sb->st_ctim.tv_nsec;
+}
+
+/**
+ * Add a filled in skeleton to the cache, in place of any skeleton of the
+ * same traversal, for later traversals to reuse. Takes over the reference of
+ * the caller.
+ *
+ * @param skeleton
+ */
+void publish_skeleton(struct argusskeleton *const skeleton) {
+    struct argusskeleton **skeletons;
+    unsigned int i;
+
+    pthread_mutex_lock(&skeletonmux_);
+    for (i = 0; i < skeletonc_; ++i) {
+        if (same_skeleton_key(skeletons_[i], skeleton)) {
+            unref_skeleton(skeletons_[i]);
+            skeletons_[i] = skeletons_[--skeletonc_];
+            break;
+        }
+    }
+    if (skeletonsize_ > 0 &&
+        skeletonc_ == (unsigned int)skeletonsize_) {
+        evict_skeleton();
+    }
+    if (skeletonsize_ == 0 ||
+        (skeletons = realloc(skeletons_, (skeletonc_ + 1) * sizeof(struct argusskeleton *))) == NULL) {
+        unref_skeleton(skeleton);
+    } else {
+        skeletons_ = skeletons;
+        skeleton->used = ++skeletonclock_;
+        skeletons_[skeletonc_++] = skeleton;
+    }
+    pthread_mutex_unlock(&skeletonmux_);
+}
+
+/**
+ * Give back a reference to `skeleton`, freeing it if it was the last one.
+ *
+ * @param skeleton
+ */
+void release_skeleton(struct argusskeleton *const skeleton) {
+    pthread_mutex_lock(&skeletonmux_);
+    unref_skeleton(skeleton);
+    pthread_mutex_unlock(&skeletonmux_);
+}
+
+/**
+ * Drop the least recently used skeleton from the cache. Called with the lock
+ * held.
+ */
+static void evict_skeleton() {
+    unsigned int i, lru = 0;
+    if (skeletonc_ == 0) {
+        return;
+    }
+    for (i = 1; i < skeletonc_; ++i) {
+        if (skeletons_[i]->used < skeletons_[lru]->used) {
+            lru = i;
+        }
+    }
+    unref_skeleton(skeletons_[lru]);
+    skeletons_[lru] = skeletons_[--skeletonc_];
+}
+
+/**
+ * Give back a reference to `skeleton`. Called with the lock held.
+ *
+ * @param skeleton
+ */
+static void unref_skeleton(struct argusskeleton *const skeleton) {
+    if (--skeleton->refs == 0) {
+        free_skeleton(skeleton);
+    }
+}
+
+/**
+ * Free `skeleton` and everything it holds.
+ *
+ * @param skeleton
+ */
+static void free_skeleton(struct argusskeleton *const skeleton) {
+    unsigned int i;
+    for (i = 0; i < skeleton->dirc; ++i) {
+        free(skeleton->dirs[i].path);
+    }
+    free(skeleton->dirs);
+    free(skeleton->layer);
+    free(skeleton->root);
+    free(skeleton->ignores);
+    free(skeleton);
+}
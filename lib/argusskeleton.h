@@ -0,0 +1,84 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_SKELETON__
+#define __ARGUS_SKELETON__
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "argusutil.h"
+
+#ifndef ALLOC_INC
+#define ALLOC_INC 32
+#endif
+
+#ifndef SKELETON_CACHE_SIZE
+#define SKELETON_CACHE_SIZE 64 // Skeletons kept at once.
+#endif
+
+#ifndef SKELETON_RACY_WINDOW
+#define SKELETON_RACY_WINDOW 2 // Time (s) before a traversal that changes may share a timestamp with.
+#endif
+
+// Directory of a traversed tree, as of the traversal.
+struct argusskeleton_dir {
+    char *path;                       // Relative to the root ("" for the root itself).
+    int level;                        // Depth below the root.
+    struct timespec mtime, ctime;
+    bool recent;                      // Changed too close to the traversal for its timestamps to be trusted.
+};
+
+// Directories a recursive traversal of a root watched, in the order it
+// visited them (parents before their children). Watches of the same root of
+// the same image, with the same ignores and depth, walk the same skeleton.
+struct argusskeleton {
+    char *layer;                      // Image layers the root is on (NULL if keyed by `dev`/`ino`).
+    dev_t dev;
+    ino_t ino;
+    char *root;                       // Path of the root in the container.
+    char *ignores;                    // Ignore patterns, one per line.
+    int max_depth;
+    struct timespec taken;            // Wall clock time the traversal started at.
+    struct argusskeleton_dir *dirs;
+    unsigned int dirc, dircap;
+    unsigned int refs;                // References, including the cache's.
+    unsigned long used;               // When the skeleton was last looked up.
+};
+
+void set_skeleton_cache_size(int size);
+struct argusskeleton *new_skeleton(const struct arguswatch *watch, const char *path);
+static bool same_skeleton_key(const struct argusskeleton *a, const struct argusskeleton *b);
+struct argusskeleton *find_skeleton(const struct argusskeleton *key);
+bool add_skeleton_dir(struct argusskeleton *skeleton, const char *path, int level, const struct stat *sb);
+bool skeleton_dir_unchanged(const struct argusskeleton_dir *dir, const struct stat *sb);
+void publish_skeleton(struct argusskeleton *skeleton);
+void release_skeleton(struct argusskeleton *skeleton);
+static void evict_skeleton();
+static void unref_skeleton(struct argusskeleton *skeleton);
+static void free_skeleton(struct argusskeleton *skeleton);
+
+#endif
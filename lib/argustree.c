@@ -23,6 +23,7 @@
  */
 
 #define _GNU_SOURCE
+#include <dirent.h>
 #include <errno.h>
 #include <ftw.h>
 #include <limits.h>
@@ -35,12 +36,25 @@
 #include <unistd.h>
 
 #include "argustree.h"
+#include "argusbackend.h"
+#include "argusbudget.h"
 #include "arguscache.h"
+#include "argusmatch.h"
+#include "argusrecord.h"
+#include "argusskeleton.h"
 #include "argusutil.h"
 
-static struct arguswatch **watch_;
-static struct stat *rootstat_;
-static char foundpath_[PATH_MAX], pidc_[8];
+// State for the `nftw` callbacks, which take no argument of their own. Each
+// watcher runs in its own thread, and many of them can traverse at once.
+static __thread struct arguswatch **watch_;
+static __thread struct stat *rootstat_;
+static __thread char foundpath_[PATH_MAX], rootc_[PATH_MAX];
+static __thread int deepest_;
+// Skeleton of the traversal in progress (NULL if it won't be cached), the
+// length of its root path, and the depth `nftw` starts at below that root.
+static __thread struct argusskeleton *building_;
+static __thread size_t rootlen_;
+static __thread int leveloffset_;
 
 /**
  * Validate watch root paths are sanity checked before performing any
@@ -164,9 +178,14 @@ void remove_root_path(struct arguswatch **watch, const char *const path) {
 #endif
         return;
     }
-    *p = NULL;
-
+    // Keep the roots left contiguous, so they stay within `rootpathc`.
+    free(*p);
     --(*watch)->rootpathc;
+    *p = (*watch)->rootpaths[(*watch)->rootpathc];
+    (*watch)->rootpaths[(*watch)->rootpathc] = NULL;
+    if ((*watch)->rootstat != NULL) {
+        (*watch)->rootstat[p - (*watch)->rootpaths] = (*watch)->rootstat[(*watch)->rootpathc];
+    }
     if ((*watch)->rootpathc == 0) {
 #if DEBUG
         printf("no more root paths left to monitor\n");
@@ -177,22 +196,23 @@ void remove_root_path(struct arguswatch **watch, const char *const path) {
 
 int traverse_root(const char *path, const struct stat *sb, int tflag, struct FTW *ftwbuf) {
     if (rootstat_->st_ino == sb->st_ino) {
-        snprintf(foundpath_, sizeof(foundpath_), "/proc/%d/root%s", (*watch_)->pid,
-            path + (strlen(pidc_) + 13));
+        // Paths are walked from "<root>/.".
+        snprintf(foundpath_, sizeof(foundpath_), "%s%s", rootc_, path + strlen(rootc_) + 2);
         return FTW_STOP;
     }
     return FTW_CONTINUE;
 }
 /**
- * Find moved path by locating it in /proc/[pid]/root by previously-stored
- * inode value. If found, update root path in cached watch.
+ * Find moved path by locating it in /proc/[pid]/root (or the upperdir it is
+ * under) by previously-stored inode value. If found, update root path in
+ * cached watch.
  *
  * @param watch
  * @param path
  * @return
  */
 void find_replace_root_path(struct arguswatch **watch, const char *const path) {
-    char procpath[PATH_MAX];
+    char procpath[PATH_MAX + 2];
     char **p;
     struct stat *rootstat;
 
@@ -210,8 +230,8 @@ void find_replace_root_path(struct arguswatch **watch, const char *const path) {
 #endif
         return;
     }
-    snprintf(procpath, sizeof(procpath), "/proc/%d/root/.", (*watch)->pid);
-    snprintf(pidc_, sizeof(pidc_), "%d", (*watch)->pid);
+    snprintf(rootc_, sizeof(rootc_), "%s", container_root(*watch, path, procpath, sizeof(procpath)));
+    snprintf(procpath, sizeof(procpath), "%s/.", rootc_);
 
     watch_ = watch;
     rootstat_ = rootstat;
@@ -246,29 +266,81 @@ void find_replace_root_path(struct arguswatch **watch, const char *const path) {
     *p = strdup(foundpath_);
 }
 
+/**
+ * Returns the host path of the container's root that `path` is under: the
+ * overlay upperdir of the watch if it is under that, or /proc/[pid]/root
+ * (formatted into `buf`) otherwise.
+ *
+ * @param watch
+ * @param path
+ * @param buf
+ * @param size
+ * @return
+ */
+const char *container_root(const struct arguswatch *const watch, const char *const path, char *const buf,
+    const size_t size) {
+
+    size_t len;
+    if (watch->upperdir != NULL &&
+        strncmp(path, watch->upperdir, (len = strlen(watch->upperdir))) == 0 &&
+        (path[len] == '/' || path[len] == '\0')) {
+        return watch->upperdir;
+    }
+    snprintf(buf, size, "/proc/%d/root", watch->pid);
+    return buf;
+}
+
+/**
+ * Returns `path` as seen from inside the container of the watched process,
+ * i.e. without its /proc/[pid]/root (or upperdir) prefix. Ignore patterns are
+ * matched against this path, so anchored patterns read like paths in the
+ * container.
+ *
+ * @param watch
+ * @param path
+ * @return
+ */
+const char *container_path(const struct arguswatch *const watch, const char *const path) {
+    char buf[32];
+    const char *const root = container_root(watch, path, buf, sizeof(buf));
+    const size_t len = strlen(root);
+    if (strncmp(path, root, len) == 0 &&
+        (path[len] == '/' || path[len] == '\0')) {
+        return path[len] ? path + len : "/";
+    }
+    return path;
+}
+
 /**
  * Check if we should ignore path in the recursive tree check. If watching for
  * only directories and path is a file, ignore. If `ignore` list is provided
- * and matches this path, ignore.
+ * and matches this path, ignore. `sb` is the `lstat` of `path` if the caller
+ * already has it (e.g. from `nftw`), or NULL.
  *
  * @param watch
  * @param path
+ * @param sb
  * @return
  */
-static bool should_ignore_path(const struct arguswatch *const watch, const char *const path) {
-    struct stat sb;
+static bool should_ignore_path(const struct arguswatch *const watch, const char *const path,
+    const struct stat *sb) {
+
+    struct stat pathsb;
     int i;
 
     // Check the paths are directories.
-    if (lstat(path, &sb) == EOF) {
+    if (sb == NULL) {
+        if (lstat(path, &pathsb) == EOF) {
 #if DEBUG
-        fprintf(stderr, "`lstat` failed on '%s'\n", path);
-        perror("lstat");
+            fprintf(stderr, "`lstat` failed on '%s'\n", path);
+            perror("lstat");
 #endif
-        return true;
+            return true;
+        }
+        sb = &pathsb;
     }
     // Keep if it is a directory.
-    if (S_ISDIR(sb.st_mode)) {
+    if (S_ISDIR(sb->st_mode)) {
         return false;
     }
 
@@ -287,45 +359,77 @@ static bool should_ignore_path(const struct arguswatch *const watch, const char
     return true;
 }
 
+/**
+ * Returns the `inotify` mask to watch `path` with: the events asked for, plus
+ * the events we need at all times for keeping a consistent view of the
+ * filesystem tree.
+ *
+ * @param watch
+ * @param path
+ * @return
+ */
+uint32_t watch_mask_for_path(const struct arguswatch *const watch, const char *const path) {
+    uint32_t flags = IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
+    if (watch->flags & AW_ONLYDIR) {
+        flags |= IN_ONLYDIR;
+    }
+    if (find_root_path(watch, path) != NULL) {
+        flags |= IN_MOVE_SELF;
+    }
+    return watch->event_mask | flags;
+}
+
 /**
  * Add `path` to the watch list of the `inotify` file descriptor. The process
- * is not recursive. Returns number of watches/cache entries added for this
+ * is not recursive. `sb` is the `lstat` of `path` if the caller already has
+ * it, or NULL. Returns number of watches/cache entries added for this
  * subtree.
  *
  * @param watch
  * @param path
+ * @param sb
  * @return
  */
-static int watch_path(struct arguswatch **watch, const char *const path) {
+static int watch_path(struct arguswatch **watch, const char *const path, const struct stat *const sb) {
     int wd;
-    uint32_t flags;
 
     // Dont add non-directories unless directly specified by `rootpaths` and
     // `AW_ONLYDIR` flag is not set.
-    if (should_ignore_path(*watch, path)) {
+    if (should_ignore_path(*watch, path, sb)) {
         return 0;
     }
 
-    // We need to watch certain events at all times for keeping a consistent
-    // view of the filesystem tree.
-    flags = IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
-    if ((*watch)->flags & AW_ONLYDIR) {
-        flags |= IN_ONLYDIR;
+    // Paths already cached don't need another watch, e.g. when a root added
+    // to a running watch overlaps one of its existing roots.
+    if ((*watch)->rewalk &&
+        path_name_to_cache_slot(*watch, path) > -1) {
+        return 0;
     }
-    if (find_root_path(*watch, path) != NULL) {
-        flags |= IN_MOVE_SELF;
+
+    // Stop the traversal if this watch would take us over budget; the caller
+    // decides how to degrade.
+    if (!admit_watch(*watch)) {
+        (*watch)->overbudget = true;
+        return FTW_STOP;
     }
 
     // Make directories for events.
-    if ((wd = inotify_add_watch((*watch)->fd, path, (*watch)->event_mask | flags)) == EOF) {
+    if ((wd = add_backend_watch(*watch, path, watch_mask_for_path(*watch, path))) == EOF) {
         // By the time we come to create a watch, the directory might already
         // have been deleted or renamed, in which case we'll get an ENOENT
-        // error. Log the error, but carry on execution. Other errors are
-        // unexpected, and if we hit them, we give up.
+        // error. Log the error, but carry on execution. ENOSPC means the
+        // kernel ran out of watches before our own budget did (e.g. other
+        // processes on the node use them), which is handled the same way as
+        // running over budget. Other errors are unexpected, and if we hit
+        // them, we give up.
 #if DEBUG
         fprintf(stderr, "inotify_add_watch: %s: %s\n", path, strerror(errno));
         perror("inotify_add_watch");
 #endif
+        if (errno == ENOSPC) {
+            (*watch)->overbudget = true;
+            return FTW_STOP;
+        }
         return (errno == ENOENT) ? 0 : -1;
     }
 
@@ -356,6 +460,9 @@ static int watch_path(struct arguswatch **watch, const char *const path) {
     (*watch)->paths[(*watch)->pathc] = strdup(path);
 
     ++(*watch)->pathc;
+    if ((*watch)->status != NULL) {
+        __atomic_store_n(&(*watch)->status->traversed, (*watch)->pathc, __ATOMIC_RELAXED);
+    }
 
     return 0;
 }
@@ -373,29 +480,224 @@ static int watch_path(struct arguswatch **watch, const char *const path) {
  * @return
  */
 int traverse_tree(const char *path, const struct stat *sb, int tflag, struct FTW *ftwbuf) {
-    int i;
+    int maxdepth = (*watch_)->max_depth, level = ftwbuf->level + leveloffset_, ret;
     if (((*watch_)->flags & AW_ONLYDIR) &&
         !S_ISDIR(sb->st_mode)) {
         // Ignore nondirectory files.
         return FTW_CONTINUE;
     }
-    // Stop recursing subtree if path in ignores list.
-    for (i = 0; i < (*watch_)->ignorec; ++i) {
-        if (strcmp(&path[ftwbuf->base], (*watch_)->ignores[i]) == 0) {
-            return FTW_SKIP_SUBTREE;
-        }
+    // Stop recursing subtree if path matches an ignore pattern.
+    if ((*watch_)->ignore != NULL &&
+        match_path((*watch_)->ignore, container_path(*watch_, path))) {
+        return FTW_SKIP_SUBTREE;
+    }
+    // Stop recursing siblings if reached max depth, or the depth this watch
+    // was degraded to.
+    if ((*watch_)->depth_cap &&
+        (!maxdepth || (*watch_)->depth_cap < maxdepth)) {
+        maxdepth = (*watch_)->depth_cap;
     }
-    // Stop recursing siblings if reached max depth.
-    if ((*watch_)->max_depth &&
-        ftwbuf->level + 1 > (*watch_)->max_depth) {
+    if (maxdepth &&
+        level + 1 > maxdepth) {
         return FTW_SKIP_SIBLINGS;
     }
+    if (level > deepest_) {
+        deepest_ = level;
+    }
 
 #if DEBUG
-    printf("    traverse_tree: %s; level = %d\n", path, ftwbuf->level);
+    printf("    traverse_tree: %s; level = %d\n", path, level);
     fflush(stdout);
 #endif
-    return watch_path(watch_, path);
+    // `nftw` already stat'ed the path, unless it couldn't.
+    ret = watch_path(watch_, path, tflag == FTW_NS ? NULL : sb);
+    add_building_dir(path, level, tflag, sb, ret);
+    return ret;
+}
+
+/**
+ * Record the directory `path`, `level` deep, in the skeleton being built
+ * (if any), now that `watch_path` returned `ret` for it. A skeleton missing
+ * a directory, or the entries of one, is dropped rather than cached.
+ *
+ * @param path
+ * @param level
+ * @param tflag
+ * @param sb
+ * @param ret
+ */
+static void add_building_dir(const char *const path, const int level, const int tflag,
+    const struct stat *const sb, const int ret) {
+
+    if (building_ == NULL ||
+        (ret == 0 && tflag != FTW_D && tflag != FTW_DNR && tflag != FTW_NS)) {
+        return;
+    }
+    if (ret != 0 ||
+        tflag != FTW_D ||
+        !add_skeleton_dir(building_, path + rootlen_, level, sb)) {
+        release_skeleton(building_);
+        building_ = NULL;
+    }
+}
+
+/**
+ * Watch the tree under the root `path` from the skeleton an earlier
+ * traversal left, instead of reading every directory in it. Each directory
+ * is still `stat`ed: one that is gone is left out along with everything
+ * under it, and one whose timestamps changed is read again for
+ * subdirectories the skeleton doesn't have. Returns the number of
+ * directories that changed.
+ *
+ * @param watch
+ * @param path
+ * @param skeleton
+ * @return
+ */
+static int watch_skeleton(struct arguswatch **watch, const char *const path,
+    const struct argusskeleton *const skeleton) {
+
+    char fullpath[PATH_MAX];
+    const struct argusskeleton_dir *dir;
+    struct stat sb;
+    int maxdepth = (*watch)->max_depth, skiplevel = -1, changed = 0, ret;
+    unsigned int i;
+
+    if ((*watch)->depth_cap &&
+        (!maxdepth || (*watch)->depth_cap < maxdepth)) {
+        maxdepth = (*watch)->depth_cap;
+    }
+    for (i = 0; i < skeleton->dirc; ++i) {
+        dir = &skeleton->dirs[i];
+        // Skip the rest of a subtree that is gone.
+        if (skiplevel > -1 &&
+            dir->level > skiplevel) {
+            continue;
+        }
+        skiplevel = -1;
+        if (maxdepth &&
+            dir->level + 1 > maxdepth) {
+            continue;
+        }
+
+        snprintf(fullpath, sizeof(fullpath), "%s%s", path, dir->path);
+        if (lstat(fullpath, &sb) == EOF ||
+            !S_ISDIR(sb.st_mode)) {
+            skiplevel = dir->level;
+            ++changed;
+            continue;
+        }
+        if (dir->level > deepest_) {
+            deepest_ = dir->level;
+        }
+        ret = watch_path(watch, fullpath, &sb);
+        add_building_dir(fullpath, dir->level, FTW_D, &sb, ret);
+        if (ret != 0) {
+            break;
+        }
+        if (!skeleton_dir_unchanged(dir, &sb)) {
+            ++changed;
+            if ((!maxdepth || dir->level + 2 <= maxdepth) &&
+                watch_new_subdirs(watch, fullpath, skeleton, i) != 0) {
+                break;
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * The directory `path`, entry `index` of `skeleton`, changed since the
+ * skeleton was recorded. Traverse its subdirectories the skeleton doesn't
+ * have; the ones it does have are watched from the skeleton as usual.
+ *
+ * @param watch
+ * @param path
+ * @param skeleton
+ * @param index
+ * @return
+ */
+static int watch_new_subdirs(struct arguswatch **watch, const char *const path,
+    const struct argusskeleton *const skeleton, const unsigned int index) {
+
+    char fullpath[PATH_MAX + NAME_MAX + 1];
+    const struct argusskeleton_dir *dir = &skeleton->dirs[index];
+    const char **known = NULL, **names, *name;
+    struct dirent *entry;
+    struct stat sb;
+    unsigned int i, knownc = 0;
+    DIR *dp;
+
+    if ((dp = opendir(path)) == NULL) {
+#if DEBUG
+        perror("opendir");
+#endif
+        // Gone again since; the caller goes on with the rest of the tree.
+        if (building_ != NULL) {
+            release_skeleton(building_);
+            building_ = NULL;
+        }
+        return 0;
+    }
+    // Subdirectories of `path` in the skeleton come after it, before the
+    // next entry that isn't below it.
+    for (i = index + 1; i < skeleton->dirc && skeleton->dirs[i].level > dir->level; ++i) {
+        if (skeleton->dirs[i].level != dir->level + 1) {
+            continue;
+        }
+        if ((names = realloc(known, (knownc + 1) * sizeof(char *))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            free(known);
+            closedir(dp);
+            return -1;
+        }
+        known = names;
+        known[knownc++] = strrchr(skeleton->dirs[i].path, '/') + 1;
+    }
+    qsort(known, knownc, sizeof(char *), compare_names);
+
+    while ((entry = readdir(dp)) != NULL) {
+        name = entry->d_name;
+        if ((entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) ||
+            strcmp(name, ".") == 0 ||
+            strcmp(name, "..") == 0 ||
+            (knownc && bsearch(&name, known, knownc, sizeof(char *), compare_names) != NULL)) {
+            continue;
+        }
+        FORMAT_PATH(fullpath, path, name);
+        if (entry->d_type == DT_UNKNOWN &&
+            (lstat(fullpath, &sb) == EOF || !S_ISDIR(sb.st_mode))) {
+            continue;
+        }
+        leveloffset_ = dir->level + 1;
+        if (nftw(fullpath, traverse_tree, 20, FTW_ACTIONRETVAL | FTW_PHYS) == EOF) {
+#if DEBUG
+            printf("nftw: %s: %s (directory probably deleted before we could watch)\n",
+                fullpath, strerror(errno));
+            fflush(stdout);
+#endif
+        }
+        leveloffset_ = 0;
+        if ((*watch)->overbudget) {
+            break;
+        }
+    }
+    free(known);
+    closedir(dp);
+    return (*watch)->overbudget ? FTW_STOP : 0;
+}
+
+/**
+ * Compare two directory entry names, for `qsort` and `bsearch`.
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
 }
 
 /**
@@ -408,42 +710,144 @@ int traverse_tree(const char *path, const struct stat *sb, int tflag, struct FTW
  * @return
  */
 static int watch_path_recursive(struct arguswatch **watch, const char *const path) {
-    // Use FTW_PHYS to avoid following soft links to directories (which could
-    // lead us in circles). By the time we come to process `path`, it may
-    // already have been deleted, so we log errors from `nftw`, but keep on
-    // going.
+    struct argusskeleton *skeleton = NULL;
+    int changed = 0;
+
+    // Reuse the skeleton of an earlier traversal of the same tree if there is
+    // one, e.g. in another container of the same image, and record one for
+    // later traversals otherwise.
     watch_ = watch;
-    if (nftw(path, traverse_tree, 20, FTW_ACTIONRETVAL | FTW_PHYS) == EOF) {
+    rootlen_ = strlen(path);
+    leveloffset_ = 0;
+    if ((building_ = new_skeleton(*watch, path)) != NULL &&
+        (skeleton = find_skeleton(building_)) != NULL) {
+        changed = watch_skeleton(watch, path, skeleton);
+        release_skeleton(skeleton);
 #if DEBUG
-        printf("nftw: %s: %s (directory probably deleted before we could watch)\n",
-            path, strerror(errno));
+        printf("  watch_path_recursive: %s: from skeleton, %d directories changed\n", path, changed);
         fflush(stdout);
 #endif
+    } else {
+        // Use FTW_PHYS to avoid following soft links to directories (which
+        // could lead us in circles). By the time we come to process `path`,
+        // it may already have been deleted, so we log errors from `nftw`, but
+        // keep on going.
+        if (nftw(path, traverse_tree, 20, FTW_ACTIONRETVAL | FTW_PHYS) == EOF) {
+#if DEBUG
+            printf("nftw: %s: %s (directory probably deleted before we could watch)\n",
+                path, strerror(errno));
+            fflush(stdout);
+#endif
+        }
+    }
+
+    // Only a complete skeleton is any use to the next traversal, and one that
+    // was reused as is doesn't need replacing.
+    if (building_ != NULL) {
+        if (building_->dirc &&
+            !(*watch)->overbudget &&
+            !(*watch)->depth_cap &&
+            (skeleton == NULL || changed)) {
+            publish_skeleton(building_);
+        } else {
+            release_skeleton(building_);
+        }
+        building_ = NULL;
     }
 
     return (*watch)->pathc;
 }
 
+/**
+ * Remove every watch and cache entry of `watch`, leaving the `inotify` file
+ * descriptor open.
+ *
+ * @param watch
+ */
+static void remove_all_watches(struct arguswatch **watch) {
+    int i;
+    for (i = 0; i < (*watch)->pathc; ++i) {
+        if (!is_replaying(*watch) &&
+            remove_backend_watch(*watch, (*watch)->wd[i]) == EOF) {
+#if DEBUG
+            perror("inotify_rm_watch");
+#endif
+        }
+        free((*watch)->paths[i]);
+    }
+    (*watch)->pathc = 0;
+}
+
 /**
  * Add watches and cache entries for a subtree, logging a message noting the
- * number entries added.
+ * number entries added. If the watch budget runs out part way through a
+ * recursive traversal, the watches added so far are dropped and the tree is
+ * watched again with a smaller depth (see `degrade_depth`), rather than
+ * leaving an arbitrary part of the tree unwatched.
  *
  * @param watch
  */
 void watch_subtree(struct arguswatch **watch) {
-    int i;
-    for (i = 0; i < (*watch)->rootpathc; ++i) {
-        if ((*watch)->flags & AW_RECURSIVE) {
-            watch_path_recursive(watch, (*watch)->rootpaths[i]);
-        } else {
-            watch_path(watch, (*watch)->rootpaths[i]);
+    int i, depth;
+    for (;;) {
+        (*watch)->overbudget = false;
+        deepest_ = 0;
+        for (i = 0; i < (*watch)->rootpathc; ++i) {
+            if ((*watch)->flags & AW_RECURSIVE) {
+                watch_path_recursive(watch, (*watch)->rootpaths[i]);
+            } else {
+                watch_path(watch, (*watch)->rootpaths[i], NULL);
+            }
+#if DEBUG
+            printf("  watch_subtree: %s: %d entries added\n",
+                (*watch)->rootpaths[i], (*watch)->pathc);
+            fflush(stdout);
+#endif
+        }
+
+        if (!(*watch)->overbudget ||
+            !((*watch)->flags & AW_RECURSIVE) ||
+            (depth = degrade_depth(*watch, deepest_)) == 0) {
+#if DEBUG
+            if ((*watch)->overbudget) {
+                printf("  watch_subtree: over budget, cannot degrade further\n");
+                fflush(stdout);
+            }
+#endif
+            break;
         }
 #if DEBUG
-        printf("  watch_subtree: %s: %d entries added\n",
-            (*watch)->rootpaths[i], (*watch)->pathc);
+        printf("  watch_subtree: over budget, retrying with depth %d\n", depth);
         fflush(stdout);
 #endif
+        remove_all_watches(watch);
+        (*watch)->depth_cap = depth;
     }
+    update_watch_usage(*watch);
+}
+
+/**
+ * Add watches and cache entries for a root path added to a running watch,
+ * leaving the entries of its other roots as they are.
+ *
+ * @param watch
+ * @param path
+ */
+void watch_new_root(struct arguswatch **watch, const char *const path) {
+    (*watch)->rewalk = true;
+    (*watch)->overbudget = false;
+    if ((*watch)->flags & AW_RECURSIVE) {
+        watch_path_recursive(watch, path);
+    } else {
+        watch_path(watch, path, NULL);
+    }
+    (*watch)->rewalk = false;
+#if DEBUG
+    printf("  watch_new_root: %s: %d entries in total%s\n", path, (*watch)->pathc,
+        (*watch)->overbudget ? " (over budget)" : "");
+    fflush(stdout);
+#endif
+    update_watch_usage(*watch);
 }
 
 /**
@@ -521,7 +925,8 @@ int remove_subtree(struct arguswatch **watch, const char *const path) {
             fflush(stdout);
 #endif
 
-            if (inotify_rm_watch((*watch)->fd, (*watch)->wd[i]) == EOF) {
+            if (!is_replaying(*watch) &&
+                remove_backend_watch(*watch, (*watch)->wd[i]) == EOF) {
 #if DEBUG
                 printf("    inotify_rm_watch wd = %d (%s): %s\n", (*watch)->wd[i],
                     (*watch)->paths[i], strerror(errno));
@@ -535,11 +940,14 @@ int remove_subtree(struct arguswatch **watch, const char *const path) {
                 break;
             }
 
-            mark_cache_slot_empty(i);
+            // Drop the entry from this watch's cache and look at the entry
+            // that moved into its position next.
+            remove_item_from_cache(watch, i--);
             ++cnt;
         }
     }
 
     free(pn);
+    update_watch_usage(*watch);
     return cnt;
 }
@@ -25,19 +25,29 @@
 #ifndef __ARGUS_TREE__
 #define __ARGUS_TREE__
 
+#include "argusskeleton.h"
 #include "argusutil.h"
 
 void validate_root_paths(struct arguswatch *watch);
 char **find_root_path(const struct arguswatch *watch, const char *path);
 static struct stat *find_root_stat(const struct arguswatch *watch, const char *path);
 void remove_root_path(struct arguswatch **watch, const char *path);
+const char *container_root(const struct arguswatch *watch, const char *path, char *buf, size_t size);
+const char *container_path(const struct arguswatch *watch, const char *path);
 int traverse_root(const char *path, const struct stat *sb, int tflag, struct FTW *ftwbuf);
 void find_replace_root_path(struct arguswatch **watch, const char *path);
-static bool should_ignore_path(const struct arguswatch *watch, const char *path);
-static int watch_path(struct arguswatch **watch, const char *path);
+static bool should_ignore_path(const struct arguswatch *watch, const char *path, const struct stat *sb);
+uint32_t watch_mask_for_path(const struct arguswatch *watch, const char *path);
+static int watch_path(struct arguswatch **watch, const char *path, const struct stat *sb);
 int traverse_tree(const char *path, const struct stat *sb, int tflag, struct FTW *ftwbuf);
+static void add_building_dir(const char *path, int level, int tflag, const struct stat *sb, int ret);
+static int watch_skeleton(struct arguswatch **watch, const char *path, const struct argusskeleton *skeleton);
+static int watch_new_subdirs(struct arguswatch **watch, const char *path, const struct argusskeleton *skeleton,
+    unsigned int index);
+static int compare_names(const void *a, const void *b);
 static int watch_path_recursive(struct arguswatch **watch, const char *path);
 void watch_subtree(struct arguswatch **watch);
+void watch_new_root(struct arguswatch **watch, const char *path);
 void rewrite_cached_paths(struct arguswatch **watch, const char *oldpathpf, const char *oldname,
     const char *newpathpf, const char *newname);
 int remove_subtree(struct arguswatch **watch, const char *path);
@@ -0,0 +1,312 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "argusuring.h"
+
+// Batch syscalls through `io_uring` (cleared when the kernel refuses it).
+// Off by default: `statx` requests are handed to kernel worker threads, which
+// saves syscalls but costs latency when the inodes are cached anyway.
+static bool enabled_ = false;
+
+#ifdef ARGUS_HAVE_URING
+static pthread_key_t ringkey_;
+static pthread_once_t ringonce_ = PTHREAD_ONCE_INIT;
+
+/**
+ * Unmap and close the `io_uring` instance of a thread that exited.
+ *
+ * @param arg
+ */
+static void free_uring(void *arg) {
+    struct argusuring *ring = arg;
+    if (ring == NULL) {
+        return;
+    }
+    munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+    if (ring->cqring != ring->sqring) {
+        munmap(ring->cqring, ring->cqringsz);
+    }
+    munmap(ring->sqring, ring->sqringsz);
+    close(ring->fd);
+    free(ring);
+}
+
+/**
+ * Create the key the `io_uring` instance of each thread is kept under.
+ */
+static void init_uring_key() {
+    pthread_key_create(&ringkey_, free_uring);
+}
+
+/**
+ * Return the `io_uring` instance of the calling thread, setting it up if
+ * needed. Returns NULL, and stops trying for every thread, if the kernel
+ * doesn't support it or it is disabled (e.g. by seccomp in a container).
+ *
+ * @return
+ */
+static struct argusuring *thread_uring() {
+    struct io_uring_params params;
+    struct argusuring *ring;
+
+    pthread_once(&ringonce_, init_uring_key);
+    if ((ring = pthread_getspecific(ringkey_)) != NULL) {
+        return ring;
+    }
+    if ((ring = calloc(1, sizeof(struct argusuring))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return NULL;
+    }
+    memset(&params, 0, sizeof(params));
+    if ((ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) == EOF) {
+#if DEBUG
+        perror("io_uring_setup");
+#endif
+        __atomic_store_n(&enabled_, false, __ATOMIC_RELAXED);
+        free(ring);
+        return NULL;
+    }
+    ring->entries = params.sq_entries;
+    ring->sqringsz = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqringsz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqringsz > ring->sqringsz) {
+            ring->sqringsz = ring->cqringsz;
+        }
+        ring->cqringsz = ring->sqringsz;
+    }
+    ring->sqring = mmap(NULL, ring->sqringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQ_RING);
+    ring->cqring = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sqring :
+        mmap(NULL, ring->cqringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqring == MAP_FAILED ||
+        ring->cqring == MAP_FAILED ||
+        ring->sqes == MAP_FAILED) {
+#if DEBUG
+        perror("mmap");
+#endif
+        if (ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+        }
+        if (ring->cqring != MAP_FAILED &&
+            ring->cqring != ring->sqring) {
+            munmap(ring->cqring, ring->cqringsz);
+        }
+        if (ring->sqring != MAP_FAILED) {
+            munmap(ring->sqring, ring->sqringsz);
+        }
+        close(ring->fd);
+        free(ring);
+        __atomic_store_n(&enabled_, false, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    ring->sqhead = (unsigned int *)((char *)ring->sqring + params.sq_off.head);
+    ring->sqtail = (unsigned int *)((char *)ring->sqring + params.sq_off.tail);
+    ring->sqmask = (unsigned int *)((char *)ring->sqring + params.sq_off.ring_mask);
+    ring->sqarray = (unsigned int *)((char *)ring->sqring + params.sq_off.array);
+    ring->cqhead = (unsigned int *)((char *)ring->cqring + params.cq_off.head);
+    ring->cqtail = (unsigned int *)((char *)ring->cqring + params.cq_off.tail);
+    ring->cqmask = (unsigned int *)((char *)ring->cqring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cqring + params.cq_off.cqes);
+    pthread_setspecific(ringkey_, ring);
+    return ring;
+}
+
+/**
+ * Submit the `n` entries queued on `ring` and wait for all of them to
+ * complete. Returns the number of `io_uring_enter` calls it took, or -1 if
+ * none of them could be submitted.
+ *
+ * @param ring
+ * @param n
+ * @return
+ */
+static int submit_uring(struct argusuring *const ring, const unsigned int n) {
+    unsigned int submitted = 0;
+    int calls = 0, ret;
+
+    while (submitted < n ||
+        __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE) - *ring->cqhead < n) {
+        ret = syscall(__NR_io_uring_enter, ring->fd, n - submitted, n, IORING_ENTER_GETEVENTS, NULL, 0);
+        ++calls;
+        if (ret == EOF) {
+            // Entries already submitted still have to complete before their
+            // buffers can be reused, so only give up if there are none.
+            if (errno != EINTR &&
+                submitted == 0) {
+#if DEBUG
+                perror("io_uring_enter");
+#endif
+                return EOF;
+            }
+            continue;
+        }
+        submitted += ret;
+    }
+    return calls;
+}
+#endif
+
+/**
+ * Use `io_uring` to batch syscalls, if the kernel allows it, or make them one
+ * at a time.
+ *
+ * @param enabled
+ */
+void set_uring_enabled(const bool enabled) {
+    __atomic_store_n(&enabled_, enabled, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns whether syscalls are batched through `io_uring`.
+ *
+ * @return
+ */
+bool uring_enabled() {
+#ifdef ARGUS_HAVE_URING
+    return __atomic_load_n(&enabled_, __ATOMIC_RELAXED);
+#else
+    return false;
+#endif
+}
+
+/**
+ * `lstat` each of `paths` into `sbs`, setting the matching `errs` to 0 on
+ * success or to `errno` on failure. The calls are submitted in batches of
+ * `URING_ENTRIES` `statx` requests through `io_uring` when available, and
+ * made one at a time otherwise. Returns the number of syscalls made.
+ *
+ * @param n
+ * @param paths
+ * @param sbs
+ * @param errs
+ * @return
+ */
+int batch_lstat(const unsigned int n, const char *const paths[], struct stat sbs[], int errs[]) {
+    unsigned int i = 0;
+    int calls = 0;
+
+#ifdef ARGUS_HAVE_URING
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct argusuring *ring;
+    struct statx *stx;
+    unsigned int batch, j, tail, head, k;
+    int ret;
+
+    if (n > 1 &&
+        uring_enabled() &&
+        (ring = thread_uring()) != NULL &&
+        (stx = malloc(ring->entries * sizeof(struct statx))) != NULL) {
+
+        while (i < n) {
+            batch = n - i < ring->entries ? n - i : ring->entries;
+            tail = *ring->sqtail;
+            for (j = 0; j < batch; ++j) {
+                k = (tail + j) & *ring->sqmask;
+                sqe = &ring->sqes[k];
+                memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (unsigned long)paths[i + j];
+                sqe->len = STATX_BASIC_STATS;
+                sqe->off = (unsigned long)&stx[j];
+                sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+                sqe->user_data = j;
+                ring->sqarray[k] = k;
+            }
+            __atomic_store_n(ring->sqtail, tail + batch, __ATOMIC_RELEASE);
+            if ((ret = submit_uring(ring, batch)) == EOF) {
+                // Take the entries back, and make the calls one at a time.
+                __atomic_store_n(ring->sqtail, tail, __ATOMIC_RELEASE);
+                __atomic_store_n(&enabled_, false, __ATOMIC_RELAXED);
+                break;
+            }
+            calls += ret;
+
+            head = *ring->cqhead;
+            while (head != __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE)) {
+                cqe = &ring->cqes[head & *ring->cqmask];
+                j = cqe->user_data;
+                if (cqe->res == -EINVAL) {
+                    // Kernels before 5.6 have no `statx` operation.
+                    __atomic_store_n(&enabled_, false, __ATOMIC_RELAXED);
+                    errs[i + j] = lstat(paths[i + j], &sbs[i + j]) == EOF ? errno : 0;
+                    ++calls;
+                } else if (cqe->res < 0) {
+                    errs[i + j] = -cqe->res;
+                } else {
+                    memset(&sbs[i + j], 0, sizeof(struct stat));
+                    sbs[i + j].st_dev = makedev(stx[j].stx_dev_major, stx[j].stx_dev_minor);
+                    sbs[i + j].st_ino = stx[j].stx_ino;
+                    sbs[i + j].st_mode = stx[j].stx_mode;
+                    sbs[i + j].st_nlink = stx[j].stx_nlink;
+                    sbs[i + j].st_uid = stx[j].stx_uid;
+                    sbs[i + j].st_gid = stx[j].stx_gid;
+                    sbs[i + j].st_rdev = makedev(stx[j].stx_rdev_major, stx[j].stx_rdev_minor);
+                    sbs[i + j].st_size = stx[j].stx_size;
+                    sbs[i + j].st_blksize = stx[j].stx_blksize;
+                    sbs[i + j].st_blocks = stx[j].stx_blocks;
+                    sbs[i + j].st_atim.tv_sec = stx[j].stx_atime.tv_sec;
+                    sbs[i + j].st_atim.tv_nsec = stx[j].stx_atime.tv_nsec;
+                    sbs[i + j].st_mtim.tv_sec = stx[j].stx_mtime.tv_sec;
+                    sbs[i + j].st_mtim.tv_nsec = stx[j].stx_mtime.tv_nsec;
+                    sbs[i + j].st_ctim.tv_sec = stx[j].stx_ctime.tv_sec;
+                    sbs[i + j].st_ctim.tv_nsec = stx[j].stx_ctime.tv_nsec;
+                    errs[i + j] = 0;
+                }
+                ++head;
+            }
+            __atomic_store_n(ring->cqhead, head, __ATOMIC_RELEASE);
+            i += batch;
+        }
+        free(stx);
+    }
+#endif
+
+    // Whatever wasn't batched.
+    for (; i < n; ++i) {
+        errs[i] = lstat(paths[i], &sbs[i]) == EOF ? errno : 0;
+        ++calls;
+    }
+    return calls;
+}
@@ -0,0 +1,65 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_URING__
+#define __ARGUS_URING__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ARGUS_HAVE_URING 1
+#endif
+#endif
+
+#ifndef URING_ENTRIES
+#define URING_ENTRIES 256
+#endif
+
+#ifdef ARGUS_HAVE_URING
+#include <linux/io_uring.h>
+
+// `io_uring` instance of a thread, set up the first time it batches syscalls.
+struct argusuring {
+    int fd;
+    unsigned int entries;
+    void *sqring, *cqring;              // Mapped submission, completion rings.
+    size_t sqringsz, cqringsz;
+    struct io_uring_sqe *sqes;          // Mapped submission queue entries.
+    unsigned int *sqhead, *sqtail, *sqmask, *sqarray;
+    unsigned int *cqhead, *cqtail, *cqmask;
+    struct io_uring_cqe *cqes;
+};
+
+static struct argusuring *thread_uring();
+static int submit_uring(struct argusuring *ring, unsigned int n);
+#endif
+
+void set_uring_enabled(bool enabled);
+bool uring_enabled();
+int batch_lstat(unsigned int n, const char *const paths[], struct stat sbs[], int errs[]);
+
+#endif
@@ -29,6 +29,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifndef DEBUG
@@ -39,6 +40,25 @@
 #define AW_RECURSIVE 0x00000002
 #define AW_FOLLOW    0x00000004
 
+#define AW_FTYPE_DIR    0x00000001 // Directories.
+#define AW_FTYPE_REG    0x00000002 // Regular files.
+#define AW_FTYPE_LNK    0x00000004 // Symbolic links.
+#define AW_FTYPE_OTHER  0x00000008 // FIFOs, sockets, devices.
+#define AW_FTYPE_NONDIR (AW_FTYPE_REG | AW_FTYPE_LNK | AW_FTYPE_OTHER)
+
+#define AW_EVENT_TYPES 12 // Event bits in IN_ALL_EVENTS.
+
+#define AW_STATE_RESOLVING  0 // Watcher arguments are being resolved.
+#define AW_STATE_TRAVERSING 1 // Paths are being walked; no events until armed.
+#define AW_STATE_ARMED      2 // Every path is watched.
+#define AW_STATE_FAILED     3 // Watcher could not be started.
+#define AW_STATE_STOPPED    4 // Watcher exited.
+
+#define AW_BACKEND_INOTIFY  0 // A watch on every directory of the tree.
+#define AW_BACKEND_FANOTIFY 1 // A mark on the whole filesystem, filtered to the tree.
+#define AW_BACKEND_FAKE     2 // Events injected in memory, for benchmarks.
+#define AW_BACKEND_POLL     3 // The tree rescanned every so often, for filesystems `inotify` is blind on.
+
 #define IN_EVENT_LEN (sizeof(struct inotify_event))
 #define IN_BUFFER_SIZE (IN_EVENT_LEN + NAME_MAX + 1)
 #define IN_EVENT_NEXT(evt, len, evtlen) ((struct inotify_event *)(((char *)(evt)) + (evtlen)))
@@ -76,8 +96,86 @@
     fflush(stdout);                                                                      \
 } while(0)
 
+/**
+ * Returns the monotonic clock in nanoseconds.
+ *
+ * @return
+ */
+static inline uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Returns the monotonic clock in microseconds.
+ *
+ * @return
+ */
+static inline long long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Returns the monotonic clock in milliseconds.
+ *
+ * @return
+ */
+static inline long long monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Lifecycle of a watcher, updated by the watcher thread as it goes.
+struct arguswatch_status {
+    int state;                        // One of AW_STATE_*.
+    unsigned int traversed;           // Paths watched so far.
+};
+
+// Live `inotify` instance handed over by another process; see
+// `recv_watch_handoff`.
+struct arguswatch_handoff {
+    int pid, sid;
+    int fd;                           // `inotify` file descriptor.
+    int backend;                      // AW_BACKEND_* the fd belongs to.
+    int depth_cap;                    // Depth the watch was degraded to (0 if not).
+    unsigned int pathc;               // Cached wd -> path entries.
+    int *wd;
+    char **paths;
+};
+
+struct arguswatch_opts {
+    int coalesce_window;              // Window for folding repeated events together (ms, 0 for off).
+    double rate_limit, rate_burst;    // Events per second logged for this subject, burst size (0 for off).
+    struct arguslimit *shared_limit;  // Rate limit shared by all subjects of the ArgusWatcher (NULL if off).
+    unsigned int hot_threshold;       // Access/open events per second before a directory is downgraded (0 for off).
+    int hot_cooldown;                 // Time (ms) a hot directory stays downgraded.
+    struct arguswatch_status *status; // Lifecycle reported to the caller (NULL if not wanted).
+    struct arguswatch_handoff *handoff; // Instance to carry on with instead of walking the tree (NULL if none).
+    bool verify_content;              // Only log writes that changed the content of a file.
+    bool baseline;                    // Hash the watched files whenever the watch is (re)armed.
+    int backend;                      // One of AW_BACKEND_*.
+    int poll_interval;                // Time (ms) between rescans with AW_BACKEND_POLL (0 for the default).
+    int poll_budget;                  // Percentage of a CPU rescans may use (0 for the default).
+    const char *upperdir;             // Host path of the container's overlay upperdir the paths are under (NULL if none).
+};
+
+// New configuration for a running watch; see `update_inotify_watcher`.
+struct arguswatch_update {
+    const char *name;
+    unsigned int pathc, ignorec, includec;
+    const char **paths, **ignores, **includes;
+    uint32_t file_types, event_mask, flags;
+    int max_depth;
+    struct arguswatch_opts opts;
+    const char *tags, *log_format;
+};
+
 struct arguswatch {
-    struct epoll_event epollevt[2];   // `epoll` structures for polling watchers.
+    struct epoll_event epollevt[4];   // `epoll` structures for polling watchers.
     const char *name;                 // Name of ArgusWatcher.
     const char *node_name, *pod_name; // Name of node, pod in which process is running.
     const char *tags;                 // Custom tags for printing ArgusWatcher event.
@@ -92,9 +190,40 @@ struct arguswatch {
     unsigned int pathc;               // Cached path count, including recursive traversal.
     uint32_t event_mask;              // Event mask for `inotify`.
     uint32_t flags;                   // Flags for ArgusWatcher.
-    int pid, sid, slot;               // PID, Subject ID, `wlcache` slot.
+    int pid, sid, slot;               // PID, Subject ID, watch cache slot.
     int fd, processevtfd, efd;        // `inotify` fd, anonymous pipe to send watch kill signal, `epoll` fd.
+    int pidfd;                        // `pidfd` of the watched process, to notice when it exits.
     int max_depth;                    // Max `nftw` depth to recurse through.
+    int depth_cap;                    // Depth the watch was degraded to for running over budget (0 if not).
+    unsigned int budgeted;            // Watches accounted for in the node-wide budget.
+    bool overbudget;                  // Last traversal was refused a watch by the budget.
+    struct argusrecord *record;       // Raw event stream recording, or replay source.
+    struct argusmatch *ignore;        // Compiled `ignores` patterns (NULL if none).
+    struct argusmatch *include;       // Compiled include patterns for logged events (NULL if all).
+    uint32_t file_types;              // AW_FTYPE_* of logged events (0 if all).
+    unsigned long filter_hits;        // Events that passed the include filters.
+    unsigned long filter_misses;      // Events dropped by the include filters.
+    struct arguscoalesce *coalesce;   // Repeated events waiting to be folded (NULL if off).
+    struct arguslimit *limit;         // Rate limit of this subject (NULL if off).
+    struct arguslimit *shared_limit;  // Rate limit shared with the rest of the ArgusWatcher (NULL if off).
+    unsigned long suppressed[AW_EVENT_TYPES]; // Events over the rate limit, by event type.
+    long long summary_due;            // Monotonic time (ms) suppressed events are reported at (0 if none).
+    struct argushot *hot;             // Event rates of hot directories (NULL if off).
+    char **hot_paths;                 // Downgraded directories, as published for other threads.
+    unsigned int hot_pathc;
+    struct arguswatch_update *update; // Configuration waiting to be applied to the running watch.
+    bool rewalk;                      // Traversal may revisit paths that are already cached.
+    struct arguswatch_status *status; // Lifecycle reported to the caller (NULL if not wanted).
+    struct argusdigest *digest;       // Content hashes of written files (NULL if not verified).
+    unsigned long unchanged_writes;   // Writes not logged since the content didn't change.
+    bool baseline;                    // Hash the watched files whenever the watch is (re)armed.
+    int backend;                      // AW_BACKEND_* asked for.
+    const struct argusbackend *source; // Backend events are read from (NULL until started).
+    struct argusfanotify *fanotify;   // Filesystem marks in use (NULL if watching with `inotify`).
+    struct argusfake *fake;           // Injected events waiting to be read (NULL unless faked).
+    struct arguspoll *poll;           // Index of the tree to rescan (NULL unless polled).
+    int poll_interval, poll_budget;   // See `arguswatch_opts`.
+    const char *upperdir;             // Overlay upperdir standing in for /proc/[pid]/root (NULL if not).
 };
 
 struct arguswatch_event {
@@ -102,11 +231,11 @@ struct arguswatch_event {
     const char *path_name, *file_name;
     uint32_t event_mask;
     bool is_dir;
+    unsigned int count;               // Number of identical events folded into this one.
+    struct timespec first, last;      // Wall clock time of the first and last of them.
+    bool suppressed;                  // Summary of `count` events suppressed by rate limiting.
 };
 
 typedef void (*arguswatch_logfn)(struct arguswatch_event *);
 
-extern struct arguswatch **wlcache; // Array of cached watches.
-extern int wlcachec;
-
 #endif
@@ -0,0 +1,193 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "argusd_checkpoint.h"
+
+namespace argusd {
+// Identifies (and versions) the checkpoint file format: the magic is
+// followed by records of a 32-bit length and a serialized `ArgusdConfig`.
+static const std::string kCheckpointMagic = "ARGUSCK1";
+
+/**
+ * Reads the watcher configurations stored in the checkpoint file. A missing
+ * file is an empty checkpoint; a truncated or corrupted one keeps the records
+ * that could be read.
+ *
+ * @return
+ */
+std::vector<argus::ArgusdConfig> Checkpoint::load() {
+    std::vector<argus::ArgusdConfig> configs;
+    if (!enabled()) {
+        return configs;
+    }
+    std::ifstream fh(path_, std::ios::binary);
+    if (!fh) {
+        return configs;
+    }
+    std::string data((std::istreambuf_iterator<char>(fh)), std::istreambuf_iterator<char>());
+    if (data.compare(0, kCheckpointMagic.size(), kCheckpointMagic) != 0) {
+        LOG(WARNING) << "Ignoring checkpoint with unknown format: " << path_;
+        return configs;
+    }
+
+    std::lock_guard<std::mutex> lock(mux_);
+    size_t pos = kCheckpointMagic.size();
+    while (pos + sizeof(uint32_t) <= data.size()) {
+        uint32_t len;
+        data.copy(reinterpret_cast<char *>(&len), sizeof(len), pos);
+        pos += sizeof(len);
+        argus::ArgusdConfig config;
+        if (pos + len > data.size() ||
+            !config.ParseFromArray(data.data() + pos, len)) {
+            LOG(WARNING) << "Checkpoint truncated after " << configs.size() << " watchers: " << path_;
+            break;
+        }
+        pos += len;
+        configs_[keyFor(config.podname(), config.nodename())] = data.substr(pos - len, len);
+        configs.push_back(std::move(config));
+    }
+    return configs;
+}
+
+/**
+ * Returns the configurations of all current watchers, whether or not a
+ * checkpoint file is written.
+ *
+ * @return
+ */
+std::vector<argus::ArgusdConfig> Checkpoint::configs() {
+    std::vector<argus::ArgusdConfig> configs;
+    std::lock_guard<std::mutex> lock(mux_);
+    for (const auto &it : configs_) {
+        argus::ArgusdConfig config;
+        if (config.ParseFromString(it.second)) {
+            configs.push_back(std::move(config));
+        }
+    }
+    return configs;
+}
+
+/**
+ * Records the configuration of a watcher, replacing an earlier one for the
+ * same pod and node. The file is only rewritten if the configuration changed,
+ * since the controller keeps sending the same ones.
+ *
+ * @param config
+ */
+void Checkpoint::store(const argus::ArgusdConfig &config) {
+    std::string data;
+    config.SerializeToString(&data);
+    std::lock_guard<std::mutex> lock(mux_);
+    auto &stored = configs_[keyFor(config.podname(), config.nodename())];
+    if (stored == data) {
+        return;
+    }
+    stored = std::move(data);
+    if (enabled()) {
+        write();
+    }
+}
+
+/**
+ * Drops the configuration of a watcher that was destroyed.
+ *
+ * @param podName
+ * @param nodeName
+ */
+void Checkpoint::remove(const std::string &podName, const std::string &nodeName) {
+    std::lock_guard<std::mutex> lock(mux_);
+    if (configs_.erase(keyFor(podName, nodeName)) &&
+        enabled()) {
+        write();
+    }
+}
+
+/**
+ * Returns the key a watcher is checkpointed under.
+ *
+ * @param podName
+ * @param nodeName
+ * @return
+ */
+std::string Checkpoint::keyFor(const std::string &podName, const std::string &nodeName) {
+    return podName + ":" + nodeName;
+}
+
+/**
+ * Writes every configuration to a temporary file, flushes it to disk and
+ * renames it over the checkpoint, so a crash part way through never leaves a
+ * partial checkpoint. Callers hold `mux_`.
+ */
+void Checkpoint::write() {
+    std::string tmp = path_ + ".tmp";
+    std::string data = kCheckpointMagic;
+    for (const auto &it : configs_) {
+        uint32_t len = it.second.size();
+        data.append(reinterpret_cast<const char *>(&len), sizeof(len));
+        data.append(it.second);
+    }
+
+    int fd;
+    if ((fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1) {
+        LOG(WARNING) << "Failed to write checkpoint: " << tmp << ": " << strerror(errno);
+        return;
+    }
+    size_t pos = 0;
+    while (pos < data.size()) {
+        ssize_t n = ::write(fd, data.data() + pos, data.size() - pos);
+        if (n == -1 &&
+            errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        pos += n;
+    }
+    if (pos < data.size() ||
+        fsync(fd) == -1) {
+        LOG(WARNING) << "Failed to write checkpoint: " << tmp << ": " << strerror(errno);
+        close(fd);
+        return;
+    }
+    close(fd);
+    if (std::rename(tmp.c_str(), path_.c_str()) != 0) {
+        LOG(WARNING) << "Failed to replace checkpoint: " << path_;
+    }
+}
+} // namespace argusd
@@ -0,0 +1,60 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUSD_CHECKPOINT_H__
+#define __ARGUSD_CHECKPOINT_H__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <argus-proto/c++/argus.grpc.pb.h>
+
+namespace argusd {
+class Checkpoint final {
+public:
+    explicit Checkpoint(std::string path) : path_(std::move(path)) {}
+    ~Checkpoint() = default;
+
+    bool enabled() const { return !path_.empty(); }
+    std::vector<argus::ArgusdConfig> load();
+    std::vector<argus::ArgusdConfig> configs();
+    void store(const argus::ArgusdConfig &config);
+    void remove(const std::string &podName, const std::string &nodeName);
+
+private:
+    static std::string keyFor(const std::string &podName, const std::string &nodeName);
+    void write();
+
+    const std::string path_;
+    // Serialized `ArgusdConfig` of each watcher by pod:node.
+    std::map<std::string, std::string> configs_;
+    std::mutex mux_;
+};
+} // namespace argusd
+
+#endif
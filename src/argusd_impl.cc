@@ -25,11 +25,16 @@
 #include <poll.h>
 #include <sys/eventfd.h>
 #include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <future>
+#include <iterator>
 #include <memory>
 #include <mutex>
 #include <regex>
@@ -38,6 +43,7 @@
 #include <thread>
 
 #include <fmt/format.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <grpc/grpc.h>
 #include <grpc++/server_context.h>
@@ -46,18 +52,55 @@
 #include "argusd_impl.h"
 
 extern "C" {
+#include <lib/argusbudget.h>
+#include <lib/argusdigest.h>
+#include <lib/argushandoff.h>
+#include <lib/argushot.h>
+#include <lib/arguslimit.h>
 #include <lib/argusnotify.h>
+#include <lib/argusoverlay.h>
 #include <lib/argusutil.h>
 }
 
+DECLARE_int32(coalescewindow);
+DECLARE_double(ratelimit);
+DECLARE_double(rateburst);
+DECLARE_double(watcherratelimit);
+DECLARE_double(watcherrateburst);
+DECLARE_uint32(hotthreshold);
+DECLARE_int32(hotcooldown);
+DECLARE_bool(verifycontent);
+DECLARE_bool(baseline);
+DECLARE_string(backend);
+DECLARE_int32(pollinterval);
+DECLARE_int32(pollbudget);
+DECLARE_bool(upperdir);
+DECLARE_int32(createtimeout);
+DECLARE_int32(statsinterval);
+
 grpc::ServerWriter<argus::ArgusdMetricsHandle> *kMetricsWriter;
 
 namespace argusd {
+// Subject tags with this prefix carry options rather than custom tags.
+static const std::string kReservedTagPrefix = "argus.";
+// `GetWatchState` metadata: the registry generation and fingerprint last
+// seen by the controller, and sent back with the current ones; whether the
+// response is a delta or every watcher.
+static const std::string kGenerationMetadata = "argus-generation";
+static const std::string kFingerprintMetadata = "argus-fingerprint";
+static const std::string kDeltaMetadata = "argus-delta";
+
+// Sent in place of the length of a watcher configuration once every watcher
+// was handed over.
+static const uint32_t kHandoffDone = UINT32_MAX;
+
 /**
  * CreateWatch is responsible for creating (or updating) an argus watcher. Find
  * list of PIDs from the request's container IDs list. With the list of PIDs,
  * create `inotify` watchers by spawning an argusnotify process that handles
- * the filesystem-level instructions.
+ * the filesystem-level instructions. Each (pid, subject) is started or
+ * updated concurrently. With `-createtimeout`, the call only returns once
+ * every watcher is armed, or fails if one of them couldn't be.
  *
  * @param context
  * @param request
@@ -80,44 +123,58 @@ grpc::Status ArgusdImpl::CreateWatch(grpc::ServerContext *context [[maybe_unused
         << request->podname() << ":" << request->nodename() << ")";
 
     if (watcher != nullptr) {
-        // Stop existing watcher polling.
-        sendKillSignalToWatcher(watcher);
-
-        // Wait for all inotify threads to be finished and cleaned up.
-        std::unique_lock<std::mutex> lock(mux_);
-        cv_.wait_until(lock, std::chrono::system_clock::now() + std::chrono::seconds(2), [=] {
-            for (const auto &it : doneMap_) {
-                if (!it.second) {
-                    return false;
-                }
+        // Existing watchers are updated in place, so only PIDs that are no
+        // longer part of the request are stopped.
+        for (const auto &pid : watcher->pid()) {
+            if (std::find(pids.cbegin(), pids.cend(), pid) == pids.cend()) {
+                send_watcher_kill_signal(pid);
             }
-            return true;
-        });
+        }
     }
 
     response->set_nodename(request->nodename().c_str());
     response->set_podname(request->podname().c_str());
 
-    for_each(pids.cbegin(), pids.cend(), [&](const int pid) {
-        int i = 0;
-        // Reset done map flags.
-        doneMap_[pid] = false;
-
-        for_each(request->subject().cbegin(), request->subject().cend(), [&](const argus::ArgusWatcherSubject subject) {
-            // @TODO: Check if any watchers are started, if not, don't add to response.
-            createInotifyWatcher(request->name(), response->nodename(), response->podname(),
-                std::make_shared<argus::ArgusWatcherSubject>(subject), pid, i, request->subject_size(),
-                request->logformat());
-            ++i;
-        });
+    // Rate limit shared by every subject and PID of this watcher; each
+    // argusnotify watcher takes its own reference.
+    struct arguslimit *sharedLimit = create_rate_limit(FLAGS_watcherratelimit, FLAGS_watcherrateburst);
+
+    std::vector<std::future<void>> tasks;
+    const std::string nodeName = response->nodename(), podName = response->podname();
+    for (const auto &pid : pids) {
+        for (int sid = 0; sid < request->subject_size(); ++sid) {
+            auto subject = std::make_shared<argus::ArgusWatcherSubject>(request->subject(sid));
+            tasks.push_back(std::async(std::launch::async, [=] {
+                // Hand the new configuration to a running watcher, or start one.
+                if (!updateInotifyWatcher(request->name(), subject, pid, sid, request->logformat(), sharedLimit)) {
+                    // @TODO: Check if any watchers are started, if not, don't add to response.
+                    createInotifyWatcher(request->name(), nodeName, podName, subject, pid, sid, request->logformat(),
+                        sharedLimit);
+                }
+            }));
+        }
+        // Stop watchers of subjects that were removed from the request.
+        trim_watcher_subjects(pid, request->subject_size());
         response->add_pid(pid);
-    });
+    }
+    for (auto &task : tasks) {
+        task.wait();
+    }
+    release_rate_limit(sharedLimit);
 
-    if (watcher == nullptr) {
-        // Store new watcher.
-        watchers_.push_back(std::make_shared<argus::ArgusdHandle>(*response));
+    // Store new watcher, or keep the stored one in step with the PIDs now
+    // watched.
+    if (watcher != nullptr &&
+        (watcher->podname() != response->podname() ||
+        watcher->nodename() != response->nodename())) {
+        watchers_.remove(watcher->podname(), watcher->nodename());
     }
+    watchers_.put(*response);
+    checkpoint_.store(*request);
 
+    if (FLAGS_createtimeout > 0) {
+        return waitForWatchersArmed(pids, request->subject_size(), std::chrono::milliseconds(FLAGS_createtimeout));
+    }
     return grpc::Status::OK;
 }
 
@@ -139,8 +196,21 @@ grpc::Status ArgusdImpl::DestroyWatch(grpc::ServerContext *context [[maybe_unuse
     if (watcher != nullptr) {
         // Stop existing watcher polling.
         sendKillSignalToWatcher(watcher);
+        watchers_.remove(watcher->podname(), watcher->nodename());
+    }
+    checkpoint_.remove(request->podname(), request->nodename());
+    {
+        // Watchers that are running drop their status when they stop.
+        std::lock_guard<std::mutex> statusLock(mux_);
+        for (const auto &pid : request->pid()) {
+            for (auto it = status_.lower_bound(std::make_pair(pid, 0)); it != status_.end() && it->first.first == pid;) {
+                it = __atomic_load_n(&it->second->state, __ATOMIC_ACQUIRE) == AW_STATE_FAILED ? status_.erase(it) : std::next(it);
+            }
+        }
     }
-    watchers_.erase(remove(watchers_.begin(), watchers_.end(), watcher), watchers_.end());
+    std::for_each(request->cid().cbegin(), request->cid().cend(), [&](const std::string &cid) {
+        pidCache_.invalidate(cid);
+    });
 
     return grpc::Status::OK;
 }
@@ -150,23 +220,379 @@ grpc::Status ArgusdImpl::DestroyWatch(grpc::ServerContext *context [[maybe_unuse
  * responsible for gathering the current watcher state to send back so the
  * controller can reconcile if any watchers need to be added or destroyed.
  *
+ * A controller that sends the `argus-generation` (and optionally
+ * `argus-fingerprint`) it got back from the previous call as metadata only
+ * gets the watchers that changed since; removed watchers are sent without
+ * any PIDs. Nothing is sent if the fingerprint still matches. Without them,
+ * or if the generation is too old, every watcher is sent, as indicated by
+ * `argus-delta: 0`.
+ *
  * @param context
  * @param request
  * @param writer
  * @return
  */
-grpc::Status ArgusdImpl::GetWatchState(grpc::ServerContext *context [[maybe_unused]], const argus::Empty *request [[maybe_unused]],
+grpc::Status ArgusdImpl::GetWatchState(grpc::ServerContext *context, const argus::Empty *request [[maybe_unused]],
     grpc::ServerWriter<argus::ArgusdHandle> *writer) {
 
-    std::for_each(watchers_.cbegin(), watchers_.cend(), [&](const std::shared_ptr<argus::ArgusdHandle> watcher) {
+    uint64_t generation = 0, fingerprint = 0;
+    auto readMetadata = [&](const std::string &key, const int base, uint64_t &value) {
+        auto it = context->client_metadata().find(key);
+        if (it == context->client_metadata().end()) {
+            return;
+        }
+        try {
+            value = std::stoull(std::string(it->second.data(), it->second.size()), nullptr, base);
+        } catch (const std::exception &e) {
+            LOG(WARNING) << "Malformed `" << key << "` metadata";
+        }
+    };
+    readMetadata(kGenerationMetadata, 10, generation);
+    readMetadata(kFingerprintMetadata, 16, fingerprint);
+    auto delta = watchers_.since(generation, fingerprint);
+    std::stringstream ss;
+    ss << std::hex << delta.fingerprint;
+    context->AddInitialMetadata(kGenerationMetadata, std::to_string(delta.generation));
+    context->AddInitialMetadata(kFingerprintMetadata, ss.str());
+    context->AddInitialMetadata(kDeltaMetadata, delta.full ? "0" : "1");
+
+    // Going over every watcher takes the status lock and each watcher's
+    // counters, so it is only done every `-statsinterval`; in between, only
+    // the watchers that changed are logged.
+    auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto last = lastStatsSweep_.load(std::memory_order_relaxed);
+    if (now - last >= std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::milliseconds(FLAGS_statsinterval)).count() &&
+        lastStatsSweep_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+        struct argusbudget_usage usage;
+        get_budget_usage(&usage);
+        LOG(INFO) << "inotify budget: " << usage.watches << "/" << usage.maxwatches << " watches, "
+            << usage.instances << "/" << usage.maxinstances << " instances, "
+            << usage.degraded << " degraded watchers";
+        watchers_.forEach([&](const std::shared_ptr<argus::ArgusdHandle> &watcher) {
+            logWatcherStats(watcher);
+            logWatcherStatus(watcher);
+        });
+    } else {
+        for (const auto &watcher : delta.changed) {
+            logWatcherStats(watcher);
+            logWatcherStatus(watcher);
+        }
+    }
+
+    for (const auto &watcher : delta.changed) {
         if (!writer->Write(*watcher)) {
             // Broken stream.
+            return grpc::Status::CANCELLED;
         }
-    });
+    }
+    for (const auto &removed : delta.removed) {
+        argus::ArgusdHandle watcher;
+        watcher.set_podname(removed.first);
+        watcher.set_nodename(removed.second);
+        if (!writer->Write(watcher)) {
+            return grpc::Status::CANCELLED;
+        }
+    }
 
     return grpc::Status::OK;
 }
 
+/**
+ * Re-creates the watchers stored in the checkpoint file (`-checkpointfile`)
+ * after a restart, re-resolving the PIDs of their containers. Watchers are
+ * restored concurrently in the background, so the server can answer the
+ * controller meanwhile; its `CreateWatch` calls for the same watchers become
+ * in-place updates. The time from startup until every restored watcher is
+ * armed is logged. Watchers whose containers are gone are dropped from the
+ * checkpoint.
+ */
+void ArgusdImpl::restoreFromCheckpoint() {
+    auto configs = checkpoint_.load();
+    if (configs.empty()) {
+        return;
+    }
+    LOG(INFO) << "Restoring " << configs.size() << " watchers from checkpoint";
+
+    std::thread([this, configs] {
+        // Long enough for the largest trees; this only bounds the report.
+        static const std::chrono::minutes kRestoreTimeout(10);
+        std::atomic<int> armed{0};
+        std::vector<std::future<void>> tasks;
+        for (const auto &config : configs) {
+            tasks.push_back(std::async(std::launch::async, [&, config] {
+                argus::ArgusdHandle response;
+                if (CreateWatch(nullptr, &config, &response).error_code() == grpc::StatusCode::CANCELLED) {
+                    LOG(INFO) << "Not restoring `inotify` watcher (" << config.podname() << ":"
+                        << config.nodename() << "), containers not found";
+                    checkpoint_.remove(config.podname(), config.nodename());
+                    return;
+                }
+                std::vector<int> pids(response.pid().cbegin(), response.pid().cend());
+                if (waitForWatchersArmed(pids, config.subject_size(), kRestoreTimeout).ok()) {
+                    ++armed;
+                }
+            }));
+        }
+        for (auto &task : tasks) {
+            task.wait();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - startTime_);
+        LOG(INFO) << "Warm restart: " << armed << " of " << configs.size() << " watchers armed "
+            << elapsed.count() << " ms after startup";
+    }).detach();
+}
+
+/**
+ * Takes over the watchers of a running argusd listening on `socketPath`
+ * (see `serveHandoff`), e.g. the previous version of this daemon during an
+ * upgrade. The `inotify` instances of its watchers are passed to us along
+ * with their caches, so they carry on without walking any tree again and
+ * without losing the events queued meanwhile. Returns false if there is no
+ * daemon to take over from, or if the handoff broke off before every watcher
+ * was received; the caller then restores them from the checkpoint, which
+ * only updates the watchers already taken over in place.
+ *
+ * @param socketPath
+ * @return
+ */
+bool ArgusdImpl::receiveHandoff(const std::string &socketPath) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == EOF ||
+        connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == EOF) {
+        if (sock != EOF) {
+            close(sock);
+        }
+        return false;
+    }
+    LOG(INFO) << "Taking over `inotify` watchers from " << socketPath;
+
+    auto readAll = [&](void *buf, size_t len) {
+        return recv(sock, buf, len, MSG_WAITALL) == static_cast<ssize_t>(len);
+    };
+    auto start = std::chrono::steady_clock::now();
+    int watchers = 0, instances = 0;
+    bool complete = false;
+    uint32_t len;
+    // Each watcher is its configuration, followed by its instances, each
+    // preceded by a 1, and a 0. `kHandoffDone` follows the last one.
+    while (readAll(&len, sizeof(len))) {
+        if (len == kHandoffDone) {
+            complete = true;
+            break;
+        }
+        std::string data(len, '\0');
+        argus::ArgusdConfig config;
+        if (!readAll(&data[0], len) ||
+            !config.ParseFromString(data)) {
+            LOG(WARNING) << "Malformed watcher configuration in handoff";
+            break;
+        }
+
+        argus::ArgusdHandle response;
+        response.set_nodename(config.nodename());
+        response.set_podname(config.podname());
+        std::vector<int> pids;
+        struct arguslimit *sharedLimit = create_rate_limit(FLAGS_watcherratelimit, FLAGS_watcherrateburst);
+        uint8_t more;
+        while (readAll(&more, sizeof(more)) && more) {
+            auto handoff = new arguswatch_handoff();
+            if (recv_watch_handoff(sock, handoff) != 0) {
+                delete handoff;
+                break;
+            }
+            if (handoff->sid < 0 ||
+                handoff->sid >= config.subject_size()) {
+                free_watch_handoff(handoff);
+                delete handoff;
+                continue;
+            }
+            createInotifyWatcher(config.name(), config.nodename(), config.podname(),
+                std::make_shared<argus::ArgusWatcherSubject>(config.subject(handoff->sid)), handoff->pid,
+                handoff->sid, config.logformat(), sharedLimit, handoff);
+            if (std::find(pids.cbegin(), pids.cend(), handoff->pid) == pids.cend()) {
+                pids.push_back(handoff->pid);
+                response.add_pid(handoff->pid);
+            }
+            ++instances;
+        }
+        release_rate_limit(sharedLimit);
+
+        if (!pids.empty()) {
+            watchers_.put(response);
+            checkpoint_.store(config);
+            ++watchers;
+        }
+    }
+    close(sock);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    LOG(INFO) << "Took over " << watchers << " watchers (" << instances << " `inotify` instances) in "
+        << elapsed.count() << " ms";
+    if (!complete) {
+        LOG(WARNING) << "Handoff broke off, restoring the remaining watchers from the checkpoint";
+    }
+    return complete;
+}
+
+/**
+ * Listens on `socketPath` in the background for a newer argusd to hand our
+ * watchers to (see `receiveHandoff`). Once they are handed over,
+ * `onHandedOff` is called to stop this daemon. If the handoff fails, the
+ * watchers not handed over yet carry on here, and we listen again.
+ *
+ * @param socketPath
+ * @param onHandedOff
+ */
+void ArgusdImpl::serveHandoff(const std::string &socketPath, std::function<void()> onHandedOff) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socketPath.c_str());
+    // Only root can take over our `inotify` instances.
+    mode_t mask = umask(0077);
+    if (sock == EOF ||
+        bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == EOF ||
+        listen(sock, 1) == EOF) {
+        umask(mask);
+        LOG(WARNING) << "Failed to listen for handoff on " << socketPath << ": " << strerror(errno);
+        if (sock != EOF) {
+            close(sock);
+        }
+        return;
+    }
+    umask(mask);
+
+    std::thread([this, sock, socketPath, onHandedOff] {
+        int conn;
+        while ((conn = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC)) == EOF &&
+            errno == EINTR) {}
+        close(sock);
+        unlink(socketPath.c_str());
+        if (conn == EOF) {
+            LOG(WARNING) << "Failed to accept handoff: " << strerror(errno);
+            return;
+        }
+        bool handedOff = sendHandoff(conn);
+        close(conn);
+        if (handedOff) {
+            onHandedOff();
+            return;
+        }
+        LOG(WARNING) << "Handoff failed, carrying on with the watchers that weren't handed over";
+        serveHandoff(socketPath, onHandedOff);
+    }).detach();
+}
+
+/**
+ * Hands every watcher over on the connected socket `sock`: each one's
+ * watcher threads are detached, leaving their `inotify` instances open and
+ * their caches in place, and the instances are passed over with
+ * `send_watch_handoff`. Returns false if the handoff broke off, after
+ * re-arming the watchers that were detached but not handed over.
+ *
+ * @param sock
+ * @return
+ */
+bool ArgusdImpl::sendHandoff(const int sock) {
+    static const uint8_t kMore = 1, kEnd = 0;
+    auto writeAll = [&](const void *buf, size_t len) {
+        return send(sock, buf, len, MSG_NOSIGNAL) == static_cast<ssize_t>(len);
+    };
+
+    LOG(INFO) << "Handing `inotify` watchers over to a new argusd";
+    for (const auto &config : checkpoint_.configs()) {
+        auto watcher = watchers_.find(config.podname(), config.nodename());
+        if (watcher == nullptr) {
+            continue;
+        }
+
+        // Stop reading events; they queue up in the kernel until the new
+        // daemon carries on reading them.
+        for (const auto &pid : watcher->pid()) {
+            detach_inotify_watchers(pid);
+        }
+        {
+            std::unique_lock<std::mutex> lock(mux_);
+            cv_.wait_for(lock, std::chrono::seconds(5), [&] {
+                for (const auto &pid : watcher->pid()) {
+                    for (int sid = 0; sid < config.subject_size(); ++sid) {
+                        auto it = status_.find(std::make_pair(pid, sid));
+                        if (it != status_.end() &&
+                            __atomic_load_n(&it->second->state, __ATOMIC_ACQUIRE) != AW_STATE_FAILED) {
+                            return false;
+                        }
+                    }
+                }
+                return true;
+            });
+        }
+
+        std::string data;
+        config.SerializeToString(&data);
+        uint32_t len = data.size();
+        if (!writeAll(&len, sizeof(len)) ||
+            !writeAll(data.data(), len)) {
+            LOG(WARNING) << "Handoff aborted: " << strerror(errno);
+            rearmDetachedWatchers(config, watcher);
+            return false;
+        }
+        for (const auto &pid : watcher->pid()) {
+            for (int sid = 0; sid < config.subject_size(); ++sid) {
+                if (find_detached_watch(pid, sid) == -1) {
+                    // Not running (e.g. failed); the new daemon doesn't get
+                    // this one until the controller creates it again.
+                    LOG(WARNING) << "Not handing over watcher (" << config.podname() << ":" << config.nodename()
+                        << ") pid " << pid << " subject " << sid << ", it isn't running";
+                    continue;
+                }
+                if (!writeAll(&kMore, sizeof(kMore)) ||
+                    send_watch_handoff(sock, pid, sid) == EOF) {
+                    LOG(WARNING) << "Handoff aborted: " << strerror(errno);
+                    rearmDetachedWatchers(config, watcher);
+                    return false;
+                }
+            }
+        }
+        if (!writeAll(&kEnd, sizeof(kEnd))) {
+            return false;
+        }
+    }
+    return writeAll(&kHandoffDone, sizeof(kHandoffDone));
+}
+
+/**
+ * Restarts the watcher threads of `watcher` that `sendHandoff` detached but
+ * didn't hand over, on the `inotify` instances they left behind (see
+ * `take_watch_handoff`), so no events are lost. Those already handed over
+ * are gone, and come back once the controller creates the watcher again.
+ *
+ * @param config
+ * @param watcher
+ */
+void ArgusdImpl::rearmDetachedWatchers(const argus::ArgusdConfig &config,
+    std::shared_ptr<argus::ArgusdHandle> watcher) {
+    struct arguslimit *sharedLimit = create_rate_limit(FLAGS_watcherratelimit, FLAGS_watcherrateburst);
+    for (const auto &pid : watcher->pid()) {
+        for (int sid = 0; sid < config.subject_size(); ++sid) {
+            auto handoff = new arguswatch_handoff();
+            if (take_watch_handoff(pid, sid, handoff) == EOF) {
+                delete handoff;
+                continue;
+            }
+            createInotifyWatcher(config.name(), config.nodename(), config.podname(),
+                std::make_shared<argus::ArgusWatcherSubject>(config.subject(sid)), pid, sid, config.logformat(),
+                sharedLimit, handoff);
+        }
+    }
+    release_rate_limit(sharedLimit);
+}
+
 /**
  * RecordMetrics is used to send the controller `inotify` events that occur on
  * this daemon by way of a gRPC stream.
@@ -194,21 +620,17 @@ grpc::Status ArgusdImpl::RecordMetrics(grpc::ServerContext *context [[maybe_unus
 }
 
 /**
- * Return list of PIDs looked up by container IDs from request.
+ * Return list of PIDs looked up by container IDs from request. Lookups go
+ * through `pidCache_` so that reconciling unchanged pods doesn't have to find
+ * the container runtime and PID again.
  *
  * @param request
  * @return
  */
-std::vector<int> ArgusdImpl::getPidsFromRequest(std::shared_ptr<argus::ArgusdConfig> request) const {
-    std::vector<int> pids;
-    std::for_each(request->cid().cbegin(), request->cid().cend(), [&](std::string cid) {
-        std::string runtime = clustergarage::container::Util::findContainerRuntime(cid);
-        cleanContainerId(cid, runtime);
-        int pid = clustergarage::container::Util::getPidForContainer(cid, runtime);
-        if (pid) {
-            pids.push_back(pid);
-        }
-    });
+std::vector<int> ArgusdImpl::getPidsFromRequest(std::shared_ptr<argus::ArgusdConfig> request) {
+    auto pids = pidCache_.lookup(std::vector<std::string>(request->cid().cbegin(), request->cid().cend()));
+    LOG(INFO) << "Resolved " << pids.size() << "/" << request->cid_size() << " container(s) ("
+        << pidCache_.hits() << " pid cache hits, " << pidCache_.misses() << " misses)";
     return pids;
 }
 
@@ -220,46 +642,75 @@ std::vector<int> ArgusdImpl::getPidsFromRequest(std::shared_ptr<argus::ArgusdCon
  * @return
  */
 std::shared_ptr<argus::ArgusdHandle> ArgusdImpl::findArgusdWatcherByPids(const std::string nodeName, const std::vector<int> pids) const {
-    auto it = find_if(watchers_.cbegin(), watchers_.cend(), [&](std::shared_ptr<argus::ArgusdHandle> watcher) {
-        bool foundPid = false;
-        for (const auto &pid : pids) {
-            auto watcherPid = std::find_if(watcher->pid().cbegin(), watcher->pid().cend(),
-                [&](int p) { return p == pid; });
-            foundPid = watcherPid != watcher->pid().cend();
-        }
-        return watcher->nodename() == nodeName && foundPid;
-    });
-    if (it != watchers_.cend()) {
-        return *it;
-    }
-    return nullptr;
+    return watchers_.findByPids(nodeName, pids);
 }
 
 /**
  * Returns array of char buffer paths to do the actual watch on given a
  * subject. These prepend /proc/{PID}/root on each path so we can monitor via
- * profs directly to receive inode events.
+ * profs directly to receive inode events. If `upperdir` is set, paths that
+ * exist in the container's writable layer are watched there instead, leaving
+ * out the read-only image layers.
  *
  * @param pid
  * @param subject
+ * @param upperdir
  * @return
  */
-char **ArgusdImpl::getPathArrayFromSubject(const int pid, std::shared_ptr<argus::ArgusWatcherSubject> subject) const {
+char **ArgusdImpl::getPathArrayFromSubject(const int pid, std::shared_ptr<argus::ArgusWatcherSubject> subject,
+    const char *upperdir) const {
+
     std::vector<std::string> pathvec;
     std::for_each(subject->path().cbegin(), subject->path().cend(), [&](std::string path) {
         std::stringstream ss;
-        ss << "/proc/" << pid << "/root" << path.c_str();
+        struct stat sb;
+        if (upperdir != nullptr &&
+            lstat((upperdir + path).c_str(), &sb) == 0) {
+            ss << upperdir << path.c_str();
+        } else {
+            // Nothing was written under it yet.
+            ss << "/proc/" << pid << "/root" << path.c_str();
+        }
         pathvec.push_back(ss.str());
     });
 
-    char **patharr = new char *[pathvec.size()];
+    char **patharr = static_cast<char **>(calloc(pathvec.size(), sizeof(char *)));
     for(size_t i = 0; i < pathvec.size(); ++i) {
-        patharr[i] = new char[pathvec[i].size() + 1];
-        strcpy(patharr[i], pathvec[i].c_str());
+        patharr[i] = strdup(pathvec[i].c_str());
     }
     return patharr;
 }
 
+/**
+ * Returns the host path of the overlay upperdir of the container `pid` runs
+ * in, if the subject watches only its writable layer (`argus.upperdir` tag,
+ * or `-upperdir`), or nullptr. Containers whose root isn't an overlay are
+ * watched through /proc/{PID}/root as usual.
+ *
+ * @param pid
+ * @param subject
+ * @return
+ */
+const char *ArgusdImpl::getUpperDirFromSubject(const int pid, std::shared_ptr<argus::ArgusWatcherSubject> subject) const {
+    bool upper = FLAGS_upperdir;
+    auto values = getTagValuesFromSubject(subject, "upperdir");
+    if (!values.empty()) {
+        if (values.front() != "true" && values.front() != "false") {
+            LOG(WARNING) << "Malformed `" << kReservedTagPrefix << "upperdir` tag: \"" << values.front() << "\"";
+        } else {
+            upper = values.front() == "true";
+        }
+    }
+    if (!upper) {
+        return nullptr;
+    }
+    char *upperdir = find_overlay_upperdir(pid);
+    if (upperdir == nullptr) {
+        LOG(WARNING) << "No overlay upperdir found for pid " << pid << ", watching the merged view";
+    }
+    return upperdir;
+}
+
 /**
  * Returns array of char buffer paths to ignore given a subject. When doing a
  * recursive watch, if ignore paths are provided that match a specific path it
@@ -269,18 +720,179 @@ char **ArgusdImpl::getPathArrayFromSubject(const int pid, std::shared_ptr<argus:
  * @return
  */
 char **ArgusdImpl::getIgnoreArrayFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const {
-    char **patharr = new char *[subject->ignore_size()];
+    char **patharr = static_cast<char **>(calloc(subject->ignore_size(), sizeof(char *)));
     size_t i = 0;
     std::for_each(subject->ignore().cbegin(), subject->ignore().cend(), [&](std::string path) {
-        patharr[i] = new char[path.size() + 1];
-        strcpy(patharr[i], path.c_str());
-        ++i;
+        patharr[i++] = strdup(path.c_str());
     });
     return patharr;
 }
 
+/**
+ * Returns the comma-separated values of a reserved subject tag. Options that
+ * have no field of their own in `ArgusWatcherSubject` are passed as tags
+ * prefixed with `argus.`, e.g. `argus.include: "*.conf,*.so"`.
+ *
+ * @param subject
+ * @param key
+ * @return
+ */
+std::vector<std::string> ArgusdImpl::getTagValuesFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject,
+    const std::string &key) const {
+    std::vector<std::string> values;
+    auto tag = subject->tags().find(kReservedTagPrefix + key);
+    if (tag == subject->tags().end()) {
+        return values;
+    }
+    std::stringstream ss(tag->second);
+    std::string value;
+    while (std::getline(ss, value, ',')) {
+        if (!value.empty()) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+/**
+ * Returns array of char buffer patterns that file names or paths have to
+ * match for events to be logged, from the `argus.include` tag of a subject.
+ *
+ * @param subject
+ * @param count
+ * @return
+ */
+char **ArgusdImpl::getIncludeArrayFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject,
+    unsigned int *count) const {
+    std::vector<std::string> patterns = getTagValuesFromSubject(subject, "include");
+    char **patternarr = static_cast<char **>(calloc(patterns.size(), sizeof(char *)));
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        patternarr[i] = strdup(patterns[i].c_str());
+    }
+    *count = patterns.size();
+    return patternarr;
+}
+
+/**
+ * Returns a bitwise-OR combined set of file types to log events for, from
+ * the `argus.filetype` tag of a subject. Options include `dir`, `file` (any
+ * non-directory), `regular`, `symlink` and `other`.
+ *
+ * @param subject
+ * @return
+ */
+uint32_t ArgusdImpl::getFileTypesFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const {
+    uint32_t types = 0;
+    for (const auto &type : getTagValuesFromSubject(subject, "filetype")) {
+        if (type == "dir")          types |= AW_FTYPE_DIR;
+        else if (type == "file")    types |= AW_FTYPE_NONDIR;
+        else if (type == "regular") types |= AW_FTYPE_REG;
+        else if (type == "symlink") types |= AW_FTYPE_LNK;
+        else if (type == "other")   types |= AW_FTYPE_OTHER;
+        else LOG(WARNING) << "Unknown file type: " << type;
+    }
+    return types;
+}
+
+/**
+ * Returns the tuning options of a watcher from the reserved tags of a
+ * subject, falling back to the daemon-wide defaults:
+ *
+ * @tag argus.coalesce   Window in ms for folding repeated identical events
+ *                       together (`-coalescewindow`).
+ * @tag argus.ratelimit  Events per second logged for this subject
+ *                       (`-ratelimit`).
+ * @tag argus.rateburst  Burst size of the rate limit (`-rateburst`).
+ * @tag argus.hotthreshold
+ *                       Access/open events per second before a directory
+ *                       stops being watched for them (`-hotthreshold`).
+ * @tag argus.hotcooldown
+ *                       Time in ms before they are watched again
+ *                       (`-hotcooldown`).
+ * @tag argus.verifycontent
+ *                       Only log writes that changed the content of a file,
+ *                       `true` or `false` (`-verifycontent`).
+ * @tag argus.baseline   Hash the watched files whenever the watcher is
+ *                       (re)armed and log what changed since the last time,
+ *                       `true` or `false` (`-baseline`).
+ * @tag argus.backend    How the tree is watched: `inotify` for a watch on
+ *                       every directory, `fanotify` for a mark on the whole
+ *                       filesystem, filtered to the tree, or `poll` to
+ *                       rescan it every so often (`-backend`).
+ * @tag argus.pollinterval
+ *                       Time in ms between rescans with the `poll` backend
+ *                       (`-pollinterval`).
+ * @tag argus.pollbudget Percentage of a CPU each rescan may use
+ *                       (`-pollbudget`).
+ * @tag argus.upperdir   Watch only the container's overlay upperdir, `true`
+ *                       or `false` (`-upperdir`). Resolved separately, see
+ *                       `getUpperDirFromSubject`.
+ *
+ * The watcher-wide `sharedLimit` is acquired for the new watcher.
+ *
+ * @param subject
+ * @param sharedLimit
+ * @return
+ */
+struct arguswatch_opts *ArgusdImpl::getOptsFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject,
+    struct arguslimit *sharedLimit) const {
+
+    auto opts = new arguswatch_opts();
+    opts->coalesce_window = FLAGS_coalescewindow;
+    opts->rate_limit = FLAGS_ratelimit;
+    opts->rate_burst = FLAGS_rateburst;
+    opts->shared_limit = acquire_rate_limit(sharedLimit);
+    opts->hot_threshold = FLAGS_hotthreshold;
+    opts->hot_cooldown = FLAGS_hotcooldown;
+    opts->verify_content = FLAGS_verifycontent;
+    opts->baseline = FLAGS_baseline;
+
+    auto readTag = [&](const std::string &key, auto parse, auto &value) {
+        auto values = getTagValuesFromSubject(subject, key);
+        if (values.empty()) {
+            return;
+        }
+        try {
+            value = parse(values.front());
+        } catch (const std::exception &e) {
+            LOG(WARNING) << "Malformed `" << kReservedTagPrefix << key << "` tag: \"" << values.front() << "\"";
+        }
+    };
+    readTag("coalesce", [](const std::string &s) { return std::stoi(s); }, opts->coalesce_window);
+    readTag("ratelimit", [](const std::string &s) { return std::stod(s); }, opts->rate_limit);
+    readTag("rateburst", [](const std::string &s) { return std::stod(s); }, opts->rate_burst);
+    readTag("hotthreshold", [](const std::string &s) { return std::stoul(s); }, opts->hot_threshold);
+    readTag("hotcooldown", [](const std::string &s) { return std::stoi(s); }, opts->hot_cooldown);
+    auto parseBool = [](const std::string &s) {
+        if (s != "true" && s != "false") {
+            throw std::invalid_argument(s);
+        }
+        return s == "true";
+    };
+    readTag("verifycontent", parseBool, opts->verify_content);
+    readTag("baseline", parseBool, opts->baseline);
+    auto parseBackend = [](const std::string &s) {
+        if (s == "fanotify") {
+            return AW_BACKEND_FANOTIFY;
+        } else if (s == "poll") {
+            return AW_BACKEND_POLL;
+        } else if (s != "inotify") {
+            throw std::invalid_argument(s);
+        }
+        return AW_BACKEND_INOTIFY;
+    };
+    opts->backend = parseBackend(FLAGS_backend);
+    readTag("backend", parseBackend, opts->backend);
+    opts->poll_interval = FLAGS_pollinterval;
+    opts->poll_budget = FLAGS_pollbudget;
+    readTag("pollinterval", [](const std::string &s) { return std::stoi(s); }, opts->poll_interval);
+    readTag("pollbudget", [](const std::string &s) { return std::stoi(s); }, opts->poll_budget);
+    return opts;
+}
+
 /**
  * Returns a comma-separated list of key=value pairs for a subject tag map.
+ * Reserved `argus.` tags are options rather than tags, and are left out.
  *
  * @param subject
  * @return
@@ -288,6 +900,9 @@ char **ArgusdImpl::getIgnoreArrayFromSubject(std::shared_ptr<argus::ArgusWatcher
 std::string ArgusdImpl::getTagListFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const {
     std::string tags;
     for (const auto &tag : subject->tags()) {
+        if (tag.first.compare(0, kReservedTagPrefix.size(), kReservedTagPrefix) == 0) {
+            continue;
+        }
         if (!tags.empty()) {
             tags += ",";
         }
@@ -353,7 +968,8 @@ uint32_t ArgusdImpl::getFlagsFromSubject(std::shared_ptr<argus::ArgusWatcherSubj
  * background thread later from this implementation; in the case of
  * updating/deleting an existing watcher. An additional cleanup thread is
  * created to specify removing the anonymous pipe in the case of an error
- * returned by the argusnotify poller.
+ * returned by the argusnotify poller. The watcher reports its lifecycle
+ * through a status kept in `status_` until it stops.
  *
  * @param watcherName
  * @param nodeName
@@ -361,27 +977,45 @@ uint32_t ArgusdImpl::getFlagsFromSubject(std::shared_ptr<argus::ArgusWatcherSubj
  * @param subject
  * @param pid
  * @param sid
- * @param subjectLen
  * @param logFormat
+ * @param sharedLimit
+ * @param handoff
  */
 void ArgusdImpl::createInotifyWatcher(const std::string watcherName, const std::string nodeName, const std::string podName,
-    std::shared_ptr<argus::ArgusWatcherSubject> subject, const int pid, const int sid, const int subjectLen,
-    const std::string logFormat) {
+    std::shared_ptr<argus::ArgusWatcherSubject> subject, const int pid, const int sid, const std::string logFormat,
+    struct arguslimit *sharedLimit, struct arguswatch_handoff *handoff) {
+
+    auto status = std::make_shared<struct arguswatch_status>();
+    status->state = AW_STATE_RESOLVING;
+    {
+        std::lock_guard<std::mutex> lock(mux_);
+        status_[std::make_pair(pid, sid)] = status;
+    }
+
+    unsigned int includec;
+    char **includes = getIncludeArrayFromSubject(subject, &includec);
+    std::shared_ptr<struct arguswatch_opts> opts(getOptsFromSubject(subject, sharedLimit));
+    opts->status = status.get();
+    opts->upperdir = getUpperDirFromSubject(pid, subject);
+    opts->handoff = handoff;
 
     std::packaged_task<int(const char *, const char *, const char *, int, int, unsigned int, const char **,
-        unsigned int, const char **, uint32_t, uint32_t, int, const char *, const char *, arguswatch_logfn)>
-        task(start_inotify_watcher);
+        unsigned int, const char **, unsigned int, const char **, uint32_t, uint32_t, uint32_t, int,
+        const struct arguswatch_opts *, const char *, const char *, arguswatch_logfn)> task(start_inotify_watcher);
     std::shared_future<int> result(task.get_future());
     std::thread taskThread(std::move(task),
         convertStringToCString(watcherName),
         convertStringToCString(nodeName),
         convertStringToCString(podName),
         pid, sid,
-        subject->path_size(), const_cast<const char **>(getPathArrayFromSubject(pid, subject)),
+        subject->path_size(), const_cast<const char **>(getPathArrayFromSubject(pid, subject, opts->upperdir)),
         subject->ignore_size(), const_cast<const char **>(getIgnoreArrayFromSubject(subject)),
+        includec, const_cast<const char **>(includes),
+        getFileTypesFromSubject(subject),
         getEventMaskFromSubject(subject),
         getFlagsFromSubject(subject),
         subject->maxdepth(),
+        opts.get(),
         convertStringToCString(getTagListFromSubject(subject)),
         convertStringToCString(logFormat),
         logArgusWatchEvent);
@@ -391,21 +1025,222 @@ void ArgusdImpl::createInotifyWatcher(const std::string watcherName, const std::
     // Once the argusnotify task begins we listen for a return status in a
     // separate, cleanup thread. When this result comes back, we do any
     // necessary cleanup here, such as destroy our anonymous pipe into the
-    // argusnotify poller.
-    int cnt = 0;
-    std::thread cleanupThread([=](std::shared_future<int> res) mutable {
+    // argusnotify poller. The status and options have to outlive the
+    // watcher, so they are only dropped here.
+    std::thread cleanupThread([=](std::shared_future<int> res) {
         res.wait();
+        if (opts->handoff != nullptr) {
+            // Whatever the watcher didn't take over.
+            free_watch_handoff(opts->handoff);
+            delete opts->handoff;
+        }
         if (res.valid()) {
-            if (++cnt == subjectLen) {
-                doneMap_[pid] = true;
+            if (res.get() == ARGUSNOTIFY_PROCESS_EXIT) {
+                // The container exited, there is nothing left to watch.
+                removeExitedPid(pid);
+            }
+            {
+                // Failed watchers stay around for `GetWatchState` to report.
+                std::lock_guard<std::mutex> lock(mux_);
+                auto it = status_.find(std::make_pair(pid, sid));
+                if (it != status_.end() &&
+                    it->second == status &&
+                    __atomic_load_n(&status->state, __ATOMIC_ACQUIRE) != AW_STATE_FAILED) {
+                    status_.erase(it);
+                }
             }
             // Notify the `condition_variable` of changes.
-            cv_.notify_one();
+            cv_.notify_all();
         }
     }, result);
     cleanupThread.detach();
 }
 
+/**
+ * Applies a new subject configuration to the running argusnotify watcher of
+ * `pid`/`sid` in place (see `update_inotify_watcher`), so an update doesn't
+ * stop the watcher and walk every tree again. Returns false if there is no
+ * running watcher to update, in which case one has to be created.
+ *
+ * @param watcherName
+ * @param subject
+ * @param pid
+ * @param sid
+ * @param logFormat
+ * @param sharedLimit
+ * @return
+ */
+bool ArgusdImpl::updateInotifyWatcher(const std::string watcherName, std::shared_ptr<argus::ArgusWatcherSubject> subject,
+    const int pid, const int sid, const std::string logFormat, struct arguslimit *sharedLimit) {
+
+    unsigned int includec;
+    char **includes = getIncludeArrayFromSubject(subject, &includec);
+    std::unique_ptr<struct arguswatch_opts> opts(getOptsFromSubject(subject, sharedLimit));
+    opts->upperdir = getUpperDirFromSubject(pid, subject);
+
+    if (update_inotify_watcher(
+        convertStringToCString(watcherName),
+        pid, sid,
+        subject->path_size(), const_cast<const char **>(getPathArrayFromSubject(pid, subject, opts->upperdir)),
+        subject->ignore_size(), const_cast<const char **>(getIgnoreArrayFromSubject(subject)),
+        includec, const_cast<const char **>(includes),
+        getFileTypesFromSubject(subject),
+        getEventMaskFromSubject(subject),
+        getFlagsFromSubject(subject),
+        subject->maxdepth(),
+        opts.get(),
+        convertStringToCString(getTagListFromSubject(subject)),
+        convertStringToCString(logFormat)) != EXIT_SUCCESS) {
+        // The configuration, including the reference to the shared limit,
+        // was freed along with the failed update.
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Waits up to `timeout` for the watchers of every PID and subject to be
+ * armed, i.e. for every path to be watched. Watchers report their state
+ * without notifying us, so it is checked every few milliseconds; watchers
+ * that stop wake us straight away.
+ *
+ * @param pids
+ * @param subjectLen
+ * @param timeout
+ * @return
+ */
+grpc::Status ArgusdImpl::waitForWatchersArmed(const std::vector<int> &pids, const int subjectLen,
+    const std::chrono::milliseconds timeout) {
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    int armed = 0, failed = 0;
+    std::unique_lock<std::mutex> lock(mux_);
+    for (;;) {
+        armed = 0;
+        failed = 0;
+        for (const auto &pid : pids) {
+            for (int sid = 0; sid < subjectLen; ++sid) {
+                auto it = status_.find(std::make_pair(pid, sid));
+                int state = it != status_.end() ? __atomic_load_n(&it->second->state, __ATOMIC_ACQUIRE) :
+                    AW_STATE_STOPPED;
+                if (state == AW_STATE_ARMED) {
+                    ++armed;
+                } else if (state == AW_STATE_FAILED ||
+                    state == AW_STATE_STOPPED) {
+                    ++failed;
+                }
+            }
+        }
+        if (armed + failed == static_cast<int>(pids.size()) * subjectLen ||
+            std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        cv_.wait_for(lock, std::chrono::milliseconds(20));
+    }
+
+    int total = static_cast<int>(pids.size()) * subjectLen;
+    if (failed > 0) {
+        return grpc::Status(grpc::StatusCode::UNAVAILABLE,
+            fmt::format("{} of {} `inotify` watchers failed to start", failed, total));
+    }
+    if (armed < total) {
+        return grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED,
+            fmt::format("{} of {} `inotify` watchers armed", armed, total));
+    }
+    return grpc::Status::OK;
+}
+
+/**
+ * Logs the events let through and filtered out by the include filters of
+ * `watcher`, the writes content verification left out, and the directories
+ * currently downgraded for being hot.
+ *
+ * @param watcher
+ */
+void ArgusdImpl::logWatcherStats(std::shared_ptr<argus::ArgusdHandle> watcher) {
+    unsigned long hits = 0, misses = 0;
+    for (const auto &pid : watcher->pid()) {
+        unsigned long pidhits, pidmisses;
+        get_filter_stats(pid, &pidhits, &pidmisses);
+        hits += pidhits;
+        misses += pidmisses;
+    }
+    if (hits || misses) {
+        LOG(INFO) << "Include filters (" << watcher->podname() << ":" << watcher->nodename() << "): "
+            << hits << " events logged, " << misses << " filtered out";
+    }
+    unsigned long unchanged = 0;
+    for (const auto &pid : watcher->pid()) {
+        unsigned long pidunchanged;
+        get_digest_stats(pid, &pidunchanged);
+        unchanged += pidunchanged;
+    }
+    if (unchanged) {
+        LOG(INFO) << "Content verification (" << watcher->podname() << ":" << watcher->nodename() << "): "
+            << unchanged << " writes left the content unchanged";
+    }
+    std::vector<std::string> hotPaths;
+    for (const auto &pid : watcher->pid()) {
+        list_downgraded_paths(pid, [](const char *path, void *arg) {
+            static_cast<std::vector<std::string> *>(arg)->push_back(path);
+        }, &hotPaths);
+    }
+    for (const auto &path : hotPaths) {
+        LOG(INFO) << "Hot directory, not watching access/open events (" << watcher->podname() << ":"
+            << watcher->nodename() << "): " << path;
+    }
+}
+
+/**
+ * Logs the lifecycle state of each watcher thread of `watcher` that isn't
+ * armed, with the number of paths watched so far. Watchers that are all armed
+ * are only summed up at `-v 1`, so steady polls stay quiet.
+ *
+ * @param watcher
+ */
+void ArgusdImpl::logWatcherStatus(std::shared_ptr<argus::ArgusdHandle> watcher) {
+    static const char *const kStateNames[] = {"resolving", "traversing", "armed", "failed", "stopped"};
+    int armed = 0, pending = 0;
+    std::lock_guard<std::mutex> lock(mux_);
+    for (const auto &pid : watcher->pid()) {
+        for (auto it = status_.lower_bound(std::make_pair(pid, 0));
+            it != status_.end() && it->first.first == pid; ++it) {
+            int state = __atomic_load_n(&it->second->state, __ATOMIC_ACQUIRE);
+            if (state == AW_STATE_ARMED) {
+                ++armed;
+                continue;
+            }
+            ++pending;
+            LOG(INFO) << "Watcher (" << watcher->podname() << ":" << watcher->nodename() << ") pid " << pid
+                << " subject " << it->first.second << ": " << kStateNames[state] << " ("
+                << __atomic_load_n(&it->second->traversed, __ATOMIC_RELAXED) << " paths watched)";
+        }
+    }
+    if (pending) {
+        LOG(INFO) << "Watcher (" << watcher->podname() << ":" << watcher->nodename() << "): " << armed << " armed, "
+            << pending << " not armed";
+    } else {
+        VLOG(1) << "Watcher (" << watcher->podname() << ":" << watcher->nodename() << "): " << armed << " armed";
+    }
+}
+
+/**
+ * Drops a PID whose process has exited from the stored watchers, so
+ * `GetWatchState` stops reporting it without waiting for the controller to
+ * call `DestroyWatch`. A watcher left without any PIDs is removed entirely.
+ *
+ * @param pid
+ */
+void ArgusdImpl::removeExitedPid(const int pid) {
+    for (const auto &watcher : watchers_.removePid(pid)) {
+        LOG(INFO) << "Process " << pid << " exited, stopped `inotify` watcher (" << watcher->podname() << ":"
+            << watcher->nodename() << ")";
+        if (watcher->pid_size() == 0) {
+            checkpoint_.remove(watcher->podname(), watcher->nodename());
+        }
+    }
+}
+
 /**
  * Sends a message over the anonymous pipe to stop the argusnotify poller.
  *
@@ -434,8 +1269,21 @@ void logArgusWatchEvent(struct arguswatch_event *awevent) {
      * @specifier ftype    Evaluates to "file" or "directory".
      * @specifier tags     List of custom tags in key=value comma-separated list.
      * @specifier sep      Placeholder for a "/" character (e.g. between path/file).
+     * @specifier count    Number of identical events folded into this one.
+     * @specifier first    Time of the first of the folded events.
+     * @specifier last     Time of the last of the folded events.
      */
     static const std::string kDefaultFormat = "{event} {ftype} '{path}{sep}{file}' ({pod}:{node}) {tags}";
+    // Used instead of the default when events were folded together.
+    static const std::string kDefaultCoalescedFormat = kDefaultFormat + " x{count} ({first} - {last})";
+
+    auto formatTime = [](const struct timespec &ts) -> std::string {
+        struct tm tm;
+        char buf[32];
+        gmtime_r(&ts.tv_sec, &tm);
+        strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+        return fmt::format("{}.{:03d}", buf, ts.tv_nsec / 1000000);
+    };
 
     std::string maskStr;
     if (awevent->event_mask & IN_ACCESS)             maskStr = "ACCESS";
@@ -451,17 +1299,37 @@ void logArgusWatchEvent(struct arguswatch_event *awevent) {
     else if (awevent->event_mask & IN_MOVED_TO)      maskStr = "MOVED_TO";
     else if (awevent->event_mask & IN_OPEN)          maskStr = "OPEN";
 
+    if (awevent->suppressed) {
+        LOG(WARNING) << "Rate limit: suppressed " << awevent->count << " " << maskStr << " events ("
+            << awevent->watch->pod_name << ":" << awevent->watch->node_name << ")";
+        return;
+    }
+
+    // Paths are logged as seen from inside the container.
+    std::string containerPath(awevent->path_name);
+    const char *upperdir = awevent->watch->upperdir;
+    if (upperdir != nullptr &&
+        containerPath.compare(0, strlen(upperdir), upperdir) == 0) {
+        containerPath.erase(0, strlen(upperdir));
+    } else {
+        containerPath = std::regex_replace(containerPath, std::regex("/proc/[0-9]+/root"), "");
+    }
+
     fmt::memory_buffer out;
     try {
-        fmt::format_to(out, *awevent->watch->log_format ? std::string(awevent->watch->log_format) : kDefaultFormat,
+        fmt::format_to(out, *awevent->watch->log_format ? std::string(awevent->watch->log_format) :
+            awevent->count > 1 ? kDefaultCoalescedFormat : kDefaultFormat,
             fmt::arg("event", maskStr),
             fmt::arg("ftype", awevent->is_dir ? "directory" : "file"),
-            fmt::arg("path", std::regex_replace(awevent->path_name, std::regex("/proc/[0-9]+/root"), "")),
+            fmt::arg("path", containerPath),
             fmt::arg("file", awevent->file_name),
             fmt::arg("sep", *awevent->file_name ? "/" : ""),
             fmt::arg("pod", awevent->watch->pod_name),
             fmt::arg("node", awevent->watch->node_name),
-            fmt::arg("tags", *awevent->watch->tags ? awevent->watch->tags : ""));
+            fmt::arg("tags", *awevent->watch->tags ? awevent->watch->tags : ""),
+            fmt::arg("count", awevent->count),
+            fmt::arg("first", formatTime(awevent->first)),
+            fmt::arg("last", formatTime(awevent->last)));
         LOG(INFO) << fmt::to_string(out);
     } catch(const std::exception &e) {
         LOG(WARNING) << "Malformed ArgusWatcher `.spec.logFormat`: \"" << e.what() << "\"";
@@ -25,17 +25,31 @@
 #ifndef __ARGUSD_IMPL_H__
 #define __ARGUSD_IMPL_H__
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <future>
 #include <map>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <argus-proto/c++/argus.grpc.pb.h>
-#include <libcontainer/container_util.h>
+
+#include "argusd_checkpoint.h"
+#include "argusd_pidcache.h"
+#include "argusd_registry.h"
+
+struct arguslimit;
+struct arguswatch_opts;
+struct arguswatch_status;
+struct arguswatch_handoff;
 
 namespace argusd {
 class ArgusdImpl final : public argus::Argusd::Service {
 public:
-    explicit ArgusdImpl() = default;
+    explicit ArgusdImpl(std::string checkpointFile = "") : checkpoint_(std::move(checkpointFile)),
+        startTime_(std::chrono::steady_clock::now()) {}
     ~ArgusdImpl() final = default;
 
     grpc::Status CreateWatch(grpc::ServerContext *context, const argus::ArgusdConfig *request, argus::ArgusdHandle *response) override;
@@ -43,29 +57,38 @@ public:
     grpc::Status GetWatchState(grpc::ServerContext *context, const argus::Empty *request, grpc::ServerWriter<argus::ArgusdHandle> *writer) override;
     grpc::Status RecordMetrics(grpc::ServerContext *context, const argus::Empty *request, grpc::ServerWriter<argus::ArgusdMetricsHandle> *writer) override;
 
+    void restoreFromCheckpoint();
+    bool receiveHandoff(const std::string &socketPath);
+    void serveHandoff(const std::string &socketPath, std::function<void()> onHandedOff);
+
 private:
-    std::vector<int> getPidsFromRequest(std::shared_ptr<argus::ArgusdConfig> request) const;
+    std::vector<int> getPidsFromRequest(std::shared_ptr<argus::ArgusdConfig> request);
     std::shared_ptr<argus::ArgusdHandle> findArgusdWatcherByPids(std::string nodeName, std::vector<int> pids) const;
-    char **getPathArrayFromSubject(int pid, std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
+    char **getPathArrayFromSubject(int pid, std::shared_ptr<argus::ArgusWatcherSubject> subject,
+        const char *upperdir) const;
+    const char *getUpperDirFromSubject(int pid, std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
     char **getIgnoreArrayFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
+    std::vector<std::string> getTagValuesFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject,
+        const std::string &key) const;
+    char **getIncludeArrayFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject, unsigned int *count) const;
+    uint32_t getFileTypesFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
+    struct arguswatch_opts *getOptsFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject,
+        struct arguslimit *sharedLimit) const;
     std::string getTagListFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
     uint32_t getEventMaskFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
     uint32_t getFlagsFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
     void createInotifyWatcher(std::string watcherName, std::string nodeName, std::string podName,
-        std::shared_ptr<argus::ArgusWatcherSubject> subject, int pid, int sid, int slen,
-        std::string logFormat);
+        std::shared_ptr<argus::ArgusWatcherSubject> subject, int pid, int sid, std::string logFormat,
+        struct arguslimit *sharedLimit, struct arguswatch_handoff *handoff = nullptr);
+    bool updateInotifyWatcher(std::string watcherName, std::shared_ptr<argus::ArgusWatcherSubject> subject, int pid,
+        int sid, std::string logFormat, struct arguslimit *sharedLimit);
     void sendKillSignalToWatcher(std::shared_ptr<argus::ArgusdHandle> watcher) const;
-
-    /**
-     * Helper function to remove prepended container protocol from `containerId`
-     * given a prefix; currently docker|cri-o|rkt|containerd.
-     *
-     * @param containerId
-     * @param prefix
-     */
-    inline void cleanContainerId(std::string &containerId, const std::string &prefix) const {
-        clustergarage::container::Util::eraseSubstr(containerId, prefix + "://");
-    }
+    void removeExitedPid(int pid);
+    grpc::Status waitForWatchersArmed(const std::vector<int> &pids, int subjectLen, std::chrono::milliseconds timeout);
+    void logWatcherStats(std::shared_ptr<argus::ArgusdHandle> watcher);
+    void logWatcherStatus(std::shared_ptr<argus::ArgusdHandle> watcher);
+    bool sendHandoff(int sock);
+    void rearmDetachedWatchers(const argus::ArgusdConfig &config, std::shared_ptr<argus::ArgusdHandle> watcher);
 
     /**
      * Helper function to convert `str` as type `std::string` to a usable
@@ -75,13 +98,19 @@ private:
      * @return
      */
     inline const char *convertStringToCString(const std::string &str) const {
-        char *cstr = new char[str.size() + 1];
-        strncpy(cstr, str.c_str(), str.size() + 1);
-        return cstr;
+        // Watchers take these over and `free` them.
+        return strdup(str.c_str());
     }
 
-    std::vector<std::shared_ptr<argus::ArgusdHandle>> watchers_;
-    std::map<int, bool> doneMap_;
+    PidCache pidCache_;
+    Checkpoint checkpoint_;
+    const std::chrono::steady_clock::time_point startTime_;
+    WatcherRegistry watchers_;
+    // When `GetWatchState` last logged the stats of every watcher, in
+    // `steady_clock` ticks.
+    std::atomic<std::chrono::steady_clock::rep> lastStatsSweep_{0};
+    // Lifecycle of each watcher thread by (pid, sid), guarded by `mux_`.
+    std::map<std::pair<int, int>, std::shared_ptr<struct arguswatch_status>> status_;
     std::condition_variable cv_;
     std::mutex mux_;
 };
@@ -0,0 +1,165 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <libcontainer/container_util.h>
+
+#include "argusd_pidcache.h"
+
+namespace argusd {
+/**
+ * Returns the PIDs for a list of container IDs, skipping any that cannot be
+ * resolved. Cached PIDs are only reused while the process they point to is
+ * still the one we found originally (same start time), so a recycled PID is
+ * never mistaken for the container. Container IDs that miss the cache are
+ * resolved concurrently, since each resolution globs cgroup hierarchies and
+ * runtime state directories.
+ *
+ * @param cids
+ * @return
+ */
+std::vector<int> PidCache::lookup(const std::vector<std::string> &cids) {
+    std::vector<int> pids(cids.size(), 0);
+    std::vector<std::pair<size_t, std::future<int>>> pending;
+
+    for (size_t i = 0; i < cids.size(); ++i) {
+        if (findValid(cids[i], pids[i])) {
+            ++hits_;
+            continue;
+        }
+        ++misses_;
+        pending.emplace_back(i, std::async(std::launch::async, resolvePid, cids[i]));
+    }
+    for (auto &it : pending) {
+        pids[it.first] = it.second.get();
+        if (pids[it.first]) {
+            store(cids[it.first], pids[it.first]);
+        }
+    }
+
+    std::vector<int> found;
+    std::copy_if(pids.cbegin(), pids.cend(), std::back_inserter(found), [](const int pid) { return pid != 0; });
+    return found;
+}
+
+/**
+ * Drops a container ID from the cache, e.g. once its watcher is destroyed.
+ *
+ * @param cid
+ */
+void PidCache::invalidate(const std::string &cid) {
+    std::lock_guard<std::mutex> lock(mux_);
+    cache_.erase(cid);
+}
+
+/**
+ * Looks up `cid` in the cache and validates that the cached process is still
+ * alive and has not been replaced by another process with the same PID.
+ * Stale entries are evicted.
+ *
+ * @param cid
+ * @param pid
+ * @return
+ */
+bool PidCache::findValid(const std::string &cid, int &pid) {
+    std::lock_guard<std::mutex> lock(mux_);
+    auto it = cache_.find(cid);
+    if (it == cache_.end()) {
+        return false;
+    }
+    unsigned long long startTime = getProcessStartTime(it->second.pid);
+    if (startTime == 0 ||
+        startTime != it->second.startTime) {
+        cache_.erase(it);
+        return false;
+    }
+    pid = it->second.pid;
+    return true;
+}
+
+/**
+ * Caches `pid` for `cid` along with the start time of the process.
+ *
+ * @param cid
+ * @param pid
+ */
+void PidCache::store(const std::string &cid, const int pid) {
+    unsigned long long startTime = getProcessStartTime(pid);
+    if (startTime == 0) {
+        // Exited between resolving and caching; don't cache.
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mux_);
+    cache_[cid] = {pid, startTime};
+}
+
+/**
+ * Resolves a container ID to the PID of its init process with the container
+ * runtime it was started with; currently docker|cri-o|rkt|containerd.
+ *
+ * @param cid
+ * @return
+ */
+int PidCache::resolvePid(std::string cid) {
+    std::string runtime = clustergarage::container::Util::findContainerRuntime(cid);
+    // Remove prepended container protocol from `cid`.
+    clustergarage::container::Util::eraseSubstr(cid, runtime + "://");
+    return clustergarage::container::Util::getPidForContainer(cid, runtime);
+}
+
+/**
+ * Returns the start time of `pid` in clock ticks after boot (field 22 of
+ * /proc/[pid]/stat), or 0 if the process doesn't exist.
+ *
+ * @param pid
+ * @return
+ */
+unsigned long long PidCache::getProcessStartTime(const int pid) {
+    std::ifstream fh("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    if (!std::getline(fh, stat)) {
+        return 0;
+    }
+    // The command name (field 2) is in parentheses and may itself contain
+    // spaces or parentheses, so start parsing after the last ')'.
+    auto pos = stat.rfind(')');
+    if (pos == std::string::npos) {
+        return 0;
+    }
+    std::istringstream ss(stat.substr(pos + 1));
+    std::string field;
+    unsigned long long startTime = 0;
+    // Fields 3 through 21 precede the start time.
+    for (int i = 3; i < 22 && ss >> field; ++i) {}
+    ss >> startTime;
+    return startTime;
+}
+} // namespace argusd
@@ -0,0 +1,294 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "argusd_registry.h"
+
+namespace argusd {
+// Removed watchers remembered for deltas; older ones force a full resync.
+static const size_t kMaxRemoved = 4096;
+
+/**
+ * Stores a watcher, replacing the one for the same pod and node if there is
+ * one.
+ *
+ * @param handle
+ */
+void WatcherRegistry::put(const argus::ArgusdHandle &handle) {
+    std::unique_lock<std::shared_mutex> lock(mux_);
+    store(keyFor(handle.podname(), handle.nodename()), std::make_shared<argus::ArgusdHandle>(handle));
+}
+
+/**
+ * Removes the watcher for a pod and node. Returns false if there was none.
+ *
+ * @param podName
+ * @param nodeName
+ * @return
+ */
+bool WatcherRegistry::remove(const std::string &podName, const std::string &nodeName) {
+    std::unique_lock<std::shared_mutex> lock(mux_);
+    auto it = entries_.find(keyFor(podName, nodeName));
+    if (it == entries_.end()) {
+        return false;
+    }
+    erase(it);
+    return true;
+}
+
+/**
+ * Drops `pid` from every watcher, and removes the watchers left without any
+ * PIDs. Returns the watchers that changed, as stored now; removed ones have
+ * no PIDs.
+ *
+ * @param pid
+ * @return
+ */
+std::vector<WatcherRegistry::Handle> WatcherRegistry::removePid(const int pid) {
+    std::vector<Handle> changed;
+    std::vector<std::string> keys;
+    std::unique_lock<std::shared_mutex> lock(mux_);
+    for (const auto &node : pids_) {
+        auto it = node.second.find(pid);
+        if (it != node.second.end()) {
+            keys.push_back(it->second);
+        }
+    }
+    for (const auto &key : keys) {
+        auto it = entries_.find(key);
+        auto handle = std::make_shared<argus::ArgusdHandle>(*it->second.handle);
+        handle->clear_pid();
+        for (const auto &p : it->second.handle->pid()) {
+            if (p != pid) {
+                handle->add_pid(p);
+            }
+        }
+        changed.push_back(handle);
+        if (handle->pid_size() == 0) {
+            erase(it);
+        } else {
+            store(key, handle);
+        }
+    }
+    return changed;
+}
+
+/**
+ * Returns the watcher for a pod and node, or nullptr.
+ *
+ * @param podName
+ * @param nodeName
+ * @return
+ */
+WatcherRegistry::Handle WatcherRegistry::find(const std::string &podName, const std::string &nodeName) const {
+    std::shared_lock<std::shared_mutex> lock(mux_);
+    auto it = entries_.find(keyFor(podName, nodeName));
+    return it != entries_.end() ? it->second.handle : nullptr;
+}
+
+/**
+ * Returns a watcher on node `nodeName` watching any of `pids`, or nullptr.
+ *
+ * @param nodeName
+ * @param pids
+ * @return
+ */
+WatcherRegistry::Handle WatcherRegistry::findByPids(const std::string &nodeName, const std::vector<int> &pids) const {
+    std::shared_lock<std::shared_mutex> lock(mux_);
+    auto node = pids_.find(nodeName);
+    if (node == pids_.end()) {
+        return nullptr;
+    }
+    for (const auto &pid : pids) {
+        auto it = node->second.find(pid);
+        if (it != node->second.end()) {
+            return entries_.at(it->second).handle;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Calls `fn` for every watcher, under a shared lock.
+ *
+ * @param fn
+ */
+void WatcherRegistry::forEach(const std::function<void(const Handle &)> &fn) const {
+    std::shared_lock<std::shared_mutex> lock(mux_);
+    for (const auto &it : entries_) {
+        fn(it.second.handle);
+    }
+}
+
+/**
+ * Returns the watchers that changed or were removed after `generation`. If
+ * `fingerprint` matches the current fingerprint nothing has changed, and the
+ * delta is empty. If `generation` is older than the removals we still
+ * remember (or is 0), the delta is every watcher (`full`).
+ *
+ * @param generation
+ * @param fingerprint
+ * @return
+ */
+WatcherRegistry::Delta WatcherRegistry::since(const uint64_t generation, const uint64_t fingerprint) const {
+    std::shared_lock<std::shared_mutex> lock(mux_);
+    Delta delta{generation_, fingerprint_, false, {}, {}};
+    if (fingerprint != 0 &&
+        fingerprint == fingerprint_) {
+        return delta;
+    }
+    delta.full = generation == 0 ||
+        generation < horizon_ ||
+        generation > generation_;
+    for (const auto &it : entries_) {
+        if (delta.full ||
+            it.second.generation > generation) {
+            delta.changed.push_back(it.second.handle);
+        }
+    }
+    if (!delta.full) {
+        for (auto it = removedAt_.upper_bound(generation); it != removedAt_.end(); ++it) {
+            auto sep = it->second.rfind(':');
+            delta.removed.emplace_back(it->second.substr(0, sep), it->second.substr(sep + 1));
+        }
+    }
+    return delta;
+}
+
+/**
+ * Returns the key a watcher is stored under.
+ *
+ * @param podName
+ * @param nodeName
+ * @return
+ */
+std::string WatcherRegistry::keyFor(const std::string &podName, const std::string &nodeName) {
+    return podName + ":" + nodeName;
+}
+
+/**
+ * Returns a hash of the contents of a handle.
+ *
+ * @param handle
+ * @return
+ */
+uint64_t WatcherRegistry::hashOf(const argus::ArgusdHandle &handle) {
+    return std::hash<std::string>()(handle.SerializeAsString());
+}
+
+/**
+ * Stores `handle` under `key` at a new generation. Callers hold `mux_`
+ * exclusively.
+ *
+ * @param key
+ * @param handle
+ */
+void WatcherRegistry::store(const std::string &key, Handle handle) {
+    uint64_t hash = hashOf(*handle);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        if (it->second.hash == hash) {
+            // Nothing changed.
+            it->second.handle = handle;
+            return;
+        }
+        fingerprint_ ^= it->second.hash;
+        unindex(*it->second.handle);
+    }
+    fingerprint_ ^= hash;
+    index(key, *handle);
+    entries_[key] = {handle, ++generation_, hash};
+    auto removed = removed_.find(key);
+    if (removed != removed_.end()) {
+        removedAt_.erase(removed->second);
+        removed_.erase(removed);
+    }
+}
+
+/**
+ * Removes an entry at a new generation, remembering the removal for deltas.
+ * Callers hold `mux_` exclusively.
+ *
+ * @param it
+ */
+void WatcherRegistry::erase(std::unordered_map<std::string, Entry>::iterator it) {
+    fingerprint_ ^= it->second.hash;
+    unindex(*it->second.handle);
+    removed_[it->first] = ++generation_;
+    removedAt_[generation_] = it->first;
+    entries_.erase(it);
+    if (removed_.size() > kMaxRemoved) {
+        // Forget the oldest removal; deltas from before it can't be told.
+        auto oldest = removedAt_.begin();
+        horizon_ = oldest->first;
+        removed_.erase(oldest->second);
+        removedAt_.erase(oldest);
+    }
+}
+
+/**
+ * Indexes the PIDs of `handle`, stored under `key`. Callers hold `mux_`
+ * exclusively.
+ *
+ * @param key
+ * @param handle
+ */
+void WatcherRegistry::index(const std::string &key, const argus::ArgusdHandle &handle) {
+    auto &node = pids_[handle.nodename()];
+    for (const auto &pid : handle.pid()) {
+        node[pid] = key;
+    }
+}
+
+/**
+ * Drops the PIDs of `handle` from the index. Callers hold `mux_` exclusively.
+ *
+ * @param handle
+ */
+void WatcherRegistry::unindex(const argus::ArgusdHandle &handle) {
+    auto node = pids_.find(handle.nodename());
+    if (node == pids_.end()) {
+        return;
+    }
+    auto key = keyFor(handle.podname(), handle.nodename());
+    for (const auto &pid : handle.pid()) {
+        auto it = node->second.find(pid);
+        if (it != node->second.end() &&
+            it->second == key) {
+            node->second.erase(it);
+        }
+    }
+    if (node->second.empty()) {
+        pids_.erase(node);
+    }
+}
+} // namespace argusd
@@ -0,0 +1,102 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUSD_REGISTRY_H__
+#define __ARGUSD_REGISTRY_H__
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <argus-proto/c++/argus.grpc.pb.h>
+
+namespace argusd {
+/**
+ * Registry of the watchers of this daemon, by pod and node, and indexed by
+ * node and PID. Every change bumps a generation number, so readers can ask
+ * for what changed since the generation they saw last. Handles are never
+ * modified once stored; a change stores a new one.
+ */
+class WatcherRegistry final {
+public:
+    using Handle = std::shared_ptr<argus::ArgusdHandle>;
+
+    // Changes since a generation; see `since`.
+    struct Delta {
+        uint64_t generation;                                   // Current generation.
+        uint64_t fingerprint;                                  // Current fingerprint.
+        bool full;                                             // `changed` is every watcher.
+        std::vector<Handle> changed;                           // Watchers added or changed.
+        std::vector<std::pair<std::string, std::string>> removed; // Pod and node of removed watchers.
+    };
+
+    explicit WatcherRegistry() = default;
+    ~WatcherRegistry() = default;
+
+    void put(const argus::ArgusdHandle &handle);
+    bool remove(const std::string &podName, const std::string &nodeName);
+    std::vector<Handle> removePid(int pid);
+    Handle find(const std::string &podName, const std::string &nodeName) const;
+    Handle findByPids(const std::string &nodeName, const std::vector<int> &pids) const;
+    void forEach(const std::function<void(const Handle &)> &fn) const;
+    Delta since(uint64_t generation, uint64_t fingerprint) const;
+
+private:
+    struct Entry {
+        Handle handle;
+        uint64_t generation;  // Generation the handle was stored at.
+        uint64_t hash;        // Hash of the serialized handle.
+    };
+
+    static std::string keyFor(const std::string &podName, const std::string &nodeName);
+    static uint64_t hashOf(const argus::ArgusdHandle &handle);
+    void store(const std::string &key, Handle handle);
+    void erase(std::unordered_map<std::string, Entry>::iterator it);
+    void index(const std::string &key, const argus::ArgusdHandle &handle);
+    void unindex(const argus::ArgusdHandle &handle);
+
+    std::unordered_map<std::string, Entry> entries_;
+    // Node -> PID -> key of the watcher watching it.
+    std::unordered_map<std::string, std::unordered_map<int, std::string>> pids_;
+    // Generation each watcher was removed at, both ways, so deltas can report
+    // it.
+    std::unordered_map<std::string, uint64_t> removed_;
+    std::map<uint64_t, std::string> removedAt_;
+    // Oldest generation deltas can still be computed from.
+    uint64_t horizon_ = 0;
+    uint64_t generation_ = 0;
+    // XOR of the hashes of all entries, updated as they change.
+    uint64_t fingerprint_ = 0;
+    mutable std::shared_mutex mux_;
+};
+} // namespace argusd
+
+#endif
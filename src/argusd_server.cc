@@ -22,7 +22,9 @@
  * SOFTWARE.
  */
 
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -38,12 +40,77 @@
 #include "argusd_impl.h"
 #include "health_impl.h"
 
+extern "C" {
+#include <lib/argusbudget.h>
+#include <lib/argusdigest.h>
+#include <lib/argusmanifest.h>
+#include <lib/arguspoll.h>
+#include <lib/argusrecord.h>
+#include <lib/argusskeleton.h>
+#include <lib/argusuring.h>
+}
+
 #define PORT 50051
 
 DEFINE_bool(tls, false, "run server with TLS enabled");
 DEFINE_string(tlscafile, "", "file containing trusted certificates for verifying the client");
 DEFINE_string(tlscertfile, "", "file containing the server certificate for authenticating with the client");
 DEFINE_string(tlskeyfile, "", "file containing the server private key for authenticating with the client");
+DEFINE_string(backend, "inotify", "how watchers watch their trees by default: inotify (a watch per directory), fanotify (a mark per filesystem) or poll (periodic rescans)");
+DEFINE_int32(pollinterval, POLL_INTERVAL, "default time in ms between rescans of trees watched with the poll backend");
+DEFINE_int32(pollbudget, POLL_BUDGET, "default percentage of a CPU each rescan of a tree watched with the poll backend may use");
+DEFINE_bool(upperdir, false, "watch only the overlay upperdir (writable layer) of containers, by default");
+DEFINE_double(watchbudget, 0.9, "fraction of fs.inotify.max_user_watches shared between all watchers on this node");
+DEFINE_uint64(watchquota, 0, "maximum number of inotify watches a single watcher may hold (0 for no limit)");
+DEFINE_int32(skeletoncache, SKELETON_CACHE_SIZE, "number of directory skeletons of traversed trees kept for watchers of the same image to reuse (0 to disable)");
+DEFINE_string(degradepolicy, "depth", "how to degrade watchers that don't fit the watch budget: depth or toplevel");
+DEFINE_int32(coalescewindow, 0, "default window in ms for folding repeated identical events together (0 to disable)");
+DEFINE_double(ratelimit, 0, "default number of events per second logged for each subject of a watcher (0 to disable)");
+DEFINE_double(rateburst, 0, "default burst size of the per-subject rate limit (defaults to -ratelimit)");
+DEFINE_double(watcherratelimit, 0, "number of events per second logged for all subjects of a watcher together (0 to disable)");
+DEFINE_double(watcherrateburst, 0, "burst size of the per-watcher rate limit (defaults to -watcherratelimit)");
+DEFINE_uint32(hotthreshold, 0, "access/open events per second after which a directory stops being watched for them (0 to disable)");
+DEFINE_int32(hotcooldown, 30000, "time in ms before a hot directory is watched for access/open events again");
+DEFINE_bool(verifycontent, false, "only log writes to a file that changed its content, by default");
+DEFINE_int32(digestworkers, 4, "number of threads hashing written files for content verification");
+DEFINE_bool(baseline, false, "hash the watched files whenever a watcher is armed and log changes since the last time, by default");
+DEFINE_string(manifestdir, "", "directory baseline manifests are kept in across restarts (empty to keep them in memory)");
+DEFINE_int32(manifestworkers, MANIFEST_WORKERS, "number of files hashed at once by all baseline scans together");
+DEFINE_int32(statsinterval, 60000, "minimum time in ms between GetWatchState calls logging the stats of every watcher, rather than only of those that changed");
+DEFINE_int32(createtimeout, 0, "time in ms CreateWatch waits for its watchers to be armed before returning (0 to return right away)");
+DEFINE_string(checkpointfile, "", "file the configuration of watchers is kept in, to restore them on restart (empty to disable)");
+DEFINE_string(handoffsocket, "", "Unix socket to take over watchers from a running argusd on, and to hand them to the next one on (empty to disable)");
+DEFINE_bool(iouring, false, "batch the stat calls of cache consistency checks through io_uring, where the kernel allows it");
+DEFINE_string(recorddir, "", "directory to record raw inotify event streams to, for offline replay with argus_replay");
+
+/**
+ * Logs the outcome of a baseline scan, and each path that differs from the
+ * previous baseline of the watch.
+ *
+ * @param report
+ */
+static void logBaselineReport(const struct argusmanifest_report *report) {
+    double mb = report->bytes / 1048576.0;
+    double seconds = report->seconds > 0 ? report->seconds : 1e-9;
+    LOG(INFO) << "Baseline (" << report->pod_name << ":" << report->node_name << " " << report->sid << "): "
+        << report->files << " files, " << std::fixed << std::setprecision(1) << mb << " MB in "
+        << report->seconds << " s (" << mb / seconds << " MB/s, " << report->files / seconds << " files/s)"
+        << (report->first ? ", first scan" : "");
+    if (report->first) {
+        return;
+    }
+    LOG(INFO) << "Baseline (" << report->pod_name << ":" << report->node_name << " " << report->sid << "): "
+        << report->addedc << " added, " << report->removedc << " removed, " << report->changedc << " changed";
+    for (unsigned int i = 0; i < report->addedc; ++i) {
+        LOG(INFO) << "  added: " << report->added[i];
+    }
+    for (unsigned int i = 0; i < report->removedc; ++i) {
+        LOG(INFO) << "  removed: " << report->removed[i];
+    }
+    for (unsigned int i = 0; i < report->changedc; ++i) {
+        LOG(INFO) << "  changed: " << report->changed[i];
+    }
+}
 
 int main(int argc, char **argv) {
     google::ParseCommandLineFlags(&argc, &argv, true);
@@ -60,6 +127,33 @@ int main(int argc, char **argv) {
         return buffer.str();
     };
 
+    if (FLAGS_degradepolicy != "depth" &&
+        FLAGS_degradepolicy != "toplevel") {
+        LOG(WARNING) << "Unknown degrade policy: " << FLAGS_degradepolicy;
+        return 1;
+    }
+    if (FLAGS_backend != "inotify" &&
+        FLAGS_backend != "fanotify" &&
+        FLAGS_backend != "poll") {
+        LOG(WARNING) << "Unknown backend: " << FLAGS_backend;
+        return 1;
+    }
+    configure_budget(FLAGS_watchbudget, FLAGS_watchquota,
+        FLAGS_degradepolicy == "toplevel" ? AW_DEGRADE_TOPLEVEL : AW_DEGRADE_DEPTH);
+    set_skeleton_cache_size(FLAGS_skeletoncache);
+
+    set_digest_workers(FLAGS_digestworkers);
+    set_uring_enabled(FLAGS_iouring);
+    if (!FLAGS_manifestdir.empty()) {
+        LOG(INFO) << "Keeping baseline manifests in " << FLAGS_manifestdir;
+    }
+    configure_manifests(FLAGS_manifestdir.c_str(), FLAGS_manifestworkers, logBaselineReport);
+
+    if (!FLAGS_recorddir.empty()) {
+        LOG(INFO) << "Recording inotify event streams to " << FLAGS_recorddir;
+        set_record_dir(FLAGS_recorddir.c_str());
+    }
+
     std::shared_ptr<grpc::ServerCredentials> credentials;
     if (FLAGS_tls) {
         if (FLAGS_tlscertfile.empty() ||
@@ -93,13 +187,28 @@ int main(int argc, char **argv) {
     grpc::ServerBuilder builder;
     builder.AddListeningPort(serverAddress, credentials);
 
-    argusd::ArgusdImpl argusdSvc;
+    argusd::ArgusdImpl argusdSvc(FLAGS_checkpointfile);
     builder.RegisterService(&argusdSvc);
+    // Carry on with the `inotify` instances of the daemon we are replacing,
+    // if there is one. Whatever it didn't hand over is restored below.
+    bool handedOver = !FLAGS_handoffsocket.empty() &&
+        argusdSvc.receiveHandoff(FLAGS_handoffsocket);
     argusdhealth::HealthImpl healthSvc;
     builder.RegisterService(&healthSvc);
 
     std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
     LOG(INFO) << "Server listening on " << serverAddress;
+    // Re-arm the watchers we had before restarting, without waiting for the
+    // controller to create them again.
+    if (!handedOver) {
+        argusdSvc.restoreFromCheckpoint();
+    }
+    if (!FLAGS_handoffsocket.empty()) {
+        argusdSvc.serveHandoff(FLAGS_handoffsocket, [&]() {
+            LOG(INFO) << "Watchers handed over, shutting down";
+            server->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(1));
+        });
+    }
     server->Wait();
 
     google::ShutdownGoogleLogging();